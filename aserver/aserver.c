@@ -21,7 +21,9 @@
 #include "aserver.h"
 
 #include <sys/shm.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <poll.h>
 #include <sys/un.h>
 #include <sys/uio.h>
@@ -34,6 +36,7 @@
 #include <netdb.h>
 #include <limits.h>
 #include <signal.h>
+#include <pthread.h>
 
 
 char *command;
@@ -110,49 +113,137 @@ static int make_inet_socket(int port)
 	return sock;
 }
 
-struct pollfd *pollfds;
-unsigned int pollfds_count = 0;
 typedef struct waiter waiter_t;
-typedef int (*waiter_handler_t)(waiter_t *waiter, unsigned short events);
+typedef int (*waiter_handler_t)(waiter_t *waiter, unsigned int events);
 struct waiter {
 	int fd;
+	int epfd;
+	unsigned int gen;
 	void *private_data;
 	waiter_handler_t handler;
 };
 waiter_t *waiters;
 
-static void add_waiter(int fd, unsigned short events, waiter_handler_t handler,
-		void *data)
+/*
+ * The waiters table is shared by the main thread, which adds the waiters
+ * of the new clients, and the workers, which remove them.  The epoll
+ * events carry the fd with the generation of its waiter, so that an event
+ * left for an fd removed and reused meanwhile is dropped.  A waiter must
+ * be removed before its fd is closed.
+ */
+pthread_mutex_t waiters_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define WAITER_KEY(fd, gen)	(((uint64_t)(gen) << 32) | (uint32_t)(fd))
+
+/*
+ * The listening sockets are served by the main thread. Each client is
+ * bound to one worker thread for its whole life, so the commands of a
+ * stream are never reordered and a slow ioctl stalls only the clients
+ * sharing that worker.
+ */
+typedef struct {
+	int epfd;
+	pthread_t thread;
+} worker_t;
+worker_t *workers;
+unsigned int workers_count;
+unsigned int workers_next;
+int main_epfd = -1;
+
+#define MAX_EVENTS	64
+
+static int add_waiter(int epfd, int fd, unsigned int events,
+		      waiter_handler_t handler, void *data)
 {
 	waiter_t *w = &waiters[fd];
-	struct pollfd *pfd = &pollfds[pollfds_count];
+	struct epoll_event ev;
+	pthread_mutex_lock(&waiters_lock);
 	assert(!w->handler);
-	pfd->fd = fd;
-	pfd->events = events;
-	pfd->revents = 0;
 	w->fd = fd;
+	w->epfd = epfd;
+	w->gen++;
 	w->private_data = data;
 	w->handler = handler;
-	pollfds_count++;
+	ev.events = events;
+	ev.data.u64 = WAITER_KEY(fd, w->gen);
+	pthread_mutex_unlock(&waiters_lock);
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		int result = -errno;
+		SYSERROR("epoll_ctl failed");
+		pthread_mutex_lock(&waiters_lock);
+		w->handler = 0;
+		pthread_mutex_unlock(&waiters_lock);
+		return result;
+	}
+	return 0;
 }
 
 static void del_waiter(int fd)
 {
 	waiter_t *w = &waiters[fd];
-	unsigned int k;
+	int epfd;
+	pthread_mutex_lock(&waiters_lock);
 	assert(w->handler);
 	w->handler = 0;
-	for (k = 0; k < pollfds_count; ++k) {
-		if (pollfds[k].fd == fd)
-			break;
+	epfd = w->epfd;
+	pthread_mutex_unlock(&waiters_lock);
+	if (epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL) < 0)
+		SYSERROR("epoll_ctl failed");
+}
+
+/* the waiter of an event, NULL when it was removed meanwhile */
+static waiter_t *get_waiter(int epfd, uint64_t key)
+{
+	waiter_t *w = &waiters[(uint32_t)key];
+	pthread_mutex_lock(&waiters_lock);
+	if (!w->handler || w->epfd != epfd || WAITER_KEY(w->fd, w->gen) != key)
+		w = NULL;
+	pthread_mutex_unlock(&waiters_lock);
+	return w;
+}
+
+static void event_loop(int epfd)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int k, n, err;
+
+	while (1) {
+		n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno != EINTR)
+				SYSERROR("epoll_wait failed");
+			continue;
+		}
+		for (k = 0; k < n; k++) {
+			waiter_t *w = get_waiter(epfd, events[k].data.u64);
+			/* removed by an earlier handler, maybe reused since */
+			if (!w)
+				continue;
+			err = w->handler(w, events[k].events);
+			if (err < 0)
+				ERROR("waiter handler failed");
+		}
 	}
-	assert(k < pollfds_count);
-	pollfds_count--;
-	memmove(&pollfds[k], &pollfds[k + 1], pollfds_count - k);
+}
+
+static void *worker_thread(void *arg)
+{
+	worker_t *worker = arg;
+
+	event_loop(worker->epfd);
+	return NULL;
+}
+
+static worker_t *pick_worker(void)
+{
+	return &workers[workers_next++ % workers_count];
 }
 
 typedef struct client client_t;
 
+/* command latency histogram, bucket n counts the commands under 2^n us */
+#define CLIENT_HIST_BUCKETS	16
+
 typedef struct {
 	int (*open)(client_t *client, int *cookie);
 	int (*cmd)(client_t *client);
@@ -161,6 +252,7 @@ typedef struct {
 
 struct client {
 	struct list_head list;
+	worker_t *worker;
 	int poll_fd;
 	int ctrl_fd;
 	int local;
@@ -199,16 +291,45 @@ struct client {
 	} device;
 	int polling;
 	int open;
+	int stats_request;
 	int cookie;
+	pthread_mutex_t lock;
+	struct {
+		unsigned long hist[CLIENT_HIST_BUCKETS];
+		unsigned long max_us;
+	} stats;
 	union {
 		struct {
 			int ctrl_id;
 			void *ctrl;
+			int memfd;
+			int fast_quit;
+			pthread_t fast_thread;
 		} shm;
 	} transport;
 };
 
 LIST_HEAD(clients);
+pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void client_account(client_t *client, const struct timespec *start)
+{
+	struct timespec now;
+	unsigned long us, max;
+	unsigned int b = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - start->tv_sec) * 1000000L +
+	     (now.tv_nsec - start->tv_nsec) / 1000;
+	while (b < CLIENT_HIST_BUCKETS - 1 && (us >> b) > 0)
+		b++;
+	__atomic_fetch_add(&client->stats.hist[b], 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&client->stats.max_us, __ATOMIC_RELAXED);
+	while (us > max &&
+	       !__atomic_compare_exchange_n(&client->stats.max_us, &max, us, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
 
 typedef struct {
 	struct list_head list;
@@ -218,7 +339,7 @@ typedef struct {
 LIST_HEAD(inet_pendings);
 
 #if 0
-static int pcm_handler(waiter_t *waiter, unsigned short events)
+static int pcm_handler(waiter_t *waiter, unsigned int events)
 {
 	client_t *client = waiter->private_data;
 	char buf[1] = {0};
@@ -280,12 +401,10 @@ static void pcm_shm_appl_ptr_changed(snd_pcm_t *pcm, snd_pcm_t *src ATTRIBUTE_UN
 	pcm->appl.ptr = &ctrl->appl.ptr;
 }
 
-static int pcm_shm_open(client_t *client, int *cookie)
+static int pcm_shm_open_pcm(client_t *client)
 {
-	int shmid;
 	snd_pcm_t *pcm;
 	int err;
-	int result;
 	err = snd_pcm_open(&pcm, client->name, client->stream, SND_PCM_NONBLOCK);
 	if (err < 0)
 		return err;
@@ -295,6 +414,21 @@ static int pcm_shm_open(client_t *client, int *cookie)
 	pcm->hw.changed = pcm_shm_hw_ptr_changed;
 	pcm->appl.private_data = client;
 	pcm->appl.changed = pcm_shm_appl_ptr_changed;
+	pthread_mutex_init(&client->lock, NULL);
+	client->transport.shm.memfd = -1;
+	return 0;
+}
+
+static int pcm_shm_open(client_t *client, int *cookie)
+{
+	int shmid;
+	snd_pcm_t *pcm;
+	int err;
+	int result;
+	err = pcm_shm_open_pcm(client);
+	if (err < 0)
+		return err;
+	pcm = client->device.pcm.handle;
 
 	shmid = shmget(IPC_PRIVATE, PCM_SHM_SIZE, 0666);
 	if (shmid < 0) {
@@ -314,11 +448,111 @@ static int pcm_shm_open(client_t *client, int *cookie)
 	return 0;
 
  _err:
+	pthread_mutex_destroy(&client->lock);
 	snd_pcm_close(pcm);
 	return result;
 
 }
 
+#ifdef SND_TRANSPORT_MEMFD
+static int pcm_shm_fast_cmd(snd_pcm_t *pcm, volatile snd_pcm_shm_ctrl_t *ctrl, int cmd);
+
+/*
+ * serve the commands signalled through the doorbell
+ */
+static void *pcm_memfd_thread(void *arg)
+{
+	client_t *client = arg;
+	volatile snd_pcm_shm_ctrl_t *ctrl = client->transport.shm.ctrl;
+	struct timespec start;
+	uint32_t req, done = 0;
+	int cmd;
+
+	while (1) {
+		req = snd_shm_doorbell_get(&ctrl->fast.req);
+		if (__atomic_load_n(&client->transport.shm.fast_quit, __ATOMIC_ACQUIRE))
+			break;
+		if (req == done) {
+			snd_shm_doorbell_wait(&ctrl->fast.req, req, -1);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		pthread_mutex_lock(&client->lock);
+		cmd = ctrl->cmd;
+		ctrl->cmd = 0;
+		if (!pcm_shm_fast_cmd(client->device.pcm.handle, ctrl, cmd)) {
+			ERROR("Bogus fast cmd: %x", cmd);
+			ctrl->result = -ENOSYS;
+		}
+		pthread_mutex_unlock(&client->lock);
+		client_account(client, &start);
+		done = req;
+		snd_shm_doorbell_ring(&ctrl->fast.ack, req);
+	}
+	return NULL;
+}
+
+static int pcm_memfd_open(client_t *client, int *cookie)
+{
+	volatile snd_pcm_shm_ctrl_t *ctrl;
+	void *ptr;
+	int fd, err, result;
+
+	err = pcm_shm_open_pcm(client);
+	if (err < 0)
+		return err;
+	fd = memfd_create("aserver-pcm", MFD_CLOEXEC);
+	if (fd < 0) {
+		result = -errno;
+		SYSERROR("memfd_create failed");
+		goto _err;
+	}
+	if (ftruncate(fd, PCM_SHM_SIZE) < 0) {
+		result = -errno;
+		SYSERROR("ftruncate failed");
+		goto _err_fd;
+	}
+	ptr = mmap(NULL, PCM_SHM_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		result = -errno;
+		SYSERROR("mmap failed");
+		goto _err_fd;
+	}
+	ctrl = ptr;
+	client->transport.shm.ctrl = ptr;
+	client->transport.shm.memfd = fd;
+	client->transport.shm.fast_quit = 0;
+	err = pthread_create(&client->transport.shm.fast_thread, NULL,
+			     pcm_memfd_thread, client);
+	if (err) {
+		result = -err;
+		ERROR("pthread_create failed");
+		client->transport.shm.ctrl = 0;
+		client->transport.shm.memfd = -1;
+		munmap((void *)ctrl, PCM_SHM_SIZE);
+		goto _err_fd;
+	}
+	*cookie = 0;
+	return 0;
+
+ _err_fd:
+	close(fd);
+ _err:
+	pthread_mutex_destroy(&client->lock);
+	snd_pcm_close(client->device.pcm.handle);
+	return result;
+}
+
+static void pcm_memfd_stop(client_t *client)
+{
+	volatile snd_pcm_shm_ctrl_t *ctrl = client->transport.shm.ctrl;
+
+	__atomic_store_n(&client->transport.shm.fast_quit, 1, __ATOMIC_RELEASE);
+	snd_shm_doorbell_ring(&ctrl->fast.req, ctrl->fast.req + 1);
+	pthread_join(client->transport.shm.fast_thread, NULL);
+}
+#endif
+
 static int pcm_shm_close(client_t *client)
 {
 	snd_pcm_shm_ctrl_t *ctrl;
@@ -328,11 +562,22 @@ static int pcm_shm_close(client_t *client)
 		del_waiter(client->device.pcm.fd);
 		client->polling = 0;
 	}
+#ifdef SND_TRANSPORT_MEMFD
+	if (client->transport.shm.memfd >= 0)
+		pcm_memfd_stop(client);
+#endif
 	err = snd_pcm_close(client->device.pcm.handle);
 	if (err < 0)
 		ERROR("snd_pcm_close");
+	pthread_mutex_destroy(&client->lock);
 	ctrl = client->transport.shm.ctrl;
-	if (ctrl) {
+	if (ctrl && client->transport.shm.memfd >= 0) {
+		ctrl->result = err;
+		munmap(ctrl, PCM_SHM_SIZE);
+		close(client->transport.shm.memfd);
+		client->transport.shm.memfd = -1;
+		client->transport.shm.ctrl = 0;
+	} else if (ctrl) {
 		ctrl->result = err;
 		err = shmdt((void *)client->transport.shm.ctrl);
 		if (err < 0)
@@ -390,19 +635,52 @@ static void async_handler(snd_async_handler_t *handler)
 	kill(client->async_pid, client->async_sig);
 }
 
-static int pcm_shm_cmd(client_t *client)
+/*
+ * commands not changing the setup; with the memfd transport they are
+ * served also through the doorbell
+ */
+static int pcm_shm_fast_cmd(snd_pcm_t *pcm, volatile snd_pcm_shm_ctrl_t *ctrl, int cmd)
+{
+	switch (cmd) {
+	case SNDRV_PCM_IOCTL_STATUS:
+		ctrl->result = snd_pcm_status(pcm, (snd_pcm_status_t *) &ctrl->u.status);
+		break;
+	case SND_PCM_IOCTL_STATE:
+		ctrl->result = snd_pcm_state(pcm);
+		break;
+	case SND_PCM_IOCTL_HWSYNC:
+		ctrl->result = snd_pcm_hwsync(pcm);
+		break;
+	case SNDRV_PCM_IOCTL_DELAY:
+		ctrl->result = snd_pcm_delay(pcm, (snd_pcm_sframes_t *) &ctrl->u.delay.frames);
+		break;
+	case SND_PCM_IOCTL_AVAIL_UPDATE:
+		ctrl->result = snd_pcm_avail_update(pcm);
+		break;
+	case SNDRV_PCM_IOCTL_REWIND:
+		ctrl->result = snd_pcm_rewind(pcm, ctrl->u.rewind.frames);
+		break;
+	case SND_PCM_IOCTL_FORWARD:
+		ctrl->result = snd_pcm_forward(pcm, ctrl->u.forward.frames);
+		break;
+	case SND_PCM_IOCTL_MMAP_COMMIT:
+		ctrl->result = snd_pcm_mmap_commit(pcm,
+						   ctrl->u.mmap_commit.offset,
+						   ctrl->u.mmap_commit.frames);
+		break;
+	default:
+		return 0;
+	}
+	return 1;
+}
+
+static int pcm_shm_cmd_locked(client_t *client, int cmd)
 {
 	volatile snd_pcm_shm_ctrl_t *ctrl = client->transport.shm.ctrl;
-	char buf[1];
-	int err;
-	int cmd;
 	snd_pcm_t *pcm;
-	err = read(client->ctrl_fd, buf, 1);
-	if (err != 1)
-		return -EBADFD;
-	cmd = ctrl->cmd;
-	ctrl->cmd = 0;
 	pcm = client->device.pcm.handle;
+	if (pcm_shm_fast_cmd(pcm, ctrl, cmd))
+		return shm_ack(client);
 	switch (cmd) {
 	case SND_PCM_IOCTL_ASYNC:
 		ctrl->result = snd_pcm_async(pcm, ctrl->u.async.sig, ctrl->u.async.pid);
@@ -435,21 +713,6 @@ static int pcm_shm_cmd(client_t *client)
 	case SNDRV_PCM_IOCTL_SW_PARAMS:
 		ctrl->result = snd_pcm_sw_params(pcm, (snd_pcm_sw_params_t *) &ctrl->u.sw_params);
 		break;
-	case SNDRV_PCM_IOCTL_STATUS:
-		ctrl->result = snd_pcm_status(pcm, (snd_pcm_status_t *) &ctrl->u.status);
-		break;
-	case SND_PCM_IOCTL_STATE:
-		ctrl->result = snd_pcm_state(pcm);
-		break;
-	case SND_PCM_IOCTL_HWSYNC:
-		ctrl->result = snd_pcm_hwsync(pcm);
-		break;
-	case SNDRV_PCM_IOCTL_DELAY:
-		ctrl->result = snd_pcm_delay(pcm, (snd_pcm_sframes_t *) &ctrl->u.delay.frames);
-		break;
-	case SND_PCM_IOCTL_AVAIL_UPDATE:
-		ctrl->result = snd_pcm_avail_update(pcm);
-		break;
 	case SNDRV_PCM_IOCTL_PREPARE:
 		ctrl->result = snd_pcm_prepare(pcm);
 		break;
@@ -474,12 +737,6 @@ static int pcm_shm_cmd(client_t *client)
 		    ctrl->u.channel_info.type == SND_PCM_AREA_MMAP)
 			return shm_ack_fd(client, ctrl->u.channel_info.u.mmap.fd);
 		break;
-	case SNDRV_PCM_IOCTL_REWIND:
-		ctrl->result = snd_pcm_rewind(pcm, ctrl->u.rewind.frames);
-		break;
-	case SND_PCM_IOCTL_FORWARD:
-		ctrl->result = snd_pcm_forward(pcm, ctrl->u.forward.frames);
-		break;
 	case SNDRV_PCM_IOCTL_LINK:
 	{
 		/* FIXME */
@@ -502,35 +759,56 @@ static int pcm_shm_cmd(client_t *client)
 		ctrl->result = snd_pcm_munmap(pcm);
 		break;
 	}
-	case SND_PCM_IOCTL_MMAP_COMMIT:
-		ctrl->result = snd_pcm_mmap_commit(pcm,
-						   ctrl->u.mmap_commit.offset,
-						   ctrl->u.mmap_commit.frames);
-		break;
 	case SND_PCM_IOCTL_POLL_DESCRIPTOR:
 		ctrl->result = 0;
 		return shm_ack_fd(client, _snd_pcm_poll_descriptor(pcm));
-	case SND_PCM_IOCTL_CLOSE:
-		client->ops->close(client);
-		break;
 	case SND_PCM_IOCTL_HW_PTR_FD:
 		return shm_rbptr_fd(client, &pcm->hw);
 	case SND_PCM_IOCTL_APPL_PTR_FD:
 		return shm_rbptr_fd(client, &pcm->appl);
 	default:
-		ERROR("Bogus cmd: %x", ctrl->cmd);
+		ERROR("Bogus cmd: %x", cmd);
 		ctrl->result = -ENOSYS;
 	}
 	return shm_ack(client);
 }
 
+static int pcm_shm_cmd(client_t *client)
+{
+	volatile snd_pcm_shm_ctrl_t *ctrl = client->transport.shm.ctrl;
+	char buf[1];
+	int err;
+	int cmd;
+	err = read(client->ctrl_fd, buf, 1);
+	if (err != 1)
+		return -EBADFD;
+	cmd = ctrl->cmd;
+	ctrl->cmd = 0;
+	if (cmd == SND_PCM_IOCTL_CLOSE) {
+		client->ops->close(client);
+		return shm_ack(client);
+	}
+	pthread_mutex_lock(&client->lock);
+	err = pcm_shm_cmd_locked(client, cmd);
+	pthread_mutex_unlock(&client->lock);
+	return err;
+}
+
 transport_ops_t pcm_shm_ops = {
 	.open	= pcm_shm_open,
 	.cmd	= pcm_shm_cmd,
 	.close	= pcm_shm_close,
 };
 
-static int ctl_handler(waiter_t *waiter, unsigned short events)
+#ifdef SND_TRANSPORT_MEMFD
+transport_ops_t pcm_memfd_ops = {
+	.open	= pcm_memfd_open,
+	.cmd	= pcm_shm_cmd,
+	.close	= pcm_shm_close,
+};
+#endif
+
+static int ctl_handler(waiter_t *waiter, unsigned int events)
 {
 	client_t *client = waiter->private_data;
 	char buf[1] = {0};
@@ -574,7 +852,8 @@ static int ctl_shm_open(client_t *client, int *cookie)
 		goto _err;
 	}
 	*cookie = shmid;
-	add_waiter(client->device.ctl.fd, POLLIN, ctl_handler, client);
+	add_waiter(client->worker->epfd, client->device.ctl.fd, EPOLLIN,
+		   ctl_handler, client);
 	client->polling = 1;
 	return 0;
 
@@ -725,6 +1004,71 @@ transport_ops_t ctl_shm_ops = {
 	.close	= ctl_shm_close,
 };
 
+static const char *client_dev_name(client_t *client)
+{
+	switch (client->dev_type) {
+	case SND_DEV_TYPE_PCM:
+		return client->stream == SND_PCM_STREAM_CAPTURE ?
+			"pcm capture" : "pcm playback";
+	case SND_DEV_TYPE_CONTROL:
+		return "ctl";
+	default:
+		return "?";
+	}
+}
+
+/*
+ * answer a stats request with the command latency histograms of all
+ * open clients as text; the answer result is the text length.  Only
+ * local clients get it, like the shared memory transports.
+ */
+static int client_send_stats(client_t *client)
+{
+	snd_client_open_answer_t ans;
+	snd_output_t *out;
+	struct list_head *item;
+	unsigned long total, count;
+	char *text;
+	size_t len;
+	unsigned int b, idx = 0;
+	int err;
+
+	err = snd_output_buffer_open(&out);
+	if (err < 0)
+		return err;
+	pthread_mutex_lock(&clients_lock);
+	list_for_each(item, &clients) {
+		client_t *c = list_entry(item, client_t, list);
+		if (!c->open)
+			continue;
+		total = 0;
+		for (b = 0; b < CLIENT_HIST_BUCKETS; b++)
+			total += __atomic_load_n(&c->stats.hist[b], __ATOMIC_RELAXED);
+		snd_output_printf(out, "client %u: %s '%s', worker %u, %lu commands, max %lu us\n",
+				  idx++, client_dev_name(c), c->name,
+				  (unsigned int)(c->worker - workers), total,
+				  __atomic_load_n(&c->stats.max_us, __ATOMIC_RELAXED));
+		for (b = 0; b < CLIENT_HIST_BUCKETS; b++) {
+			count = __atomic_load_n(&c->stats.hist[b], __ATOMIC_RELAXED);
+			if (!count)
+				continue;
+			if (b == CLIENT_HIST_BUCKETS - 1)
+				snd_output_printf(out, "  >= %6lu us: %lu\n", 1UL << (b - 1), count);
+			else
+				snd_output_printf(out, "  <  %6lu us: %lu\n", 1UL << b, count);
+		}
+	}
+	pthread_mutex_unlock(&clients_lock);
+	len = snd_output_buffer_string(out, &text);
+	memset(&ans, 0, sizeof(ans));
+	ans.result = len;
+	err = write(client->ctrl_fd, &ans, sizeof(ans));
+	if (err == sizeof(ans) && len > 0)
+		err = write(client->ctrl_fd, text, len);
+	snd_output_close(out);
+	return err < 0 ? -errno : 0;
+}
+
 static int snd_client_open(client_t *client)
 {
 	int err;
@@ -756,6 +1100,15 @@ static int snd_client_open(client_t *client)
 		goto _answer;
 	}
 
+	if (req.dev_type == SND_DEV_TYPE_STATS) {
+		if (!client->local) {
+			ans.result = -EINVAL;
+			goto _answer;
+		}
+		client->stats_request = 1;
+		return client_send_stats(client);
+	}
+
 	switch (req.transport_type) {
 	case SND_TRANSPORT_TYPE_SHM:
 		if (!client->local) {
@@ -774,6 +1127,15 @@ static int snd_client_open(client_t *client)
 			goto _answer;
 		}
 		break;
+#ifdef SND_TRANSPORT_MEMFD
+	case SND_TRANSPORT_TYPE_MEMFD:
+		if (!client->local || req.dev_type != SND_DEV_TYPE_PCM) {
+			ans.result = -EINVAL;
+			goto _answer;
+		}
+		client->ops = &pcm_memfd_ops;
+		break;
+#endif
 	default:
 		ans.result = -EINVAL;
 		goto _answer;
@@ -782,6 +1144,7 @@ static int snd_client_open(client_t *client)
 	name[req.namelen] = '\0';
 
 	client->transport_type = req.transport_type;
+	client->dev_type = req.dev_type;
 	if (sizeof(client->name) < (size_t)(req.namelen + 1)) {
 		ans.result = -ENOMEM;
 		goto _answer;
@@ -804,42 +1167,85 @@ static int snd_client_open(client_t *client)
 		SYSERROR("write failed");
 		exit(1);
 	}
+#ifdef SND_TRANSPORT_MEMFD
+	/* the control area follows the answer */
+	if (client->open && client->transport_type == SND_TRANSPORT_TYPE_MEMFD)
+		return shm_ack_fd(client, client->transport.shm.memfd);
+#endif
 	return 0;
 }
 
-static int client_poll_handler(waiter_t *waiter, unsigned short events ATTRIBUTE_UNUSED)
+static void client_free(client_t *client)
 {
-	client_t *client = waiter->private_data;
 	if (client->open)
 		client->ops->close(client);
-	close(client->poll_fd);
-	close(client->ctrl_fd);
-	del_waiter(client->poll_fd);
 	del_waiter(client->ctrl_fd);
+	close(client->ctrl_fd);
+	if (!client->local) {
+		del_waiter(client->poll_fd);
+		close(client->poll_fd);
+	}
+	pthread_mutex_lock(&clients_lock);
 	list_del(&client->list);
+	pthread_mutex_unlock(&clients_lock);
 	free(client);
+}
+
+static int client_poll_handler(waiter_t *waiter, unsigned int events ATTRIBUTE_UNUSED)
+{
+	client_free(waiter->private_data);
 	return 0;
 }
 
-static int client_ctrl_handler(waiter_t *waiter, unsigned short events)
+static int client_ctrl_handler(waiter_t *waiter, unsigned int events)
 {
 	client_t *client = waiter->private_data;
-	if (events & POLLHUP) {
-		if (client->open)
-			client->ops->close(client);
-		close(client->ctrl_fd);
-		del_waiter(client->ctrl_fd);
-		list_del(&client->list);
-		free(client);
-		return 0;
+	struct timespec start;
+	char buf[1];
+	int err;
+
+	while (1) {
+		if (events & EPOLLHUP) {
+			client_free(client);
+			return 0;
+		}
+		if (client->open) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			err = client->ops->cmd(client);
+			if (client->open)
+				client_account(client, &start);
+		} else {
+			err = snd_client_open(client);
+			if (client->stats_request) {
+				client_free(client);
+				return err;
+			}
+		}
+		if (err < 0)
+			return err;
+		/* edge triggered, so serve everything queued before returning */
+		err = recv(client->ctrl_fd, buf, 1, MSG_PEEK | MSG_DONTWAIT);
+		if (err < 0)
+			return 0;
+		if (err == 0)
+			events = EPOLLHUP;
 	}
-	if (client->open)
-		return client->ops->cmd(client);
-	else
-		return snd_client_open(client);
 }
 
-static int inet_pending_handler(waiter_t *waiter, unsigned short events)
+static void client_start(client_t *client)
+{
+	client->worker = pick_worker();
+	pthread_mutex_lock(&clients_lock);
+	list_add_tail(&client->list, &clients);
+	pthread_mutex_unlock(&clients_lock);
+	add_waiter(client->worker->epfd, client->ctrl_fd, EPOLLIN | EPOLLET,
+		   client_ctrl_handler, client);
+	if (!client->local)
+		add_waiter(client->worker->epfd, client->poll_fd, EPOLLET,
+			   client_poll_handler, client);
+}
+
+static int inet_pending_handler(waiter_t *waiter, unsigned int events)
 {
 	inet_pending_t *pending = waiter->private_data;
 	inet_pending_t *pdata;
@@ -847,7 +1253,7 @@ static int inet_pending_handler(waiter_t *waiter, unsigned short events)
 	uint32_t cookie;
 	struct list_head *item;
 	int remove = 0;
-	if (events & POLLHUP)
+	if (events & EPOLLHUP)
 		remove = 1;
 	else {
 		int err = read(waiter->fd, &cookie, sizeof(cookie));
@@ -880,57 +1286,62 @@ static int inet_pending_handler(waiter_t *waiter, unsigned short events)
 	client->local = 0;
 	client->poll_fd = pdata->fd;
 	client->ctrl_fd = waiter->fd;
-	add_waiter(client->ctrl_fd, POLLIN | POLLHUP, client_ctrl_handler, client);
-	add_waiter(client->poll_fd, POLLHUP, client_poll_handler, client);
 	client->open = 0;
-	list_add_tail(&client->list, &clients);
 	list_del(&pending->list);
 	list_del(&pdata->list);
 	free(pending);
 	free(pdata);
+	client_start(client);
 	return 0;
 }
 
-static int local_handler(waiter_t *waiter, unsigned short events ATTRIBUTE_UNUSED)
+static int local_handler(waiter_t *waiter, unsigned int events ATTRIBUTE_UNUSED)
 {
 	int sock;
-	sock = accept(waiter->fd, 0, 0);
-	if (sock < 0) {
-		int result = -errno;
-		SYSERROR("accept failed");
-		return result;
-	} else {
-		client_t *client = calloc(1, sizeof(*client));
-		client->ctrl_fd = sock;
-		client->local = 1;
-		client->open = 0;
-		add_waiter(sock, POLLIN | POLLHUP, client_ctrl_handler, client);
-		list_add_tail(&client->list, &clients);
+	/* edge triggered, accept until the queue is empty */
+	while (1) {
+		sock = accept(waiter->fd, 0, 0);
+		if (sock < 0) {
+			int result = -errno;
+			if (result == -EAGAIN || result == -EWOULDBLOCK)
+				return 0;
+			SYSERROR("accept failed");
+			return result;
+		} else {
+			client_t *client = calloc(1, sizeof(*client));
+			client->ctrl_fd = sock;
+			client->local = 1;
+			client->open = 0;
+			client_start(client);
+		}
 	}
-	return 0;
 }
 
-static int inet_handler(waiter_t *waiter, unsigned short events ATTRIBUTE_UNUSED)
+static int inet_handler(waiter_t *waiter, unsigned int events ATTRIBUTE_UNUSED)
 {
 	int sock;
-	sock = accept(waiter->fd, 0, 0);
-	if (sock < 0) {
-		int result = -errno;
-		SYSERROR("accept failed");
-		return result;
-	} else {
-		inet_pending_t *pending = calloc(1, sizeof(*pending));
-		pending->fd = sock;
-		pending->cookie = 0;
-		add_waiter(sock, POLLIN, inet_pending_handler, pending);
-		list_add_tail(&pending->list, &inet_pendings);
+	/* edge triggered, accept until the queue is empty */
+	while (1) {
+		sock = accept(waiter->fd, 0, 0);
+		if (sock < 0) {
+			int result = -errno;
+			if (result == -EAGAIN || result == -EWOULDBLOCK)
+				return 0;
+			SYSERROR("accept failed");
+			return result;
+		} else {
+			inet_pending_t *pending = calloc(1, sizeof(*pending));
+			pending->fd = sock;
+			pending->cookie = 0;
+			add_waiter(main_epfd, sock, EPOLLIN, inet_pending_handler, pending);
+			list_add_tail(&pending->list, &inet_pendings);
+		}
 	}
-	return 0;
 }
 
-static int server(const char *sockname, int port)
+static int server(const char *sockname, int port, unsigned int threads)
 {
-	int err, result, sockn = -1, socki = -1;
+	int result, sockn = -1, socki = -1;
 	unsigned int k;
 	long open_max;
 
@@ -942,8 +1353,35 @@ static int server(const char *sockname, int port)
 		SYSERROR("sysconf failed");
 		return result;
 	}
-	pollfds = calloc((size_t) open_max, sizeof(*pollfds));
 	waiters = calloc((size_t) open_max, sizeof(*waiters));
+	workers = calloc(threads, sizeof(*workers));
+	if (!waiters || !workers) {
+		result = -ENOMEM;
+		goto _end;
+	}
+	main_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (main_epfd < 0) {
+		result = -errno;
+		SYSERROR("epoll_create1 failed");
+		goto _end;
+	}
+	for (k = 0; k < threads; k++) {
+		workers[k].epfd = epoll_create1(EPOLL_CLOEXEC);
+		if (workers[k].epfd < 0) {
+			result = -errno;
+			SYSERROR("epoll_create1 failed");
+			goto _end;
+		}
+		result = pthread_create(&workers[k].thread, NULL,
+					worker_thread, &workers[k]);
+		if (result) {
+			result = -result;
+			close(workers[k].epfd);
+			ERROR("pthread_create failed");
+			goto _end;
+		}
+		workers_count++;
+	}
 
 	if (sockname) {
 		sockn = make_local_socket(sockname);
@@ -959,7 +1397,7 @@ static int server(const char *sockname, int port)
 			SYSERROR("listen failed");
 			goto _end;
 		}
-		add_waiter(sockn, POLLIN, local_handler, NULL);
+		add_waiter(main_epfd, sockn, EPOLLIN | EPOLLET, local_handler, NULL);
 	}
 	if (port >= 0) {
 		socki = make_inet_socket(port);
@@ -975,41 +1413,75 @@ static int server(const char *sockname, int port)
 			SYSERROR("listen failed");
 			goto _end;
 		}
-		add_waiter(socki, POLLIN, inet_handler, NULL);
+		add_waiter(main_epfd, socki, EPOLLIN | EPOLLET, inet_handler, NULL);
 	}
 
-	while (1) {
-		struct pollfd pfds[open_max];
-		size_t pfds_count;
-		do {
-			err = poll(pollfds, pollfds_count, -1);
-		} while (err == 0);
-		if (err < 0) {
-			SYSERROR("poll failed");
-			continue;
-		}
-
-		pfds_count = pollfds_count;
-		memcpy(pfds, pollfds, sizeof(*pfds) * pfds_count);
-		for (k = 0; k < pfds_count; k++) {
-			struct pollfd *pfd = &pfds[k];
-			if (pfd->revents) {
-				waiter_t *w = &waiters[pfd->fd];
-				if (!w->handler)
-					continue;
-				err = w->handler(w, pfd->revents);
-				if (err < 0)
-					ERROR("waiter handler failed");
-			}
-		}
-	}
+	event_loop(main_epfd);
  _end:
 	if (sockn >= 0)
 		close(sockn);
 	if (socki >= 0)
 		close(socki);
-	free(pollfds);
+	/* the started workers never return, leave their data to the exit */
+	if (workers_count > 0)
+		return result;
+	if (main_epfd >= 0)
+		close(main_epfd);
 	free(waiters);
+	free(workers);
+	return result;
+}
+
+/*
+ * print the command latency histograms of a running server
+ */
+static int server_stats(const char *sockname)
+{
+	size_t l = strlen(sockname);
+	size_t size = offsetof(struct sockaddr_un, sun_path) + l;
+	struct sockaddr_un *addr = alloca(size);
+	snd_client_open_request_t req;
+	snd_client_open_answer_t ans;
+	char buf[4096];
+	ssize_t n;
+	long left;
+	int sock, result = 0;
+
+	sock = socket(PF_LOCAL, SOCK_STREAM, 0);
+	if (sock < 0) {
+		result = -errno;
+		SYSERROR("socket failed");
+		return result;
+	}
+	addr->sun_family = AF_LOCAL;
+	memcpy(addr->sun_path, sockname, l);
+	if (connect(sock, (struct sockaddr *) addr, size) < 0) {
+		result = -errno;
+		SYSERROR("connect failed");
+		goto _end;
+	}
+	memset(&req, 0, sizeof(req));
+	req.dev_type = SND_DEV_TYPE_STATS;
+	req.transport_type = SND_TRANSPORT_TYPE_SHM;
+	if (write(sock, &req, sizeof(req)) != sizeof(req) ||
+	    read(sock, &ans, sizeof(ans)) != sizeof(ans)) {
+		result = -EBADFD;
+		ERROR("stats request failed");
+		goto _end;
+	}
+	if (ans.result < 0) {
+		result = ans.result;
+		ERROR("stats request refused: %s", snd_strerror(result));
+		goto _end;
+	}
+	for (left = ans.result; left > 0; left -= n) {
+		n = read(sock, buf, left < (long)sizeof(buf) ? left : (long)sizeof(buf));
+		if (n <= 0)
+			break;
+		fwrite(buf, 1, n, stdout);
+	}
+ _end:
+	close(sock);
 	return result;
 }
 
@@ -1018,7 +1490,9 @@ static void usage(void)
 {
 	fprintf(stderr,
 		"Usage: %s [OPTIONS] server\n"
-		"--help			help\n",
+		"--help			help\n"
+		"--threads=#		number of worker threads (default: CPU count)\n"
+		"--stats			show the command latency of a running server\n",
 		command);
 }
 
@@ -1026,9 +1500,13 @@ int main(int argc, char **argv)
 {
 	static const struct option long_options[] = {
 		{"help", 0, 0, 'h'},
+		{"threads", 1, 0, 't'},
+		{"stats", 0, 0, 's'},
 		{ 0 , 0 , 0, 0 }
 	};
 	int c;
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int stats = 0;
 	snd_config_t *conf;
 	snd_config_iterator_t i, next;
 	const char *sockname = NULL;
@@ -1037,11 +1515,21 @@ int main(int argc, char **argv)
 	char *srvname;
 
 	command = argv[0];
-	while ((c = getopt_long(argc, argv, "h", long_options, 0)) != -1) {
+	while ((c = getopt_long(argc, argv, "ht:s", long_options, 0)) != -1) {
 		switch (c) {
 		case 'h':
 			usage();
 			return 0;
+		case 't':
+			threads = atol(optarg);
+			if (threads < 1) {
+				ERROR("invalid number of threads: %s", optarg);
+				return 1;
+			}
+			break;
+		case 's':
+			stats = 1;
+			break;
 		default:
 			fprintf(stderr, "Try `%s --help' for more information\n", command);
 			return 1;
@@ -1094,10 +1582,19 @@ int main(int argc, char **argv)
 		ERROR("Unknown field %s", id);
 		return 1;
 	}
+	if (stats) {
+		if (!sockname) {
+			ERROR("socket needs to be defined for stats");
+			return 1;
+		}
+		return server_stats(sockname) < 0;
+	}
 	if (!sockname && port < 0) {
 		ERROR("either socket or port need to be defined");
 		return 1;
 	}
-	server(sockname, port);
+	if (threads < 1)
+		threads = 1;
+	server(sockname, port, threads);
 	return 0;
 }
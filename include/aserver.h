@@ -21,6 +21,14 @@
 #include "../src/pcm/pcm_local.h"
 #include "../src/control/control_local.h"
 #include <netdb.h>
+#include <time.h>
+#if defined(HAVE_MEMFD_CREATE) && defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#ifdef SYS_futex
+#define SND_TRANSPORT_MEMFD	1
+#endif
+#endif
 
 int snd_receive_fd(int sock, void *data, size_t len, int *fd);
 
@@ -31,11 +39,13 @@ typedef enum _snd_dev_type {
 	SND_DEV_TYPE_TIMER,
 	SND_DEV_TYPE_HWDEP,
 	SND_DEV_TYPE_SEQ,
+	SND_DEV_TYPE_STATS,
 } snd_dev_type_t;
 
 typedef enum _snd_transport_type {
 	SND_TRANSPORT_TYPE_SHM,
 	SND_TRANSPORT_TYPE_TCP,
+	SND_TRANSPORT_TYPE_MEMFD,
 } snd_transport_type_t;
 
 #define SND_PCM_IOCTL_HWSYNC		_IO ('A', 0x22)
@@ -58,6 +68,16 @@ typedef struct {
 	int changed;
 } snd_pcm_shm_rbptr_t;
 
+/*
+ * doorbell of the memfd transport: the client stores a new req value
+ * to ask for a fast command and the server copies it to ack when the
+ * command is done; both are futex words
+ */
+typedef struct {
+	uint32_t req;
+	uint32_t ack;
+} snd_pcm_shm_doorbell_t;
+
 typedef struct {
 	long result;
 	int cmd;
@@ -102,11 +122,41 @@ typedef struct {
 			off_t offset;
 		} rbptr;
 	} u;
+	snd_pcm_shm_doorbell_t fast;
 	char data[0];
 } snd_pcm_shm_ctrl_t;
 
 #define PCM_SHM_SIZE sizeof(snd_pcm_shm_ctrl_t)
 
+#ifdef SND_TRANSPORT_MEMFD
+static inline uint32_t snd_shm_doorbell_get(volatile uint32_t *word)
+{
+	return __atomic_load_n(word, __ATOMIC_ACQUIRE);
+}
+
+static inline void snd_shm_doorbell_ring(volatile uint32_t *word, uint32_t val)
+{
+	__atomic_store_n(word, val, __ATOMIC_RELEASE);
+	syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/* wait while *word is val; timeout in ms, negative = forever */
+static inline int snd_shm_doorbell_wait(volatile uint32_t *word, uint32_t val,
+					int timeout)
+{
+	struct timespec ts, *tsp = NULL;
+
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * 1000000L;
+		tsp = &ts;
+	}
+	if (syscall(SYS_futex, word, FUTEX_WAIT, val, tsp, NULL, 0) < 0)
+		return -errno;
+	return 0;
+}
+#endif
+
 #define SND_CTL_IOCTL_READ		_IOR('U', 0xf1, snd_ctl_event_t)
 #define SND_CTL_IOCTL_CLOSE		_IO ('U', 0xf2)
 #define SND_CTL_IOCTL_POLL_DESCRIPTOR	_IO ('U', 0xf3)
@@ -368,6 +368,8 @@ static inline int snd_open_device(const char *filename, int fmode)
 	snd1_config_check_hop
 #define snd_config_search_alias_hooks \
 	snd1_config_search_alias_hooks
+#define snd_config_cache_env \
+	snd1_config_cache_env
 
 /* dlobj cache */
 void *snd_dlobj_cache_get(const char *lib, const char *name, const char *version, int verbose);
@@ -386,6 +388,12 @@ int snd_config_search_alias_hooks(snd_config_t *config,
 
 int _snd_conf_generic_id(const char *id);
 
+/* binary config cache: record an environment variable the tree depends on */
+void snd_config_cache_env(const char *name);
+
+/* contiguous reads for the configuration parser */
+ssize_t _snd_input_block(snd_input_t *input, const char **ptr);
+
 int _snd_config_load_with_include(snd_config_t *config, snd_input_t *in,
 				  int override, const char * const *default_include_path);
 
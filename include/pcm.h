@@ -486,7 +486,9 @@ enum _snd_pcm_type {
 	SND_PCM_TYPE_EXTPLUG,
 	/** Mmap-emulation plugin */
 	SND_PCM_TYPE_MMAP_EMUL,
-	SND_PCM_TYPE_LAST = SND_PCM_TYPE_MMAP_EMUL
+	/** DSP module host plugin */
+	SND_PCM_TYPE_DSP,
+	SND_PCM_TYPE_LAST = SND_PCM_TYPE_DSP
 };
 
 /** PCM type */
@@ -1314,6 +1316,23 @@ int snd_pcm_scope_s16_open(snd_pcm_t *pcm, const char *name,
 int16_t *snd_pcm_scope_s16_get_channel_buffer(snd_pcm_scope_t *scope,
 					      unsigned int channel);
 
+/** Levels of a channel reported by the peak scope */
+typedef struct _snd_pcm_scope_peak_info {
+	/** sample peak since the previous update (1.0 is full scale) */
+	float peak;
+	/** RMS level since the previous update (1.0 is full scale) */
+	float rms;
+	/** 4x oversampled peak since the previous update */
+	float true_peak;
+	/** full scale samples since the last reset */
+	unsigned long clips;
+} snd_pcm_scope_peak_info_t;
+
+int snd_pcm_scope_peak_open(snd_pcm_t *pcm, const char *name,
+			    snd_pcm_scope_t **scopep);
+int snd_pcm_scope_peak_get_info(snd_pcm_scope_t *scope, unsigned int channel,
+				snd_pcm_scope_peak_info_t *info);
+
 /** \} */
 
 /**
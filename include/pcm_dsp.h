@@ -0,0 +1,127 @@
+/**
+ * \file include/pcm_dsp.h
+ * \brief External DSP-Plugin SDK
+ * \date 2026
+ *
+ * External DSP-Plugin SDK
+ */
+
+/*
+ * ALSA external PCM DSP plugin SDK
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __ALSA_PCM_DSP_H
+#define __ALSA_PCM_DSP_H
+
+#ifndef __ASOUNDLIB_LOCAL
+#include <alsa/asoundlib.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Protocol version major */
+#define SND_PCM_DSP_VERSION_MAJOR	1
+/** Protocol version minor */
+#define SND_PCM_DSP_VERSION_MINOR	0
+/** Protocol version tiny */
+#define SND_PCM_DSP_VERSION_TINY	0
+/**
+ * Protocol version; modules with a different major version are refused
+ */
+#define SND_PCM_DSP_VERSION	((SND_PCM_DSP_VERSION_MAJOR<<16) |\
+				 (SND_PCM_DSP_VERSION_MINOR<<8) |\
+				 (SND_PCM_DSP_VERSION_TINY))
+
+enum {
+	SND_PCM_DSP_FLAG_S32 = (1U << 0),		/**< accepts S32 samples in CPU endian */
+	SND_PCM_DSP_FLAG_FLOAT = (1U << 1),		/**< accepts FLOAT samples in CPU endian */
+	SND_PCM_DSP_FLAG_INTERLEAVED = (1U << 2),	/**< accepts one interleaved buffer */
+	SND_PCM_DSP_FLAG_PLANAR = (1U << 3),		/**< accepts one buffer per channel */
+};
+
+/** stream parameters passed to the init callback */
+typedef struct snd_pcm_dsp_info {
+	snd_pcm_format_t format;	/**< #SND_PCM_FORMAT_S32 or #SND_PCM_FORMAT_FLOAT */
+	int planar;			/**< one buffer per channel when set */
+	unsigned int channels;		/**< channel count */
+	unsigned int rate;		/**< sample rate */
+	snd_pcm_uframes_t max_frames;	/**< largest block passed to process */
+} snd_pcm_dsp_info_t;
+
+/** Callback table of a DSP module */
+typedef struct snd_pcm_dsp_ops {
+	/**
+	 * the protocol version the module was built with
+	 */
+	unsigned int version;
+	/**
+	 * accepted formats and layouts, SND_PCM_DSP_FLAG_*
+	 */
+	unsigned int flags;
+	/**
+	 * preferred processing block in frames; 0 = any
+	 */
+	snd_pcm_uframes_t block_size;
+	/**
+	 * close the module; optional
+	 */
+	void (*close)(void *obj);
+	/**
+	 * initialize the module, called at hw_params
+	 */
+	int (*init)(void *obj, const snd_pcm_dsp_info_t *info);
+	/**
+	 * free the resources allocated by init; optional
+	 */
+	void (*free)(void *obj);
+	/**
+	 * clear the processing state, called at prepare and reset; optional
+	 */
+	void (*reset)(void *obj);
+	/**
+	 * return the algorithmic delay in frames; optional
+	 */
+	snd_pcm_uframes_t (*latency)(void *obj);
+	/**
+	 * process the samples in place; bufs holds one pointer for the
+	 * interleaved layout or one pointer per channel for the planar one
+	 */
+	void (*process)(void *obj, void *const *bufs, snd_pcm_uframes_t frames);
+	/**
+	 * show the module state; optional
+	 */
+	void (*dump)(void *obj, snd_output_t *out);
+} snd_pcm_dsp_ops_t;
+
+/** open function type */
+typedef int (*snd_pcm_dsp_open_func_t)(unsigned int version, void **objp,
+				       snd_pcm_dsp_ops_t *opsp,
+				       const snd_config_t *conf);
+
+/**
+ * Define the object entry for external PCM DSP modules
+ */
+#define SND_PCM_DSP_PLUGIN_ENTRY(name) _snd_pcm_dsp_##name##_open
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ALSA_PCM_DSP_H */
@@ -65,7 +65,7 @@ typedef snd_pcm_extplug_callback snd_pcm_extplug_callback_t;
  */
 #define SND_PCM_EXTPLUG_VERSION_MAJOR	1	/**< Protocol major version */
 #define SND_PCM_EXTPLUG_VERSION_MINOR	0	/**< Protocol minor version */
-#define SND_PCM_EXTPLUG_VERSION_TINY	2	/**< Protocol tiny version */
+#define SND_PCM_EXTPLUG_VERSION_TINY	3	/**< Protocol tiny version */
 /**
  * Filter-plugin protocol version
  */
@@ -128,6 +128,18 @@ struct snd_pcm_extplug {
 	 * slave_channels hw parameter; filled after hw_params is caled
 	 */
 	unsigned int slave_channels;
+	/**
+	 * processing block in frames; when non-zero, the transfer callback
+	 * is called only with whole contiguous blocks; the preferred size
+	 * must be set before hw_params is called, the hw_params callback
+	 * may adapt it up to the period size; since v1.0.3
+	 */
+	snd_pcm_uframes_t block_size;
+	/**
+	 * intrinsic latency of the processing in frames, added to the
+	 * delay; since v1.0.3
+	 */
+	snd_pcm_uframes_t latency;
 };
 
 /** Callback table of extplug */
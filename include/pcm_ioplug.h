@@ -72,13 +72,15 @@ typedef snd_pcm_ioplug_callback snd_pcm_ioplug_callback_t;
 #define SND_PCM_IOPLUG_FLAG_MONOTONIC	(1<<1)		/**< monotonic timestamps */
 /** hw pointer wrap around at boundary instead of buffer_size */
 #define SND_PCM_IOPLUG_FLAG_BOUNDARY_WA	(1<<2)
+/** hw pointer is published via #snd_pcm_ioplug_publish_hw_ptr(); since v1.0.3 */
+#define SND_PCM_IOPLUG_FLAG_PUBLISH_HW_PTR	(1<<3)
 
 /*
  * Protocol version
  */
 #define SND_PCM_IOPLUG_VERSION_MAJOR	1	/**< Protocol major version */
 #define SND_PCM_IOPLUG_VERSION_MINOR	0	/**< Protocol minor version */
-#define SND_PCM_IOPLUG_VERSION_TINY	2	/**< Protocol tiny version */
+#define SND_PCM_IOPLUG_VERSION_TINY	3	/**< Protocol tiny version */
 /**
  * IO-plugin protocol version
  */
@@ -139,7 +141,8 @@ struct snd_pcm_ioplug_callback {
 	 */
 	int (*stop)(snd_pcm_ioplug_t *io);
 	/**
-	 * get the current DMA position; required, called inside mutex lock
+	 * get the current DMA position; required unless
+	 * #SND_PCM_IOPLUG_FLAG_PUBLISH_HW_PTR is set, called inside mutex lock
 	 * \return buffer position up to buffer_size or
 	 * when #SND_PCM_IOPLUG_FLAG_BOUNDARY_WA flag is set up to boundary or
 	 * a negative error code for Xrun
@@ -226,9 +229,12 @@ int snd_pcm_ioplug_delete(snd_pcm_ioplug_t *io);
 /* update poll_fd and mmap_rw */
 int snd_pcm_ioplug_reinit_status(snd_pcm_ioplug_t *ioplug);
 
-/* get a mmap area (for mmap_rw only) */
+/* get a mmap area (for mmap_rw or a shared mmap buffer only) */
 const snd_pcm_channel_area_t *snd_pcm_ioplug_mmap_areas(snd_pcm_ioplug_t *ioplug);
 
+/* expose the plugin buffer as the mmap area (call from hw_params) */
+int snd_pcm_ioplug_set_mmap_buffer(snd_pcm_ioplug_t *ioplug, int fd, off_t offset);
+
 /* clear hw_parameter setting */
 void snd_pcm_ioplug_params_reset(snd_pcm_ioplug_t *io);
 
@@ -239,6 +245,9 @@ int snd_pcm_ioplug_set_param_list(snd_pcm_ioplug_t *io, int type, unsigned int n
 /* change PCM status */
 int snd_pcm_ioplug_set_state(snd_pcm_ioplug_t *ioplug, snd_pcm_state_t state);
 
+/* publish the DMA position (for SND_PCM_IOPLUG_FLAG_PUBLISH_HW_PTR) */
+int snd_pcm_ioplug_publish_hw_ptr(snd_pcm_ioplug_t *ioplug, snd_pcm_sframes_t hw_ptr);
+
 /* calucalte the available frames */
 snd_pcm_uframes_t snd_pcm_ioplug_avail(const snd_pcm_ioplug_t * const ioplug,
 				       const snd_pcm_uframes_t hw_ptr,
@@ -199,6 +199,16 @@ int _snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
 			 snd_config_t *root, snd_config_t *conf,
 			 snd_pcm_stream_t stream, int mode);
 
+/*
+ *  DSP module host plugin
+ */
+int snd_pcm_dsp_open(snd_pcm_t **pcmp, const char *name,
+		     snd_config_t *modules, snd_pcm_format_t format,
+		     snd_pcm_t *slave, int close_slave);
+int _snd_pcm_dsp_open(snd_pcm_t **pcmp, const char *name,
+		      snd_config_t *root, snd_config_t *conf,
+		      snd_pcm_stream_t stream, int mode);
+
 /*
  *  Jack plugin
  */
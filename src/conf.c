@@ -418,7 +418,13 @@ beginning:</P>
   <LI>The function load_for_all_cards - \c snd_config_hook_load_for_all_cards() -
       loads and parses the given configuration files for each installed sound
       card. The driver name (the type of the sound card) is passed in the
-      private configuration node.
+      private configuration node. With the \c lazy field set to true
+      (or with the \c LIBASOUND_CONFIG_LAZY_CARDS environment variable set
+      to 1 when the field is absent), the files are not loaded at once;
+      a load_card hook is left in the node of the driver instead.
+  <LI>The function load_card - \c snd_config_hook_load_card() -
+      loads the configuration files of one sound card deferred by
+      load_for_all_cards, on the first search through the node of its driver.
 </UL>
 
 */
@@ -429,11 +435,17 @@ beginning:</P>
 #include <stdbool.h>
 #include <limits.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <dirent.h>
 #include <locale.h>
 #ifdef HAVE_LIBPTHREAD
 #include <pthread.h>
 #endif
+#if defined(HAVE_LIBPTHREAD) && defined(HAVE_SYS_INOTIFY_H)
+#define CONFIG_WATCH
+#include <sys/inotify.h>
+#endif
 
 #ifndef DOC_HIDDEN
 
@@ -455,16 +467,21 @@ struct _snd_config {
 		struct {
 			struct list_head fields;
 			bool join;
+			struct config_hash *hash;	/* id index of large nodes */
+			unsigned int count;		/* children */
 		} compound;
 	} u;
 	struct list_head list;
 	snd_config_t *parent;
 	int hop;
+	unsigned int flags;		/* CONFIG_ARENA_* */
+	struct config_arena *arena;	/* owner of the node memory, if any */
 };
 
 struct filedesc {
 	char *name;
 	snd_input_t *in;
+	const char *ptr, *end;	/* unread part of the current input block */
 	unsigned int line, column;
 	struct filedesc *next;
 
@@ -494,6 +511,25 @@ typedef struct {
 	int ch;
 } input_t;
 
+/* inputs of the binary config cache, recorded while the global
+ * configuration is rebuilt (under the config lock); without TLS, the
+ * recording state and the current arena would be seen by the other
+ * threads, so the recording (the cache save and the memo) and the
+ * arenas are disabled
+ */
+#ifdef HAVE___THREAD
+#define CONFIG_TLS	__thread
+#else
+#define CONFIG_TLS	/* NOP */
+#endif
+struct config_deps;
+static CONFIG_TLS struct config_deps *config_deps;
+static void config_dep_path(const char *name);
+static void config_dep_uncacheable(void);
+static int config_dep_pure_func(const char *name);
+static void config_memo_flush(void);
+static unsigned int config_global_gen;	/* changes of the global tree */
+
 #ifdef HAVE_LIBPTHREAD
 
 static void snd_config_init_mutex(void)
@@ -643,8 +679,10 @@ static int input_stdio_open(snd_input_t **inputp, const char *file,
 	char full_path[PATH_MAX];
 	int err;
 
-	if (file[0] == '/')
+	if (file[0] == '/') {
+		config_dep_path(file);
 		return snd_input_stdio_open(inputp, file, "r");
+	}
 
 	/* search file in user specified include paths. These directories
 	 * are subdirectories of /usr/share/alsa.
@@ -657,6 +695,7 @@ static int input_stdio_open(snd_input_t **inputp, const char *file,
 				continue;
 
 			snprintf(full_path, PATH_MAX, "%s/%s", path->dir, file);
+			config_dep_path(full_path);
 			err = snd_input_stdio_open(inputp, full_path, "r");
 			if (err == 0)
 				return 0;
@@ -743,6 +782,18 @@ int _snd_safe_strtod(const char *str, double *val)
 	return 0;
 }
 
+static int fill_block(struct filedesc *fd)
+{
+	ssize_t len = _snd_input_block(fd->in, &fd->ptr);
+
+	if (len <= 0) {
+		fd->ptr = fd->end = NULL;
+		return EOF;
+	}
+	fd->end = fd->ptr + len;
+	return 0;
+}
+
 static int get_char(input_t *input)
 {
 	int c;
@@ -753,7 +804,10 @@ static int get_char(input_t *input)
 	}
  again:
 	fd = input->current;
-	c = snd_input_getc(fd->in);
+	if (fd->ptr == fd->end && fill_block(fd) < 0)
+		c = EOF;
+	else
+		c = (unsigned char)*fd->ptr++;
 	switch (c) {
 	case '\n':
 		fd->column = 0;
@@ -834,6 +888,7 @@ static int get_char_skip_comments(input_t *input)
 				if (tmp == NULL)
 					return -ENOMEM;
 				str = tmp;
+				config_dep_path(str);
 				err = snd_input_stdio_open(&in, str, "r");
 			} else { /* absolute or relative file path */
 				err = input_stdio_open(&in, str, input->current);
@@ -851,6 +906,7 @@ static int get_char_skip_comments(input_t *input)
 			}
 			fd->name = str;
 			fd->in = in;
+			fd->ptr = fd->end = NULL;
 			fd->next = input->current;
 			fd->line = 1;
 			fd->column = 0;
@@ -861,6 +917,12 @@ static int get_char_skip_comments(input_t *input)
 		if (c != '#')
 			break;
 		while (1) {
+			/* skip the comment text up to the new line */
+			struct filedesc *fd = input->current;
+			if (!input->unget && fd->ptr != fd->end) {
+				const char *nl = memchr(fd->ptr, '\n', fd->end - fd->ptr);
+				fd->ptr = nl ? nl : fd->end;
+			}
 			c = get_char(input);
 			if (c < 0)
 				return c;
@@ -988,6 +1050,82 @@ static int add_char_local_string(struct local_string *s, int c)
 	return 0;
 }
 
+static int add_chars_local_string(struct local_string *s, const char *p,
+				  size_t len)
+{
+	if (s->idx + len > s->alloc) {
+		size_t nalloc = s->alloc * 2;
+		while (nalloc < s->idx + len)
+			nalloc *= 2;
+		if (s->buf == s->tmpbuf) {
+			s->buf = malloc(nalloc);
+			if (s->buf == NULL)
+				return -ENOMEM;
+			memcpy(s->buf, s->tmpbuf, s->idx);
+		} else {
+			char *ptr = realloc(s->buf, nalloc);
+			if (ptr == NULL)
+				return -ENOMEM;
+			s->buf = ptr;
+		}
+		s->alloc = nalloc;
+	}
+	memcpy(s->buf + s->idx, p, len);
+	s->idx += len;
+	return 0;
+}
+
+/*
+ * Copy the run of the current input block up to the first character
+ * for which stop() is true; the run has no new line or tab character
+ * so only the column is updated.
+ */
+static int add_run_local_string(struct local_string *s, input_t *input,
+				const unsigned char *stop, unsigned char mask)
+{
+	struct filedesc *fd = input->current;
+	const char *p = fd->ptr;
+	size_t len;
+
+	if (input->unget)
+		return 0;
+	while (p < fd->end && !(stop[(unsigned char)*p] & mask))
+		p++;
+	len = p - fd->ptr;
+	if (len == 0)
+		return 0;
+	if (add_chars_local_string(s, fd->ptr, len) < 0)
+		return -ENOMEM;
+	fd->ptr = p;
+	fd->column += len;
+	return 0;
+}
+
+#define STOP_FREE	(1 << 0)	/* ends a free string */
+#define STOP_ID		(1 << 1)	/* ends a free string identifier */
+#define STOP_DELIM	(1 << 2)	/* needs a check in a delimited string */
+
+static const unsigned char stop_chars[256] = {
+	[' '] = STOP_FREE | STOP_ID,
+	['\f'] = STOP_FREE | STOP_ID,
+	['\t'] = STOP_FREE | STOP_ID | STOP_DELIM,
+	['\n'] = STOP_FREE | STOP_ID | STOP_DELIM,
+	['\r'] = STOP_FREE | STOP_ID,
+	['='] = STOP_FREE | STOP_ID,
+	[','] = STOP_FREE | STOP_ID,
+	[';'] = STOP_FREE | STOP_ID,
+	['{'] = STOP_FREE | STOP_ID,
+	['}'] = STOP_FREE | STOP_ID,
+	['['] = STOP_FREE | STOP_ID,
+	[']'] = STOP_FREE | STOP_ID,
+	['\''] = STOP_FREE | STOP_ID | STOP_DELIM,
+	['"'] = STOP_FREE | STOP_ID | STOP_DELIM,
+	['\\'] = STOP_FREE | STOP_ID | STOP_DELIM,
+	['#'] = STOP_FREE | STOP_ID,
+	['.'] = STOP_ID,
+	['>'] = STOP_DELIM,
+};
+
 static char *copy_local_string(struct local_string *s)
 {
 	char *dst = malloc(s->idx + 1);
@@ -1005,6 +1143,11 @@ static int get_freestring(char **string, int id, input_t *input)
 
 	init_local_string(&str);
 	while (1) {
+		if (add_run_local_string(&str, input, stop_chars,
+					 id ? STOP_ID : STOP_FREE) < 0) {
+			c = -ENOMEM;
+			break;
+		}
 		c = get_char(input);
 		if (c < 0) {
 			if (c == LOCAL_UNEXPECTED_EOF) {
@@ -1065,6 +1208,10 @@ static int get_delimstring(char **string, int delim, input_t *input)
 
 	init_local_string(&str);
 	while (1) {
+		if (add_run_local_string(&str, input, stop_chars, STOP_DELIM) < 0) {
+			c = -ENOMEM;
+			break;
+		}
 		c = get_char(input);
 		if (c < 0)
 			break;
@@ -1123,11 +1270,304 @@ static int get_string(char **string, int id, input_t *input)
 	}
 }
 
+/*
+ * Arena mode: the nodes created by a bulk operation (the global tree
+ * parse, a copy or an expansion) are carved from one arena and their ids
+ * and string values are interned in it.  The arena is released when the
+ * last of its nodes is deleted.  The flags in each node tell which strings
+ * are owned by the arena, so the nodes stay individually modifiable.
+ * Set LIBASOUND_CONFIG_ARENA=0 to allocate every node separately.
+ *
+ * The interned strings are never modified, so a copy of a tree (e.g. the
+ * result of expanding a definition of the global tree) references the
+ * strings of the source arena instead of duplicating them and holds a
+ * reference to that arena.  A changed value is set as a new string, so
+ * only the changed strings are allocated.  To keep the lifetimes simple,
+ * an arena shares the strings of a single base arena, which does not share
+ * the strings of another arena itself.
+ */
+#define CONFIG_ARENA_ID		(1 << 0)	/* id interned in the arena */
+#define CONFIG_ARENA_STRING	(1 << 1)	/* string value interned */
+#define CONFIG_SHARED_ID	(1 << 2)	/* id owned by the base arena */
+#define CONFIG_SHARED_STRING	(1 << 3)	/* string owned by the base arena */
+
+#define CONFIG_ARENA_CHUNK	4096
+#define CONFIG_ARENA_CHUNK_MAX	65536
+#define CONFIG_ARENA_ALIGN	16
+
+struct config_arena_chunk {
+	struct config_arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[] __attribute__((aligned(CONFIG_ARENA_ALIGN)));
+};
+
+struct config_arena_str {
+	unsigned int hash;
+	const char *str;
+};
+
+struct config_arena {
+	unsigned int refs;		/* live nodes + the active scope */
+	struct config_arena_chunk *chunk;
+	size_t chunk_size;
+	size_t allocated;		/* bytes of all chunks */
+	size_t used;
+	unsigned int nodes;		/* nodes ever carved */
+	unsigned int strings;		/* distinct interned strings */
+	unsigned int intern_size;	/* power of two */
+	struct config_arena_str *intern;
+	struct config_arena *base;	/* arena of the shared strings */
+};
+
+/* bulk operation scope; nested operations share the outer arena */
+struct config_arena_scope {
+	struct config_arena *arena;
+};
+
+static CONFIG_TLS struct config_arena *config_arena_current;
+
+static unsigned int config_hash_id(const char *id, size_t len)
+{
+	unsigned int hash = 2166136261U;
+
+	while (len-- > 0)
+		hash = (hash ^ (unsigned char)*id++) * 16777619U;
+	return hash;
+}
+
+static int config_arena_enabled(void)
+{
+#ifdef HAVE___THREAD
+	static int enabled = -1;
+
+	if (enabled < 0) {
+		const char *env = getenv("LIBASOUND_CONFIG_ARENA");
+		enabled = !(env && *env == '0');
+	}
+	return enabled;
+#else
+	return 0;
+#endif
+}
+
+static void config_arena_free(struct config_arena *a)
+{
+	struct config_arena_chunk *c, *next;
+
+	for (c = a->chunk; c; c = next) {
+		next = c->next;
+		free(c);
+	}
+	free(a->intern);
+	if (a->base && __atomic_sub_fetch(&a->base->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		config_arena_free(a->base);
+	free(a);
+}
+
+static void config_arena_put(struct config_arena *a)
+{
+	if (__atomic_sub_fetch(&a->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		config_arena_free(a);
+}
+
+static void *config_arena_alloc(struct config_arena *a, size_t size)
+{
+	struct config_arena_chunk *c = a->chunk;
+	size_t csize;
+	void *p;
+
+	size = (size + CONFIG_ARENA_ALIGN - 1) & ~(size_t)(CONFIG_ARENA_ALIGN - 1);
+	if (!c || c->size - c->used < size) {
+		if (a->chunk_size < CONFIG_ARENA_CHUNK_MAX)
+			a->chunk_size *= 2;
+		csize = a->chunk_size;
+		if (csize < size)
+			csize = size;
+		c = malloc(sizeof(*c) + csize);
+		if (!c)
+			return NULL;
+		c->size = csize;
+		c->used = 0;
+		c->next = a->chunk;
+		a->chunk = c;
+		a->allocated += csize;
+	}
+	p = c->data + c->used;
+	c->used += size;
+	a->used += size;
+	return p;
+}
+
+/* return the arena copy of the string, NULL when out of memory */
+static char *config_arena_intern(struct config_arena *a, const char *str)
+{
+	size_t len = strlen(str);
+	unsigned int hash = config_hash_id(str, len), mask, k;
+	struct config_arena_str *e;
+	char *s;
+
+	if ((a->strings + 1) * 2 > a->intern_size) {
+		unsigned int size = a->intern_size ? a->intern_size * 2 : 256;
+		struct config_arena_str *t = calloc(size, sizeof(*t));
+		if (!t)
+			return NULL;
+		for (k = 0; k < a->intern_size; k++) {
+			unsigned int j;
+			e = &a->intern[k];
+			if (!e->str)
+				continue;
+			for (j = e->hash & (size - 1); t[j].str; j = (j + 1) & (size - 1))
+				;
+			t[j] = *e;
+		}
+		free(a->intern);
+		a->intern = t;
+		a->intern_size = size;
+	}
+	mask = a->intern_size - 1;
+	for (k = hash & mask; a->intern[k].str; k = (k + 1) & mask) {
+		e = &a->intern[k];
+		if (e->hash == hash && strcmp(e->str, str) == 0)
+			return (char *)e->str;
+	}
+	s = config_arena_alloc(a, len + 1);
+	if (!s)
+		return NULL;
+	memcpy(s, str, len + 1);
+	a->intern[k].hash = hash;
+	a->intern[k].str = s;
+	a->strings++;
+	return s;
+}
+
+static void config_arena_enter(struct config_arena_scope *scope)
+{
+	struct config_arena *a;
+
+	scope->arena = NULL;
+	if (config_arena_current || !config_arena_enabled())
+		return;
+	a = calloc(1, sizeof(*a));
+	if (!a)
+		return;
+	a->refs = 1;
+	a->chunk_size = CONFIG_ARENA_CHUNK / 2;
+	config_arena_current = a;
+	scope->arena = a;
+}
+
+static void config_arena_leave(struct config_arena_scope *scope)
+{
+	if (!scope->arena)
+		return;
+	config_arena_current = NULL;
+	config_arena_put(scope->arena);
+}
+
+static snd_config_t *config_node_alloc(void)
+{
+	struct config_arena *a = config_arena_current;
+	snd_config_t *n;
+
+	if (a) {
+		n = config_arena_alloc(a, sizeof(*n));
+		if (n) {
+			memset(n, 0, sizeof(*n));
+			n->arena = a;
+			a->nodes++;
+			__atomic_add_fetch(&a->refs, 1, __ATOMIC_RELAXED);
+			return n;
+		}
+	}
+	return calloc(1, sizeof(*n));
+}
+
+static void config_node_free(snd_config_t *n)
+{
+	if (n->arena)
+		config_arena_put(n->arena);
+	else
+		free(n);
+}
+
+/* the arena to intern the strings of the node, if any */
+static struct config_arena *config_node_arena(snd_config_t *n)
+{
+	if (n->arena && n->arena == config_arena_current)
+		return n->arena;
+	return NULL;
+}
+
+static void config_free_id(snd_config_t *n)
+{
+	if (!(n->flags & CONFIG_ARENA_ID))
+		free(n->id);
+	n->flags &= ~(CONFIG_ARENA_ID | CONFIG_SHARED_ID);
+	n->id = NULL;
+}
+
+static void config_free_string(snd_config_t *n)
+{
+	if (!(n->flags & CONFIG_ARENA_STRING))
+		free(n->u.string);
+	n->flags &= ~(CONFIG_ARENA_STRING | CONFIG_SHARED_STRING);
+	n->u.string = NULL;
+}
+
+/* set the string value of a node, taking the ownership of str */
+static void config_set_string_owned(snd_config_t *n, char *str)
+{
+	struct config_arena *a = config_node_arena(n);
+	char *s;
+
+	config_free_string(n);
+	if (str && a) {
+		s = config_arena_intern(a, str);
+		if (s) {
+			free(str);
+			n->u.string = s;
+			n->flags |= CONFIG_ARENA_STRING;
+			return;
+		}
+	}
+	n->u.string = str;
+}
+
+/* set a copy of value as the string value of a node */
+static int config_set_string_copy(snd_config_t *n, const char *value)
+{
+	struct config_arena *a = config_node_arena(n);
+	char *s;
+
+	if (value && a) {
+		s = config_arena_intern(a, value);
+		if (s) {
+			config_free_string(n);
+			n->u.string = s;
+			n->flags |= CONFIG_ARENA_STRING;
+			return 0;
+		}
+	}
+	if (value) {
+		s = strdup(value);
+		if (!s)
+			return -ENOMEM;
+	} else {
+		s = NULL;
+	}
+	config_free_string(n);
+	n->u.string = s;
+	return 0;
+}
+
 static int _snd_config_make(snd_config_t **config, char **id, snd_config_type_t type)
 {
 	snd_config_t *n;
+	struct config_arena *a;
+	char *s;
 	assert(config);
-	n = calloc(1, sizeof(*n));
+	n = config_node_alloc();
 	if (n == NULL) {
 		if (*id) {
 			free(*id);
@@ -1136,7 +1576,15 @@ static int _snd_config_make(snd_config_t **config, char **id, snd_config_type_t
 		return -ENOMEM;
 	}
 	if (id) {
-		n->id = *id;
+		a = config_node_arena(n);
+		s = *id && a ? config_arena_intern(a, *id) : NULL;
+		if (s) {
+			free(*id);
+			n->id = s;
+			n->flags |= CONFIG_ARENA_ID;
+		} else {
+			n->id = *id;
+		}
 		*id = NULL;
 	}
 	n->type = type;
@@ -1146,125 +1594,407 @@ static int _snd_config_make(snd_config_t **config, char **id, snd_config_type_t
 	return 0;
 }
 
+/* set a copy of id to a new node, interned in the current arena */
+static int config_set_id_copy(snd_config_t *n, const char *id)
+{
+	struct config_arena *a = config_node_arena(n);
 
-static int _snd_config_make_add(snd_config_t **config, char **id,
-				snd_config_type_t type, snd_config_t *parent)
+	n->id = a ? config_arena_intern(a, id) : NULL;
+	if (n->id) {
+		n->flags |= CONFIG_ARENA_ID;
+		return 0;
+	}
+	n->id = strdup(id);
+	return n->id ? 0 : -ENOMEM;
+}
+
+/* make a node with a copy of id, interned in the current arena */
+static int config_make_copy_id(snd_config_t **config, const char *id,
+			       snd_config_type_t type)
 {
+	char *id1 = NULL;
 	snd_config_t *n;
 	int err;
-	assert(parent->type == SND_CONFIG_TYPE_COMPOUND);
-	err = _snd_config_make(&n, id, type);
+
+	err = _snd_config_make(&n, &id1, type);
 	if (err < 0)
 		return err;
-	n->parent = parent;
-	list_add_tail(&n->list, &parent->u.compound.fields);
+	if (id) {
+		err = config_set_id_copy(n, id);
+		if (err < 0) {
+			config_node_free(n);
+			return err;
+		}
+	}
 	*config = n;
 	return 0;
 }
 
-static int _snd_config_search(snd_config_t *config,
-			      const char *id, int len, snd_config_t **result)
+/*
+ * Check whether the node dst can reference the string of src interned
+ * with the given flag and return the flags to set in dst, zero when the
+ * string must be copied.
+ */
+static unsigned int config_share(snd_config_t *dst, const snd_config_t *src,
+				 unsigned int flag, unsigned int shared)
 {
-	snd_config_iterator_t i, next;
-	snd_config_for_each(i, next, config) {
-		snd_config_t *n = snd_config_iterator_entry(i);
-		if (len < 0) {
-			if (strcmp(n->id, id) != 0)
-				continue;
-		} else if (strlen(n->id) != (size_t) len ||
-			   memcmp(n->id, id, (size_t) len) != 0)
-				continue;
-		if (result)
-			*result = n;
+	struct config_arena *a = config_node_arena(dst), *owner;
+
+	if (!a || !(src->flags & flag))
 		return 0;
+	owner = (src->flags & shared) ? src->arena->base : src->arena;
+	if (owner == a)
+		return flag;
+	if (owner->base)
+		return 0;
+	if (!a->base) {
+		/* the live node src keeps the owner alive meanwhile */
+		__atomic_add_fetch(&owner->refs, 1, __ATOMIC_RELAXED);
+		a->base = owner;
 	}
-	return -ENOENT;
+	return a->base == owner ? flag | shared : 0;
 }
 
-static int parse_value(snd_config_t **_n, snd_config_t *parent, input_t *input, char **id, int skip)
+/* make a node with the id of src, shared with src when possible */
+static int config_make_shared_id(snd_config_t **config,
+				 const snd_config_t *src,
+				 snd_config_type_t type)
 {
-	snd_config_t *n = *_n;
-	char *s;
+	snd_config_t *n;
+	unsigned int flags;
 	int err;
 
-	err = get_string(&s, 0, input);
+	err = config_make_copy_id(&n, NULL, type);
 	if (err < 0)
 		return err;
-	if (skip) {
-		free(s);
-		return 0;
-	}
-	if (err == 0 && ((s[0] >= '0' && s[0] <= '9') || s[0] == '-')) {
-		long long i;
-		errno = 0;
-		err = safe_strtoll(s, &i);
-		if (err < 0) {
-			double r;
-			err = safe_strtod(s, &r);
-			if (err >= 0) {
-				free(s);
-				if (n) {
-					if (n->type != SND_CONFIG_TYPE_REAL) {
-						snd_error(CORE, "%s is not a real", *id);
-						return -EINVAL;
-					}
-				} else {
-					err = _snd_config_make_add(&n, id, SND_CONFIG_TYPE_REAL, parent);
-					if (err < 0)
-						return err;
-				}
-				n->u.real = r;
-				*_n = n;
-				return 0;
-			}
+	if (src->id) {
+		flags = config_share(n, src, CONFIG_ARENA_ID, CONFIG_SHARED_ID);
+		if (flags) {
+			n->id = src->id;
+			n->flags |= flags;
 		} else {
-			free(s);
-			if (n) {
-				if (n->type != SND_CONFIG_TYPE_INTEGER && n->type != SND_CONFIG_TYPE_INTEGER64) {
-					snd_error(CORE, "%s is not an integer", *id);
-					return -EINVAL;
-				}
-			} else {
-				if (i <= INT_MAX)
-					err = _snd_config_make_add(&n, id, SND_CONFIG_TYPE_INTEGER, parent);
-				else
-					err = _snd_config_make_add(&n, id, SND_CONFIG_TYPE_INTEGER64, parent);
-				if (err < 0)
-					return err;
+			err = config_set_id_copy(n, src->id);
+			if (err < 0) {
+				config_node_free(n);
+				return err;
 			}
-			if (n->type == SND_CONFIG_TYPE_INTEGER)
-				n->u.integer = (long) i;
-			else
-				n->u.integer64 = i;
-			*_n = n;
-			return 0;
-		}
-	}
-	if (n) {
-		if (n->type != SND_CONFIG_TYPE_STRING) {
-			snd_error(CORE, "%s is not a string", *id);
-			free(s);
-			return -EINVAL;
 		}
-	} else {
-		err = _snd_config_make_add(&n, id, SND_CONFIG_TYPE_STRING, parent);
-		if (err < 0)
-			return err;
 	}
-	free(n->u.string);
-	n->u.string = s;
-	*_n = n;
+	*config = n;
 	return 0;
 }
 
-static int parse_defs(snd_config_t *parent, input_t *input, int skip, int override);
-static int parse_array_defs(snd_config_t *farther, input_t *input, int skip, int override);
-
-static int parse_array_def(snd_config_t *parent, input_t *input, int *idx, int skip, int override)
+/* set the string value of src to dst, shared with src when possible */
+static int config_set_string_shared(snd_config_t *dst, const snd_config_t *src)
 {
-	char *id = NULL;
-	int c;
-	int err;
+	unsigned int flags;
+
+	flags = src->u.string ? config_share(dst, src, CONFIG_ARENA_STRING,
+					     CONFIG_SHARED_STRING) : 0;
+	if (!flags)
+		return config_set_string_copy(dst, src->u.string);
+	config_free_string(dst);
+	dst->u.string = src->u.string;
+	dst->flags |= flags;
+	return 0;
+}
+
+
+/*
+ * Index of the children ids of a large compound node.  The ordered list
+ * stays the primary storage; the index is an open addressing table with
+ * linear probing, built when a child is linked and the node has
+ * CONFIG_HASH_MIN children, and kept up to date by the functions linking
+ * and unlinking the children.  When the index cannot be allocated, it is
+ * dropped and the linear search is used until the next build at the
+ * doubled count.  The searches only read the index, so concurrent
+ * searches of a tree, e.g. of the global configuration, are safe.
+ */
+#define CONFIG_HASH_MIN		32
+
+struct config_hash_entry {
+	unsigned int hash;
+	snd_config_t *node;
+};
+
+struct config_hash {
+	unsigned int size;	/* power of two */
+	unsigned int count;
+	struct config_hash_entry entry[];
+};
+
+/* a change of a node of the global tree makes the memo entries stale */
+static void config_global_touch(const snd_config_t *config)
+{
+	while (config->parent)
+		config = config->parent;
+	if (config == snd_config)
+		__atomic_add_fetch(&config_global_gen, 1, __ATOMIC_RELAXED);
+}
+
+static void config_hash_free(snd_config_t *config)
+{
+	free(config->u.compound.hash);
+	config->u.compound.hash = NULL;
+}
+
+static void config_hash_insert(struct config_hash *h, unsigned int hash,
+			       snd_config_t *node)
+{
+	unsigned int mask = h->size - 1, k;
+
+	for (k = hash & mask; h->entry[k].node; k = (k + 1) & mask)
+		;
+	h->entry[k].hash = hash;
+	h->entry[k].node = node;
+	h->count++;
+}
+
+static struct config_hash *config_hash_alloc(unsigned int count)
+{
+	struct config_hash *h;
+	unsigned int size = 64;
+
+	while (size < count * 2)
+		size *= 2;
+	h = calloc(1, sizeof(*h) + size * sizeof(h->entry[0]));
+	if (h)
+		h->size = size;
+	return h;
+}
+
+static void config_hash_build(snd_config_t *config)
+{
+	snd_config_iterator_t i, next;
+	struct config_hash *h;
+	unsigned int count = 0;
+
+	snd_config_for_each(i, next, config) {
+		if (!snd_config_iterator_entry(i)->id)
+			return;
+		count++;
+	}
+	h = config_hash_alloc(count);
+	if (!h)
+		return;
+	snd_config_for_each(i, next, config) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		config_hash_insert(h, config_hash_id(n->id, strlen(n->id)), n);
+	}
+	config->u.compound.hash = h;
+}
+
+static void config_hash_add(snd_config_t *parent, snd_config_t *child)
+{
+	struct config_hash *h = parent->u.compound.hash;
+	struct config_hash *nh;
+	unsigned int count = ++parent->u.compound.count, k;
+
+	config_global_touch(parent);
+	if (!h) {
+		/* the child is linked already, so the build includes it */
+		if (count >= CONFIG_HASH_MIN && !(count & (count - 1)))
+			config_hash_build(parent);
+		return;
+	}
+	if (!child->id) {
+		config_hash_free(parent);
+		return;
+	}
+	if ((h->count + 1) * 2 > h->size) {
+		nh = config_hash_alloc(h->count + 1);
+		if (!nh) {
+			config_hash_free(parent);
+			return;
+		}
+		for (k = 0; k < h->size; k++)
+			if (h->entry[k].node)
+				config_hash_insert(nh, h->entry[k].hash,
+						   h->entry[k].node);
+		free(h);
+		parent->u.compound.hash = h = nh;
+	}
+	config_hash_insert(h, config_hash_id(child->id, strlen(child->id)), child);
+}
+
+static void config_hash_del(snd_config_t *parent, snd_config_t *child)
+{
+	struct config_hash *h = parent->u.compound.hash;
+	unsigned int mask, k, j, home;
+
+	parent->u.compound.count--;
+	config_global_touch(parent);
+	if (!h)
+		return;
+	mask = h->size - 1;
+	k = config_hash_id(child->id, strlen(child->id)) & mask;
+	while (h->entry[k].node != child) {
+		if (!h->entry[k].node)
+			return;
+		k = (k + 1) & mask;
+	}
+	/* shift back the following entries of the probe sequence */
+	for (j = (k + 1) & mask; h->entry[j].node; j = (j + 1) & mask) {
+		home = h->entry[j].hash & mask;
+		if (((j - home) & mask) < ((j - k) & mask))
+			continue;
+		h->entry[k] = h->entry[j];
+		k = j;
+	}
+	h->entry[k].node = NULL;
+	h->count--;
+}
+
+/* append a child to a compound node */
+static void config_link_tail(snd_config_t *parent, snd_config_t *child)
+{
+	child->parent = parent;
+	list_add_tail(&child->list, &parent->u.compound.fields);
+	config_hash_add(parent, child);
+}
+
+/* remove a child from the list of its parent */
+static void config_unlink(snd_config_t *config)
+{
+	config_hash_del(config->parent, config);
+	list_del(&config->list);
+}
+
+static int _snd_config_make_add(snd_config_t **config, char **id,
+				snd_config_type_t type, snd_config_t *parent)
+{
+	snd_config_t *n;
+	int err;
+	assert(parent->type == SND_CONFIG_TYPE_COMPOUND);
+	err = _snd_config_make(&n, id, type);
+	if (err < 0)
+		return err;
+	config_link_tail(parent, n);
+	*config = n;
+	return 0;
+}
+
+static int _snd_config_search(snd_config_t *config,
+			      const char *id, int len, snd_config_t **result)
+{
+	snd_config_iterator_t i, next;
+	struct config_hash *h = config->u.compound.hash;
+	unsigned int hash, mask, k;
+	size_t l;
+
+	if (!h) {
+		snd_config_for_each(i, next, config) {
+			snd_config_t *n = snd_config_iterator_entry(i);
+			if (len < 0) {
+				if (strcmp(n->id, id) != 0)
+					continue;
+			} else if (strlen(n->id) != (size_t) len ||
+				   memcmp(n->id, id, (size_t) len) != 0)
+					continue;
+			if (result)
+				*result = n;
+			return 0;
+		}
+		return -ENOENT;
+	}
+	l = len < 0 ? strlen(id) : (size_t) len;
+	hash = config_hash_id(id, l);
+	mask = h->size - 1;
+	for (k = hash & mask; h->entry[k].node; k = (k + 1) & mask) {
+		snd_config_t *n = h->entry[k].node;
+		if (h->entry[k].hash != hash ||
+		    strncmp(n->id, id, l) != 0 || n->id[l] != '\0')
+			continue;
+		if (result)
+			*result = n;
+		return 0;
+	}
+	return -ENOENT;
+}
+
+static int parse_value(snd_config_t **_n, snd_config_t *parent, input_t *input, char **id, int skip)
+{
+	snd_config_t *n = *_n;
+	char *s;
+	int err;
+
+	err = get_string(&s, 0, input);
+	if (err < 0)
+		return err;
+	if (skip) {
+		free(s);
+		return 0;
+	}
+	if (err == 0 && ((s[0] >= '0' && s[0] <= '9') || s[0] == '-')) {
+		long long i;
+		errno = 0;
+		err = safe_strtoll(s, &i);
+		if (err < 0) {
+			double r;
+			err = safe_strtod(s, &r);
+			if (err >= 0) {
+				free(s);
+				if (n) {
+					if (n->type != SND_CONFIG_TYPE_REAL) {
+						snd_error(CORE, "%s is not a real", *id);
+						return -EINVAL;
+					}
+				} else {
+					err = _snd_config_make_add(&n, id, SND_CONFIG_TYPE_REAL, parent);
+					if (err < 0)
+						return err;
+				}
+				n->u.real = r;
+				*_n = n;
+				return 0;
+			}
+		} else {
+			free(s);
+			if (n) {
+				if (n->type != SND_CONFIG_TYPE_INTEGER && n->type != SND_CONFIG_TYPE_INTEGER64) {
+					snd_error(CORE, "%s is not an integer", *id);
+					return -EINVAL;
+				}
+			} else {
+				if (i <= INT_MAX)
+					err = _snd_config_make_add(&n, id, SND_CONFIG_TYPE_INTEGER, parent);
+				else
+					err = _snd_config_make_add(&n, id, SND_CONFIG_TYPE_INTEGER64, parent);
+				if (err < 0)
+					return err;
+			}
+			if (n->type == SND_CONFIG_TYPE_INTEGER)
+				n->u.integer = (long) i;
+			else
+				n->u.integer64 = i;
+			*_n = n;
+			return 0;
+		}
+	}
+	if (n) {
+		if (n->type != SND_CONFIG_TYPE_STRING) {
+			snd_error(CORE, "%s is not a string", *id);
+			free(s);
+			return -EINVAL;
+		}
+	} else {
+		err = _snd_config_make_add(&n, id, SND_CONFIG_TYPE_STRING, parent);
+		if (err < 0)
+			return err;
+	}
+	config_set_string_owned(n, s);
+	*_n = n;
+	return 0;
+}
+
+static int parse_defs(snd_config_t *parent, input_t *input, int skip, int override);
+static int parse_array_defs(snd_config_t *farther, input_t *input, int skip, int override);
+
+static int parse_array_def(snd_config_t *parent, input_t *input, int *idx, int skip, int override)
+{
+	char *id = NULL;
+	int c;
+	int err;
 	snd_config_t *n = NULL;
 
 	if (!skip) {
@@ -1737,12 +2467,36 @@ static int _snd_config_save_children(snd_config_t *config, snd_output_t *out,
  */
 int snd_config_substitute(snd_config_t *dst, snd_config_t *src)
 {
+	char *id = src->id, *str = NULL;
+	unsigned int flags = src->flags;
+
 	assert(dst && src && src != dst);
+	if (src->type == SND_CONFIG_TYPE_STRING)
+		str = src->u.string;
+	/* the strings interned in another arena must not outlive src */
+	if (flags && src->arena != dst->arena) {
+		if (flags & CONFIG_ARENA_ID) {
+			id = strdup(src->id);
+			if (!id)
+				return -ENOMEM;
+		}
+		if ((flags & CONFIG_ARENA_STRING) && str) {
+			str = strdup(str);
+			if (!str) {
+				if (flags & CONFIG_ARENA_ID)
+					free(id);
+				return -ENOMEM;
+			}
+		}
+		flags = 0;
+	}
 	if (dst->type == SND_CONFIG_TYPE_COMPOUND) {
 		int err = snd_config_delete_compound_members(dst);
 		if (err < 0)
 			return err;
 	}
+	if (dst->parent)	/* the id changes */
+		config_hash_del(dst->parent, dst);
 	if (dst->type == SND_CONFIG_TYPE_COMPOUND &&
 	    src->type == SND_CONFIG_TYPE_COMPOUND) {	/* overwrite */
 		snd_config_iterator_t i, next;
@@ -1753,15 +2507,20 @@ int snd_config_substitute(snd_config_t *dst, snd_config_t *src)
 		src->u.compound.fields.next->prev = &dst->u.compound.fields;
 		src->u.compound.fields.prev->next = &dst->u.compound.fields;
 	}
-	free(dst->id);
+	config_free_id(dst);
 	if (dst->type == SND_CONFIG_TYPE_STRING)
-		free(dst->u.string);
+		config_free_string(dst);
 	if (src->parent)	/* like snd_config_remove */
-		list_del(&src->list);
-	dst->id = src->id;
+		config_unlink(src);
+	dst->id = id;
 	dst->type = src->type;
 	dst->u = src->u;
-	free(src);
+	if (src->type == SND_CONFIG_TYPE_STRING)
+		dst->u.string = str;
+	dst->flags = flags;
+	if (dst->parent)
+		config_hash_add(dst->parent, dst);
+	config_node_free(src);
 	return 0;
 }
 
@@ -1917,17 +2676,14 @@ int snd_config_get_id(const snd_config_t *config, const char **id)
  */
 int snd_config_set_id(snd_config_t *config, const char *id)
 {
-	snd_config_iterator_t i, next;
+	snd_config_t *n;
 	char *new_id;
 	assert(config);
 	if (id) {
-		if (config->parent) {
-			snd_config_for_each(i, next, config->parent) {
-				snd_config_t *n = snd_config_iterator_entry(i);
-				if (n != config && strcmp(id, n->id) == 0)
-					return -EEXIST;
-			}
-		}
+		if (config->parent &&
+		    _snd_config_search(config->parent, id, -1, &n) == 0 &&
+		    n != config)
+			return -EEXIST;
 		new_id = strdup(id);
 		if (!new_id)
 			return -ENOMEM;
@@ -1936,8 +2692,12 @@ int snd_config_set_id(snd_config_t *config, const char *id)
 			return -EINVAL;
 		new_id = NULL;
 	}
-	free(config->id);
+	if (config->parent)
+		config_hash_del(config->parent, config);
+	config_free_id(config);
 	config->id = new_id;
+	if (config->parent)
+		config_hash_add(config->parent, config);
 	return 0;
 }
 
@@ -1977,6 +2737,7 @@ int _snd_config_load_with_include(snd_config_t *config, snd_input_t *in,
 		return -ENOMEM;
 	fd->name = NULL;
 	fd->in = in;
+	fd->ptr = fd->end = NULL;
 	fd->line = 1;
 	fd->column = 0;
 	fd->next = NULL;
@@ -2151,17 +2912,12 @@ int snd_config_load_override(snd_config_t *config, snd_input_t *in)
  */
 int snd_config_add(snd_config_t *parent, snd_config_t *child)
 {
-	snd_config_iterator_t i, next;
 	assert(parent && child);
 	if (!child->id || child->parent)
 		return -EINVAL;
-	snd_config_for_each(i, next, parent) {
-		snd_config_t *n = snd_config_iterator_entry(i);
-		if (strcmp(child->id, n->id) == 0)
-			return -EEXIST;
-	}
-	child->parent = parent;
-	list_add_tail(&child->list, &parent->u.compound.fields);
+	if (_snd_config_search(parent, child->id, -1, NULL) == 0)
+		return -EEXIST;
+	config_link_tail(parent, child);
 	return 0;
 }
 
@@ -2189,20 +2945,17 @@ int snd_config_add(snd_config_t *parent, snd_config_t *child)
  */
 int snd_config_add_after(snd_config_t *after, snd_config_t *child)
 {
-	snd_config_iterator_t i, next;
 	snd_config_t *parent;
 	assert(after && child);
 	parent = after->parent;
 	assert(parent);
 	if (!child->id || child->parent)
 		return -EINVAL;
-	snd_config_for_each(i, next, parent) {
-		snd_config_t *n = snd_config_iterator_entry(i);
-		if (strcmp(child->id, n->id) == 0)
-			return -EEXIST;
-	}
+	if (_snd_config_search(parent, child->id, -1, NULL) == 0)
+		return -EEXIST;
 	child->parent = parent;
 	list_insert(&child->list, &after->list, after->list.next);
+	config_hash_add(parent, child);
 	return 0;
 }
 
@@ -2230,20 +2983,17 @@ int snd_config_add_after(snd_config_t *after, snd_config_t *child)
  */
 int snd_config_add_before(snd_config_t *before, snd_config_t *child)
 {
-	snd_config_iterator_t i, next;
 	snd_config_t *parent;
 	assert(before && child);
 	parent = before->parent;
 	assert(parent);
 	if (!child->id || child->parent)
 		return -EINVAL;
-	snd_config_for_each(i, next, parent) {
-		snd_config_t *n = snd_config_iterator_entry(i);
-		if (strcmp(child->id, n->id) == 0)
-			return -EEXIST;
-	}
+	if (_snd_config_search(parent, child->id, -1, NULL) == 0)
+		return -EEXIST;
 	child->parent = parent;
 	list_insert(&child->list, before->list.prev, &before->list);
+	config_hash_add(parent, child);
 	return 0;
 }
 
@@ -2265,8 +3015,7 @@ static int _snd_config_array_merge(snd_config_t *dst, snd_config_t *src, int ind
 			snd_config_delete(sn);
 			return err;
 		}
-		sn->parent = dst;
-		list_add_tail(&sn->list, &dst->u.compound.fields);
+		config_link_tail(dst, sn);
 	}
 	snd_config_delete(src);
 	return 0;
@@ -2299,8 +3048,8 @@ static int _snd_config_array_merge(snd_config_t *dst, snd_config_t *src, int ind
  */
 int snd_config_merge(snd_config_t *dst, snd_config_t *src, int override)
 {
-	snd_config_iterator_t di, si, dnext, snext;
-	bool found;
+	snd_config_iterator_t si, snext;
+	snd_config_t *dn;
 	int err, array;
 
 	assert(dst);
@@ -2313,30 +3062,22 @@ int snd_config_merge(snd_config_t *dst, snd_config_t *src, int override)
 		return _snd_config_array_merge(dst, src, array);
 	snd_config_for_each(si, snext, src) {
 		snd_config_t *sn = snd_config_iterator_entry(si);
-		found = false;
-		snd_config_for_each(di, dnext, dst) {
-			snd_config_t *dn = snd_config_iterator_entry(di);
-			if (strcmp(sn->id, dn->id) == 0) {
-				if (override ||
-				    sn->type != SND_CONFIG_TYPE_COMPOUND ||
-				    dn->type != SND_CONFIG_TYPE_COMPOUND) {
-					err = snd_config_substitute(dn, sn);
-					if (err < 0)
-						return err;
-				} else {
-					err = snd_config_merge(dn, sn, 0);
-					if (err < 0)
-						return err;
-				}
-				found = true;
-				break;
+		if (_snd_config_search(dst, sn->id, -1, &dn) == 0) {
+			if (override ||
+			    sn->type != SND_CONFIG_TYPE_COMPOUND ||
+			    dn->type != SND_CONFIG_TYPE_COMPOUND) {
+				err = snd_config_substitute(dn, sn);
+				if (err < 0)
+					return err;
+			} else {
+				err = snd_config_merge(dn, sn, 0);
+				if (err < 0)
+					return err;
 			}
-		}
-		if (!found) {
+		} else {
 			/* move config from src to dst */
 			snd_config_remove(sn);
-			sn->parent = dst;
-			list_add_tail(&sn->list, &dst->u.compound.fields);
+			config_link_tail(dst, sn);
 		}
 	}
 	snd_config_delete(src);
@@ -2360,7 +3101,7 @@ int snd_config_remove(snd_config_t *config)
 {
 	assert(config);
 	if (config->parent)
-		list_del(&config->list);
+		config_unlink(config);
 	config->parent = NULL;
 	return 0;
 }
@@ -2399,6 +3140,7 @@ int snd_config_delete(snd_config_t *config)
 	{
 		int err;
 		struct list_head *i;
+		config_hash_free(config);
 		i = config->u.compound.fields.next;
 		while (i != &config->u.compound.fields) {
 			struct list_head *nexti = i->next;
@@ -2411,15 +3153,15 @@ int snd_config_delete(snd_config_t *config)
 		break;
 	}
 	case SND_CONFIG_TYPE_STRING:
-		free(config->u.string);
+		config_free_string(config);
 		break;
 	default:
 		break;
 	}
 	if (config->parent)
-		list_del(&config->list);
-	free(config->id);
-	free(config);
+		config_unlink(config);
+	config_free_id(config);
+	config_node_free(config);
 	return 0;
 }
 
@@ -2449,6 +3191,7 @@ int snd_config_delete_compound_members(const snd_config_t *config)
 	assert(config);
 	if (config->type != SND_CONFIG_TYPE_COMPOUND)
 		return -EINVAL;
+	config_hash_free((snd_config_t *)config);
 	i = config->u.compound.fields.next;
 	while (i != &config->u.compound.fields) {
 		struct list_head *nexti = i->next;
@@ -2483,15 +3226,8 @@ int snd_config_delete_compound_members(const snd_config_t *config)
 int snd_config_make(snd_config_t **config, const char *id,
 		    snd_config_type_t type)
 {
-	char *id1;
 	assert(config);
-	if (id) {
-		id1 = strdup(id);
-		if (!id1)
-			return -ENOMEM;
-	} else
-		id1 = NULL;
-	return _snd_config_make(config, &id1, type);
+	return config_make_copy_id(config, id, type);
 }
 
 /**
@@ -2873,14 +3609,10 @@ int snd_config_imake_string(snd_config_t **config, const char *id, const char *v
 	err = snd_config_make(&tmp, id, SND_CONFIG_TYPE_STRING);
 	if (err < 0)
 		return err;
-	if (value) {
-		tmp->u.string = strdup(value);
-		if (!tmp->u.string) {
-			snd_config_delete(tmp);
-			return -ENOMEM;
-		}
-	} else {
-		tmp->u.string = NULL;
+	err = config_set_string_copy(tmp, value);
+	if (err < 0) {
+		snd_config_delete(tmp);
+		return err;
 	}
 	*config = tmp;
 	return 0;
@@ -2985,6 +3717,7 @@ int snd_config_set_integer(snd_config_t *config, long value)
 	if (config->type != SND_CONFIG_TYPE_INTEGER)
 		return -EINVAL;
 	config->u.integer = value;
+	config_global_touch(config);
 	return 0;
 }
 
@@ -3008,6 +3741,7 @@ int snd_config_set_integer64(snd_config_t *config, long long value)
 	if (config->type != SND_CONFIG_TYPE_INTEGER64)
 		return -EINVAL;
 	config->u.integer64 = value;
+	config_global_touch(config);
 	return 0;
 }
 
@@ -3028,6 +3762,7 @@ int snd_config_set_real(snd_config_t *config, double value)
 	if (config->type != SND_CONFIG_TYPE_REAL)
 		return -EINVAL;
 	config->u.real = value;
+	config_global_touch(config);
 	return 0;
 }
 
@@ -3050,20 +3785,11 @@ int snd_config_set_real(snd_config_t *config, double value)
  */
 int snd_config_set_string(snd_config_t *config, const char *value)
 {
-	char *new_string;
 	assert(config);
 	if (config->type != SND_CONFIG_TYPE_STRING)
 		return -EINVAL;
-	if (value) {
-		new_string = strdup(value);
-		if (!new_string)
-			return -ENOMEM;
-	} else {
-		new_string = NULL;
-	}
-	free(config->u.string);
-	config->u.string = new_string;
-	return 0;
+	config_global_touch(config);
+	return config_set_string_copy(config, value);
 }
 
 /**
@@ -3085,6 +3811,7 @@ int snd_config_set_pointer(snd_config_t *config, const void *value)
 	if (config->type != SND_CONFIG_TYPE_POINTER)
 		return -EINVAL;
 	config->u.ptr = value;
+	config_global_touch(config);
 	return 0;
 }
 
@@ -3116,6 +3843,7 @@ int snd_config_set_pointer(snd_config_t *config, const void *value)
 int snd_config_set_ascii(snd_config_t *config, const char *ascii)
 {
 	assert(config && ascii);
+	config_global_touch(config);
 	switch (config->type) {
 	case SND_CONFIG_TYPE_INTEGER:
 		{
@@ -3149,7 +3877,7 @@ int snd_config_set_ascii(snd_config_t *config, const char *ascii)
 			char *ptr = strdup(ascii);
 			if (ptr == NULL)
 				return -ENOMEM;
-			free(config->u.string);
+			config_free_string(config);
 			config->u.string = ptr;
 		}
 		break;
@@ -3443,16 +4171,136 @@ int snd_config_save(snd_config_t *config, snd_output_t *out)
 	}
 }
 
-/*
- *  *** search macros ***
- */
-
 #ifndef DOC_HIDDEN
+#define CONFIG_MEMORY_ARENAS	16
+
+struct config_memory {
+	unsigned int nodes;
+	unsigned int arena_nodes;
+	unsigned int interned;		/* ids and strings owned by arenas */
+	unsigned int shared;		/* owned by the base arenas */
+	size_t heap;			/* separately allocated nodes and strings */
+	size_t index;			/* compound id indexes */
+	unsigned int arenas;
+	unsigned int arenas_other;	/* not listed */
+	const struct config_arena *arena[CONFIG_MEMORY_ARENAS];
+};
 
-#define SND_CONFIG_SEARCH(config, key, result, extra_code) \
-{ \
-	snd_config_t *n; \
-	int err; \
+static void config_memory_walk(const snd_config_t *config,
+			       struct config_memory *mem)
+{
+	snd_config_iterator_t i, next;
+	unsigned int k;
+
+	mem->nodes++;
+	if (config->arena) {
+		mem->arena_nodes++;
+		for (k = 0; k < mem->arenas; k++)
+			if (mem->arena[k] == config->arena)
+				break;
+		if (k == mem->arenas) {
+			if (k < CONFIG_MEMORY_ARENAS)
+				mem->arena[mem->arenas++] = config->arena;
+			else
+				mem->arenas_other++;
+		}
+	} else {
+		mem->heap += sizeof(*config);
+	}
+	if (config->id) {
+		if (config->flags & CONFIG_ARENA_ID) {
+			mem->interned++;
+			if (config->flags & CONFIG_SHARED_ID)
+				mem->shared++;
+		} else {
+			mem->heap += strlen(config->id) + 1;
+		}
+	}
+	switch (config->type) {
+	case SND_CONFIG_TYPE_STRING:
+		if (!config->u.string)
+			break;
+		if (config->flags & CONFIG_ARENA_STRING) {
+			mem->interned++;
+			if (config->flags & CONFIG_SHARED_STRING)
+				mem->shared++;
+		} else {
+			mem->heap += strlen(config->u.string) + 1;
+		}
+		break;
+	case SND_CONFIG_TYPE_COMPOUND:
+		if (config->u.compound.hash)
+			mem->index += sizeof(struct config_hash) +
+				config->u.compound.hash->size *
+				sizeof(struct config_hash_entry);
+		snd_config_for_each(i, next, config)
+			config_memory_walk(snd_config_iterator_entry(i), mem);
+		break;
+	default:
+		break;
+	}
+}
+#endif /* DOC_HIDDEN */
+
+/**
+ * \brief Dumps the memory usage of a configuration tree.
+ * \param config Handle to the (root) configuration node.
+ * \param out Output handle.
+ * \return Zero if successful, otherwise a negative error code.
+ *
+ * This function writes the count of the nodes, the memory allocated
+ * separately for the nodes and their strings, and the usage of the
+ * arenas the nodes were carved from to the output \a out.  The arenas
+ * are used by the global configuration parsing, #snd_config_copy and
+ * #snd_config_expand unless the environment variable
+ * \c LIBASOUND_CONFIG_ARENA is set to 0.  The copies share the unchanged
+ * strings with the source tree; these are counted as shared.
+ *
+ * This function is intended for debugging.
+ */
+int snd_config_memory_dump(const snd_config_t *config, snd_output_t *out)
+{
+	struct config_memory mem;
+	unsigned int k;
+
+	assert(config && out);
+	memset(&mem, 0, sizeof(mem));
+	config_memory_walk(config, &mem);
+	snd_output_printf(out, "nodes: %u (%u in arenas)\n",
+			  mem.nodes, mem.arena_nodes);
+	snd_output_printf(out, "interned strings: %u (%u shared)\n",
+			  mem.interned, mem.shared);
+	snd_output_printf(out, "heap: %zu bytes\n", mem.heap);
+	snd_output_printf(out, "index: %zu bytes\n", mem.index);
+	for (k = 0; k < mem.arenas; k++) {
+		const struct config_arena *a = mem.arena[k];
+		snd_output_printf(out, "arena %u: %zu/%zu bytes used, "
+				  "%u nodes carved, %u references, "
+				  "%u strings\n", k, a->used, a->allocated,
+				  a->nodes,
+				  __atomic_load_n(&a->refs, __ATOMIC_RELAXED),
+				  a->strings);
+		if (a->base)
+			snd_output_printf(out, "arena %u: shares the strings "
+					  "of another arena (%u references)\n", k,
+					  __atomic_load_n(&a->base->refs,
+							  __ATOMIC_RELAXED));
+	}
+	if (mem.arenas_other)
+		snd_output_printf(out, "other arenas: %u\n", mem.arenas_other);
+	return 0;
+}
+
+/*
+ *  *** search macros ***
+ */
+
+#ifndef DOC_HIDDEN
+
+#define SND_CONFIG_SEARCH(config, key, result, extra_code) \
+{ \
+	snd_config_t *n; \
+	int err; \
 	const char *p; \
 	assert(config && key); \
 	while (1) { \
@@ -3961,6 +4809,8 @@ struct finfo {
 struct _snd_config_update {
 	unsigned int count;
 	struct finfo *finfo;
+	char *configs;			/* watched file list, NULL if unwatched */
+	unsigned int generation;	/* of the watcher when last checked */
 };
 #endif /* DOC_HIDDEN */
 
@@ -3987,6 +4837,9 @@ static int snd_config_hooks_call(snd_config_t *root, snd_config_t *config, snd_c
 		return err;
 	}
 	assert(str);
+	/* only the file loading is known to depend on recorded inputs */
+	if (strcmp(str, "load"))
+		config_dep_uncacheable();
 	err = snd_config_search_definition(root, "hook_func", str, &func_conf);
 	if (err >= 0) {
 		snd_config_iterator_t i, next;
@@ -4019,6 +4872,9 @@ static int snd_config_hooks_call(snd_config_t *root, snd_config_t *config, snd_c
 			snd_error(CORE, "Unknown field %s", id);
 		}
 	}
+	/* a redefined function may come from any library */
+	if (lib)
+		config_dep_uncacheable();
 	if (!func_name) {
 		int len = 16 + strlen(str) + 1;
 		buf = malloc(len);
@@ -4093,6 +4949,8 @@ static int snd_config_hooks(snd_config_t *config, snd_config_t *private_data)
 	err = 0;
        _err:
 	snd_config_delete(n);
+	/* the hooks may have replaced the remembered definitions */
+	config_memo_flush();
 	snd_config_unlock();
 	return err;
 }
@@ -4121,6 +4979,7 @@ static int config_file_open(snd_config_t *root, const char *filename, int merge)
 	snd_input_t *in;
 	int err;
 
+	config_dep_path(filename);
 	err = snd_input_stdio_open(&in, filename, "r");
 	if (err >= 0) {
 		if (merge)
@@ -4142,6 +5001,8 @@ static int config_file_load(snd_config_t *root, const char *fn, int errors, int
 	struct dirent64 **namelist;
 	int err, n;
 
+	/* a directory is recorded too, its mtime follows the entries */
+	config_dep_path(fn);
 	if (!errors && access(fn, R_OK) < 0)
 		return 1;
 	if (stat64(fn, &st) < 0) {
@@ -4192,6 +5053,9 @@ static int config_file_load_user(snd_config_t *root, const char *fn, int errors,
 	char *fn2;
 	int err;
 
+	/* the shell expansion may depend on any variable */
+	if (strpbrk(fn, "$`"))
+		config_dep_uncacheable();
 	err = snd_user_file(fn, &fn2);
 	if (err < 0)
 		return config_file_load(root, fn, errors, merge);
@@ -4411,6 +5275,86 @@ static int _snd_config_hook_table(snd_config_t *root, snd_config_t *config, snd_
 	return 0;
 }
 
+/* the lazy field of the hook or LIBASOUND_CONFIG_LAZY_CARDS if it is absent */
+static int config_hook_lazy_cards(snd_config_t *config)
+{
+	snd_config_t *n;
+	const char *env;
+	int lazy;
+
+	if (snd_config_search(config, "lazy", &n) >= 0) {
+		lazy = snd_config_get_bool(n);
+		if (lazy < 0)
+			snd_error(CORE, "Invalid bool value in field lazy");
+		return lazy;
+	}
+	env = getenv("LIBASOUND_CONFIG_LAZY_CARDS");
+	return env && *env && *env != '0';
+}
+
+/* leave a load_card hook for the card in the node of its driver */
+static int config_hook_defer_card(snd_config_t *root, snd_config_t *config,
+				  int card, const char *driver)
+{
+	snd_config_iterator_t i, next;
+	snd_config_t *n, *hooks, *hook, *c;
+	char id[16];
+	int err, idx = 0;
+
+	if (_snd_config_search(root, driver, -1, &n) < 0) {
+		err = snd_config_make_compound(&n, driver, 0);
+		if (err < 0)
+			return err;
+		err = snd_config_add(root, n);
+		if (err < 0) {
+			snd_config_delete(n);
+			return err;
+		}
+	}
+	if (_snd_config_search(n, "@hooks", -1, &hooks) < 0) {
+		err = snd_config_make_compound(&hooks, "@hooks", 0);
+		if (err < 0)
+			return err;
+		err = snd_config_add(n, hooks);
+		if (err < 0) {
+			snd_config_delete(hooks);
+			return err;
+		}
+	}
+	snd_config_for_each(i, next, hooks)
+		idx++;
+	err = snd_config_copy(&hook, config);
+	if (err < 0)
+		return err;
+	snprintf(id, sizeof(id), "%d", idx);
+	err = snd_config_set_id(hook, id);
+	if (err < 0)
+		goto _err;
+	if (_snd_config_search(hook, "table", -1, &c) >= 0)
+		snd_config_delete(c);
+	if (_snd_config_search(hook, "lazy", -1, &c) >= 0)
+		snd_config_delete(c);
+	if (_snd_config_search(hook, "func", -1, &c) >= 0) {
+		err = snd_config_set_string(c, "load_card");
+		if (err < 0)
+			goto _err;
+	}
+	err = snd_config_imake_integer(&c, "card", card);
+	if (err < 0)
+		goto _err;
+	err = snd_config_add(hook, c);
+	if (err < 0) {
+		snd_config_delete(c);
+		goto _err;
+	}
+	err = snd_config_add(hooks, hook);
+	if (err >= 0)
+		return 0;
+       _err:
+	snd_config_delete(hook);
+	return err;
+}
+
 /**
  * \brief Loads and parses the given configurations files for each
  *        installed sound card.
@@ -4425,11 +5369,20 @@ static int _snd_config_hook_table(snd_config_t *root, snd_config_t *config, snd_
  * This function works like #snd_config_hook_load, but the files are
  * loaded once for each sound card.  The driver name is available with
  * the \c private_string function to customize the file name.
+ *
+ * In the lazy mode (see \ref confhooks_ref), only the table entries
+ * are created here. The files of each card are loaded by
+ * #snd_config_hook_load_card when a search passes through the node
+ * of its driver for the first time, so a process which uses one card
+ * does not parse the configuration of the others.
  */
 int snd_config_hook_load_for_all_cards(snd_config_t *root, snd_config_t *config, snd_config_t **dst, snd_config_t *private_data ATTRIBUTE_UNUSED)
 {
-	int card = -1, err;
+	int card = -1, err, lazy;
 
+	lazy = config_hook_lazy_cards(config);
+	if (lazy < 0)
+		return lazy;
 	do {
 		err = snd_card_next(&card);
 		if (err < 0)
@@ -4470,7 +5423,10 @@ int snd_config_hook_load_for_all_cards(snd_config_t *root, snd_config_t *config,
 			err = _snd_config_hook_table(root, config, private_data);
 			if (err < 0)
 				goto __err;
-			err = snd_config_hook_load(root, config, &n, private_data);
+			if (lazy)
+				err = config_hook_defer_card(root, config, card, driver);
+			else
+				err = snd_config_hook_load(root, config, &n, private_data);
 		      __err:
 			if (private_data)
 				snd_config_delete(private_data);
@@ -4482,46 +5438,955 @@ int snd_config_hook_load_for_all_cards(snd_config_t *root, snd_config_t *config,
 	*dst = NULL;
 	return 0;
 }
-#ifndef DOC_HIDDEN
-SND_DLSYM_BUILD_VERSION(snd_config_hook_load_for_all_cards, SND_CONFIG_DLSYM_VERSION_HOOK);
-#endif
+#ifndef DOC_HIDDEN
+SND_DLSYM_BUILD_VERSION(snd_config_hook_load_for_all_cards, SND_CONFIG_DLSYM_VERSION_HOOK);
+#endif
+
+/**
+ * \brief Loads and parses the configuration files of one sound card.
+ * \param[in] root Handle to the configuration node of the card driver.
+ * \param[in] config Handle to the configuration node for this hook.
+ * \param[out] dst The function puts the handle to the configuration
+ *                 node loaded from the file(s) at the address specified
+ *                 by \a dst.
+ * \param[in] private_data Handle to the private data configuration node.
+ * \return Zero if successful, otherwise a negative error code.
+ *
+ * This hook is left by #snd_config_hook_load_for_all_cards in the lazy
+ * mode. The \c card field holds the card number, the driver name is
+ * the id of \a root. The files are loaded to the parent of \a root
+ * like #snd_config_hook_load_for_all_cards would do, and the loaded
+ * definitions of the driver are moved to \a root.
+ */
+int snd_config_hook_load_card(snd_config_t *root, snd_config_t *config, snd_config_t **dst, snd_config_t *private_data ATTRIBUTE_UNUSED)
+{
+	snd_config_t *parent = root->parent, *n, *pdata;
+	long card;
+	int err;
+
+	assert(root && dst);
+	if (!parent) {
+		snd_error(CORE, "Card hook %s has no parent", root->id);
+		return -EINVAL;
+	}
+	if (_snd_config_search(config, "card", -1, &n) < 0 ||
+	    snd_config_get_integer(n, &card) < 0) {
+		snd_error(CORE, "Unable to find field card");
+		return -EINVAL;
+	}
+	pdata = _snd_config_hook_private_data(card, root->id);
+	if (!pdata)
+		return -ENOMEM;
+	/* the files are loaded in the override mode which would delete root */
+	snd_config_remove(root);
+	err = snd_config_hook_load(parent, config, &n, pdata);
+	snd_config_delete(pdata);
+	if (_snd_config_search(parent, root->id, -1, &n) >= 0) {
+		if (err >= 0 && snd_config_get_type(n) == SND_CONFIG_TYPE_COMPOUND) {
+			err = snd_config_substitute(root, n);
+			if (err < 0)
+				snd_config_delete(n);
+		} else {
+			snd_config_delete(n);
+		}
+	}
+	snd_config_add(parent, root);
+	*dst = NULL;
+	return err;
+}
+#ifndef DOC_HIDDEN
+SND_DLSYM_BUILD_VERSION(snd_config_hook_load_card, SND_CONFIG_DLSYM_VERSION_HOOK);
+#endif
+
+#ifndef DOC_HIDDEN
+
+/* The name of the environment variable with the binary cache file path */
+#define ALSA_CONFIG_CACHE_VAR "ALSA_CONFIG_CACHE"
+
+#define CONFIG_CACHE_MAGIC	"ALSACFGC"
+#define CONFIG_CACHE_VERSION	1
+#define CONFIG_CACHE_ENDIAN	0x01020304
+#define CONFIG_CACHE_SIZES	(sizeof(long) | (sizeof(long long) << 8) | \
+				 (sizeof(double) << 16))
+#define CONFIG_CACHE_NONE	0xffffffffU
+#define CONFIG_CACHE_MAX_DEPTH	256
+
+enum {
+	CONFIG_DEP_FILE,	/* existing file or directory */
+	CONFIG_DEP_ABSENT,	/* file which did not exist */
+	CONFIG_DEP_ENV,		/* environment variable */
+};
+
+struct config_dep {
+	unsigned int type;
+	char *name;
+	char *value;		/* CONFIG_DEP_ENV, NULL if unset */
+	struct stat64 st;	/* CONFIG_DEP_FILE */
+};
+
+struct config_deps {
+	unsigned int count;
+	unsigned int alloc;
+	struct config_dep *dep;
+	int uncacheable;
+	int cards;		/* depends on the sound card state */
+};
+
+/* on-disk layout: header, dependencies, nodes in preorder, strings */
+struct config_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint32_t sizes;
+	uint32_t ndeps;
+	uint32_t nnodes;
+	uint32_t configs;	/* string offset of the file list */
+	uint64_t deps_offset;
+	uint64_t nodes_offset;
+	uint64_t strings_offset;
+	uint64_t size;
+};
+
+struct config_cache_dep {
+	uint32_t type;
+	uint32_t name;
+	uint32_t value;
+	uint32_t reserved;
+	uint64_t dev;
+	uint64_t ino;
+	int64_t sec;
+	int64_t nsec;
+	int64_t size;
+};
+
+struct config_cache_node {
+	uint32_t type;
+	uint32_t join;
+	uint32_t id;
+	uint32_t children;
+	union {
+		int64_t integer;	/* also the string offset */
+		double real;
+	} u;
+};
+
+struct config_cache_buf {
+	char *data;
+	size_t len;
+	size_t alloc;
+};
+
+static void config_deps_free(struct config_deps *deps)
+{
+	unsigned int k;
+
+	if (!deps)
+		return;
+	for (k = 0; k < deps->count; k++) {
+		free(deps->dep[k].name);
+		free(deps->dep[k].value);
+	}
+	free(deps->dep);
+	free(deps);
+}
+
+static struct config_dep *config_dep_add(unsigned int type, const char *name)
+{
+	struct config_deps *deps = config_deps;
+	struct config_dep *dep;
+	unsigned int k;
+
+	for (k = 0; k < deps->count; k++) {
+		dep = &deps->dep[k];
+		if ((dep->type == CONFIG_DEP_ENV) == (type == CONFIG_DEP_ENV) &&
+		    strcmp(dep->name, name) == 0)
+			return NULL;
+	}
+	if (deps->count == deps->alloc) {
+		unsigned int alloc = deps->alloc ? deps->alloc * 2 : 32;
+		dep = realloc(deps->dep, alloc * sizeof(*dep));
+		if (!dep) {
+			deps->uncacheable = 1;
+			return NULL;
+		}
+		deps->dep = dep;
+		deps->alloc = alloc;
+	}
+	dep = &deps->dep[deps->count];
+	memset(dep, 0, sizeof(*dep));
+	dep->type = type;
+	dep->name = strdup(name);
+	if (!dep->name) {
+		deps->uncacheable = 1;
+		return NULL;
+	}
+	deps->count++;
+	return dep;
+}
+
+/* record a file, directory or a missing path the tree depends on */
+static void config_dep_path(const char *name)
+{
+	struct config_dep *dep;
+
+	if (!config_deps || config_deps->uncacheable)
+		return;
+	dep = config_dep_add(CONFIG_DEP_FILE, name);
+	if (!dep)
+		return;
+	if (stat64(name, &dep->st) < 0) {
+		if (errno != ENOENT && errno != ENOTDIR)
+			config_deps->uncacheable = 1;
+		dep->type = CONFIG_DEP_ABSENT;
+	}
+}
+
+static void config_dep_env(const char *name)
+{
+	struct config_dep *dep;
+	const char *value;
+
+	if (!config_deps || config_deps->uncacheable)
+		return;
+	dep = config_dep_add(CONFIG_DEP_ENV, name);
+	if (!dep)
+		return;
+	value = getenv(name);
+	if (value) {
+		dep->value = strdup(value);
+		if (!dep->value)
+			config_deps->uncacheable = 1;
+	}
+}
+
+/* the rebuilt tree depends on something which cannot be recorded */
+static void config_dep_uncacheable(void)
+{
+	if (config_deps)
+		config_deps->uncacheable = 1;
+}
+
+/* configuration functions whose result depends only on recorded inputs */
+static int config_dep_pure_func(const char *name)
+{
+	static const char *const pure[] = {
+		"concat", "iadd", "imul", "datadir", "getenv", "igetenv",
+		"private_string", "private_integer",
+	};
+	unsigned int k;
+
+	for (k = 0; k < ARRAY_SIZE(pure); k++)
+		if (strcmp(name, pure[k]) == 0)
+			return 1;
+	return 0;
+}
+
+/* configuration functions whose result depends on the sound card state */
+static int config_dep_card_func(const char *name)
+{
+	static const char *const card[] = {
+		"card_inum", "card_driver", "card_id", "card_name",
+		"pcm_id", "pcm_args_by_class",
+	};
+	unsigned int k;
+
+	for (k = 0; k < ARRAY_SIZE(card); k++)
+		if (strcmp(name, card[k]) == 0)
+			return 1;
+	return 0;
+}
+
+/*
+ * The card state is recorded as the device directory, which is changed
+ * when a card is added or removed.  The binary cache does not store the
+ * trees depending on it.
+ */
+static void config_dep_cards(void)
+{
+	if (!config_deps || config_deps->uncacheable)
+		return;
+	config_deps->cards = 1;
+	config_dep_path(ALSA_DEVICE_DIRECTORY);
+}
+
+/* record the inputs of a configuration function call */
+static void config_dep_func(const char *name, snd_config_t *src)
+{
+	snd_config_t *file;
+
+	if (config_dep_card_func(name))
+		config_dep_cards();
+	else if (strcmp(name, "refer") == 0) {
+		/* the referred file is loaded into the searched tree */
+		if (snd_config_search(src, "file", &file) >= 0)
+			config_dep_uncacheable();
+	} else if (!config_dep_pure_func(name))
+		config_dep_uncacheable();
+}
+
+/* check that none of the recorded inputs changed */
+static int config_deps_valid(const struct config_deps *deps)
+{
+	const struct config_dep *dep;
+	const char *env;
+	struct stat64 st;
+	unsigned int k;
+
+	for (k = 0; k < deps->count; k++) {
+		dep = &deps->dep[k];
+		switch (dep->type) {
+		case CONFIG_DEP_FILE:
+			if (stat64(dep->name, &st) < 0 ||
+			    st.st_dev != dep->st.st_dev ||
+			    st.st_ino != dep->st.st_ino ||
+			    st.st_mtim.tv_sec != dep->st.st_mtim.tv_sec ||
+			    st.st_mtim.tv_nsec != dep->st.st_mtim.tv_nsec ||
+			    st.st_size != dep->st.st_size)
+				return 0;
+			break;
+		case CONFIG_DEP_ABSENT:
+			if (stat64(dep->name, &st) >= 0 ||
+			    (errno != ENOENT && errno != ENOTDIR))
+				return 0;
+			break;
+		case CONFIG_DEP_ENV:
+			env = getenv(dep->name);
+			if (dep->value ? !env || strcmp(env, dep->value) : !!env)
+				return 0;
+			break;
+		}
+	}
+	return 1;
+}
+
+/**
+ * \brief Records an environment variable used while building the global tree.
+ * \param name The variable name.
+ *
+ * Used by the configuration functions reading the environment to invalidate
+ * the binary cache when the variable changes.
+ */
+void snd_config_cache_env(const char *name)
+{
+	config_dep_env(name);
+}
+
+static struct config_deps *config_deps_new(void)
+{
+	struct config_deps *deps;
+
+#ifndef HAVE___THREAD
+	return NULL;
+#endif
+	deps = calloc(1, sizeof(*deps));
+	if (!deps)
+		return NULL;
+	config_deps = deps;
+	/* used implicitly by the user file expansion and the top directory */
+	config_dep_env("HOME");
+	config_dep_env("XDG_CONFIG_HOME");
+	config_dep_env("ALSA_CONFIG_DIR");
+	return deps;
+}
+
+static int config_cache_buf_add(struct config_cache_buf *buf,
+				const void *data, size_t len)
+{
+	if (buf->len + len > buf->alloc) {
+		size_t alloc = buf->alloc ? buf->alloc : 4096;
+		char *d;
+		while (alloc < buf->len + len)
+			alloc *= 2;
+		d = realloc(buf->data, alloc);
+		if (!d)
+			return -ENOMEM;
+		buf->data = d;
+		buf->alloc = alloc;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+	return 0;
+}
+
+static int config_cache_string(struct config_cache_buf *strings,
+			       const char *str, uint32_t *offset)
+{
+	if (!str) {
+		*offset = CONFIG_CACHE_NONE;
+		return 0;
+	}
+	if (strings->len >= CONFIG_CACHE_NONE)
+		return -E2BIG;
+	*offset = strings->len;
+	return config_cache_buf_add(strings, str, strlen(str) + 1);
+}
+
+static int config_cache_put_node(snd_config_t *config, unsigned int depth,
+				 struct config_cache_buf *nodes,
+				 struct config_cache_buf *strings)
+{
+	struct config_cache_node node;
+	uint32_t offset;
+	snd_config_iterator_t i, next;
+	int err;
+
+	if (depth > CONFIG_CACHE_MAX_DEPTH)
+		return -E2BIG;
+	memset(&node, 0, sizeof(node));
+	node.type = config->type;
+	err = config_cache_string(strings, config->id, &node.id);
+	if (err < 0)
+		return err;
+	switch (config->type) {
+	case SND_CONFIG_TYPE_INTEGER:
+		node.u.integer = config->u.integer;
+		break;
+	case SND_CONFIG_TYPE_INTEGER64:
+		node.u.integer = config->u.integer64;
+		break;
+	case SND_CONFIG_TYPE_REAL:
+		node.u.real = config->u.real;
+		break;
+	case SND_CONFIG_TYPE_STRING:
+		err = config_cache_string(strings, config->u.string, &offset);
+		if (err < 0)
+			return err;
+		node.u.integer = offset;
+		break;
+	case SND_CONFIG_TYPE_COMPOUND:
+		node.join = config->u.compound.join;
+		snd_config_for_each(i, next, config)
+			node.children++;
+		break;
+	default:
+		/* pointers are process local */
+		return -EINVAL;
+	}
+	err = config_cache_buf_add(nodes, &node, sizeof(node));
+	if (err < 0 || config->type != SND_CONFIG_TYPE_COMPOUND)
+		return err;
+	snd_config_for_each(i, next, config) {
+		err = config_cache_put_node(snd_config_iterator_entry(i),
+					    depth + 1, nodes, strings);
+		if (err < 0)
+			return err;
+	}
+	return 0;
+}
+
+static int config_cache_write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t r;
+
+	while (len > 0) {
+		r = write(fd, p, len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += r;
+		len -= r;
+	}
+	return 0;
+}
+
+/*
+ * Store the tree with its recorded inputs; the file is replaced atomically
+ * so that concurrent readers see either the old or the new cache.
+ */
+static int config_cache_save(const char *path, const char *configs,
+			     struct config_deps *deps, snd_config_t *top)
+{
+	struct config_cache_header hdr;
+	struct config_cache_buf dbuf = { 0 }, nodes = { 0 }, strings = { 0 };
+	char *tmp = NULL;
+	unsigned int k;
+	int fd = -1, err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	/* offset zero is the empty string */
+	err = config_cache_buf_add(&strings, "", 1);
+	if (err < 0)
+		goto _end;
+	err = config_cache_string(&strings, configs, &hdr.configs);
+	if (err < 0)
+		goto _end;
+	for (k = 0; k < deps->count; k++) {
+		struct config_dep *dep = &deps->dep[k];
+		struct config_cache_dep d;
+
+		memset(&d, 0, sizeof(d));
+		d.type = dep->type;
+		err = config_cache_string(&strings, dep->name, &d.name);
+		if (err < 0)
+			goto _end;
+		err = config_cache_string(&strings, dep->value, &d.value);
+		if (err < 0)
+			goto _end;
+		if (dep->type == CONFIG_DEP_FILE) {
+			d.dev = dep->st.st_dev;
+			d.ino = dep->st.st_ino;
+			d.sec = dep->st.st_mtim.tv_sec;
+			d.nsec = dep->st.st_mtim.tv_nsec;
+			d.size = dep->st.st_size;
+		}
+		err = config_cache_buf_add(&dbuf, &d, sizeof(d));
+		if (err < 0)
+			goto _end;
+	}
+	err = config_cache_put_node(top, 0, &nodes, &strings);
+	if (err < 0)
+		goto _end;
+	memcpy(hdr.magic, CONFIG_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CONFIG_CACHE_VERSION;
+	hdr.endian = CONFIG_CACHE_ENDIAN;
+	hdr.sizes = CONFIG_CACHE_SIZES;
+	hdr.ndeps = deps->count;
+	hdr.nnodes = nodes.len / sizeof(struct config_cache_node);
+	hdr.deps_offset = sizeof(hdr);
+	hdr.nodes_offset = hdr.deps_offset + dbuf.len;
+	hdr.strings_offset = hdr.nodes_offset + nodes.len;
+	hdr.size = hdr.strings_offset + strings.len;
+
+	tmp = malloc(strlen(path) + 8);
+	if (!tmp) {
+		err = -ENOMEM;
+		goto _end;
+	}
+	sprintf(tmp, "%s.XXXXXX", path);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		err = -errno;
+		goto _end;
+	}
+	err = config_cache_write_all(fd, &hdr, sizeof(hdr));
+	if (err >= 0)
+		err = config_cache_write_all(fd, dbuf.data, dbuf.len);
+	if (err >= 0)
+		err = config_cache_write_all(fd, nodes.data, nodes.len);
+	if (err >= 0)
+		err = config_cache_write_all(fd, strings.data, strings.len);
+	if (close(fd) < 0 && err >= 0)
+		err = -errno;
+	if (err >= 0 && rename(tmp, path) < 0)
+		err = -errno;
+	if (err < 0)
+		unlink(tmp);
+ _end:
+	free(tmp);
+	free(dbuf.data);
+	free(nodes.data);
+	free(strings.data);
+	return err;
+}
+
+struct config_cache_map {
+	const char *strings;
+	uint64_t strings_size;
+	const struct config_cache_node *nodes;
+	uint32_t nnodes;
+	uint32_t next;
+};
+
+static const char *config_cache_str(const struct config_cache_map *map,
+				    uint64_t offset)
+{
+	if (offset >= map->strings_size)
+		return NULL;
+	return map->strings + offset;
+}
+
+static int config_cache_get_node(struct config_cache_map *map,
+				 snd_config_t *parent, unsigned int depth,
+				 snd_config_t **result)
+{
+	const struct config_cache_node *node;
+	snd_config_t *n;
+	const char *s;
+	char *id = NULL;
+	uint32_t k;
+	int err;
+
+	if (depth > CONFIG_CACHE_MAX_DEPTH || map->next >= map->nnodes)
+		return -EINVAL;
+	node = &map->nodes[map->next++];
+	if (node->type != SND_CONFIG_TYPE_COMPOUND && node->children)
+		return -EINVAL;
+	if (node->id != CONFIG_CACHE_NONE) {
+		s = config_cache_str(map, node->id);
+		if (!s)
+			return -EINVAL;
+		id = strdup(s);
+		if (!id)
+			return -ENOMEM;
+	} else if (parent) {
+		return -EINVAL;
+	}
+	switch (node->type) {
+	case SND_CONFIG_TYPE_INTEGER:
+	case SND_CONFIG_TYPE_INTEGER64:
+	case SND_CONFIG_TYPE_REAL:
+	case SND_CONFIG_TYPE_STRING:
+	case SND_CONFIG_TYPE_COMPOUND:
+		break;
+	default:
+		free(id);
+		return -EINVAL;
+	}
+	if (parent)
+		err = _snd_config_make_add(&n, &id, node->type, parent);
+	else
+		err = _snd_config_make(&n, &id, node->type);
+	if (err < 0)
+		return err;
+	if (!parent)
+		*result = n;
+	switch (node->type) {
+	case SND_CONFIG_TYPE_INTEGER:
+		n->u.integer = node->u.integer;
+		break;
+	case SND_CONFIG_TYPE_INTEGER64:
+		n->u.integer64 = node->u.integer;
+		break;
+	case SND_CONFIG_TYPE_REAL:
+		n->u.real = node->u.real;
+		break;
+	case SND_CONFIG_TYPE_STRING:
+		if (node->u.integer == CONFIG_CACHE_NONE)
+			break;
+		s = config_cache_str(map, node->u.integer);
+		if (!s)
+			return -EINVAL;
+		err = config_set_string_copy(n, s);
+		if (err < 0)
+			return err;
+		break;
+	case SND_CONFIG_TYPE_COMPOUND:
+		n->u.compound.join = node->join != 0;
+		if (node->children > map->nnodes - map->next)
+			return -EINVAL;
+		for (k = 0; k < node->children; k++) {
+			err = config_cache_get_node(map, n, depth + 1, NULL);
+			if (err < 0)
+				return err;
+		}
+		break;
+	}
+	return 0;
+}
+
+static int config_cache_dep_valid(const struct config_cache_map *map,
+				  const struct config_cache_dep *d)
+{
+	const char *name, *value, *env;
+	struct stat64 st;
+
+	name = config_cache_str(map, d->name);
+	if (!name)
+		return 0;
+	switch (d->type) {
+	case CONFIG_DEP_FILE:
+		return stat64(name, &st) >= 0 &&
+		       (uint64_t)st.st_dev == d->dev &&
+		       (uint64_t)st.st_ino == d->ino &&
+		       st.st_mtim.tv_sec == d->sec &&
+		       st.st_mtim.tv_nsec == d->nsec &&
+		       st.st_size == d->size;
+	case CONFIG_DEP_ABSENT:
+		return stat64(name, &st) < 0 &&
+		       (errno == ENOENT || errno == ENOTDIR);
+	case CONFIG_DEP_ENV:
+		env = getenv(name);
+		if (d->value == CONFIG_CACHE_NONE)
+			return env == NULL;
+		value = config_cache_str(map, d->value);
+		return value && env && strcmp(env, value) == 0;
+	}
+	return 0;
+}
+
+/*
+ * The cache file path; ignored in setuid and setgid processes, which
+ * would create and replace the file named by the caller with their
+ * privileges.
+ */
+static const char *config_cache_name(void)
+{
+	if (getuid() != geteuid() || getgid() != getegid())
+		return NULL;
+	return getenv(ALSA_CONFIG_CACHE_VAR);
+}
+
+/*
+ * Build the tree from a valid cache; the strings are copied out of the
+ * mapping as the tree nodes own them.
+ */
+static int config_cache_load(const char *path, const char *configs,
+			     snd_config_t **_top)
+{
+	const struct config_cache_header *hdr;
+	const struct config_cache_dep *deps;
+	struct config_cache_map map;
+	snd_config_t *top = NULL;
+	struct stat64 st;
+	const char *s;
+	void *data;
+	size_t size;
+	uint32_t k;
+	int fd, err = -EINVAL;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd < 0)
+		return -errno;
+	if (fstat64(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) ||
+	    st.st_size < (off64_t)sizeof(*hdr)) {
+		close(fd);
+		return -EINVAL;
+	}
+	size = st.st_size;
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return -errno;
+	hdr = data;
+	if (memcmp(hdr->magic, CONFIG_CACHE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != CONFIG_CACHE_VERSION ||
+	    hdr->endian != CONFIG_CACHE_ENDIAN ||
+	    hdr->sizes != CONFIG_CACHE_SIZES ||
+	    hdr->size != size ||
+	    hdr->deps_offset != sizeof(*hdr) ||
+	    hdr->nodes_offset != hdr->deps_offset +
+				 (uint64_t)hdr->ndeps * sizeof(*deps) ||
+	    hdr->strings_offset != hdr->nodes_offset +
+				   (uint64_t)hdr->nnodes * sizeof(*map.nodes) ||
+	    hdr->strings_offset >= size ||
+	    ((const char *)data)[size - 1] != '\0')
+		goto _end;
+	deps = (const void *)((const char *)data + hdr->deps_offset);
+	map.nodes = (const void *)((const char *)data + hdr->nodes_offset);
+	map.nnodes = hdr->nnodes;
+	map.next = 0;
+	map.strings = (const char *)data + hdr->strings_offset;
+	map.strings_size = size - hdr->strings_offset;
+	s = config_cache_str(&map, hdr->configs);
+	if (!s || strcmp(s, configs)) {
+		err = -ESTALE;
+		goto _end;
+	}
+	for (k = 0; k < hdr->ndeps; k++) {
+		if (!config_cache_dep_valid(&map, &deps[k])) {
+			err = -ESTALE;
+			goto _end;
+		}
+	}
+	if (map.nnodes == 0 ||
+	    map.nodes[0].type != SND_CONFIG_TYPE_COMPOUND)
+		goto _end;
+	err = config_cache_get_node(&map, NULL, 0, &top);
+	if (err >= 0 && map.next != map.nnodes)
+		err = -EINVAL;
+	if (err < 0) {
+		if (top)
+			snd_config_delete(top);
+		goto _end;
+	}
+	*_top = top;
+ _end:
+	munmap(data, size);
+	return err;
+}
+
+/*
+ * Watcher of the configuration files: with LIBASOUND_CONFIG_WATCH=1, the
+ * files checked by config_update() and their directories are watched by
+ * a non-blocking inotify descriptor shared by the process.  The pending
+ * events are read by config_update() and bump the generation counter;
+ * while the counter is unchanged, the files need not be stat()ed again.
+ * Any event only forces the usual check.  A forked child doesn't use the
+ * inherited descriptor, whose events are shared with the parent, but
+ * opens its own one.
+ */
+#ifdef CONFIG_WATCH
+
+#define CONFIG_WATCH_MASK	(IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | \
+				 IN_CREATE | IN_DELETE | IN_MOVED_FROM | \
+				 IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static pthread_mutex_t config_watch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int config_watch_enabled = -1;
+static int config_watch_fd = -1;
+static pid_t config_watch_pid;
+static unsigned int config_watch_generation;
+
+/* drop the descriptor, the armed updates get checked again */
+static void config_watch_close(void)
+{
+	if (config_watch_fd < 0)
+		return;
+	close(config_watch_fd);
+	config_watch_fd = -1;
+	config_watch_generation++;
+}
+
+/* (re)open the descriptor of this process, called with the mutex held */
+static int config_watch_open(void)
+{
+	if (config_watch_enabled < 0) {
+		const char *env = getenv("LIBASOUND_CONFIG_WATCH");
+		config_watch_enabled = env && *env == '1';
+	}
+	if (!config_watch_enabled)
+		return -ENOSYS;
+	if (config_watch_fd >= 0 && config_watch_pid != getpid())
+		config_watch_close();
+	if (config_watch_fd >= 0)
+		return 0;
+	config_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (config_watch_fd < 0)
+		return -errno;
+	config_watch_pid = getpid();
+	return 0;
+}
+
+/* read the pending events, called with the mutex held */
+static void config_watch_read(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+
+	while (1) {
+		len = read(config_watch_fd, buf, sizeof(buf));
+		if (len > 0) {
+			config_watch_generation++;
+			continue;
+		}
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && errno == EAGAIN)
+			break;
+		/* the descriptor is broken, check the files each time */
+		config_watch_close();
+		break;
+	}
+}
+
+static int config_watch_add(const char *name)
+{
+	const char *s = strrchr(name, '/');
+	char *dir;
+
+	if (inotify_add_watch(config_watch_fd, name, CONFIG_WATCH_MASK) < 0)
+		return -errno;
+	if (!s || s == name)
+		return 0;
+	dir = strndup(name, s - name);
+	if (!dir)
+		return -ENOMEM;
+	if (inotify_add_watch(config_watch_fd, dir, CONFIG_WATCH_MASK) < 0) {
+		free(dir);
+		return -errno;
+	}
+	free(dir);
+	return 0;
+}
+
+/* watch the files of update before they are checked */
+static void config_watch_arm(snd_config_update_t *update, const char *configs)
+{
+	unsigned int k;
+
+	pthread_mutex_lock(&config_watch_mutex);
+	if (config_watch_open() < 0)
+		goto _unlock;
+	for (k = 0; k < update->count; k++) {
+		if (config_watch_add(update->finfo[k].name) < 0)
+			goto _unlock;
+	}
+	/* the events so far are older than the check */
+	config_watch_read();
+	if (config_watch_fd < 0)
+		goto _unlock;
+	update->generation = config_watch_generation;
+	update->configs = strdup(configs);
+ _unlock:
+	pthread_mutex_unlock(&config_watch_mutex);
+}
+
+/* no event since the files of update were checked */
+static int config_watch_fresh(snd_config_update_t *update, const char *configs)
+{
+	int fresh;
+
+	if (!update->configs)
+		return 0;
+	pthread_mutex_lock(&config_watch_mutex);
+	fresh = config_watch_fd >= 0 && config_watch_pid == getpid();
+	if (fresh) {
+		config_watch_read();
+		fresh = config_watch_fd >= 0 &&
+			config_watch_generation == update->generation;
+	}
+	pthread_mutex_unlock(&config_watch_mutex);
+	return fresh && strcmp(update->configs, configs) == 0;
+}
+
+/* release the descriptor with the global configuration */
+static void config_watch_free(void)
+{
+	pthread_mutex_lock(&config_watch_mutex);
+	config_watch_close();
+	pthread_mutex_unlock(&config_watch_mutex);
+}
+
+#else /* !CONFIG_WATCH */
+
+static inline void config_watch_arm(snd_config_update_t *update ATTRIBUTE_UNUSED,
+				    const char *configs ATTRIBUTE_UNUSED)
+{
+}
+
+static inline int config_watch_fresh(snd_config_update_t *update ATTRIBUTE_UNUSED,
+				     const char *configs ATTRIBUTE_UNUSED)
+{
+	return 0;
+}
 
-/**
- * \brief Updates a configuration tree by rereading the configuration files (if needed).
- * \param[in,out] _top Address of the handle to the top-level node.
- * \param[in,out] _update Address of a pointer to private update information.
- * \param[in] cfgs A list of configuration file names, delimited with ':'.
- *                 If \p cfgs is \c NULL, the default global
- *                 configuration file is used.
- * \return 0 if \a _top was up to date, 1 if the configuration files
- *         have been reread, otherwise a negative error code.
- *
- * The variables pointed to by \a _top and \a _update can be initialized
- * to \c NULL before the first call to this function.  The private
- * update information holds information about all used configuration
- * files that allows this function to detects changes to them; this data
- * can be freed with #snd_config_update_free.
- *
- * The global configuration files are specified in the environment variable
- * \c ALSA_CONFIG_PATH.
- *
- * \warning If the configuration tree is reread, all string pointers and
- * configuration node handles previously obtained from this tree become
- * invalid.
- *
- * \par Errors:
- * Any errors encountered when parsing the input or returned by hooks or
- * functions.
+static inline void config_watch_free(void)
+{
+}
+
+#endif /* CONFIG_WATCH */
+
+/* the files of update were found unchanged, keep the newer watch state */
+static void config_watch_renew(snd_config_update_t *update, snd_config_update_t *local)
+{
+	free(update->configs);
+	update->configs = local->configs;
+	update->generation = local->generation;
+	local->configs = NULL;
+}
+
+#endif /* DOC_HIDDEN */
+
+/*
+ * Reread the configuration files if needed; use_cache enables the binary
+ * cache named by ALSA_CONFIG_CACHE, only for the global configuration.
  */
-int snd_config_update_r(snd_config_t **_top, snd_config_update_t **_update, const char *cfgs)
+static int config_update(snd_config_t **_top, snd_config_update_t **_update,
+			 const char *cfgs, int use_cache)
 {
 	int err;
-	const char *configs, *c;
+	const char *configs, *c, *cache = NULL;
 	unsigned int k;
 	size_t l;
 	snd_config_update_t *local;
 	snd_config_update_t *update;
 	snd_config_t *top;
+	struct config_deps *deps = NULL;
+	struct config_arena_scope scope = { NULL };
 
 	assert(_top && _update);
 	top = *_top;
@@ -4537,6 +6402,8 @@ int snd_config_update_r(snd_config_t **_top, snd_config_update_t **_update, cons
 			configs = s;
 		}
 	}
+	if (update && config_watch_fresh(update, configs))
+		return 0;
 	for (k = 0, c = configs; (l = strcspn(c, ": ")) > 0; ) {
 		c += l;
 		k++;
@@ -4570,6 +6437,7 @@ int snd_config_update_r(snd_config_t **_top, snd_config_update_t **_update, cons
 			break;
 		c++;
 	}
+	config_watch_arm(local, configs);
 	for (k = 0; k < local->count; ++k) {
 		struct stat64 st;
 		struct finfo *lf;
@@ -4582,6 +6450,8 @@ _nextf:
 			lf->mtime = st.st_mtime;
 		} else {
 			snd_error(CORE, "Cannot access file %s", lf->name);
+			/* the file appearance is not tracked by the cache */
+			use_cache = 0;
 			free(lf->name);
 			local->count--;
 			if (k < local->count) {
@@ -4605,6 +6475,7 @@ _nextf:
 		    lf->mtime != uf->mtime)
 			goto _reread;
 	}
+	config_watch_renew(update, local);
 	err = 0;
 
  _end:
@@ -4620,6 +6491,11 @@ _nextf:
 	}
 	if (local)
 		snd_config_update_free(local);
+	if (deps) {
+		config_deps = NULL;
+		config_deps_free(deps);
+	}
+	config_arena_leave(&scope);
 	return err;
 
  _reread:
@@ -4633,6 +6509,15 @@ _nextf:
 		snd_config_delete(top);
 		top = NULL;
 	}
+	config_arena_enter(&scope);
+	if (use_cache && local) {
+		cache = config_cache_name();
+		if (cache && *cache) {
+			if (config_cache_load(cache, configs, &top) >= 0)
+				goto _done;
+			deps = config_deps_new();
+		}
+	}
 	err = snd_config_top(&top);
 	if (err < 0)
 		goto _end;
@@ -4640,6 +6525,7 @@ _nextf:
 		goto _skip;
 	for (k = 0; k < local->count; ++k) {
 		snd_input_t *in;
+		config_dep_path(local->finfo[k].name);
 		err = snd_input_stdio_open(&in, local->finfo[k].name, "r");
 		if (err >= 0) {
 			err = snd_config_load(top, in);
@@ -4658,16 +6544,68 @@ _nextf:
 		snd_error(CORE, "hooks failed, removing configuration");
 		goto _end;
 	}
+	if (deps) {
+		config_deps = NULL;
+		if (!deps->uncacheable && !deps->cards)
+			config_cache_save(cache, configs, deps, top);
+		config_deps_free(deps);
+	}
+ _done:
+	config_arena_leave(&scope);
 	*_top = top;
 	*_update = local;
 	return 1;
 }
 
+/**
+ * \brief Updates a configuration tree by rereading the configuration files (if needed).
+ * \param[in,out] _top Address of the handle to the top-level node.
+ * \param[in,out] _update Address of a pointer to private update information.
+ * \param[in] cfgs A list of configuration file names, delimited with ':'.
+ *                 If \p cfgs is \c NULL, the default global
+ *                 configuration file is used.
+ * \return 0 if \a _top was up to date, 1 if the configuration files
+ *         have been reread, otherwise a negative error code.
+ *
+ * The variables pointed to by \a _top and \a _update can be initialized
+ * to \c NULL before the first call to this function.  The private
+ * update information holds information about all used configuration
+ * files that allows this function to detects changes to them; this data
+ * can be freed with #snd_config_update_free.
+ *
+ * The global configuration files are specified in the environment variable
+ * \c ALSA_CONFIG_PATH.
+ *
+ * With the environment variable \c LIBASOUND_CONFIG_WATCH set to 1,
+ * the configuration files are watched with inotify, and they are checked
+ * again only after a change has been reported.
+ *
+ * \warning If the configuration tree is reread, all string pointers and
+ * configuration node handles previously obtained from this tree become
+ * invalid.
+ *
+ * \par Errors:
+ * Any errors encountered when parsing the input or returned by hooks or
+ * functions.
+ */
+int snd_config_update_r(snd_config_t **_top, snd_config_update_t **_update, const char *cfgs)
+{
+	return config_update(_top, _update, cfgs, 0);
+}
+
 /**
  * \brief Updates #snd_config by rereading the global configuration files (if needed).
  * \return 0 if #snd_config was up to date, 1 if #snd_config was
  *         updated, otherwise a negative error code.
  *
+ * If the environment variable \c ALSA_CONFIG_CACHE names a file, the
+ * tree built from the configuration files and the hooks is stored there
+ * with the list of the files, directories and environment variables it
+ * was built from.  The next process loads the tree from this file while
+ * all these inputs are unchanged, without parsing the configuration.
+ * Trees using hooks or functions from other libraries are not cached.
+ * The variable is ignored in setuid and setgid processes.
+ *
  * \warning Whenever #snd_config is updated, all string pointers and
  * configuration node handles previously obtained from it may become
  * invalid.
@@ -4686,7 +6624,9 @@ int snd_config_update(void)
 	int err;
 
 	snd_config_lock();
-	err = snd_config_update_r(&snd_config, &snd_config_global_update, NULL);
+	err = config_update(&snd_config, &snd_config_global_update, NULL, 1);
+	if (err != 0)	/* reread or deleted */
+		config_memo_flush();
 	snd_config_unlock();
 	return err;
 }
@@ -4709,7 +6649,9 @@ int snd_config_update_ref(snd_config_t **top)
 	if (top)
 		*top = NULL;
 	snd_config_lock();
-	err = snd_config_update_r(&snd_config, &snd_config_global_update, NULL);
+	err = config_update(&snd_config, &snd_config_global_update, NULL, 1);
+	if (err != 0)	/* reread or deleted */
+		config_memo_flush();
 	if (err >= 0) {
 		if (snd_config) {
 			if (top) {
@@ -4772,6 +6714,7 @@ int snd_config_update_free(snd_config_update_t *update)
 	for (k = 0; k < update->count; k++)
 		free(update->finfo[k].name);
 	free(update->finfo);
+	free(update->configs);
 	free(update);
 	return 0;
 }
@@ -4789,6 +6732,7 @@ int snd_config_update_free(snd_config_update_t *update)
 int snd_config_update_free_global(void)
 {
 	snd_config_lock();
+	config_memo_flush();
 	if (snd_config)
 		snd_config_delete(snd_config);
 	snd_config = NULL;
@@ -4796,6 +6740,7 @@ int snd_config_update_free_global(void)
 		snd_config_update_free(snd_config_global_update);
 	snd_config_global_update = NULL;
 	snd_config_unlock();
+	config_watch_free();
 	/* FIXME: better to place this in another place... */
 	snd_dlobj_cache_cleanup();
 
@@ -4945,53 +6890,35 @@ static int _snd_config_copy(snd_config_t *src,
 			    void *private_data ATTRIBUTE_UNUSED)
 {
 	int err;
-	const char *id = src->id;
 	snd_config_type_t type = snd_config_get_type(src);
 	switch (pass) {
 	case SND_CONFIG_WALK_PASS_PRE:
-		err = snd_config_make_compound(dst, id, src->u.compound.join);
+		err = config_make_shared_id(dst, src, SND_CONFIG_TYPE_COMPOUND);
 		if (err < 0)
 			return err;
+		(*dst)->u.compound.join = src->u.compound.join;
 		break;
 	case SND_CONFIG_WALK_PASS_LEAF:
-		err = snd_config_make(dst, id, type);
+		err = config_make_shared_id(dst, src, type);
 		if (err < 0)
 			return err;
 		switch (type) {
 		case SND_CONFIG_TYPE_INTEGER:
-		{
-			long v;
-			err = snd_config_get_integer(src, &v);
-			assert(err >= 0);
-			snd_config_set_integer(*dst, v);
+			(*dst)->u.integer = src->u.integer;
 			break;
-		}
 		case SND_CONFIG_TYPE_INTEGER64:
-		{
-			long long v;
-			err = snd_config_get_integer64(src, &v);
-			assert(err >= 0);
-			snd_config_set_integer64(*dst, v);
+			(*dst)->u.integer64 = src->u.integer64;
 			break;
-		}
 		case SND_CONFIG_TYPE_REAL:
-		{
-			double v;
-			err = snd_config_get_real(src, &v);
-			assert(err >= 0);
-			snd_config_set_real(*dst, v);
+			(*dst)->u.real = src->u.real;
 			break;
-		}
 		case SND_CONFIG_TYPE_STRING:
-		{
-			const char *s;
-			err = snd_config_get_string(src, &s);
-			assert(err >= 0);
-			err = snd_config_set_string(*dst, s);
-			if (err < 0)
+			err = config_set_string_shared(*dst, src);
+			if (err < 0) {
+				snd_config_delete(*dst);
 				return err;
+			}
 			break;
-		}
 		default:
 			assert(0);
 		}
@@ -5023,7 +6950,13 @@ static int _snd_config_copy(snd_config_t *src,
 int snd_config_copy(snd_config_t **dst,
 		    snd_config_t *src)
 {
-	return snd_config_walk(src, NULL, dst, _snd_config_copy, NULL, NULL);
+	struct config_arena_scope scope;
+	int err;
+
+	config_arena_enter(&scope);
+	err = snd_config_walk(src, NULL, dst, _snd_config_copy, NULL, NULL);
+	config_arena_leave(&scope);
+	return err;
 }
 
 static int _snd_config_expand_vars(snd_config_t **dst, const char *s, void *private_data)
@@ -5037,7 +6970,7 @@ static int _snd_config_expand_vars(snd_config_t **dst, const char *s, void *priv
 }
 
 static int _snd_config_expand(snd_config_t *src,
-			      snd_config_t *root ATTRIBUTE_UNUSED,
+			      snd_config_t *root,
 			      snd_config_t **dst,
 			      snd_config_walk_pass_t pass,
 			      snd_config_expand_fcn_t fcn,
@@ -5048,79 +6981,31 @@ static int _snd_config_expand(snd_config_t *src,
 	snd_config_type_t type = snd_config_get_type(src);
 	switch (pass) {
 	case SND_CONFIG_WALK_PASS_PRE:
-	{
 		if (id && strcmp(id, "@args") == 0)
 			return 0;
-		err = snd_config_make_compound(dst, id, src->u.compound.join);
-		if (err < 0)
-			return err;
 		break;
-	}
 	case SND_CONFIG_WALK_PASS_LEAF:
-		switch (type) {
-		case SND_CONFIG_TYPE_INTEGER:
-		{
-			long v;
-			err = snd_config_get_integer(src, &v);
-			assert(err >= 0);
-			err = snd_config_imake_integer(dst, id, v);
-			if (err < 0)
-				return err;
-			break;
-		}
-		case SND_CONFIG_TYPE_INTEGER64:
-		{
-			long long v;
-			err = snd_config_get_integer64(src, &v);
-			assert(err >= 0);
-			err = snd_config_imake_integer64(dst, id, v);
-			if (err < 0)
-				return err;
-			break;
-		}
-		case SND_CONFIG_TYPE_REAL:
-		{
-			double v;
-			err = snd_config_get_real(src, &v);
-			assert(err >= 0);
-			err = snd_config_imake_real(dst, id, v);
-			if (err < 0)
-				return err;
-			break;
-		}
-		case SND_CONFIG_TYPE_STRING:
-		{
-			const char *s;
+		if (type == SND_CONFIG_TYPE_STRING &&
+		    src->u.string && *src->u.string == '$') {
 			snd_config_t *vars = private_data;
-			err = snd_config_get_string(src, &s);
+			err = snd_config_evaluate_string(dst, src->u.string, fcn, vars);
 			if (err < 0)
 				return err;
-			if (s && *s == '$') {
-				err = snd_config_evaluate_string(dst, s, fcn, vars);
-				if (err < 0)
-					return err;
-				if (*dst == NULL)
-					return 0;
-				err = snd_config_set_id(*dst, id);
-				if (err < 0) {
-					snd_config_delete(*dst);
-					return err;
-				}
-			} else {
-				err = snd_config_imake_string(dst, id, s);
-				if (err < 0)
-					return err;
+			if (*dst == NULL)
+				return 0;
+			err = snd_config_set_id(*dst, id);
+			if (err < 0) {
+				snd_config_delete(*dst);
+				return err;
 			}
-			break;
-		}
-		default:
-			assert(0);
+			return 1;
 		}
 		break;
 	default:
-		break;
+		return 1;
 	}
-	return 1;
+	/* the unchanged nodes are copied, sharing the strings */
+	return _snd_config_copy(src, root, dst, pass, NULL, NULL);
 }
 
 static int _snd_config_evaluate(snd_config_t *src,
@@ -5148,6 +7033,7 @@ static int _snd_config_evaluate(snd_config_t *src,
 			return err;
 		}
 		assert(str);
+		config_dep_func(str, src);
 		err = snd_config_search_definition(root, "func", str, &func_conf);
 		if (err >= 0) {
 			snd_config_iterator_t i, next;
@@ -5180,6 +7066,8 @@ static int _snd_config_evaluate(snd_config_t *src,
 				snd_error(CORE, "Unknown field %s", id);
 			}
 		}
+		if (lib)
+			config_dep_uncacheable();
 		if (!func_name) {
 			int len = 9 + strlen(str) + 1;
 			buf = malloc(len);
@@ -5665,10 +7553,13 @@ int snd_config_expand_custom(snd_config_t *config, snd_config_t *root,
 			     snd_config_expand_fcn_t fcn, void *private_data,
 			     snd_config_t **result)
 {
+	struct config_arena_scope scope;
 	snd_config_t *res;
 	int err;
 
+	config_arena_enter(&scope);
 	err = snd_config_walk(config, root, &res, _snd_config_expand, fcn, private_data);
+	config_arena_leave(&scope);
 	if (err < 0) {
 		snd_error(CORE, "Expand error (walk): %s", snd_strerror(err));
 		return err;
@@ -5677,25 +7568,9 @@ int snd_config_expand_custom(snd_config_t *config, snd_config_t *root,
 	return 1;
 }
 
-/**
- * \brief Expands a configuration node, applying arguments and functions.
- * \param[in] config Handle to the configuration node.
- * \param[in] root Handle to the root configuration node.
- * \param[in] args Arguments string, can be \c NULL.
- * \param[in] private_data Handle to the private data node for functions.
- * \param[out] result The function puts the handle to the result
- *                    configuration node at the address specified by
- *                    \a result.
- * \return A non-negative value if successful, otherwise a negative error code.
- *
- * If \a config has arguments (defined by a child with id \c \@args),
- * this function replaces any string node beginning with $ with the
- * respective argument value, or the default argument value, or nothing.
- * Furthermore, any functions are evaluated (see #snd_config_evaluate).
- * The resulting copy of \a config is returned in \a result.
- */
-int snd_config_expand(snd_config_t *config, snd_config_t *root, const char *args,
-		      snd_config_t *private_data, snd_config_t **result)
+static int config_expand(snd_config_t *config, snd_config_t *root,
+			 const char *args, snd_config_t *private_data,
+			 snd_config_t **result)
 {
 	int err;
 	snd_config_t *defs, *subs = NULL, *res;
@@ -5747,6 +7622,175 @@ int snd_config_expand(snd_config_t *config, snd_config_t *root, const char *args
 	return err;
 }
 
+/**
+ * \brief Expands a configuration node, applying arguments and functions.
+ * \param[in] config Handle to the configuration node.
+ * \param[in] root Handle to the root configuration node.
+ * \param[in] args Arguments string, can be \c NULL.
+ * \param[in] private_data Handle to the private data node for functions.
+ * \param[out] result The function puts the handle to the result
+ *                    configuration node at the address specified by
+ *                    \a result.
+ * \return A non-negative value if successful, otherwise a negative error code.
+ *
+ * If \a config has arguments (defined by a child with id \c \@args),
+ * this function replaces any string node beginning with $ with the
+ * respective argument value, or the default argument value, or nothing.
+ * Furthermore, any functions are evaluated (see #snd_config_evaluate).
+ * The resulting copy of \a config is returned in \a result.
+ */
+int snd_config_expand(snd_config_t *config, snd_config_t *root, const char *args,
+		      snd_config_t *private_data, snd_config_t **result)
+{
+	struct config_arena_scope scope;
+	int err;
+
+	config_arena_enter(&scope);
+	err = config_expand(config, root, args, private_data, result);
+	config_arena_leave(&scope);
+	return err;
+}
+
+/*
+ * Memo of the definitions expanded from the global tree, keyed by the
+ * definition node and the arguments.  The inputs of the functions
+ * evaluated by the expansion are recorded like for the binary cache;
+ * the card state is checked by the device directory.  Expansions using
+ * any other function are not stored.  The memo is flushed when the
+ * global tree is reread or when hooks modify it, and the entries made
+ * before any other change of the global tree (see config_global_touch())
+ * are not used, so a freed and reused definition node can't match
+ * either.  The list is protected
+ * by the update lock and ordered from the most recently used entry.
+ * Set LIBASOUND_CONFIG_MEMO=0 to expand the definitions on each search.
+ */
+#define CONFIG_MEMO_MAX		32
+
+struct config_memo {
+	struct list_head list;
+	const snd_config_t *def;
+	unsigned int gen;		/* config_global_gen of the expansion */
+	char *args;
+	struct config_deps *deps;
+	snd_config_t *result;
+};
+
+static LIST_HEAD(config_memo_list);
+static unsigned int config_memo_count;
+
+static int config_memo_enabled(void)
+{
+#ifdef HAVE___THREAD
+	static int enabled = -1;
+
+	if (enabled < 0) {
+		const char *env = getenv("LIBASOUND_CONFIG_MEMO");
+		enabled = !(env && *env == '0');
+	}
+	return enabled;
+#else
+	return 0;
+#endif
+}
+
+static void config_memo_free(struct config_memo *memo)
+{
+	list_del(&memo->list);
+	config_memo_count--;
+	snd_config_delete(memo->result);
+	config_deps_free(memo->deps);
+	free(memo->args);
+	free(memo);
+}
+
+static void config_memo_flush(void)
+{
+	while (!list_empty(&config_memo_list))
+		config_memo_free(list_entry(config_memo_list.next,
+					    struct config_memo, list));
+}
+
+static struct config_memo *config_memo_find(const snd_config_t *def,
+					    unsigned int gen, const char *args)
+{
+	struct list_head *pos;
+	struct config_memo *memo;
+
+	list_for_each(pos, &config_memo_list) {
+		memo = list_entry(pos, struct config_memo, list);
+		if (memo->def == def && memo->gen == gen &&
+		    (memo->args ? args && strcmp(memo->args, args) == 0 : !args))
+			return memo;
+	}
+	return NULL;
+}
+
+/* store a copy of the expanded tree, taking the ownership of deps */
+static void config_memo_add(const snd_config_t *def, unsigned int gen,
+			    const char *args, struct config_deps *deps,
+			    snd_config_t *result)
+{
+	struct config_memo *memo;
+
+	memo = calloc(1, sizeof(*memo));
+	if (!memo)
+		goto _err;
+	if (args) {
+		memo->args = strdup(args);
+		if (!memo->args)
+			goto _err;
+	}
+	if (snd_config_copy(&memo->result, result) < 0)
+		goto _err;
+	memo->def = def;
+	memo->gen = gen;
+	memo->deps = deps;
+	if (config_memo_count == CONFIG_MEMO_MAX)
+		config_memo_free(list_entry(config_memo_list.prev,
+					    struct config_memo, list));
+	list_add(&memo->list, &config_memo_list);
+	config_memo_count++;
+	return;
+
+ _err:
+	if (memo)
+		free(memo->args);
+	free(memo);
+	config_deps_free(deps);
+}
+
+/* expand a definition of the global tree, using the memo when valid */
+static int config_memo_expand(snd_config_t *def, snd_config_t *root,
+			      const char *args, snd_config_t **result)
+{
+	struct config_memo *memo;
+	struct config_deps *deps;
+	unsigned int gen = __atomic_load_n(&config_global_gen, __ATOMIC_RELAXED);
+	int err;
+
+	memo = config_memo_find(def, gen, args);
+	if (memo) {
+		if (config_deps_valid(memo->deps)) {
+			list_del(&memo->list);
+			list_add(&memo->list, &config_memo_list);
+			err = snd_config_copy(result, memo->result);
+			return err < 0 ? err : 1;
+		}
+		config_memo_free(memo);
+	}
+	deps = calloc(1, sizeof(*deps));
+	if (!deps)
+		return snd_config_expand(def, root, args, NULL, result);
+	config_deps = deps;
+	err = snd_config_expand(def, root, args, NULL, result);
+	config_deps = NULL;
+	if (err >= 0 && !deps->uncacheable)
+		config_memo_add(def, gen, args, deps, *result);
+	else
+		config_deps_free(deps);
+	return err;
+}
+
 /**
  * \brief Searches for a definition in a configuration tree, using
  *        aliases and expanding hooks and arguments.
@@ -5767,6 +7811,14 @@ int snd_config_expand(snd_config_t *config, snd_config_t *root, const char *args
  * In any case, \a result is a new node that must be freed by the
  * caller.
  *
+ * The expanded definitions of #snd_config are remembered, so searching
+ * for the same definition with the same arguments again copies the
+ * remembered tree unless an environment variable or the card state used
+ * by the expansion has changed.  The remembered definitions are dropped
+ * when #snd_config is updated; an application modifying #snd_config
+ * directly should set the environment variable
+ * \c LIBASOUND_CONFIG_MEMO to 0.
+ *
  * \par Errors:
  * <dl>
  * <dt>-ENOENT<dd>An id in \a key or an alias id does not exist.
@@ -5802,7 +7854,11 @@ int snd_config_search_definition(snd_config_t *config,
 		snd_config_unlock();
 		return err;
 	}
-	err = snd_config_expand(conf, config, args, NULL, result);
+	/* nested searches while recording the dependencies are not stored */
+	if (config == snd_config && !config_deps && config_memo_enabled())
+		err = config_memo_expand(conf, config, args, result);
+	else
+		err = snd_config_expand(conf, config, args, NULL, result);
 	snd_config_unlock();
 	return err;
 }
@@ -80,6 +80,10 @@
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <sys/stat.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 /**
  * \brief Gets the boolean value from the given ASCII string.
@@ -313,6 +317,7 @@ int snd_func_getenv(snd_config_t **dst, snd_config_t *root, snd_config_t *src,
 					err = -EINVAL;
 					goto __error;
 				}
+				snd_config_cache_env(ptr);
 				res = getenv(ptr);
 				if (res != NULL && *res != '\0')
 					goto __ok;
@@ -631,6 +636,189 @@ static int open_ctl(long card, snd_ctl_t **ctl)
 	return snd_ctl_open(ctl, name, 0);
 }
 
+/*
+ * Card information cache shared by the card functions.  Expanding one
+ * definition evaluates several functions for the same card, so the
+ * control device is opened once per card to read the card info and the
+ * playback info of subdevice 0 of all PCM devices.  The cache is dropped
+ * when the device directory changes, i.e. when a card is added or
+ * removed, and it is not used when the directory cannot be checked.
+ */
+struct card_cache_pcm {
+	int device;
+	int err;		/* of snd_ctl_pcm_info() */
+	snd_pcm_info_t info;
+};
+
+struct card_cache {
+	snd_ctl_card_info_t info;
+	unsigned int pcms;
+	struct card_cache_pcm *pcm;
+	int pcm_err;		/* of snd_ctl_pcm_next_device() */
+};
+
+static struct card_cache *card_cache[SND_MAX_CARDS];
+static struct stat card_cache_stamp;
+
+#ifdef HAVE_LIBPTHREAD
+static pthread_mutex_t card_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void card_cache_lock(void)
+{
+	pthread_mutex_lock(&card_cache_mutex);
+}
+
+static inline void card_cache_unlock(void)
+{
+	pthread_mutex_unlock(&card_cache_mutex);
+}
+#else
+static inline void card_cache_lock(void) {}
+static inline void card_cache_unlock(void) {}
+#endif
+
+static void card_cache_flush(void)
+{
+	int card;
+
+	for (card = 0; card < SND_MAX_CARDS; card++) {
+		if (card_cache[card]) {
+			free(card_cache[card]->pcm);
+			free(card_cache[card]);
+			card_cache[card] = NULL;
+		}
+	}
+}
+
+/* drop the cache when the cards changed; returns 0 if it cannot be used */
+static int card_cache_check(void)
+{
+	struct stat st;
+
+	if (stat(ALSA_DEVICE_DIRECTORY, &st) < 0) {
+		card_cache_flush();
+		return 0;
+	}
+	if (st.st_dev != card_cache_stamp.st_dev ||
+	    st.st_ino != card_cache_stamp.st_ino ||
+	    st.st_mtim.tv_sec != card_cache_stamp.st_mtim.tv_sec ||
+	    st.st_mtim.tv_nsec != card_cache_stamp.st_mtim.tv_nsec) {
+		card_cache_flush();
+		card_cache_stamp = st;
+	}
+	return 1;
+}
+
+static int card_cache_read(snd_ctl_t *ctl, struct card_cache *c)
+{
+	struct card_cache_pcm *pcm;
+	int err, dev = -1;
+
+	err = snd_ctl_card_info(ctl, &c->info);
+	if (err < 0) {
+		snd_error(CORE, "snd_ctl_card_info error: %s", snd_strerror(err));
+		return err;
+	}
+#ifdef BUILD_PCM
+	while ((c->pcm_err = snd_ctl_pcm_next_device(ctl, &dev)) >= 0 &&
+	       dev >= 0) {
+		pcm = realloc(c->pcm, (c->pcms + 1) * sizeof(*pcm));
+		if (!pcm)
+			return -ENOMEM;
+		c->pcm = pcm;
+		pcm += c->pcms++;
+		memset(pcm, 0, sizeof(*pcm));
+		pcm->device = dev;
+		snd_pcm_info_set_device(&pcm->info, dev);
+		pcm->err = snd_ctl_pcm_info(ctl, &pcm->info);
+	}
+#endif
+	return 0;
+}
+
+/*
+ * The cache entry of a card, called with the cache lock held.  The lock is
+ * released while the control device is read, as opening it evaluates the
+ * configuration.
+ */
+static int card_cache_get(int card, struct card_cache **cp)
+{
+	struct card_cache *c;
+	snd_ctl_t *ctl;
+	int err;
+
+	if (card_cache_check() && card_cache[card]) {
+		*cp = card_cache[card];
+		return 0;
+	}
+	card_cache_unlock();
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		err = -ENOMEM;
+		goto _err;
+	}
+	err = open_ctl(card, &ctl);
+	if (err < 0) {
+		snd_error(CORE, "could not open control for card %i", card);
+		goto _err;
+	}
+	err = card_cache_read(ctl, c);
+	snd_ctl_close(ctl);
+	if (err < 0)
+		goto _err;
+	card_cache_lock();
+	/* without the directory check, the next call drops the entry */
+	if (card_cache_check() && card_cache[card]) {
+		free(c->pcm);
+		free(c);
+	} else {
+		card_cache[card] = c;
+	}
+	*cp = card_cache[card];
+	return 0;
+
+ _err:
+	if (c)
+		free(c->pcm);
+	free(c);
+	card_cache_lock();
+	return err;
+}
+
+static int card_cache_info(int card, snd_ctl_card_info_t *info)
+{
+	struct card_cache *c;
+	int err;
+
+	if (card < 0 || card >= SND_MAX_CARDS)
+		return -EINVAL;
+	card_cache_lock();
+	err = card_cache_get(card, &c);
+	if (err >= 0)
+		*info = c->info;
+	card_cache_unlock();
+	return err;
+}
+
+/* the index of the card with the given number or id */
+static int card_cache_index(const char *string)
+{
+	snd_ctl_card_info_t info;
+	int card = -1;
+
+	/* an index or a device name, see snd_card_get_index() */
+	if (!string || *string == '\0' || *string == '/' ||
+	    (isdigit(string[0]) && (string[1] == '\0' ||
+				    (isdigit(string[1]) && string[2] == '\0'))))
+		return snd_card_get_index(string);
+	while (snd_card_next(&card) >= 0 && card >= 0) {
+		if (card_cache_info(card, &info) >= 0 &&
+		    strcmp((const char *)info.id, string) == 0)
+			return card;
+	}
+	return -ENODEV;
+}
+
 #if 0
 static int string_from_integer(char **dst, long v)
 {
@@ -751,33 +939,19 @@ SND_DLSYM_BUILD_VERSION(snd_func_private_integer, SND_CONFIG_DLSYM_VERSION_EVALU
 #ifndef DOC_HIDDEN
 int snd_determine_driver(int card, char **driver)
 {
-	snd_ctl_t *ctl = NULL;
 	snd_ctl_card_info_t info = {0};
 	char *res = NULL;
 	int err;
 
 	assert(card >= 0 && card <= SND_MAX_CARDS);
-	err = open_ctl(card, &ctl);
-	if (err < 0) {
-		snd_error(CORE, "could not open control for card %i", card);
-		goto __error;
-	}
-	err = snd_ctl_card_info(ctl, &info);
-	if (err < 0) {
-		snd_error(CORE, "snd_ctl_card_info error: %s", snd_strerror(err));
-		goto __error;
-	}
+	err = card_cache_info(card, &info);
+	if (err < 0)
+		return err;
 	res = strdup(snd_ctl_card_info_get_driver(&info));
 	if (res == NULL)
-		err = -ENOMEM;
-	else {
-		*driver = res;
-		err = 0;
-	}
-      __error:
-	if (ctl)
-		snd_ctl_close(ctl);
-	return err;
+		return -ENOMEM;
+	*driver = res;
+	return 0;
 }
 #endif
 
@@ -850,7 +1024,7 @@ static int parse_card(snd_config_t *root, snd_config_t *src,
 		snd_error(CORE, "field card is not an integer or a string");
 		return err;
 	}
-	card = snd_card_get_index(str);
+	card = card_cache_index(str);
 	if (card < 0)
 		snd_error(CORE, "cannot find card '%s'", str);
 	free(str);
@@ -949,7 +1123,6 @@ SND_DLSYM_BUILD_VERSION(snd_func_card_driver, SND_CONFIG_DLSYM_VERSION_EVALUATE)
 int snd_func_card_id(snd_config_t **dst, snd_config_t *root, snd_config_t *src,
 		     snd_config_t *private_data)
 {
-	snd_ctl_t *ctl = NULL;
 	snd_ctl_card_info_t info = {0};
 	const char *id;
 	int card, err;
@@ -957,23 +1130,13 @@ int snd_func_card_id(snd_config_t **dst, snd_config_t *root, snd_config_t *src,
 	card = parse_card(root, src, private_data);
 	if (card < 0)
 		return card;
-	err = open_ctl(card, &ctl);
-	if (err < 0) {
-		snd_error(CORE, "could not open control for card %i", card);
-		goto __error;
-	}
-	err = snd_ctl_card_info(ctl, &info);
-	if (err < 0) {
-		snd_error(CORE, "snd_ctl_card_info error: %s", snd_strerror(err));
-		goto __error;
-	}
+	err = card_cache_info(card, &info);
+	if (err < 0)
+		return err;
 	err = snd_config_get_id(src, &id);
 	if (err >= 0)
 		err = snd_config_imake_string(dst, id,
 					      snd_ctl_card_info_get_id(&info));
-      __error:
-	if (ctl)
-		snd_ctl_close(ctl);
 	return err;
 }
 #ifndef DOC_HIDDEN
@@ -1000,7 +1163,6 @@ SND_DLSYM_BUILD_VERSION(snd_func_card_id, SND_CONFIG_DLSYM_VERSION_EVALUATE);
 int snd_func_card_name(snd_config_t **dst, snd_config_t *root,
 		       snd_config_t *src, snd_config_t *private_data)
 {
-	snd_ctl_t *ctl = NULL;
 	snd_ctl_card_info_t info = {0};
 	const char *id;
 	int card, err;
@@ -1008,23 +1170,13 @@ int snd_func_card_name(snd_config_t **dst, snd_config_t *root,
 	card = parse_card(root, src, private_data);
 	if (card < 0)
 		return card;
-	err = open_ctl(card, &ctl);
-	if (err < 0) {
-		snd_error(CORE, "could not open control for card %i", card);
-		goto __error;
-	}
-	err = snd_ctl_card_info(ctl, &info);
-	if (err < 0) {
-		snd_error(CORE, "snd_ctl_card_info error: %s", snd_strerror(err));
-		goto __error;
-	}
+	err = card_cache_info(card, &info);
+	if (err < 0)
+		return err;
 	err = snd_config_get_id(src, &id);
 	if (err >= 0)
 		err = snd_config_imake_safe_string(dst, id,
 					snd_ctl_card_info_get_name(&info));
-      __error:
-	if (ctl)
-		snd_ctl_close(ctl);
 	return err;
 }
 #ifndef DOC_HIDDEN
@@ -1041,6 +1193,77 @@ SND_DLSYM_BUILD_VERSION(snd_func_card_name, SND_CONFIG_DLSYM_VERSION_EVALUATE);
 
 #ifdef BUILD_PCM
 
+/* the PCM info of the playback subdevice 0 of a device is cached */
+static int card_cache_pcm_info(int card, snd_pcm_info_t *info)
+{
+	struct card_cache *c;
+	snd_ctl_t *ctl;
+	unsigned int k;
+	int err;
+
+	if (card >= 0 && card < SND_MAX_CARDS &&
+	    snd_pcm_info_get_subdevice(info) == 0 &&
+	    snd_pcm_info_get_stream(info) == SND_PCM_STREAM_PLAYBACK) {
+		card_cache_lock();
+		err = card_cache_get(card, &c);
+		if (err < 0) {
+			card_cache_unlock();
+			return err;
+		}
+		for (k = 0; k < c->pcms; k++) {
+			if (c->pcm[k].device != (int)snd_pcm_info_get_device(info))
+				continue;
+			err = c->pcm[k].err;
+			if (err >= 0)
+				*info = c->pcm[k].info;
+			card_cache_unlock();
+			return err;
+		}
+		card_cache_unlock();
+	}
+	err = open_ctl(card, &ctl);
+	if (err < 0) {
+		snd_error(CORE, "could not open control for card %i", card);
+		return err;
+	}
+	err = snd_ctl_pcm_info(ctl, info);
+	snd_ctl_close(ctl);
+	return err;
+}
+
+/* look for the index-th PCM device of the class, counting in idx */
+static int card_cache_pcm_class(int card, long class, long index,
+				int *idx, int *dev)
+{
+	struct card_cache *c;
+	unsigned int k;
+	int err;
+
+	card_cache_lock();
+	err = card_cache_get(card, &c);
+	if (err < 0) {
+		card_cache_unlock();
+		return err;
+	}
+	err = 0;
+	for (k = 0; k < c->pcms; k++) {
+		if (c->pcm[k].err < 0)
+			continue;
+		if (snd_pcm_info_get_class(&c->pcm[k].info) == (snd_pcm_class_t)class &&
+		    index == (*idx)++) {
+			*dev = c->pcm[k].device;
+			err = 1;
+			break;
+		}
+	}
+	if (!err && c->pcm_err < 0) {
+		snd_error(CORE, "could not get next pcm for card %i", card);
+		err = c->pcm_err;
+	}
+	card_cache_unlock();
+	return err;
+}
+
 /**
  * \brief Returns the pcm identification of a device.
  * \param dst The function puts the handle to the result configuration node
@@ -1064,7 +1287,6 @@ SND_DLSYM_BUILD_VERSION(snd_func_card_name, SND_CONFIG_DLSYM_VERSION_EVALUATE);
 int snd_func_pcm_id(snd_config_t **dst, snd_config_t *root, snd_config_t *src, void *private_data)
 {
 	snd_config_t *n;
-	snd_ctl_t *ctl = NULL;
 	snd_pcm_info_t info = {0};
 	const char *id;
 	long card, device, subdevice = 0;
@@ -1100,14 +1322,9 @@ int snd_func_pcm_id(snd_config_t **dst, snd_config_t *root, snd_config_t *src, v
 			goto __error;
 		}
 	}
-	err = open_ctl(card, &ctl);
-	if (err < 0) {
-		snd_error(CORE, "could not open control for card %li", card);
-		goto __error;
-	}
 	snd_pcm_info_set_device(&info, device);
 	snd_pcm_info_set_subdevice(&info, subdevice);
-	err = snd_ctl_pcm_info(ctl, &info);
+	err = card_cache_pcm_info(card, &info);
 	if (err < 0) {
 		snd_error(CORE, "snd_ctl_pcm_info error: %s", snd_strerror(err));
 		goto __error;
@@ -1117,8 +1334,6 @@ int snd_func_pcm_id(snd_config_t **dst, snd_config_t *root, snd_config_t *src, v
 		err = snd_config_imake_string(dst, id,
 						snd_pcm_info_get_id(&info));
       __error:
-	if (ctl)
-		snd_ctl_close(ctl);
 	return err;
 }
 #ifndef DOC_HIDDEN
@@ -1148,10 +1363,8 @@ SND_DLSYM_BUILD_VERSION(snd_func_pcm_id, SND_CONFIG_DLSYM_VERSION_EVALUATE);
 int snd_func_pcm_args_by_class(snd_config_t **dst, snd_config_t *root, snd_config_t *src, void *private_data)
 {
 	snd_config_t *n;
-	snd_ctl_t *ctl = NULL;
-	snd_pcm_info_t info = {0};
 	const char *id;
-	int card = -1, dev;
+	int card = -1, dev = -1;
 	long class, index;
 	int idx = 0;
 	int err;
@@ -1195,36 +1408,17 @@ int snd_func_pcm_args_by_class(snd_config_t **dst, snd_config_t *root, snd_confi
 		}
 		if (card < 0)
 			break;
-		err = open_ctl(card, &ctl);
-		if (err < 0) {
-			snd_error(CORE, "could not open control for card %i", card);
+		err = card_cache_pcm_class(card, class, index, &idx, &dev);
+		if (err < 0)
+			goto __out;
+		if (err > 0) {
+			err = 0;
 			goto __out;
 		}
-		dev = -1;
-		while(1) {
-			err = snd_ctl_pcm_next_device(ctl, &dev);
-			if (err < 0) {
-				snd_error(CORE, "could not get next pcm for card %i", card);
-				goto __out;
-			}
-			if (dev < 0)
-				break;
-			snd_pcm_info_set_device(&info, dev);
-			err = snd_ctl_pcm_info(ctl, &info);
-			if (err < 0)
-				continue;
-			if (snd_pcm_info_get_class(&info) == (snd_pcm_class_t)class &&
-					index == idx++)
-				goto __out;
-		}
-		snd_ctl_close(ctl);
-		ctl = NULL;
 	}
 	err = -ENODEV;
 
       __out:
-	if (ctl)
-		snd_ctl_close(ctl);
 	if (err < 0)
 		return err;
 	if((err = snd_config_get_id(src, &id)) >= 0) {
@@ -32,6 +32,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #ifndef DOC_HIDDEN
 
@@ -41,6 +42,7 @@ typedef struct _snd_input_ops {
 	char *(*(gets))(snd_input_t *input, char *str, size_t size);
 	int (*getch)(snd_input_t *input);
 	int (*ungetch)(snd_input_t *input, int c);
+	ssize_t (*block)(snd_input_t *input, const char **ptr);
 } snd_input_ops_t;
 
 struct _snd_input {
@@ -117,17 +119,36 @@ int snd_input_ungetc(snd_input_t *input, int c)
 	return input->ops->ungetch(input, c);
 }
 
+#ifndef DOC_HIDDEN
+/*
+ * Read the next contiguous block of the input; the block stays valid until
+ * the next call or the input close.  Returns the block size, zero at the
+ * end of the input or a negative error code.
+ */
+ssize_t _snd_input_block(snd_input_t *input, const char **ptr)
+{
+	return input->ops->block(input, ptr);
+}
+#endif
+
 #ifndef DOC_HIDDEN
 typedef struct _snd_input_stdio {
 	int close;
 	FILE *fp;
+	char *block;
+	size_t block_size;
 } snd_input_stdio_t;
 
+/* regular files up to this size are read with a single block */
+#define SND_INPUT_BLOCK_MAX	(1024 * 1024)
+#define SND_INPUT_BLOCK_MIN	4096
+
 static int snd_input_stdio_close(snd_input_t *input ATTRIBUTE_UNUSED)
 {
 	snd_input_stdio_t *stdio = input->private_data;
 	if (stdio->close)
 		fclose(stdio->fp);
+	free(stdio->block);
 	free(stdio);
 	return 0;
 }
@@ -157,12 +178,38 @@ static int snd_input_stdio_ungetc(snd_input_t *input, int c)
 	return ungetc(c, stdio->fp);
 }
 
+static ssize_t snd_input_stdio_block(snd_input_t *input, const char **ptr)
+{
+	snd_input_stdio_t *stdio = input->private_data;
+	size_t size;
+
+	if (!stdio->block) {
+		struct stat st;
+		size = SND_INPUT_BLOCK_MIN;
+		/* one extra byte to see the end of file in the same read */
+		if (fstat(fileno(stdio->fp), &st) == 0 && S_ISREG(st.st_mode) &&
+		    st.st_size >= SND_INPUT_BLOCK_MIN &&
+		    st.st_size < SND_INPUT_BLOCK_MAX)
+			size = st.st_size + 1;
+		stdio->block = malloc(size);
+		if (!stdio->block)
+			return -ENOMEM;
+		stdio->block_size = size;
+	}
+	size = fread(stdio->block, 1, stdio->block_size, stdio->fp);
+	if (size == 0)
+		return ferror(stdio->fp) ? -EIO : 0;
+	*ptr = stdio->block;
+	return size;
+}
+
 static const snd_input_ops_t snd_input_stdio_ops = {
 	.close		= snd_input_stdio_close,
 	.scan		= snd_input_stdio_scan,
 	.gets		= snd_input_stdio_gets,
 	.getch		= snd_input_stdio_getc,
 	.ungetch	= snd_input_stdio_ungetc,
+	.block		= snd_input_stdio_block,
 };
 #endif
 
@@ -283,12 +330,24 @@ static int snd_input_buffer_ungetc(snd_input_t *input, int c)
 	return c;
 }
 
+static ssize_t snd_input_buffer_block(snd_input_t *input, const char **ptr)
+{
+	snd_input_buffer_t *buffer = input->private_data;
+	size_t size = buffer->size;
+
+	*ptr = (const char *)buffer->ptr;
+	buffer->ptr += size;
+	buffer->size = 0;
+	return size;
+}
+
 static const snd_input_ops_t snd_input_buffer_ops = {
 	.close		= snd_input_buffer_close,
 	.scan		= snd_input_buffer_scan,
 	.gets		= snd_input_buffer_gets,
 	.getch		= snd_input_buffer_getc,
 	.ungetch	= snd_input_buffer_ungetc,
+	.block		= snd_input_buffer_block,
 };
 #endif
 
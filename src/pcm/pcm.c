@@ -2083,6 +2083,7 @@ static const char *const snd_pcm_type_names[] = {
 	PCMTYPE(IOPLUG),
 	PCMTYPE(EXTPLUG),
 	PCMTYPE(MMAP_EMUL),
+	PCMTYPE(DSP),
 };
 
 static const char *const snd_pcm_subformat_names[] = {
@@ -2556,6 +2557,7 @@ static const char *const build_in_pcms[] = {
 	"adpcm", "alaw", "copy", "dmix", "file", "hooks", "hw", "ladspa", "lfloat",
 	"linear", "meter", "mulaw", "multi", "null", "empty", "plug", "rate", "route", "share",
 	"shm", "dsnoop", "dshare", "asym", "iec958", "softvol", "mmap_emul",
+	"dsp",
 	NULL
 };
 
@@ -0,0 +1,792 @@
+/**
+ * \file pcm/pcm_dsp.c
+ * \ingroup PCM_Plugins
+ * \brief PCM DSP Plugin Interface
+ * \date 2026
+ */
+/*
+ *  PCM - DSP module host
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "pcm_local.h"
+#include "pcm_plugin.h"
+#include "pcm_dsp.h"
+
+#ifndef PIC
+/* entry for static linking */
+const char *_snd_module_pcm_dsp = "";
+#endif
+
+#ifndef DOC_HIDDEN
+typedef struct {
+	snd_pcm_dsp_open_func_t open_func;
+	void *obj;
+	snd_pcm_dsp_ops_t ops;
+	int initialized;
+	snd_pcm_uframes_t latency;
+} snd_pcm_dsp_module_t;
+
+typedef struct {
+	/* This field need to be the first */
+	snd_pcm_plugin_t plug;
+	snd_pcm_fast_ops_t fops;
+	unsigned int modules_count;
+	snd_pcm_dsp_module_t *modules;
+	unsigned int flags;		/* flags common to all modules */
+	snd_pcm_format_t format;	/* forced working format */
+	snd_pcm_uframes_t block_size;	/* largest preferred block */
+	int planar;			/* layout passed to the modules */
+	snd_pcm_uframes_t max_frames;
+	snd_pcm_uframes_t latency;	/* sum of the module latencies */
+	unsigned char *buf;		/* scratch when the areas don't fit the layout */
+	snd_pcm_channel_area_t *buf_areas;
+	void **bufs;
+} snd_pcm_dsp_t;
+
+extern int SND_PCM_DSP_PLUGIN_ENTRY(gain) (unsigned int version, void **objp,
+					   snd_pcm_dsp_ops_t *ops,
+					   const snd_config_t *conf);
+#endif
+
+static void snd_pcm_dsp_free_modules(snd_pcm_dsp_t *dsp)
+{
+	unsigned int idx;
+
+	for (idx = 0; idx < dsp->modules_count; idx++) {
+		snd_pcm_dsp_module_t *mod = &dsp->modules[idx];
+		if (mod->initialized && mod->ops.free)
+			mod->ops.free(mod->obj);
+		mod->initialized = 0;
+	}
+	free(dsp->buf);
+	dsp->buf = NULL;
+	free(dsp->buf_areas);
+	dsp->buf_areas = NULL;
+	free(dsp->bufs);
+	dsp->bufs = NULL;
+}
+
+static void snd_pcm_dsp_close_modules(snd_pcm_dsp_t *dsp)
+{
+	unsigned int idx;
+
+	snd_pcm_dsp_free_modules(dsp);
+	for (idx = 0; idx < dsp->modules_count; idx++) {
+		snd_pcm_dsp_module_t *mod = &dsp->modules[idx];
+		if (mod->ops.close)
+			mod->ops.close(mod->obj);
+#ifdef PIC
+		snd_dlobj_cache_put(mod->open_func);
+#endif
+	}
+	free(dsp->modules);
+	dsp->modules = NULL;
+	dsp->modules_count = 0;
+}
+
+static int snd_pcm_dsp_close(snd_pcm_t *pcm)
+{
+	snd_pcm_dsp_t *dsp = pcm->private_data;
+
+	snd_pcm_dsp_close_modules(dsp);
+	return snd_pcm_generic_close(pcm);
+}
+
+static int snd_pcm_dsp_hw_refine_cprepare(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
+{
+	snd_pcm_dsp_t *dsp = pcm->private_data;
+	snd_pcm_access_mask_t access_mask = { SND_PCM_ACCBIT_SHM };
+	snd_pcm_format_mask_t format_mask = { { 0 } };
+	int err;
+
+	err = _snd_pcm_hw_param_set_mask(params, SND_PCM_HW_PARAM_ACCESS,
+					 &access_mask);
+	if (err < 0)
+		return err;
+	if (dsp->format != SND_PCM_FORMAT_UNKNOWN) {
+		snd_pcm_format_mask_set(&format_mask, dsp->format);
+	} else {
+		if (dsp->flags & SND_PCM_DSP_FLAG_S32)
+			snd_pcm_format_mask_set(&format_mask, SND_PCM_FORMAT_S32);
+		if (dsp->flags & SND_PCM_DSP_FLAG_FLOAT)
+			snd_pcm_format_mask_set(&format_mask, SND_PCM_FORMAT_FLOAT);
+	}
+	err = _snd_pcm_hw_param_set_mask(params, SND_PCM_HW_PARAM_FORMAT,
+					 &format_mask);
+	if (err < 0)
+		return err;
+	err = _snd_pcm_hw_params_set_subformat(params, SND_PCM_SUBFORMAT_STD);
+	if (err < 0)
+		return err;
+	if (dsp->block_size > 0) {
+		err = _snd_pcm_hw_param_set_min(params, SND_PCM_HW_PARAM_PERIOD_SIZE,
+						dsp->block_size, 0);
+		if (err < 0)
+			return err;
+	}
+	params->info &= ~(SND_PCM_INFO_MMAP | SND_PCM_INFO_MMAP_VALID);
+	return 0;
+}
+
+static int snd_pcm_dsp_hw_refine_sprepare(snd_pcm_t *pcm ATTRIBUTE_UNUSED, snd_pcm_hw_params_t *sparams)
+{
+	snd_pcm_access_mask_t saccess_mask = { SND_PCM_ACCBIT_MMAP };
+	_snd_pcm_hw_params_any(sparams);
+	_snd_pcm_hw_param_set_mask(sparams, SND_PCM_HW_PARAM_ACCESS,
+				   &saccess_mask);
+	return 0;
+}
+
+static int snd_pcm_dsp_hw_refine_schange(snd_pcm_t *pcm ATTRIBUTE_UNUSED, snd_pcm_hw_params_t *params,
+					 snd_pcm_hw_params_t *sparams)
+{
+	int err;
+	unsigned int links = ~SND_PCM_HW_PARBIT_ACCESS;
+	err = _snd_pcm_hw_params_refine(sparams, links, params);
+	if (err < 0)
+		return err;
+	return 0;
+}
+
+static int snd_pcm_dsp_hw_refine_cchange(snd_pcm_t *pcm ATTRIBUTE_UNUSED, snd_pcm_hw_params_t *params,
+					 snd_pcm_hw_params_t *sparams)
+{
+	int err;
+	unsigned int links = ~SND_PCM_HW_PARBIT_ACCESS;
+	err = _snd_pcm_hw_params_refine(params, links, sparams);
+	if (err < 0)
+		return err;
+	return 0;
+}
+
+static int snd_pcm_dsp_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
+{
+	return snd_pcm_hw_refine_slave(pcm, params,
+				       snd_pcm_dsp_hw_refine_cprepare,
+				       snd_pcm_dsp_hw_refine_cchange,
+				       snd_pcm_dsp_hw_refine_sprepare,
+				       snd_pcm_dsp_hw_refine_schange,
+				       snd_pcm_generic_hw_refine);
+}
+
+static int snd_pcm_dsp_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
+{
+	snd_pcm_dsp_t *dsp = pcm->private_data;
+	snd_pcm_access_t access;
+	snd_pcm_format_t format;
+	snd_pcm_uframes_t period_size;
+	unsigned int channels, rate;
+	snd_pcm_dsp_info_t info;
+	unsigned int idx, width;
+	int err;
+
+	err = snd_pcm_hw_params_slave(pcm, params,
+				      snd_pcm_dsp_hw_refine_cchange,
+				      snd_pcm_dsp_hw_refine_sprepare,
+				      snd_pcm_dsp_hw_refine_schange,
+				      snd_pcm_generic_hw_params);
+	if (err < 0)
+		return err;
+
+	snd_pcm_dsp_free_modules(dsp);
+	INTERNAL(snd_pcm_hw_params_get_format)(params, &format);
+	INTERNAL(snd_pcm_hw_params_get_channels)(params, &channels);
+	INTERNAL(snd_pcm_hw_params_get_rate)(params, &rate, 0);
+	INTERNAL(snd_pcm_hw_params_get_period_size)(params, &period_size, 0);
+	/* prefer the layout of the destination, so no scratch copy is needed */
+	if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
+		access = dsp->plug.gen.slave->access;
+	else
+		INTERNAL(snd_pcm_hw_params_get_access)(params, &access);
+	if (!(dsp->flags & SND_PCM_DSP_FLAG_INTERLEAVED))
+		dsp->planar = 1;
+	else if (!(dsp->flags & SND_PCM_DSP_FLAG_PLANAR))
+		dsp->planar = 0;
+	else
+		dsp->planar = access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED ||
+			      access == SND_PCM_ACCESS_RW_NONINTERLEAVED;
+	dsp->max_frames = period_size;
+	if (dsp->max_frames < dsp->block_size)
+		dsp->max_frames = dsp->block_size;
+
+	width = snd_pcm_format_physical_width(format);
+	dsp->buf = malloc(dsp->max_frames * channels * width / 8);
+	dsp->buf_areas = calloc(channels, sizeof(*dsp->buf_areas));
+	dsp->bufs = calloc(channels, sizeof(void *));
+	if (!dsp->buf || !dsp->buf_areas || !dsp->bufs) {
+		snd_pcm_dsp_free_modules(dsp);
+		return -ENOMEM;
+	}
+	for (idx = 0; idx < channels; idx++) {
+		snd_pcm_channel_area_t *a = &dsp->buf_areas[idx];
+		if (dsp->planar) {
+			a->addr = dsp->buf + idx * dsp->max_frames * width / 8;
+			a->first = 0;
+			a->step = width;
+		} else {
+			a->addr = dsp->buf;
+			a->first = idx * width;
+			a->step = channels * width;
+		}
+	}
+
+	info.format = format;
+	info.planar = dsp->planar;
+	info.channels = channels;
+	info.rate = rate;
+	info.max_frames = dsp->max_frames;
+	dsp->latency = 0;
+	for (idx = 0; idx < dsp->modules_count; idx++) {
+		snd_pcm_dsp_module_t *mod = &dsp->modules[idx];
+		err = mod->ops.init(mod->obj, &info);
+		if (err < 0) {
+			snd_error(PCM, "DSP module %u init failed", idx);
+			snd_pcm_dsp_free_modules(dsp);
+			return err;
+		}
+		mod->initialized = 1;
+		mod->latency = mod->ops.latency ? mod->ops.latency(mod->obj) : 0;
+		dsp->latency += mod->latency;
+	}
+	return 0;
+}
+
+static int snd_pcm_dsp_hw_free(snd_pcm_t *pcm)
+{
+	snd_pcm_dsp_t *dsp = pcm->private_data;
+
+	snd_pcm_dsp_free_modules(dsp);
+	return snd_pcm_generic_hw_free(pcm);
+}
+
+static int snd_pcm_dsp_init(snd_pcm_t *pcm)
+{
+	snd_pcm_dsp_t *dsp = pcm->private_data;
+	unsigned int idx;
+
+	for (idx = 0; idx < dsp->modules_count; idx++) {
+		snd_pcm_dsp_module_t *mod = &dsp->modules[idx];
+		if (mod->initialized && mod->ops.reset)
+			mod->ops.reset(mod->obj);
+	}
+	return 0;
+}
+
+static int snd_pcm_dsp_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
+{
+	snd_pcm_dsp_t *dsp = pcm->private_data;
+	int err;
+
+	err = snd_pcm_plugin_fast_ops.delay(pcm, delayp);
+	if (err < 0)
+		return err;
+	*delayp += dsp->latency;
+	return 0;
+}
+
+/* fill the buffer pointers when the areas match the module layout */
+static int snd_pcm_dsp_map_areas(snd_pcm_t *pcm,
+				 const snd_pcm_channel_area_t *areas,
+				 snd_pcm_uframes_t offset)
+{
+	snd_pcm_dsp_t *dsp = pcm->private_data;
+	unsigned int width = snd_pcm_format_physical_width(pcm->format);
+	unsigned int chn;
+
+	for (chn = 0; chn < pcm->channels; chn++) {
+		const snd_pcm_channel_area_t *a = &areas[chn];
+		if (dsp->planar) {
+			if (a->step != width || a->first % 8)
+				return 0;
+			dsp->bufs[chn] = snd_pcm_channel_area_addr(a, offset);
+		} else {
+			if (a->step != pcm->channels * width ||
+			    a->addr != areas[0].addr ||
+			    a->first != areas[0].first + chn * width)
+				return 0;
+		}
+	}
+	if (!dsp->planar) {
+		if (areas[0].first % 8)
+			return 0;
+		dsp->bufs[0] = snd_pcm_channel_area_addr(&areas[0], offset);
+	}
+	return 1;
+}
+
+static void snd_pcm_dsp_run(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
+{
+	snd_pcm_dsp_t *dsp = pcm->private_data;
+	unsigned int width = snd_pcm_format_physical_width(pcm->format);
+	unsigned int idx, chn, count;
+	snd_pcm_uframes_t done, n, chunk;
+
+	count = dsp->planar ? pcm->channels : 1;
+	for (idx = 0; idx < dsp->modules_count; idx++) {
+		snd_pcm_dsp_module_t *mod = &dsp->modules[idx];
+		chunk = mod->ops.block_size ? mod->ops.block_size : dsp->max_frames;
+		for (done = 0; done < frames; done += n) {
+			n = frames - done;
+			if (n > chunk)
+				n = chunk;
+			mod->ops.process(mod->obj, dsp->bufs, n);
+			for (chn = 0; chn < count; chn++)
+				dsp->bufs[chn] = (char *)dsp->bufs[chn] +
+					n * width / 8 * (dsp->planar ? 1 : pcm->channels);
+		}
+		for (chn = 0; chn < count; chn++)
+			dsp->bufs[chn] = (char *)dsp->bufs[chn] -
+				frames * width / 8 * (dsp->planar ? 1 : pcm->channels);
+	}
+}
+
+/* copy src to dst once and process the modules in place on dst */
+static void snd_pcm_dsp_transfer(snd_pcm_t *pcm,
+				 const snd_pcm_channel_area_t *dst_areas,
+				 snd_pcm_uframes_t dst_offset,
+				 const snd_pcm_channel_area_t *src_areas,
+				 snd_pcm_uframes_t src_offset,
+				 snd_pcm_uframes_t size)
+{
+	snd_pcm_dsp_t *dsp = pcm->private_data;
+	snd_pcm_uframes_t n;
+	unsigned int chn;
+
+	snd_pcm_areas_copy(dst_areas, dst_offset, src_areas, src_offset,
+			   pcm->channels, size, pcm->format);
+	if (snd_pcm_dsp_map_areas(pcm, dst_areas, dst_offset)) {
+		snd_pcm_dsp_run(pcm, size);
+		return;
+	}
+	/* the destination layout does not fit, go through the scratch */
+	while (size > 0) {
+		n = size;
+		if (n > dsp->max_frames)
+			n = dsp->max_frames;
+		snd_pcm_areas_copy(dsp->buf_areas, 0, dst_areas, dst_offset,
+				   pcm->channels, n, pcm->format);
+		for (chn = 0; chn < (dsp->planar ? pcm->channels : 1); chn++)
+			dsp->bufs[chn] = dsp->buf_areas[chn].addr;
+		snd_pcm_dsp_run(pcm, n);
+		snd_pcm_areas_copy(dst_areas, dst_offset, dsp->buf_areas, 0,
+				   pcm->channels, n, pcm->format);
+		dst_offset += n;
+		size -= n;
+	}
+}
+
+static snd_pcm_uframes_t
+snd_pcm_dsp_write_areas(snd_pcm_t *pcm,
+			const snd_pcm_channel_area_t *areas,
+			snd_pcm_uframes_t offset,
+			snd_pcm_uframes_t size,
+			const snd_pcm_channel_area_t *slave_areas,
+			snd_pcm_uframes_t slave_offset,
+			snd_pcm_uframes_t *slave_sizep)
+{
+	if (size > *slave_sizep)
+		size = *slave_sizep;
+	snd_pcm_dsp_transfer(pcm, slave_areas, slave_offset,
+			     areas, offset, size);
+	*slave_sizep = size;
+	return size;
+}
+
+static snd_pcm_uframes_t
+snd_pcm_dsp_read_areas(snd_pcm_t *pcm,
+		       const snd_pcm_channel_area_t *areas,
+		       snd_pcm_uframes_t offset,
+		       snd_pcm_uframes_t size,
+		       const snd_pcm_channel_area_t *slave_areas,
+		       snd_pcm_uframes_t slave_offset,
+		       snd_pcm_uframes_t *slave_sizep)
+{
+	if (size > *slave_sizep)
+		size = *slave_sizep;
+	snd_pcm_dsp_transfer(pcm, areas, offset,
+			     slave_areas, slave_offset, size);
+	*slave_sizep = size;
+	return size;
+}
+
+static void snd_pcm_dsp_dump(snd_pcm_t *pcm, snd_output_t *out)
+{
+	snd_pcm_dsp_t *dsp = pcm->private_data;
+	unsigned int idx;
+
+	snd_output_printf(out, "DSP PCM (%u modules)\n", dsp->modules_count);
+	for (idx = 0; idx < dsp->modules_count; idx++) {
+		snd_pcm_dsp_module_t *mod = &dsp->modules[idx];
+		snd_output_printf(out, "  Module %u: version 0x%06x, block %lu, latency %lu\n",
+				  idx, mod->ops.version,
+				  (unsigned long)mod->ops.block_size,
+				  (unsigned long)mod->latency);
+		if (mod->ops.dump) {
+			snd_output_printf(out, "    ");
+			mod->ops.dump(mod->obj, out);
+		}
+	}
+	if (pcm->setup) {
+		snd_output_printf(out, "  Layout: %s\n",
+				  dsp->planar ? "planar" : "interleaved");
+		snd_output_printf(out, "Its setup is:\n");
+		snd_pcm_dump_setup(pcm, out);
+	}
+	snd_output_printf(out, "Slave: ");
+	snd_pcm_dump(dsp->plug.gen.slave, out);
+}
+
+static const snd_pcm_ops_t snd_pcm_dsp_ops = {
+	.close = snd_pcm_dsp_close,
+	.info = snd_pcm_generic_info,
+	.hw_refine = snd_pcm_dsp_hw_refine,
+	.hw_params = snd_pcm_dsp_hw_params,
+	.hw_free = snd_pcm_dsp_hw_free,
+	.sw_params = snd_pcm_generic_sw_params,
+	.channel_info = snd_pcm_generic_channel_info,
+	.dump = snd_pcm_dsp_dump,
+	.nonblock = snd_pcm_generic_nonblock,
+	.async = snd_pcm_generic_async,
+	.mmap = snd_pcm_generic_mmap,
+	.munmap = snd_pcm_generic_munmap,
+	.query_chmaps = snd_pcm_generic_query_chmaps,
+	.get_chmap = snd_pcm_generic_get_chmap,
+	.set_chmap = snd_pcm_generic_set_chmap,
+};
+
+#ifdef PIC
+static int is_builtin_module(const char *type)
+{
+	return strcmp(type, "gain") == 0;
+}
+#endif
+
+static int snd_pcm_dsp_open_module(snd_pcm_dsp_module_t *mod, snd_config_t *conf)
+{
+	snd_config_iterator_t i, next;
+	const char *type = NULL, *lib = NULL;
+	char open_name[64], lib_name[128];
+	int err;
+
+	if (snd_config_get_type(conf) != SND_CONFIG_TYPE_COMPOUND) {
+		snd_error(PCM, "DSP module must be defined inside a compound");
+		return -EINVAL;
+	}
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id;
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+		if (strcmp(id, "type") == 0) {
+			err = snd_config_get_string(n, &type);
+			if (err < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return err;
+			}
+			continue;
+		}
+		if (strcmp(id, "lib") == 0) {
+			err = snd_config_get_string(n, &lib);
+			if (err < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return err;
+			}
+			continue;
+		}
+	}
+	if (!type) {
+		snd_error(PCM, "DSP module type is not defined");
+		return -EINVAL;
+	}
+	snprintf(open_name, sizeof(open_name), "_snd_pcm_dsp_%s_open", type);
+#ifdef PIC
+	if (!lib && !is_builtin_module(type)) {
+		snprintf(lib_name, sizeof(lib_name),
+			 "libasound_module_dsp_%s.so", type);
+		lib = lib_name;
+	}
+	mod->open_func = snd_dlobj_cache_get(lib, open_name, NULL, 1);
+#else
+	(void)lib_name;
+	if (lib || strcmp(type, "gain") != 0) {
+		snd_error(PCM, "DSP module %s is not available in the static build", type);
+		return -ENOENT;
+	}
+	mod->open_func = SND_PCM_DSP_PLUGIN_ENTRY(gain);
+#endif
+	if (!mod->open_func)
+		return -ENOENT;
+	err = mod->open_func(SND_PCM_DSP_VERSION, &mod->obj, &mod->ops, conf);
+	if (err >= 0 && (mod->ops.version >> 16) != SND_PCM_DSP_VERSION_MAJOR) {
+		snd_error(PCM, "DSP module %s has incompatible version 0x%x",
+			  type, mod->ops.version);
+		if (mod->ops.close)
+			mod->ops.close(mod->obj);
+		err = -EINVAL;
+	}
+	if (err >= 0 && (!mod->ops.init || !mod->ops.process)) {
+		snd_error(PCM, "DSP module %s has no init or process callback", type);
+		if (mod->ops.close)
+			mod->ops.close(mod->obj);
+		err = -EINVAL;
+	}
+	if (err < 0) {
+#ifdef PIC
+		snd_dlobj_cache_put(mod->open_func);
+#endif
+		mod->open_func = NULL;
+		return err;
+	}
+	return 0;
+}
+
+/**
+ * \brief Creates a new DSP PCM
+ * \param pcmp Returns created PCM handle
+ * \param name Name of PCM
+ * \param modules Compound with the DSP module definitions, in order
+ * \param format Working format (#SND_PCM_FORMAT_S32, #SND_PCM_FORMAT_FLOAT
+ *        or #SND_PCM_FORMAT_UNKNOWN to negotiate it)
+ * \param slave Slave PCM handle
+ * \param close_slave When set, the slave PCM handle is closed with copy PCM
+ * \retval zero on success otherwise a negative error code
+ * \warning Using of this function might be dangerous in the sense
+ *          of compatibility reasons. The prototype might be freely
+ *          changed in future.
+ */
+int snd_pcm_dsp_open(snd_pcm_t **pcmp, const char *name,
+		     snd_config_t *modules, snd_pcm_format_t format,
+		     snd_pcm_t *slave, int close_slave)
+{
+	snd_config_iterator_t i, next;
+	snd_pcm_t *pcm;
+	snd_pcm_dsp_t *dsp;
+	unsigned int count = 0;
+	int err;
+
+	assert(pcmp && modules && slave);
+	if (format != SND_PCM_FORMAT_UNKNOWN &&
+	    format != SND_PCM_FORMAT_S32 && format != SND_PCM_FORMAT_FLOAT)
+		return -EINVAL;
+	if (snd_config_get_type(modules) != SND_CONFIG_TYPE_COMPOUND) {
+		snd_error(PCM, "modules must be defined inside a compound");
+		return -EINVAL;
+	}
+	dsp = calloc(1, sizeof(snd_pcm_dsp_t));
+	if (!dsp)
+		return -ENOMEM;
+	snd_config_for_each(i, next, modules)
+		count++;
+	if (count == 0) {
+		snd_error(PCM, "empty module list is not accepted");
+		free(dsp);
+		return -EINVAL;
+	}
+	dsp->modules = calloc(count, sizeof(*dsp->modules));
+	if (!dsp->modules) {
+		free(dsp);
+		return -ENOMEM;
+	}
+	dsp->format = format;
+	dsp->flags = ~0U;
+	snd_config_for_each(i, next, modules) {
+		snd_pcm_dsp_module_t *mod = &dsp->modules[dsp->modules_count];
+		err = snd_pcm_dsp_open_module(mod, snd_config_iterator_entry(i));
+		if (err < 0) {
+			snd_pcm_dsp_close_modules(dsp);
+			free(dsp);
+			return err;
+		}
+		dsp->modules_count++;
+		dsp->flags &= mod->ops.flags;
+		if (mod->ops.block_size > dsp->block_size)
+			dsp->block_size = mod->ops.block_size;
+	}
+	if (!(dsp->flags & (SND_PCM_DSP_FLAG_S32 | SND_PCM_DSP_FLAG_FLOAT)) ||
+	    !(dsp->flags & (SND_PCM_DSP_FLAG_INTERLEAVED | SND_PCM_DSP_FLAG_PLANAR)) ||
+	    (format == SND_PCM_FORMAT_S32 && !(dsp->flags & SND_PCM_DSP_FLAG_S32)) ||
+	    (format == SND_PCM_FORMAT_FLOAT && !(dsp->flags & SND_PCM_DSP_FLAG_FLOAT))) {
+		snd_error(PCM, "DSP modules have no common format or layout");
+		snd_pcm_dsp_close_modules(dsp);
+		free(dsp);
+		return -EINVAL;
+	}
+
+	snd_pcm_plugin_init(&dsp->plug);
+	dsp->plug.read = snd_pcm_dsp_read_areas;
+	dsp->plug.write = snd_pcm_dsp_write_areas;
+	dsp->plug.init = snd_pcm_dsp_init;
+	dsp->plug.undo_read = snd_pcm_plugin_undo_read_generic;
+	dsp->plug.undo_write = snd_pcm_plugin_undo_write_generic;
+	dsp->plug.gen.slave = slave;
+	dsp->plug.gen.close_slave = close_slave;
+
+	err = snd_pcm_new(&pcm, SND_PCM_TYPE_DSP, name, slave->stream, slave->mode);
+	if (err < 0) {
+		snd_pcm_dsp_close_modules(dsp);
+		free(dsp);
+		return err;
+	}
+	pcm->ops = &snd_pcm_dsp_ops;
+	dsp->fops = snd_pcm_plugin_fast_ops;
+	dsp->fops.delay = snd_pcm_dsp_delay;
+	pcm->fast_ops = &dsp->fops;
+	pcm->private_data = dsp;
+	pcm->poll_fd = slave->poll_fd;
+	pcm->poll_events = slave->poll_events;
+	pcm->tstamp_type = slave->tstamp_type;
+	snd_pcm_set_hw_ptr(pcm, &dsp->plug.hw_ptr, -1, 0);
+	snd_pcm_set_appl_ptr(pcm, &dsp->plug.appl_ptr, -1, 0);
+	*pcmp = pcm;
+
+	return 0;
+}
+
+/*! \page pcm_plugins
+
+\section pcm_plugins_dsp Plugin: DSP
+
+This plugin runs a chain of in-process DSP modules. The modules implement
+the versioned interface from <alsa/pcm_dsp.h> and declare the sample
+formats (S32 and/or FLOAT in CPU endian) and buffer layouts (interleaved
+and/or planar) they accept, the preferred block size and the latency.
+
+The plugin works in a format accepted by all modules, with the same format
+on both sides, so the chain itself never converts samples. The data are
+copied once to the destination (the slave for playback, the application
+buffer for capture) and the modules process them there in place. A
+scratch buffer is used only when the destination layout does not match the
+one accepted by the modules.
+
+The period size is at least the largest preferred block size. The module
+latencies are added to the reported delay.
+
+The module of the given type is loaded from libasound_module_dsp_TYPE.so
+with the entry point _snd_pcm_dsp_TYPE_open (see SND_PCM_DSP_PLUGIN_ENTRY),
+unless lib is set. The whole module compound is passed to the module, which
+ignores the type and lib fields. The built-in gain module multiplies the
+samples by the gain value.
+
+\code
+pcm.name {
+	type dsp		# DSP module host
+	slave STR		# Slave name
+	# or
+	slave {			# Slave definition
+		pcm STR		# Slave PCM name
+		# or
+		pcm { }		# Slave PCM definition
+	}
+	[format STR]		# Working format, S32 or FLOAT (default negotiated)
+	modules {
+		N {		# Module N, processed in the order of definition
+			type STR	# Module type (for example gain)
+			[lib STR]	# Library with the module
+			...		# Module specific fields
+		}
+	}
+}
+\endcode
+
+\subsection pcm_plugins_dsp_funcref Function reference
+
+<UL>
+  <LI>snd_pcm_dsp_open()
+  <LI>_snd_pcm_dsp_open()
+</UL>
+
+*/
+
+/**
+ * \brief Creates a new DSP PCM
+ * \param pcmp Returns created PCM handle
+ * \param name Name of PCM
+ * \param root Root configuration node
+ * \param conf Configuration node with DSP PCM description
+ * \param stream Stream type
+ * \param mode Stream mode
+ * \retval zero on success otherwise a negative error code
+ * \warning Using of this function might be dangerous in the sense
+ *          of compatibility reasons. The prototype might be freely
+ *          changed in future.
+ */
+int _snd_pcm_dsp_open(snd_pcm_t **pcmp, const char *name,
+		      snd_config_t *root, snd_config_t *conf,
+		      snd_pcm_stream_t stream, int mode)
+{
+	snd_config_iterator_t i, next;
+	int err;
+	snd_pcm_t *spcm;
+	snd_config_t *slave = NULL, *sconf, *modules = NULL;
+	snd_pcm_format_t format = SND_PCM_FORMAT_UNKNOWN;
+	snd_config_for_each(i, next, conf) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		const char *id;
+		if (snd_config_get_id(n, &id) < 0)
+			continue;
+		if (snd_pcm_conf_generic_id(id))
+			continue;
+		if (strcmp(id, "slave") == 0) {
+			slave = n;
+			continue;
+		}
+		if (strcmp(id, "modules") == 0) {
+			modules = n;
+			continue;
+		}
+		if (strcmp(id, "format") == 0) {
+			const char *str;
+			err = snd_config_get_string(n, &str);
+			if (err < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return -EINVAL;
+			}
+			format = snd_pcm_format_value(str);
+			if (format != SND_PCM_FORMAT_S32 &&
+			    format != SND_PCM_FORMAT_FLOAT) {
+				snd_error(PCM, "format must be S32 or FLOAT");
+				return -EINVAL;
+			}
+			continue;
+		}
+		snd_error(PCM, "Unknown field %s", id);
+		return -EINVAL;
+	}
+	if (!slave) {
+		snd_error(PCM, "slave is not defined");
+		return -EINVAL;
+	}
+	if (!modules) {
+		snd_error(PCM, "modules are not defined");
+		return -EINVAL;
+	}
+	err = snd_pcm_slave_conf(root, slave, &sconf, 0);
+	if (err < 0)
+		return err;
+	err = snd_pcm_open_slave(&spcm, root, sconf, stream, mode, conf);
+	snd_config_delete(sconf);
+	if (err < 0)
+		return err;
+	err = snd_pcm_dsp_open(pcmp, name, modules, format, spcm, 1);
+	if (err < 0)
+		snd_pcm_close(spcm);
+	return err;
+}
+#ifndef DOC_HIDDEN
+SND_DLSYM_BUILD_VERSION(_snd_pcm_dsp_open, SND_PCM_DLSYM_VERSION);
+#endif
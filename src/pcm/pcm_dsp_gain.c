@@ -0,0 +1,138 @@
+/*
+ *  Gain module for the PCM DSP plugin
+ *
+ *   This library is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as
+ *   published by the Free Software Foundation; either version 2.1 of
+ *   the License, or (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "pcm_local.h"
+#include "pcm_dsp.h"
+
+struct gain_priv {
+	double gain;
+	snd_pcm_format_t format;
+	unsigned int channels;
+	int planar;
+};
+
+static int gain_init(void *obj, const snd_pcm_dsp_info_t *info)
+{
+	struct gain_priv *gain = obj;
+
+	gain->format = info->format;
+	gain->channels = info->channels;
+	gain->planar = info->planar;
+	return 0;
+}
+
+static void gain_process_float(float *buf, snd_pcm_uframes_t samples, float g)
+{
+	snd_pcm_uframes_t i;
+
+	for (i = 0; i < samples; i++)
+		buf[i] *= g;
+}
+
+static void gain_process_s32(int32_t *buf, snd_pcm_uframes_t samples, double g)
+{
+	snd_pcm_uframes_t i;
+	double v;
+
+	for (i = 0; i < samples; i++) {
+		v = buf[i] * g;
+		if (v > INT32_MAX)
+			v = INT32_MAX;
+		else if (v < INT32_MIN)
+			v = INT32_MIN;
+		buf[i] = (int32_t)v;
+	}
+}
+
+static void gain_process(void *obj, void *const *bufs, snd_pcm_uframes_t frames)
+{
+	struct gain_priv *gain = obj;
+	unsigned int idx, count;
+	snd_pcm_uframes_t samples;
+
+	if (gain->planar) {
+		count = gain->channels;
+		samples = frames;
+	} else {
+		count = 1;
+		samples = frames * gain->channels;
+	}
+	for (idx = 0; idx < count; idx++) {
+		if (gain->format == SND_PCM_FORMAT_FLOAT)
+			gain_process_float(bufs[idx], samples, gain->gain);
+		else
+			gain_process_s32(bufs[idx], samples, gain->gain);
+	}
+}
+
+static void gain_close(void *obj)
+{
+	free(obj);
+}
+
+static void gain_dump(void *obj, snd_output_t *out)
+{
+	struct gain_priv *gain = obj;
+
+	snd_output_printf(out, "Gain %g\n", gain->gain);
+}
+
+static const snd_pcm_dsp_ops_t gain_ops = {
+	.version = SND_PCM_DSP_VERSION,
+	.flags = SND_PCM_DSP_FLAG_S32 | SND_PCM_DSP_FLAG_FLOAT |
+		 SND_PCM_DSP_FLAG_INTERLEAVED | SND_PCM_DSP_FLAG_PLANAR,
+	.close = gain_close,
+	.init = gain_init,
+	.process = gain_process,
+	.dump = gain_dump,
+};
+
+int SND_PCM_DSP_PLUGIN_ENTRY(gain) (unsigned int version, void **objp,
+				    snd_pcm_dsp_ops_t *ops,
+				    const snd_config_t *conf)
+{
+	snd_config_iterator_t i, next;
+	struct gain_priv *gain;
+	double val = 1.0;
+
+	if ((version >> 16) != SND_PCM_DSP_VERSION_MAJOR)
+		return -EINVAL;
+	if (conf) {
+		snd_config_for_each(i, next, conf) {
+			snd_config_t *n = snd_config_iterator_entry(i);
+			const char *id;
+			if (snd_config_get_id(n, &id) < 0)
+				continue;
+			if (strcmp(id, "gain") == 0) {
+				if (snd_config_get_ireal(n, &val) < 0) {
+					snd_error(PCM, "Invalid type for %s", id);
+					return -EINVAL;
+				}
+				continue;
+			}
+		}
+	}
+	gain = calloc(1, sizeof(*gain));
+	if (!gain)
+		return -ENOMEM;
+	gain->gain = val;
+	*objp = gain;
+	*ops = gain_ops;
+	return 0;
+}
@@ -43,8 +43,28 @@ typedef struct snd_pcm_extplug_priv {
 	snd_pcm_extplug_t *data;
 	struct snd_ext_parm params[SND_PCM_EXTPLUG_HW_PARAMS];
 	struct snd_ext_parm sparams[SND_PCM_EXTPLUG_HW_PARAMS];
+	snd_pcm_fast_ops_t fops;
+	/* block mode: the input is collected into in_areas and the output
+	 * is taken from out_areas, which hold the previous processed block
+	 */
+	snd_pcm_uframes_t block_size;
+	snd_pcm_uframes_t block_pos;
+	int block_fed;			/* data was fed since the init */
+	int drain_stage;		/* EXTPLUG_DRAIN_XXX */
+	snd_pcm_uframes_t drain_ptr;	/* next frame of out_areas to drain */
+	void *in_buf, *out_buf;
+	snd_pcm_channel_area_t *in_areas, *out_areas;
+	unsigned int in_channels, out_channels;
+	snd_pcm_format_t in_format, out_format;
 } extplug_priv_t;
 
+/* drain stages of the block mode */
+enum {
+	EXTPLUG_DRAIN_NONE,	/* not draining */
+	EXTPLUG_DRAIN_HELD,	/* writing the rest of the held output block */
+	EXTPLUG_DRAIN_LAST,	/* writing the padded last block */
+};
+
 static const int hw_params_type[SND_PCM_EXTPLUG_HW_PARAMS] = {
 	[SND_PCM_EXTPLUG_HW_FORMAT] = SND_PCM_HW_PARAM_FORMAT,
 	[SND_PCM_EXTPLUG_HW_CHANNELS] = SND_PCM_HW_PARAM_CHANNELS
@@ -203,10 +223,18 @@ static int extplug_hw_refine(snd_pcm_hw_params_t *hw_params,
 	return change;
 }
 
+static snd_pcm_uframes_t extplug_block_size(extplug_priv_t *ext)
+{
+	if (ext->data->version < 0x010003)
+		return 0;
+	return ext->data->block_size;
+}
+
 static int snd_pcm_extplug_hw_refine_cprepare(snd_pcm_t *pcm,
 					      snd_pcm_hw_params_t *params)
 {
 	extplug_priv_t *ext = pcm->private_data;
+	snd_pcm_uframes_t block_size = extplug_block_size(ext);
 	int err;
 	snd_pcm_access_mask_t access_mask = { SND_PCM_ACCBIT_SHM };
 	err = _snd_pcm_hw_param_set_mask(params, SND_PCM_HW_PARAM_ACCESS,
@@ -216,6 +244,13 @@ static int snd_pcm_extplug_hw_refine_cprepare(snd_pcm_t *pcm,
 	err = extplug_hw_refine(params, ext->params);
 	if (err < 0)
 		return err;
+	/* a period should carry at least one block */
+	if (block_size > 0) {
+		err = _snd_pcm_hw_param_set_min(params, SND_PCM_HW_PARAM_PERIOD_SIZE,
+						block_size, 0);
+		if (err < 0)
+			return err;
+	}
 	params->info &= ~(SND_PCM_INFO_MMAP | SND_PCM_INFO_MMAP_VALID);
 	return 0;
 }
@@ -286,6 +321,92 @@ static int snd_pcm_extplug_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params
 	return err;
 }
 
+static void extplug_reset_blocks(extplug_priv_t *ext)
+{
+	ext->block_pos = 0;
+	ext->block_fed = 0;
+	ext->drain_stage = EXTPLUG_DRAIN_NONE;
+	snd_pcm_areas_silence(ext->out_areas, 0, ext->out_channels,
+			      ext->block_size, ext->out_format);
+}
+
+static void extplug_free_blocks(extplug_priv_t *ext)
+{
+	free(ext->in_buf);
+	free(ext->out_buf);
+	free(ext->in_areas);
+	free(ext->out_areas);
+	ext->in_buf = ext->out_buf = NULL;
+	ext->in_areas = ext->out_areas = NULL;
+	ext->block_size = 0;
+}
+
+static int extplug_alloc_block(snd_pcm_uframes_t frames,
+			       unsigned int channels, snd_pcm_format_t format,
+			       void **bufp, snd_pcm_channel_area_t **areasp)
+{
+	unsigned int width = snd_pcm_format_physical_width(format);
+	snd_pcm_channel_area_t *areas;
+	unsigned int c;
+
+	*bufp = malloc(frames * channels * width / 8);
+	*areasp = areas = calloc(channels, sizeof(*areas));
+	if (!*bufp || !areas)
+		return -ENOMEM;
+	for (c = 0; c < channels; c++) {
+		areas[c].addr = *bufp;
+		areas[c].first = c * width;
+		areas[c].step = channels * width;
+	}
+	return 0;
+}
+
+/*
+ * allocate the blocks for the block mode
+ */
+static int extplug_setup_blocks(extplug_priv_t *ext,
+				snd_pcm_hw_params_t *params)
+{
+	snd_pcm_extplug_t *data = ext->data;
+	snd_pcm_uframes_t period_size;
+	int err;
+
+	extplug_free_blocks(ext);
+	if (!extplug_block_size(ext))
+		return 0;
+	if (data->stream == SND_PCM_STREAM_PLAYBACK) {
+		ext->in_format = data->format;
+		ext->in_channels = data->channels;
+		ext->out_format = data->slave_format;
+		ext->out_channels = data->slave_channels;
+	} else {
+		ext->in_format = data->slave_format;
+		ext->in_channels = data->slave_channels;
+		ext->out_format = data->format;
+		ext->out_channels = data->channels;
+	}
+	/* the hw_params callback may have adapted the preferred size */
+	INTERNAL(snd_pcm_hw_params_get_period_size)(params, &period_size, NULL);
+	if (data->block_size > period_size) {
+		snd_error(PCM, "extplug: block size %lu exceeds the period size %lu",
+			  data->block_size, period_size);
+		return -EINVAL;
+	}
+	ext->block_size = data->block_size;
+	err = extplug_alloc_block(ext->block_size, ext->in_channels,
+				  ext->in_format, &ext->in_buf, &ext->in_areas);
+	if (err >= 0)
+		err = extplug_alloc_block(ext->block_size, ext->out_channels,
+					  ext->out_format, &ext->out_buf,
+					  &ext->out_areas);
+	if (err < 0) {
+		extplug_free_blocks(ext);
+		return err;
+	}
+	extplug_reset_blocks(ext);
+	return 0;
+}
+
 /*
  * hw_params callback
  */
@@ -314,7 +435,7 @@ static int snd_pcm_extplug_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params
 		if (err < 0)
 			return err;
 	}
-	return 0;
+	return extplug_setup_blocks(ext, params);
 }
 
 /*
@@ -324,12 +445,67 @@ static int snd_pcm_extplug_hw_free(snd_pcm_t *pcm)
 {
 	extplug_priv_t *ext = pcm->private_data;
 
+	extplug_free_blocks(ext);
 	snd_pcm_hw_free(ext->plug.gen.slave);
 	if (ext->data->callback->hw_free)
 		return ext->data->callback->hw_free(ext->data);
 	return 0;
 }
 
+/*
+ * block mode - process the complete input block into the output block
+ */
+static void extplug_process_block(extplug_priv_t *ext)
+{
+	snd_pcm_sframes_t result;
+
+	result = ext->data->callback->transfer(ext->data, ext->out_areas, 0,
+					       ext->in_areas, 0,
+					       ext->block_size);
+	if (result < 0)
+		result = 0;
+	if (result < (snd_pcm_sframes_t)ext->block_size)
+		snd_pcm_areas_silence(ext->out_areas, result, ext->out_channels,
+				      ext->block_size - result,
+				      ext->out_format);
+}
+
+/*
+ * block mode - feed the input block, return the previous output block
+ * and call transfer callback whenever the input block is complete
+ */
+static void extplug_transfer_blocks(extplug_priv_t *ext,
+				    const snd_pcm_channel_area_t *dst_areas,
+				    snd_pcm_uframes_t dst_offset,
+				    const snd_pcm_channel_area_t *src_areas,
+				    snd_pcm_uframes_t src_offset,
+				    snd_pcm_uframes_t size)
+{
+	snd_pcm_uframes_t frames;
+
+	if (size > 0)
+		ext->block_fed = 1;
+	while (size > 0) {
+		frames = ext->block_size - ext->block_pos;
+		if (frames > size)
+			frames = size;
+		snd_pcm_areas_copy(ext->in_areas, ext->block_pos,
+				   src_areas, src_offset,
+				   ext->in_channels, frames, ext->in_format);
+		snd_pcm_areas_copy(dst_areas, dst_offset,
+				   ext->out_areas, ext->block_pos,
+				   ext->out_channels, frames, ext->out_format);
+		ext->block_pos += frames;
+		if (ext->block_pos == ext->block_size) {
+			extplug_process_block(ext);
+			ext->block_pos = 0;
+		}
+		src_offset += frames;
+		dst_offset += frames;
+		size -= frames;
+	}
+}
+
 /*
  * write_areas skeleton - call transfer callback
  */
@@ -346,8 +522,12 @@ snd_pcm_extplug_write_areas(snd_pcm_t *pcm,
 
 	if (size > *slave_sizep)
 		size = *slave_sizep;
-	size = ext->data->callback->transfer(ext->data, slave_areas, slave_offset,
-					     areas, offset, size);
+	if (ext->block_size)
+		extplug_transfer_blocks(ext, slave_areas, slave_offset,
+					areas, offset, size);
+	else
+		size = ext->data->callback->transfer(ext->data, slave_areas, slave_offset,
+						     areas, offset, size);
 	*slave_sizep = size;
 	return size;
 }
@@ -368,8 +548,12 @@ snd_pcm_extplug_read_areas(snd_pcm_t *pcm,
 
 	if (size > *slave_sizep)
 		size = *slave_sizep;
-	size = ext->data->callback->transfer(ext->data, areas, offset,
-					     slave_areas, slave_offset, size);
+	if (ext->block_size)
+		extplug_transfer_blocks(ext, areas, offset,
+					slave_areas, slave_offset, size);
+	else
+		size = ext->data->callback->transfer(ext->data, areas, offset,
+						     slave_areas, slave_offset, size);
 	*slave_sizep = size;
 	return size;
 }
@@ -380,7 +564,152 @@ snd_pcm_extplug_read_areas(snd_pcm_t *pcm,
 static int snd_pcm_extplug_init(snd_pcm_t *pcm)
 {
 	extplug_priv_t *ext = pcm->private_data;
-	return ext->data->callback->init(ext->data);
+
+	if (ext->block_size)
+		extplug_reset_blocks(ext);
+	if (ext->data->version >= 0x010001 && ext->data->callback->init)
+		return ext->data->callback->init(ext->data);
+	return 0;
+}
+
+/*
+ * delay includes the block held back and the plugin latency
+ */
+static int snd_pcm_extplug_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
+{
+	extplug_priv_t *ext = pcm->private_data;
+	int err;
+
+	err = snd_pcm_plugin_fast_ops.delay(pcm, delayp);
+	if (err < 0)
+		return err;
+	*delayp += ext->block_size;
+	if (ext->data->version >= 0x010003)
+		*delayp += ext->data->latency;
+	return 0;
+}
+
+/*
+ * the frames in the slave buffer were processed a block earlier,
+ * so they can't be rewound in the block mode
+ */
+static snd_pcm_sframes_t snd_pcm_extplug_rewindable(snd_pcm_t *pcm)
+{
+	extplug_priv_t *ext = pcm->private_data;
+
+	if (ext->block_size)
+		return 0;
+	return snd_pcm_plugin_fast_ops.rewindable(pcm);
+}
+
+static snd_pcm_sframes_t snd_pcm_extplug_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
+{
+	extplug_priv_t *ext = pcm->private_data;
+
+	if (ext->block_size)
+		return 0;
+	return snd_pcm_plugin_fast_ops.rewind(pcm, frames);
+}
+
+static snd_pcm_sframes_t snd_pcm_extplug_forwardable(snd_pcm_t *pcm)
+{
+	extplug_priv_t *ext = pcm->private_data;
+
+	if (ext->block_size)
+		return 0;
+	return snd_pcm_plugin_fast_ops.forwardable(pcm);
+}
+
+static snd_pcm_sframes_t snd_pcm_extplug_forward(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
+{
+	extplug_priv_t *ext = pcm->private_data;
+
+	if (ext->block_size)
+		return 0;
+	return snd_pcm_plugin_fast_ops.forward(pcm, frames);
+}
+
+/*
+ * write out_areas from drain_ptr up to the block end to the slave
+ */
+static int extplug_drain_write(snd_pcm_t *pcm)
+{
+	extplug_priv_t *ext = pcm->private_data;
+	snd_pcm_t *slave = ext->plug.gen.slave;
+	unsigned int frame_bytes = ext->out_channels *
+		snd_pcm_format_physical_width(ext->out_format) / 8;
+	snd_pcm_sframes_t frames;
+
+	while (ext->drain_ptr < ext->block_size) {
+		frames = snd_pcm_mmap_writei(slave, (char *)ext->out_buf +
+					     ext->drain_ptr * frame_bytes,
+					     ext->block_size - ext->drain_ptr);
+		if (frames < 0)
+			return frames;
+		ext->drain_ptr += frames;
+	}
+	return 0;
+}
+
+/*
+ * block mode - pass the held output block and the padded partial input
+ * block to the slave before draining it
+ */
+static int extplug_drain_blocks(snd_pcm_t *pcm)
+{
+	extplug_priv_t *ext = pcm->private_data;
+	int err;
+
+	if (ext->drain_stage == EXTPLUG_DRAIN_NONE) {
+		if (!ext->block_fed)
+			return 0;
+		ext->drain_ptr = ext->block_pos;
+		ext->drain_stage = EXTPLUG_DRAIN_HELD;
+	}
+	if (ext->drain_stage == EXTPLUG_DRAIN_HELD) {
+		err = extplug_drain_write(pcm);
+		if (err < 0)
+			return err;
+		if (ext->block_pos > 0) {
+			snd_pcm_areas_silence(ext->in_areas, ext->block_pos,
+					      ext->in_channels,
+					      ext->block_size - ext->block_pos,
+					      ext->in_format);
+			extplug_process_block(ext);
+			ext->drain_ptr = 0;
+			ext->drain_stage = EXTPLUG_DRAIN_LAST;
+		}
+	}
+	if (ext->drain_stage == EXTPLUG_DRAIN_LAST) {
+		err = extplug_drain_write(pcm);
+		if (err < 0)
+			return err;
+	}
+	extplug_reset_blocks(ext);
+	return 0;
+}
+
+static int snd_pcm_extplug_drain(snd_pcm_t *pcm)
+{
+	extplug_priv_t *ext = pcm->private_data;
+	int err;
+
+	if (ext->block_size && pcm->stream == SND_PCM_STREAM_PLAYBACK) {
+		__snd_pcm_lock(pcm);
+		switch (__snd_pcm_state(pcm)) {
+		case SND_PCM_STATE_PREPARED:
+		case SND_PCM_STATE_RUNNING:
+			err = extplug_drain_blocks(pcm);
+			break;
+		default:
+			err = 0;
+			break;
+		}
+		__snd_pcm_unlock(pcm);
+		if (err < 0)
+			return err;
+	}
+	return snd_pcm_plugin_fast_ops.drain(pcm);
 }
 
 /*
@@ -421,6 +750,7 @@ static int snd_pcm_extplug_close(snd_pcm_t *pcm)
 
 	snd_pcm_close(ext->plug.gen.slave);
 	clear_ext_params(ext);
+	extplug_free_blocks(ext);
 	if (ext->data->callback->close)
 		ext->data->callback->close(ext->data);
 	free(ext);
@@ -624,6 +954,23 @@ The init callback is called when the PCM is at prepare state or any
 initialization is issued.  Use this callback to reset the PCM instance
 to a sane initial state.
 
+By default, the transfer callback receives the data in the chunks given
+by the application and by the wrap around of the buffers, which may be
+just a few frames.  A plugin processing fixed blocks (e.g. FFT based)
+can set the block_size field before the hw_params are set.  The transfer
+callback is then always called with whole blocks of block_size frames
+in contiguous buffers.  The block is assembled from the application
+data and the processed block is passed on while the next one is being
+collected, which adds block_size frames to the delay.  The block size
+given before the hw_params is the preferred one and the period size is
+restricted to at least one block.  The hw_params callback may adapt
+block_size to the chosen period (e.g. to a divisor of the period size),
+but not above the period size.  At the playback drain, the held block
+and the last partial block padded with silence are passed to the slave.
+Rewinding and forwarding aren't possible in this mode.  The latency
+field can be set for the intrinsic latency of the processing itself,
+and it's added to the value reported by #snd_pcm_delay(), too.
+
 The hw_params constraints can be defined via either
 #snd_pcm_extplug_set_param_minmax() and #snd_pcm_extplug_set_param_list()
 functions after calling #snd_pcm_extplug_create().
@@ -718,8 +1065,7 @@ int snd_pcm_extplug_create(snd_pcm_extplug_t *extplug, const char *name,
 	ext->plug.undo_write = snd_pcm_plugin_undo_write_generic;
 	ext->plug.gen.slave = spcm;
 	ext->plug.gen.close_slave = 1;
-	if (extplug->version >= 0x010001 && extplug->callback->init)
-		ext->plug.init = snd_pcm_extplug_init;
+	ext->plug.init = snd_pcm_extplug_init;
 
 	err = snd_pcm_new(&pcm, SND_PCM_TYPE_EXTPLUG, name, stream, mode);
 	if (err < 0) {
@@ -729,7 +1075,14 @@ int snd_pcm_extplug_create(snd_pcm_extplug_t *extplug, const char *name,
 
 	extplug->pcm = pcm;
 	pcm->ops = &snd_pcm_extplug_ops;
-	pcm->fast_ops = &snd_pcm_plugin_fast_ops;
+	ext->fops = snd_pcm_plugin_fast_ops;
+	ext->fops.delay = snd_pcm_extplug_delay;
+	ext->fops.rewindable = snd_pcm_extplug_rewindable;
+	ext->fops.rewind = snd_pcm_extplug_rewind;
+	ext->fops.forwardable = snd_pcm_extplug_forwardable;
+	ext->fops.forward = snd_pcm_extplug_forward;
+	ext->fops.drain = snd_pcm_extplug_drain;
+	pcm->fast_ops = &ext->fops;
 	pcm->private_data = ext;
 	pcm->poll_fd = spcm->poll_fd;
 	pcm->poll_events = spcm->poll_events;
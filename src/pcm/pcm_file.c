@@ -31,6 +31,10 @@
 #include "bswap.h"
 #include <ctype.h>
 #include <string.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#include <semaphore.h>
+#endif
 
 #ifndef PIC
 /* entry for static linking */
@@ -54,6 +58,24 @@ typedef enum _snd_pcm_file_format {
 	SND_PCM_FILE_FORMAT_WAV
 } snd_pcm_file_format_t;
 
+#ifdef HAVE_LIBPTHREAD
+/* background writer, fed through a single-producer single-consumer ring */
+typedef struct {
+	unsigned int count;		/* number of in-flight buffers */
+	size_t size;			/* bytes per buffer */
+	char *data;			/* count * size bytes */
+	size_t *lens;			/* filled bytes per buffer */
+	unsigned int head;		/* next buffer to publish (producer) */
+	unsigned int tail;		/* next buffer to write (writer) */
+	size_t fill;			/* bytes in the buffer being filled */
+	int error;			/* last write error */
+	int quit;
+	sem_t wakeup;			/* buffers published or quit */
+	sem_t done;			/* a buffer was written */
+	pthread_t thread;
+} snd_pcm_file_async_t;
+#endif
+
 /* WAV format chunk */
 struct wav_fmt {
 	short fmt;
@@ -90,6 +112,11 @@ typedef struct {
 	struct wav_fmt wav_header;
 	size_t filelen;
 	char ifmmap_overwritten;
+	unsigned int async_buffers;
+#ifdef HAVE_LIBPTHREAD
+	snd_pcm_file_async_t *async;
+#endif
+	size_t dropped_bytes;
 } snd_pcm_file_t;
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
@@ -412,6 +439,172 @@ static void fixup_wav_header(snd_pcm_t *pcm)
 			return;
 	}
 }
+
+#ifdef HAVE_LIBPTHREAD
+static void *snd_pcm_file_async_thread(void *data)
+{
+	snd_pcm_file_t *file = data;
+	snd_pcm_file_async_t *async = file->async;
+	unsigned int idx;
+	ssize_t err;
+
+	for (;;) {
+		sem_wait(&async->wakeup);
+		while (async->tail != atomic_load_acquire(&async->head)) {
+			idx = async->tail % async->count;
+			if (!async->error) {
+				err = safe_write(file->fd,
+						 async->data + idx * async->size,
+						 async->lens[idx]);
+				if (err < 0) {
+					snd_errornum(PCM, "%s write failed, file data may be corrupt", file->fname);
+					atomic_store_release(&async->error, (int)err);
+				} else {
+					file->filelen += err;
+				}
+			}
+			atomic_store_release(&async->tail, async->tail + 1);
+			sem_post(&async->done);
+		}
+		if (atomic_load_acquire(&async->quit))
+			break;
+	}
+	return NULL;
+}
+
+/* hand the buffer being filled over to the writer */
+static void snd_pcm_file_async_publish(snd_pcm_file_async_t *async)
+{
+	if (!async->fill)
+		return;
+	async->lens[async->head % async->count] = async->fill;
+	async->fill = 0;
+	atomic_store_release(&async->head, async->head + 1);
+	sem_post(&async->wakeup);
+}
+
+/* move bytes from wbuf to the writer ring, dropping them when it's full */
+static int snd_pcm_file_async_queue(snd_pcm_t *pcm, size_t bytes)
+{
+	snd_pcm_file_t *file = pcm->private_data;
+	snd_pcm_file_async_t *async = file->async;
+	int err;
+
+	err = atomic_load_acquire(&async->error);
+	if (err < 0) {
+		file->wbuf_used_bytes = 0;
+		file->file_ptr_bytes = 0;
+		return err;
+	}
+	while (bytes > 0) {
+		size_t n = bytes;
+		size_t cont = file->wbuf_size_bytes - file->file_ptr_bytes;
+		if (n > cont)
+			n = cont;
+		if (!async->fill &&
+		    async->head - atomic_load_acquire(&async->tail) >= async->count) {
+			/* the writer is behind, don't block the stream */
+			file->dropped_bytes += n;
+		} else {
+			if (n > async->size - async->fill)
+				n = async->size - async->fill;
+			memcpy(async->data + (async->head % async->count) * async->size + async->fill,
+			       file->wbuf + file->file_ptr_bytes, n);
+			async->fill += n;
+			if (async->fill == async->size)
+				snd_pcm_file_async_publish(async);
+		}
+		bytes -= n;
+		file->wbuf_used_bytes -= n;
+		file->file_ptr_bytes += n;
+		if (file->file_ptr_bytes == file->wbuf_size_bytes)
+			file->file_ptr_bytes = 0;
+	}
+	return 0;
+}
+
+/* publish the partial buffer and optionally wait until all is written */
+static void snd_pcm_file_async_flush(snd_pcm_file_t *file, int wait)
+{
+	snd_pcm_file_async_t *async = file->async;
+
+	if (!async)
+		return;
+	snd_pcm_file_async_publish(async);
+	if (!wait)
+		return;
+	while (atomic_load_acquire(&async->tail) != async->head)
+		sem_wait(&async->done);
+}
+
+static void snd_pcm_file_async_stop(snd_pcm_file_t *file)
+{
+	snd_pcm_file_async_t *async = file->async;
+
+	if (!async)
+		return;
+	snd_pcm_file_async_flush(file, 0);
+	atomic_store_release(&async->quit, 1);
+	sem_post(&async->wakeup);
+	pthread_join(async->thread, NULL);
+	sem_destroy(&async->wakeup);
+	sem_destroy(&async->done);
+	if (file->dropped_bytes)
+		snd_warn(PCM, "%s: %zu bytes dropped by the writer",
+			 file->fname ? file->fname : "file", file->dropped_bytes);
+	free(async->data);
+	free(async->lens);
+	free(async);
+	file->async = NULL;
+}
+
+static int snd_pcm_file_async_start(snd_pcm_file_t *file)
+{
+	snd_pcm_file_async_t *async;
+	int err;
+
+	async = calloc(1, sizeof(*async));
+	if (!async)
+		return -ENOMEM;
+	async->count = file->async_buffers;
+	async->size = file->buffer_bytes;
+	async->data = malloc(async->count * async->size);
+	async->lens = calloc(async->count, sizeof(*async->lens));
+	if (!async->data || !async->lens) {
+		err = -ENOMEM;
+		goto _err;
+	}
+	sem_init(&async->wakeup, 0, 0);
+	sem_init(&async->done, 0, 0);
+	file->async = async;
+	file->dropped_bytes = 0;
+	err = pthread_create(&async->thread, NULL,
+			     snd_pcm_file_async_thread, file);
+	if (err) {
+		file->async = NULL;
+		sem_destroy(&async->wakeup);
+		sem_destroy(&async->done);
+		err = -err;
+		goto _err;
+	}
+	return 0;
+
+ _err:
+	free(async->data);
+	free(async->lens);
+	free(async);
+	return err;
+}
+#else
+static void snd_pcm_file_async_flush(snd_pcm_file_t *file ATTRIBUTE_UNUSED,
+				     int wait ATTRIBUTE_UNUSED)
+{
+}
+
+static void snd_pcm_file_async_stop(snd_pcm_file_t *file ATTRIBUTE_UNUSED)
+{
+}
+#endif
 #endif /* DOC_HIDDEN */
 
 
@@ -433,6 +626,11 @@ static int snd_pcm_file_write_bytes(snd_pcm_t *pcm, size_t bytes)
 		}
 	}
 
+#ifdef HAVE_LIBPTHREAD
+	if (file->async)
+		return snd_pcm_file_async_queue(pcm, bytes);
+#endif
+
 	while (bytes > 0) {
 		size_t n = bytes;
 		size_t cont = file->wbuf_size_bytes - file->file_ptr_bytes;
@@ -527,6 +725,7 @@ static int snd_pcm_file_reset(snd_pcm_t *pcm)
 		/* FIXME: Questionable here */
 		snd_pcm_file_write_bytes(pcm, file->wbuf_used_bytes);
 		assert(file->wbuf_used_bytes == 0);
+		snd_pcm_file_async_flush(file, 0);
 	}
 	return err;
 }
@@ -539,6 +738,7 @@ static int snd_pcm_file_drop(snd_pcm_t *pcm)
 		/* FIXME: Questionable here */
 		snd_pcm_file_write_bytes(pcm, file->wbuf_used_bytes);
 		assert(file->wbuf_used_bytes == 0);
+		snd_pcm_file_async_flush(file, 0);
 	}
 	return err;
 }
@@ -552,6 +752,7 @@ static int snd_pcm_file_drain(snd_pcm_t *pcm)
 		__snd_pcm_lock(pcm);
 		snd_pcm_file_write_bytes(pcm, file->wbuf_used_bytes);
 		assert(file->wbuf_used_bytes == 0);
+		snd_pcm_file_async_flush(file, 1);
 		__snd_pcm_unlock(pcm);
 	}
 	return err;
@@ -763,6 +964,7 @@ static int snd_pcm_file_mmap_begin(snd_pcm_t *pcm, const snd_pcm_channel_area_t
 static int snd_pcm_file_hw_free(snd_pcm_t *pcm)
 {
 	snd_pcm_file_t *file = pcm->private_data;
+	snd_pcm_file_async_stop(file);
 	free(file->wbuf);
 	free(file->wbuf_areas);
 	free(file->final_fname);
@@ -825,6 +1027,15 @@ static int snd_pcm_file_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 			return err;
 		}
 	}
+#ifdef HAVE_LIBPTHREAD
+	if (file->async_buffers > 0) {
+		err = snd_pcm_file_async_start(file);
+		if (err < 0) {
+			snd_pcm_file_hw_free(pcm);
+			return err;
+		}
+	}
+#endif
 
 	/* pointer may have changed - e.g if plug is used. */
 	snd_pcm_unlink_hw_ptr(pcm, file->gen.slave);
@@ -846,6 +1057,9 @@ static void snd_pcm_file_dump(snd_pcm_t *pcm, snd_output_t *out)
 	if (file->final_fname)
 		snd_output_printf(out, "Final file PCM (file=%s)\n",
 				file->final_fname);
+	if (file->async_buffers)
+		snd_output_printf(out, "Async writer: %u buffers, %zu bytes dropped\n",
+				  file->async_buffers, file->dropped_bytes);
 
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
@@ -917,6 +1131,8 @@ static const snd_pcm_fast_ops_t snd_pcm_file_fast_ops = {
  * \param trunc Truncate the file if it already exists
  * \param fmt File format ("raw" or "wav" are available)
  * \param perm File permission
+ * \param async_buffers Number of in-flight buffers of the background
+ *        writer (0 = write synchronously)
  * \param slave Slave PCM handle
  * \param close_slave When set, the slave PCM handle is closed with copy PCM
  * \param stream the direction of PCM stream
@@ -928,7 +1144,8 @@ static const snd_pcm_fast_ops_t snd_pcm_file_fast_ops = {
 int snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 		      const char *fname, int fd, const char *ifname, int ifd,
 		      int trunc,
-		      const char *fmt, int perm, snd_pcm_t *slave, int close_slave,
+		      const char *fmt, int perm, unsigned int async_buffers,
+		      snd_pcm_t *slave, int close_slave,
 		      snd_pcm_stream_t stream)
 {
 	snd_pcm_t *pcm;
@@ -947,6 +1164,12 @@ int snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 		snd_error(PCM, "file format %s is unknown", fmt);
 		return -EINVAL;
 	}
+#ifndef HAVE_LIBPTHREAD
+	if (async_buffers > 0) {
+		snd_error(PCM, "async writer requires thread support");
+		return -ENOSYS;
+	}
+#endif
 	file = calloc(1, sizeof(snd_pcm_file_t));
 	if (!file) {
 		return -ENOMEM;
@@ -958,6 +1181,7 @@ int snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 		file->fname = strdup(fname);
 	file->trunc = trunc;
 	file->perm = perm;
+	file->async_buffers = async_buffers;
 
 	if (ifname && (stream == SND_PCM_STREAM_CAPTURE)) {
 		file->ifname = strdup(ifname);
@@ -1045,9 +1269,20 @@ pcm.name {
 	infile INT		# Input file descriptor number
 	[format STR]		# File format ("raw" or "wav")
 	[perm INT]		# Output file permission (octal, def. 0600)
+	[async_buffers INT]	# In-flight buffers of the background writer
+				# (def. 0 = write synchronously)
 }
 \endcode
 
+By default, the data is written to the output file from the thread
+calling the PCM functions, so slow storage can delay the stream.  With
+\c async_buffers set, the data is collected in buffers of one slave
+buffer size and handed over to a background writer thread without
+blocking.  When all in-flight buffers are still pending, the new data is
+dropped instead; the amount of dropped bytes is shown in the PCM dump
+and reported when the PCM is freed.  Drain waits until the queued data
+is written.
+
 \subsection pcm_plugins_file_funcref Function reference
 
 <UL>
@@ -1082,6 +1317,7 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 	const char *format = NULL;
 	long fd = -1, ifd = -1, trunc = 1;
 	long perm = 0600;
+	long async_buffers = 0;
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
 		const char *id;
@@ -1135,6 +1371,18 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 			}
 			continue;
 		}
+		if (strcmp(id, "async_buffers") == 0) {
+			err = snd_config_get_integer(n, &async_buffers);
+			if (err < 0) {
+				snd_error(PCM, "Invalid type for %s", id);
+				return err;
+			}
+			if (async_buffers < 0 || async_buffers > 1024) {
+				snd_error(PCM, "The field async_buffers is out of range (0-1024)");
+				return -EINVAL;
+			}
+			continue;
+		}
 		if (strcmp(id, "truncate") == 0) {
 			err = snd_config_get_bool(n);
 			if (err < 0)
@@ -1173,7 +1421,7 @@ int _snd_pcm_file_open(snd_pcm_t **pcmp, const char *name,
 	if (err < 0)
 		return err;
 	err = snd_pcm_file_open(pcmp, name, fname, fd, ifname, ifd,
-				trunc, format, perm, spcm, 1, stream);
+				trunc, format, perm, async_buffers, spcm, 1, stream);
 	if (err < 0)
 		snd_pcm_close(spcm);
 	return err;
@@ -63,6 +63,8 @@ struct snd_pcm_iec958 {
 	unsigned char preamble[3];	/* B/M/W or Z/X/Y */
 	snd_pcm_fast_ops_t fops;
 	int hdmi_mode;
+	snd_pcm_format_t fast_format;	/* linear side handled without get/put labels */
+	uint32_t subframe[2][192];	/* channel status and preamble bits per frame */
 };
 
 enum { PREAMBLE_Z, PREAMBLE_X, PREAMBLE_Y };
@@ -73,20 +75,17 @@ enum { PREAMBLE_Z, PREAMBLE_X, PREAMBLE_Y };
  * Determine parity for time slots 4 upto 30
  * to be sure that bit 4 upt 31 will carry
  * an even number of ones and zeros.
+ *
+ * The bits are folded down to a nibble, whose parity is looked up
+ * in the 16 bit constant 0x6996.
  */
-static unsigned int iec958_parity(unsigned int data)
+static inline unsigned int iec958_parity(uint32_t data)
 {
-	unsigned int parity;
-	int bit;
-
-	data >>= 4;     /* start from bit 4 */
-	parity = 0;
-	for (bit = 4; bit <= 30; bit++) {
-		if (data & 1)
-			parity++;
-		data >>= 1;
-	}
-	return (parity & 1);
+	data &= 0x7ffffff0;
+	data ^= data >> 16;
+	data ^= data >> 8;
+	data ^= data >> 4;
+	return (0x6996 >> (data & 0xf)) & 1;
 }
 
 /*
@@ -102,36 +101,45 @@ static unsigned int iec958_parity(unsigned int data)
  *     31   = parity
  */
 
-static inline uint32_t iec958_subframe(snd_pcm_iec958_t *iec, uint32_t data, int channel)
+static inline uint32_t iec958_subframe(snd_pcm_iec958_t *iec, uint32_t data, uint32_t bits)
 {
-	unsigned int byte = iec->counter >> 3;
-	unsigned int mask = 1 << (iec->counter - (byte << 3));
-
 	/* bit 4-27 */
 	data >>= 4;
 	data &= ~0xf;
 
-	/* set IEC status bits (up to 192 bits) */
-	if (iec->status[byte] & mask)
-		data |= 0x40000000;
+	/* status bit and preamble from iec958_setup_subframes() */
+	data |= bits;
 
 	if (iec958_parity(data))	/* parity bit 4-30 */
 		data |= 0x80000000;
 
-	/* Preamble */
-	if (channel)
-		data |= iec->preamble[PREAMBLE_Y];	/* odd sub frame, 'Y' */
-	else if (! iec->counter)
-		data |= iec->preamble[PREAMBLE_Z];	/* Block start, 'Z' */
-	else
-		data |= iec->preamble[PREAMBLE_X];	/* even sub frame, 'X' */
-
 	if (iec->byteswap)
 		data = bswap_32(data);
 
 	return data;
 }
 
+/*
+ * Precompute the IEC status bit (up to 192 bits) and the preamble
+ * of each frame in the block, for the first and for the other channels.
+ */
+static void iec958_setup_subframes(snd_pcm_iec958_t *iec)
+{
+	unsigned int counter;
+	uint32_t status;
+
+	for (counter = 0; counter < 192; counter++) {
+		status = 0;
+		if (iec->status[counter >> 3] & (1 << (counter & 7)))
+			status = 0x40000000;
+		if (!counter)
+			iec->subframe[0][counter] = status | iec->preamble[PREAMBLE_Z];	/* Block start, 'Z' */
+		else
+			iec->subframe[0][counter] = status | iec->preamble[PREAMBLE_X];	/* even sub frame, 'X' */
+		iec->subframe[1][counter] = status | iec->preamble[PREAMBLE_Y];	/* odd sub frame, 'Y' */
+	}
+}
+
 static inline int32_t iec958_to_s32(snd_pcm_iec958_t *iec, uint32_t data)
 {
 	if (iec->byteswap)
@@ -166,15 +174,40 @@ static void snd_pcm_iec958_decode(snd_pcm_iec958_t *iec,
 		src_step = snd_pcm_channel_area_step(src_area) / sizeof(uint32_t);
 		dst_step = snd_pcm_channel_area_step(dst_area);
 		frames1 = frames;
-		while (frames1-- > 0) {
-			int32_t sample = iec958_to_s32(iec, *src);
-			goto *put;
+		switch (iec->fast_format) {
+		case SND_PCM_FORMAT_S16:
+			while (frames1-- > 0) {
+				*(int16_t *)dst = iec958_to_s32(iec, *src) >> 16;
+				src += src_step;
+				dst += dst_step;
+			}
+			break;
+		case SND_PCM_FORMAT_S24:
+			while (frames1-- > 0) {
+				*(int32_t *)dst = iec958_to_s32(iec, *src) >> 8;
+				src += src_step;
+				dst += dst_step;
+			}
+			break;
+		case SND_PCM_FORMAT_S32:
+			while (frames1-- > 0) {
+				*(int32_t *)dst = iec958_to_s32(iec, *src);
+				src += src_step;
+				dst += dst_step;
+			}
+			break;
+		default:
+			while (frames1-- > 0) {
+				int32_t sample = iec958_to_s32(iec, *src);
+				goto *put;
 #define PUT32_END after
 #include "plugin_ops.h"
 #undef PUT32_END
-		after:
-			src += src_step;
-			dst += dst_step;
+			after:
+				src += src_step;
+				dst += dst_step;
+			}
+			break;
 		}
 	}
 }
@@ -192,11 +225,11 @@ static void snd_pcm_iec958_encode(snd_pcm_iec958_t *iec,
 	void *get = get32_labels[iec->getput_idx];
 	unsigned int channel;
 	int32_t sample = 0;
-	int counter = iec->counter;
+	unsigned int counter = iec->counter;
 	int single_stream = iec->hdmi_mode &&
 			    (iec->status[0] & IEC958_AES0_NONAUDIO) &&
 			    (channels == 8);
-	int counter_step = single_stream ? ((channels + 1) >> 1) : 1;
+	unsigned int counter_step = single_stream ? ((channels + 1) >> 1) : 1;
 	for (channel = 0; channel < channels; ++channel) {
 		const char *src;
 		uint32_t *dst;
@@ -204,6 +237,8 @@ static void snd_pcm_iec958_encode(snd_pcm_iec958_t *iec,
 		snd_pcm_uframes_t frames1;
 		const snd_pcm_channel_area_t *src_area = &src_areas[channel];
 		const snd_pcm_channel_area_t *dst_area = &dst_areas[channel];
+		const uint32_t *bits = iec->subframe[channel ? 1 : 0];
+		unsigned int pos;
 		src = snd_pcm_channel_area_addr(src_area, src_offset);
 		dst = snd_pcm_channel_area_addr(dst_area, dst_offset);
 		src_step = snd_pcm_channel_area_step(src_area);
@@ -211,27 +246,60 @@ static void snd_pcm_iec958_encode(snd_pcm_iec958_t *iec,
 		frames1 = frames;
 
 		if (single_stream)
-			iec->counter = (counter + (channel >> 1)) % 192;
+			pos = (counter + (channel >> 1)) % 192;
 		else
-			iec->counter = counter;
-
-		while (frames1-- > 0) {
-			goto *get;
+			pos = counter;
+
+		switch (iec->fast_format) {
+		case SND_PCM_FORMAT_S16:
+			while (frames1-- > 0) {
+				*dst = iec958_subframe(iec, (uint32_t)*(const uint16_t *)src << 16, bits[pos]);
+				src += src_step;
+				dst += dst_step;
+				pos += counter_step;
+				if (pos >= 192)
+					pos -= 192;
+			}
+			break;
+		case SND_PCM_FORMAT_S24:
+			while (frames1-- > 0) {
+				*dst = iec958_subframe(iec, *(const uint32_t *)src << 8, bits[pos]);
+				src += src_step;
+				dst += dst_step;
+				pos += counter_step;
+				if (pos >= 192)
+					pos -= 192;
+			}
+			break;
+		case SND_PCM_FORMAT_S32:
+			while (frames1-- > 0) {
+				*dst = iec958_subframe(iec, *(const uint32_t *)src, bits[pos]);
+				src += src_step;
+				dst += dst_step;
+				pos += counter_step;
+				if (pos >= 192)
+					pos -= 192;
+			}
+			break;
+		default:
+			while (frames1-- > 0) {
+				goto *get;
 #define GET32_END after
 #include "plugin_ops.h"
 #undef GET32_END
-		after:
-			sample = iec958_subframe(iec, sample, channel);
-			// fprintf(stderr, "%d:%08x\n", frames1, sample);
-			*dst = sample;
-			src += src_step;
-			dst += dst_step;
-			iec->counter += counter_step;
-			iec->counter %= 192;
+			after:
+				*dst = iec958_subframe(iec, sample, bits[pos]);
+				src += src_step;
+				dst += dst_step;
+				pos += counter_step;
+				if (pos >= 192)
+					pos -= 192;
+			}
+			break;
 		}
-		if (single_stream) /* set counter to ch0 value for next iteration */
-			iec->counter = (counter + frames * counter_step) % 192;
 	}
+	/* the block position of the first channel for the next call */
+	iec->counter = (counter + frames * counter_step) % 192;
 }
 #endif /* DOC_HIDDEN */
 
@@ -327,7 +395,7 @@ static int snd_pcm_iec958_hw_refine(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 static int snd_pcm_iec958_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 {
 	snd_pcm_iec958_t *iec = pcm->private_data;
-	snd_pcm_format_t format;
+	snd_pcm_format_t format, linear;
 	int err = snd_pcm_hw_params_slave(pcm, params,
 					  snd_pcm_iec958_hw_refine_cchange,
 					  snd_pcm_iec958_hw_refine_sprepare,
@@ -341,6 +409,7 @@ static int snd_pcm_iec958_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params
 		return err;
 
 	iec->format = format;
+	iec->fast_format = SND_PCM_FORMAT_UNKNOWN;
 	if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
 		if (iec->sformat == SND_PCM_FORMAT_IEC958_SUBFRAME_LE ||
 		    iec->sformat == SND_PCM_FORMAT_IEC958_SUBFRAME_BE) {
@@ -364,6 +433,15 @@ static int snd_pcm_iec958_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params
 			iec->byteswap = format != SND_PCM_FORMAT_IEC958_SUBFRAME;
 		}
 	}
+	/* native S16/S24/S32 are converted inline, see snd_pcm_iec958_encode() */
+	if (iec->sformat == SND_PCM_FORMAT_IEC958_SUBFRAME_LE ||
+	    iec->sformat == SND_PCM_FORMAT_IEC958_SUBFRAME_BE)
+		linear = format;
+	else
+		linear = iec->sformat;
+	if (linear == SND_PCM_FORMAT_S16 || linear == SND_PCM_FORMAT_S24 ||
+	    linear == SND_PCM_FORMAT_S32)
+		iec->fast_format = linear;
 
 	if ((iec->status[0] & IEC958_AES0_PROFESSIONAL) == 0) {
 		if ((iec->status[3] & IEC958_AES3_CON_FS) == IEC958_AES3_CON_FS_NOTID) {
@@ -438,6 +516,7 @@ static int snd_pcm_iec958_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params
 			iec->status[4] |= ws;
 		}
 	}
+	iec958_setup_subframes(iec);
 	return 0;
 }
 
@@ -45,6 +45,10 @@ typedef struct snd_pcm_ioplug_priv {
 	snd_pcm_uframes_t last_hw;
 	snd_pcm_uframes_t avail_max;
 	snd_htimestamp_t trigger_tstamp;
+	int mmap_fd;		/* plugin buffer used as mmap area, or -1 */
+	off_t mmap_offset;
+	int publish_hw;		/* hw_ptr is published, no pointer callback */
+	snd_pcm_sframes_t published_hw;	/* written by the plugin, any thread */
 } ioplug_priv_t;
 
 static int snd_pcm_ioplug_drop(snd_pcm_t *pcm);
@@ -59,7 +63,10 @@ static void snd_pcm_ioplug_hw_ptr_update(snd_pcm_t *pcm)
 	ioplug_priv_t *io = pcm->private_data;
 	snd_pcm_sframes_t hw;
 
-	hw = io->data->callback->pointer(io->data);
+	if (io->publish_hw)
+		hw = atomic_load_acquire(&io->published_hw);
+	else
+		hw = io->data->callback->pointer(io->data);
 	if (hw >= 0) {
 		snd_pcm_uframes_t delta;
 		snd_pcm_uframes_t avail;
@@ -104,7 +111,20 @@ static int snd_pcm_ioplug_info(snd_pcm_t *pcm, snd_pcm_info_t *info)
 
 static int snd_pcm_ioplug_channel_info(snd_pcm_t *pcm, snd_pcm_channel_info_t *info)
 {
-	return snd_pcm_channel_info_shm(pcm, info, -1);
+	ioplug_priv_t *io = pcm->private_data;
+	int err;
+
+	err = snd_pcm_channel_info_shm(pcm, info, -1);
+	if (err < 0 || io->mmap_fd < 0)
+		return err;
+	/* all channels are mapped at once from the plugin buffer */
+	if (pcm->access == SND_PCM_ACCESS_MMAP_NONINTERLEAVED ||
+	    pcm->access == SND_PCM_ACCESS_RW_NONINTERLEAVED)
+		info->first = info->channel * pcm->buffer_size * pcm->sample_bits;
+	info->type = SND_PCM_AREA_MMAP;
+	info->u.mmap.fd = io->mmap_fd;
+	info->u.mmap.offset = io->mmap_offset;
+	return 0;
 }
 
 static int snd_pcm_ioplug_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
@@ -161,6 +181,7 @@ static int snd_pcm_ioplug_reset(snd_pcm_t *pcm)
 	io->data->hw_ptr = 0;
 	io->last_hw = 0;
 	io->avail_max = 0;
+	atomic_store_release(&io->published_hw, 0);
 	return 0;
 }
 
@@ -439,6 +460,7 @@ static int snd_pcm_ioplug_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 	INTERNAL(snd_pcm_hw_params_get_rate)(params, &io->data->rate, 0);
 	INTERNAL(snd_pcm_hw_params_get_period_size)(params, &io->data->period_size, 0);
 	INTERNAL(snd_pcm_hw_params_get_buffer_size)(params, &io->data->buffer_size);
+	io->mmap_fd = -1;
 	if (io->data->callback->hw_params) {
 		err = io->data->callback->hw_params(io->data, params);
 		if (err < 0)
@@ -450,6 +472,8 @@ static int snd_pcm_ioplug_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
 		INTERNAL(snd_pcm_hw_params_get_period_size)(params, &io->data->period_size, 0);
 		INTERNAL(snd_pcm_hw_params_get_buffer_size)(params, &io->data->buffer_size);
 	}
+	/* read/write goes through the plugin buffer, too */
+	pcm->mmap_rw = io->data->mmap_rw || io->mmap_fd >= 0;
 	return 0;
 }
 
@@ -457,6 +481,8 @@ static int snd_pcm_ioplug_hw_free(snd_pcm_t *pcm)
 {
 	ioplug_priv_t *io = pcm->private_data;
 
+	io->mmap_fd = -1;
+	pcm->mmap_rw = io->data->mmap_rw;
 	if (io->data->callback->hw_free)
 		return io->data->callback->hw_free(io->data);
 	return 0;
@@ -998,6 +1024,14 @@ When this value is set to 1, the plugin creates always a local buffer
 and performs read/write calls using this buffer as if it's mmapped.
 The address of local buffer can be obtained via
 #snd_pcm_ioplug_mmap_areas() function.
+
+A plugin owning a shareable ring buffer (e.g. a memfd or a shared
+memory backed by a file descriptor) can instead pass it to
+#snd_pcm_ioplug_set_mmap_buffer() in the hw_params callback.  The buffer
+is then mapped as the mmap area of the PCM, and read/write calls copy the
+data straight into it, so the transfer callback is usually not needed.
+The plugin follows appl_ptr and reports its own position via the pointer
+callback as with a hardware buffer.
 When poll_fd, poll_events and mmap_rw fields are changed after
 #snd_pcm_ioplug_create(), call #snd_pcm_ioplug_reinit_status() to
 reflect the changes.
@@ -1017,6 +1051,13 @@ the PCM stream is started and stopped, repsectively.  The pointer
 callback returns the current DMA position, which may be called at any
 time.
 
+When querying the position is expensive, e.g. a round trip to another
+process, the plugin can set #SND_PCM_IOPLUG_FLAG_PUBLISH_HW_PTR in the
+flags field and push the position with #snd_pcm_ioplug_publish_hw_ptr()
+whenever it changes, from any thread.  The pointer callback is then
+never called and may be omitted, and the position updates read the
+published value atomically instead.
+
 The transfer callback is called when any data transfer happens.  It
 receives the area array, offset and the size to transfer.  The area
 array contains the array of snd_pcm_channel_area_t with the elements
@@ -1080,8 +1121,7 @@ int snd_pcm_ioplug_create(snd_pcm_ioplug_t *ioplug, const char *name,
 
 	assert(ioplug && ioplug->callback);
 	assert(ioplug->callback->start &&
-	       ioplug->callback->stop &&
-	       ioplug->callback->pointer);
+	       ioplug->callback->stop);
 
 	/* We support 1.0.0 to current */
 	if (ioplug->version < 0x010000 ||
@@ -1091,12 +1131,19 @@ int snd_pcm_ioplug_create(snd_pcm_ioplug_t *ioplug, const char *name,
 
 		return -ENXIO;
 	}
+	if (!ioplug->callback->pointer &&
+	    (ioplug->version < 0x010003 ||
+	     !(ioplug->flags & SND_PCM_IOPLUG_FLAG_PUBLISH_HW_PTR))) {
+		snd_error(PCM, "ioplug: No pointer callback");
+		return -EINVAL;
+	}
 
 	io = calloc(1, sizeof(*io));
 	if (! io)
 		return -ENOMEM;
 
 	io->data = ioplug;
+	io->mmap_fd = -1;
 	ioplug->state = SND_PCM_STATE_OPEN;
 	ioplug->stream = stream;
 
@@ -1204,13 +1251,20 @@ int snd_pcm_ioplug_set_param_minmax(snd_pcm_ioplug_t *ioplug, int type, unsigned
  */
 int snd_pcm_ioplug_reinit_status(snd_pcm_ioplug_t *ioplug)
 {
+	ioplug_priv_t *io = ioplug->pcm->private_data;
+
+	io->publish_hw = ioplug->version >= 0x010003 &&
+			 (ioplug->flags & SND_PCM_IOPLUG_FLAG_PUBLISH_HW_PTR);
+	if (!io->publish_hw && !ioplug->callback->pointer)
+		return -EINVAL;
 	ioplug->pcm->poll_fd = ioplug->poll_fd;
 	ioplug->pcm->poll_events = ioplug->poll_events;
 	if (ioplug->flags & SND_PCM_IOPLUG_FLAG_MONOTONIC)
 		ioplug->pcm->tstamp_type = SND_PCM_TSTAMP_TYPE_MONOTONIC;
 	else
 		ioplug->pcm->tstamp_type = SND_PCM_TSTAMP_TYPE_GETTIMEOFDAY;
-	ioplug->pcm->mmap_rw = ioplug->mmap_rw;
+	/* keep read/write through the buffer set by set_mmap_buffer */
+	ioplug->pcm->mmap_rw = ioplug->mmap_rw || io->mmap_fd >= 0;
 	return 0;
 }
 
@@ -1224,11 +1278,43 @@ int snd_pcm_ioplug_reinit_status(snd_pcm_ioplug_t *ioplug)
  */
 const snd_pcm_channel_area_t *snd_pcm_ioplug_mmap_areas(snd_pcm_ioplug_t *ioplug)
 {
-	if (ioplug->mmap_rw)
+	if (ioplug->pcm->mmap_rw)
 		return snd_pcm_mmap_areas(ioplug->pcm);
 	return NULL;
 }
 
+/**
+ * \brief Use the plugin buffer as the mmap area
+ * \param ioplug the ioplug handle
+ * \param fd the file descriptor of the buffer (e.g. memfd or shared memory),
+ *        or -1 to use the buffer allocated by alsa-lib
+ * \param offset the page aligned offset of the buffer in fd
+ * \return 0 if successful, or a negative error code
+ *
+ * Lets the application access the plugin buffer directly, so that no copy
+ * to the transfer callback is needed.  The function must be called from
+ * the hw_params callback, and it's valid until hw_free.
+ *
+ * The buffer holds buffer_size frames in the layout given by the access
+ * type: the channels of each frame one after another for the interleaved
+ * access, or the whole buffer of each channel one after another for the
+ * non-interleaved access.  Both mmap and read/write transfers go through
+ * this buffer; the plugin consumes or fills it according to appl_ptr and
+ * reports its position via the pointer callback.
+ */
+int snd_pcm_ioplug_set_mmap_buffer(snd_pcm_ioplug_t *ioplug, int fd, off_t offset)
+{
+	ioplug_priv_t *io = ioplug->pcm->private_data;
+
+	if (fd >= 0 && (offset < 0 || offset % page_size())) {
+		snd_error(PCM, "IOPLUG: mmap buffer offset is not page aligned");
+		return -EINVAL;
+	}
+	io->mmap_fd = fd;
+	io->mmap_offset = offset;
+	return 0;
+}
+
 /**
  * \brief Change the ioplug PCM status
  * \param ioplug the ioplug handle
@@ -1245,6 +1331,28 @@ int snd_pcm_ioplug_set_state(snd_pcm_ioplug_t *ioplug, snd_pcm_state_t state)
 	return 0;
 }
 
+/**
+ * \brief Publish the current DMA position
+ * \param ioplug the ioplug handle
+ * \param hw_ptr buffer position up to buffer_size or
+ *        when #SND_PCM_IOPLUG_FLAG_BOUNDARY_WA flag is set up to boundary or
+ *        a negative error code for Xrun
+ * \return zero if successful or a negative error code
+ *
+ * With #SND_PCM_IOPLUG_FLAG_PUBLISH_HW_PTR set, the position isn't queried
+ * through the pointer callback; the value stored here is read instead.
+ * The function takes no lock and can be called from any thread, e.g. the
+ * one receiving the position from the backend.  For capture, the data up
+ * to the position must be written before it's published.
+ */
+int snd_pcm_ioplug_publish_hw_ptr(snd_pcm_ioplug_t *ioplug, snd_pcm_sframes_t hw_ptr)
+{
+	ioplug_priv_t *io = ioplug->pcm->private_data;
+
+	atomic_store_release(&io->published_hw, hw_ptr);
+	return 0;
+}
+
 /**
  * \brief Get the available frames. This function can be used to calculate the
  * the available frames before calling #snd_pcm_avail_update()
@@ -37,6 +37,9 @@
 #include <dirent.h>
 #include <locale.h>
 #include <math.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 #include "ladspa.h"
 
@@ -63,6 +66,25 @@ typedef struct {
 	unsigned int channels;			/* forced input channels, 0 = auto */
 	unsigned int allocated;			/* count of allocated samples */
 	LADSPA_Data *zero[2];			/* zero input or dummy output */
+	unsigned int threads;			/* requested worker threads, 0 = serial */
+#ifdef HAVE_LIBPTHREAD
+	unsigned int workers_count;		/* running worker threads */
+	pthread_t *workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	unsigned int generation;		/* bumped for each dispatched job */
+	unsigned int pending;			/* workers still busy with the job */
+	int quit;
+	/* current job - instances of one plugin run in parallel */
+	struct snd_pcm_ladspa_plugin *job;
+	unsigned int job_next;			/* next instance to run */
+	const snd_pcm_channel_area_t *job_in_areas;
+	snd_pcm_uframes_t job_in_offset;
+	const snd_pcm_channel_area_t *job_out_areas;
+	snd_pcm_uframes_t job_out_offset;
+	snd_pcm_uframes_t job_size;
+#endif
 } snd_pcm_ladspa_t;
 
 typedef struct {
@@ -75,6 +97,7 @@ typedef struct {
 	snd_pcm_ladspa_array_t ports;
 	LADSPA_Data **m_data;
 	LADSPA_Data **data;
+	LADSPA_Data **conn;		/* currently connected buffers */
 } snd_pcm_ladspa_eps_t;
 
 typedef struct snd_pcm_ladspa_instance {
@@ -97,7 +120,7 @@ typedef struct {
 	LADSPA_Data *controls;			/* index = LADSPA control port index */
 } snd_pcm_ladspa_plugin_io_t;
 
-typedef struct {
+typedef struct snd_pcm_ladspa_plugin {
 	struct list_head list;
 	snd_pcm_ladspa_policy_t policy;
 	char *filename;
@@ -106,6 +129,8 @@ typedef struct {
 	snd_pcm_ladspa_plugin_io_t input;
 	snd_pcm_ladspa_plugin_io_t output;
 	struct list_head instances;		/* one LADSPA plugin might be used multiple times */
+	unsigned int instances_count;
+	snd_pcm_ladspa_instance_t **instances_array;	/* for the worker threads */
 } snd_pcm_ladspa_plugin_t;
 
 #endif /* DOC_HIDDEN */
@@ -314,6 +339,7 @@ static void snd_pcm_ladspa_free_eps(snd_pcm_ladspa_eps_t *eps)
 {
 	free(eps->channels.array);
 	free(eps->ports.array);
+	free(eps->conn);
 }
 
 static void snd_pcm_ladspa_free_instances(snd_pcm_t *pcm, snd_pcm_ladspa_t *ladspa, int cleanup)
@@ -354,6 +380,9 @@ static void snd_pcm_ladspa_free_instances(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 		}
 		if (cleanup) {
 			assert(list_empty(&plugin->instances));
+			free(plugin->instances_array);
+			plugin->instances_array = NULL;
+			plugin->instances_count = 0;
 		}
 	}
 }
@@ -683,6 +712,73 @@ static LADSPA_Data *snd_pcm_ladspa_allocate_zero(snd_pcm_ladspa_t *ladspa, unsig
 	return ladspa->zero[idx];
 }
 
+/* redirect all readers of the intermediate buffer old to buf */
+static void snd_pcm_ladspa_replace_input(struct list_head *list,
+					 LADSPA_Data *old, LADSPA_Data *buf)
+{
+	struct list_head *pos, *pos1;
+	snd_pcm_ladspa_instance_t *instance;
+	unsigned int idx;
+
+	list_for_each(pos, list) {
+		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+		list_for_each(pos1, &plugin->instances) {
+			instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
+			for (idx = 0; idx < instance->input.channels.size; idx++)
+				if (instance->input.data[idx] == old)
+					instance->input.data[idx] = buf;
+		}
+	}
+}
+
+/*
+ * Let the plugins without LADSPA_PROPERTY_INPLACE_BROKEN write their
+ * intermediate output over the intermediate input of the same channel,
+ * so the chain works on one buffer per channel instead of one per stage.
+ * Inputs coming directly from the ALSA areas or the zero buffer are
+ * never overwritten.
+ */
+static void snd_pcm_ladspa_inplace(struct list_head *list, snd_pcm_ladspa_t *ladspa)
+{
+	struct list_head *pos, *pos1;
+	snd_pcm_ladspa_instance_t *instance;
+	unsigned int idx, idx1, chn;
+	LADSPA_Data *buf, *old;
+
+	list_for_each(pos, list) {
+		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+		if (LADSPA_IS_INPLACE_BROKEN(plugin->desc->Properties))
+			continue;
+		list_for_each(pos1, &plugin->instances) {
+			instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
+			for (idx = 0; idx < instance->output.channels.size; idx++) {
+				old = instance->output.m_data[idx];
+				if (old == NULL)
+					continue;
+				chn = instance->output.channels.array[idx];
+				buf = NULL;
+				for (idx1 = 0; idx1 < instance->input.channels.size; idx1++) {
+					if (instance->input.channels.array[idx1] != chn)
+						continue;
+					buf = instance->input.data[idx1];
+					break;
+				}
+				if (buf == NULL || buf == ladspa->zero[0])
+					continue;
+				for (idx1 = 0; idx1 < instance->output.channels.size; idx1++)
+					if (instance->output.data[idx1] == buf)
+						break;
+				if (idx1 < instance->output.channels.size)
+					continue;
+				snd_pcm_ladspa_replace_input(list, old, buf);
+				instance->output.data[idx] = buf;
+				instance->output.m_data[idx] = NULL;
+				free(old);
+			}
+		}
+	}
+}
+
 static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *ladspa)
 {
 	struct list_head *list, *pos, *pos1;
@@ -741,10 +837,14 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 			instance->input.m_data = calloc(instance->input.channels.size, sizeof(void *));
 			instance->output.data = calloc(instance->output.channels.size, sizeof(void *));
 			instance->output.m_data = calloc(instance->output.channels.size, sizeof(void *));
+			instance->input.conn = calloc(instance->input.channels.size, sizeof(void *));
+			instance->output.conn = calloc(instance->output.channels.size, sizeof(void *));
 			if (instance->input.data == NULL ||
 			    instance->input.m_data == NULL ||
 			    instance->output.data == NULL ||
-			    instance->output.m_data == NULL) {
+			    instance->output.m_data == NULL ||
+			    instance->input.conn == NULL ||
+			    instance->output.conn == NULL) {
 				free(pchannels);
 				return -ENOMEM;
 			}
@@ -765,8 +865,7 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 			}
 			for (idx = 0; idx < instance->output.channels.size; idx++) {
 				chn = instance->output.channels.array[idx];
-				/* FIXME/OPTIMIZE: check if we can remove double alloc */
-				/* if LADSPA plugin has no broken inplace */
+				/* shared with the input later, if the plugin allows */
 				instance->output.data[idx] = malloc(sizeof(LADSPA_Data) * ladspa->allocated);
 				if (instance->output.data[idx] == NULL) {
 					free(pchannels);
@@ -802,6 +901,7 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 			}
 		}
 	}
+	snd_pcm_ladspa_inplace(list, ladspa);
 #if 0
 	printf("zero[0] = %p\n", ladspa->zero[0]);
 	printf("zero[1] = %p\n", ladspa->zero[1]);
@@ -820,11 +920,223 @@ static int snd_pcm_ladspa_allocate_memory(snd_pcm_t *pcm, snd_pcm_ladspa_t *lads
 	return 0;
 }
 
+/* connect the audio ports, skipping those whose buffer did not move */
+static void snd_pcm_ladspa_connect_eps(snd_pcm_ladspa_instance_t *instance,
+				       snd_pcm_ladspa_eps_t *eps,
+				       const snd_pcm_channel_area_t *areas,
+				       snd_pcm_uframes_t offset)
+{
+	LADSPA_Data *data;
+	unsigned int idx, chn;
+
+	for (idx = 0; idx < eps->channels.size; idx++) {
+		data = eps->data[idx];
+		if (data == NULL) {
+			chn = eps->channels.array[idx];
+			data = (LADSPA_Data *)((char *)areas[chn].addr + (areas[chn].first / 8));
+			data += offset;
+		}
+		if (eps->conn[idx] == data)
+			continue;
+		instance->desc->connect_port(instance->handle, eps->ports.array[idx], data);
+		eps->conn[idx] = data;
+	}
+}
+
+static void snd_pcm_ladspa_run_instance(snd_pcm_ladspa_instance_t *instance,
+					const snd_pcm_channel_area_t *in_areas,
+					snd_pcm_uframes_t in_offset,
+					const snd_pcm_channel_area_t *out_areas,
+					snd_pcm_uframes_t out_offset,
+					snd_pcm_uframes_t size)
+{
+	snd_pcm_ladspa_connect_eps(instance, &instance->input, in_areas, in_offset);
+	snd_pcm_ladspa_connect_eps(instance, &instance->output, out_areas, out_offset);
+	instance->desc->run(instance->handle, size);
+}
+
+#ifdef HAVE_LIBPTHREAD
+/* run the instances of the current job until none is left */
+static void snd_pcm_ladspa_run_job(snd_pcm_ladspa_t *ladspa)
+{
+	snd_pcm_ladspa_plugin_t *plugin = ladspa->job;
+	unsigned int idx;
+
+	for (;;) {
+		idx = __atomic_fetch_add(&ladspa->job_next, 1, __ATOMIC_RELAXED);
+		if (idx >= plugin->instances_count)
+			break;
+		snd_pcm_ladspa_run_instance(plugin->instances_array[idx],
+					    ladspa->job_in_areas, ladspa->job_in_offset,
+					    ladspa->job_out_areas, ladspa->job_out_offset,
+					    ladspa->job_size);
+	}
+}
+
+static void *snd_pcm_ladspa_worker(void *data)
+{
+	snd_pcm_ladspa_t *ladspa = data;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&ladspa->mutex);
+	for (;;) {
+		while (!ladspa->quit && ladspa->generation == generation)
+			pthread_cond_wait(&ladspa->work_cond, &ladspa->mutex);
+		if (ladspa->quit)
+			break;
+		generation = ladspa->generation;
+		pthread_mutex_unlock(&ladspa->mutex);
+		snd_pcm_ladspa_run_job(ladspa);
+		pthread_mutex_lock(&ladspa->mutex);
+		if (--ladspa->pending == 0)
+			pthread_cond_signal(&ladspa->done_cond);
+	}
+	pthread_mutex_unlock(&ladspa->mutex);
+	return NULL;
+}
+
+/* run the independent instances of a duplicated plugin in parallel;
+ * the caller's thread takes its share of the instances, too
+ */
+static void snd_pcm_ladspa_dispatch(snd_pcm_ladspa_t *ladspa,
+				    snd_pcm_ladspa_plugin_t *plugin,
+				    const snd_pcm_channel_area_t *in_areas,
+				    snd_pcm_uframes_t in_offset,
+				    const snd_pcm_channel_area_t *out_areas,
+				    snd_pcm_uframes_t out_offset,
+				    snd_pcm_uframes_t size)
+{
+	pthread_mutex_lock(&ladspa->mutex);
+	ladspa->job = plugin;
+	ladspa->job_next = 0;
+	ladspa->job_in_areas = in_areas;
+	ladspa->job_in_offset = in_offset;
+	ladspa->job_out_areas = out_areas;
+	ladspa->job_out_offset = out_offset;
+	ladspa->job_size = size;
+	ladspa->pending = ladspa->workers_count;
+	ladspa->generation++;
+	pthread_cond_broadcast(&ladspa->work_cond);
+	pthread_mutex_unlock(&ladspa->mutex);
+
+	snd_pcm_ladspa_run_job(ladspa);
+
+	pthread_mutex_lock(&ladspa->mutex);
+	while (ladspa->pending > 0)
+		pthread_cond_wait(&ladspa->done_cond, &ladspa->mutex);
+	pthread_mutex_unlock(&ladspa->mutex);
+}
+
+static void snd_pcm_ladspa_stop_workers(snd_pcm_ladspa_t *ladspa)
+{
+	unsigned int idx;
+
+	if (ladspa->workers_count == 0)
+		return;
+	pthread_mutex_lock(&ladspa->mutex);
+	ladspa->quit = 1;
+	pthread_cond_broadcast(&ladspa->work_cond);
+	pthread_mutex_unlock(&ladspa->mutex);
+	for (idx = 0; idx < ladspa->workers_count; idx++)
+		pthread_join(ladspa->workers[idx], NULL);
+	free(ladspa->workers);
+	ladspa->workers = NULL;
+	ladspa->workers_count = 0;
+	pthread_cond_destroy(&ladspa->done_cond);
+	pthread_cond_destroy(&ladspa->work_cond);
+	pthread_mutex_destroy(&ladspa->mutex);
+}
+
+/* spawn the workers when some plugin has more than one instance */
+static int snd_pcm_ladspa_start_workers(snd_pcm_t *pcm, snd_pcm_ladspa_t *ladspa)
+{
+	struct list_head *list, *pos;
+	unsigned int idx, count = 0;
+	int err;
+
+	if (ladspa->threads == 0)
+		return 0;
+	list = pcm->stream == SND_PCM_STREAM_PLAYBACK ? &ladspa->pplugins : &ladspa->cplugins;
+	list_for_each(pos, list) {
+		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+		if (plugin->instances_count > count)
+			count = plugin->instances_count;
+	}
+	if (count < 2)
+		return 0;
+	count--;
+	if (count > ladspa->threads)
+		count = ladspa->threads;
+	ladspa->workers = calloc(count, sizeof(pthread_t));
+	if (ladspa->workers == NULL)
+		return -ENOMEM;
+	pthread_mutex_init(&ladspa->mutex, NULL);
+	pthread_cond_init(&ladspa->work_cond, NULL);
+	pthread_cond_init(&ladspa->done_cond, NULL);
+	ladspa->quit = 0;
+	ladspa->generation = 0;
+	for (idx = 0; idx < count; idx++) {
+		err = pthread_create(&ladspa->workers[idx], NULL,
+				     snd_pcm_ladspa_worker, ladspa);
+		if (err) {
+			snd_error(PCM, "cannot create LADSPA worker thread");
+			ladspa->workers_count = idx;
+			if (idx == 0) {
+				free(ladspa->workers);
+				ladspa->workers = NULL;
+				pthread_cond_destroy(&ladspa->done_cond);
+				pthread_cond_destroy(&ladspa->work_cond);
+				pthread_mutex_destroy(&ladspa->mutex);
+			} else {
+				snd_pcm_ladspa_stop_workers(ladspa);
+			}
+			return -err;
+		}
+	}
+	ladspa->workers_count = count;
+	return 0;
+}
+#else
+static void snd_pcm_ladspa_stop_workers(snd_pcm_ladspa_t *ladspa ATTRIBUTE_UNUSED)
+{
+}
+
+static int snd_pcm_ladspa_start_workers(snd_pcm_t *pcm ATTRIBUTE_UNUSED,
+					snd_pcm_ladspa_t *ladspa ATTRIBUTE_UNUSED)
+{
+	return 0;
+}
+#endif
+
+/* array of the instances of each plugin for the worker threads */
+static int snd_pcm_ladspa_index_instances(snd_pcm_t *pcm, snd_pcm_ladspa_t *ladspa)
+{
+	struct list_head *list, *pos, *pos1;
+	unsigned int count;
+
+	list = pcm->stream == SND_PCM_STREAM_PLAYBACK ? &ladspa->pplugins : &ladspa->cplugins;
+	list_for_each(pos, list) {
+		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+		count = 0;
+		list_for_each(pos1, &plugin->instances)
+			count++;
+		plugin->instances_array = calloc(count, sizeof(snd_pcm_ladspa_instance_t *));
+		if (plugin->instances_array == NULL)
+			return -ENOMEM;
+		count = 0;
+		list_for_each(pos1, &plugin->instances)
+			plugin->instances_array[count++] = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
+		plugin->instances_count = count;
+	}
+	return 0;
+}
+
 static int snd_pcm_ladspa_init(snd_pcm_t *pcm)
 {
 	snd_pcm_ladspa_t *ladspa = pcm->private_data;
 	int err;
 
+	snd_pcm_ladspa_stop_workers(ladspa);
 	snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
 	err = snd_pcm_ladspa_allocate_instances(pcm, ladspa);
 	if (err < 0) {
@@ -836,6 +1148,14 @@ static int snd_pcm_ladspa_init(snd_pcm_t *pcm)
 		snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
 		return err;
 	}
+	err = snd_pcm_ladspa_index_instances(pcm, ladspa);
+	if (err < 0) {
+		snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
+		return err;
+	}
+	err = snd_pcm_ladspa_start_workers(pcm, ladspa);
+	if (err < 0)
+		snd_warn(PCM, "LADSPA plugins run serially");
 	return 0;
 }
 
@@ -843,10 +1163,41 @@ static int snd_pcm_ladspa_hw_free(snd_pcm_t *pcm)
 {
 	snd_pcm_ladspa_t *ladspa = pcm->private_data;
 
+	snd_pcm_ladspa_stop_workers(ladspa);
 	snd_pcm_ladspa_free_instances(pcm, ladspa, 1);
 	return snd_pcm_generic_hw_free(pcm);
 }
 
+static void snd_pcm_ladspa_process(snd_pcm_ladspa_t *ladspa,
+				   struct list_head *list,
+				   const snd_pcm_channel_area_t *in_areas,
+				   snd_pcm_uframes_t in_offset,
+				   const snd_pcm_channel_area_t *out_areas,
+				   snd_pcm_uframes_t out_offset,
+				   snd_pcm_uframes_t size)
+{
+	snd_pcm_ladspa_instance_t *instance;
+	struct list_head *pos, *pos1;
+
+	list_for_each(pos, list) {
+		snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
+#ifdef HAVE_LIBPTHREAD
+		if (ladspa->workers_count > 0 && plugin->instances_count > 1) {
+			snd_pcm_ladspa_dispatch(ladspa, plugin,
+						in_areas, in_offset,
+						out_areas, out_offset, size);
+			continue;
+		}
+#endif
+		list_for_each(pos1, &plugin->instances) {
+			instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
+			snd_pcm_ladspa_run_instance(instance,
+						    in_areas, in_offset,
+						    out_areas, out_offset, size);
+		}
+	}
+}
+
 static snd_pcm_uframes_t
 snd_pcm_ladspa_write_areas(snd_pcm_t *pcm,
 			   const snd_pcm_channel_area_t *areas,
@@ -857,10 +1208,7 @@ snd_pcm_ladspa_write_areas(snd_pcm_t *pcm,
 			   snd_pcm_uframes_t *slave_sizep)
 {
 	snd_pcm_ladspa_t *ladspa = pcm->private_data;
-	snd_pcm_ladspa_instance_t *instance;
-	struct list_head *pos, *pos1;
-	LADSPA_Data *data;
-	unsigned int idx, chn, size1, size2;
+	unsigned int size1, size2;
 
 	if (size > *slave_sizep)
 		size = *slave_sizep;
@@ -874,31 +1222,9 @@ snd_pcm_ladspa_write_areas(snd_pcm_t *pcm,
 		size1 = size;
 		if (size1 > ladspa->allocated)
 			size1 = ladspa->allocated;
-		list_for_each(pos, &ladspa->pplugins) {
-			snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
-			list_for_each(pos1, &plugin->instances) {
-				instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
-				for (idx = 0; idx < instance->input.channels.size; idx++) {
-					chn = instance->input.channels.array[idx];
-					data = instance->input.data[idx];
-					if (data == NULL) {
-						data = (LADSPA_Data *)((char *)areas[chn].addr + (areas[chn].first / 8));
-						data += offset;
-					}
-					instance->desc->connect_port(instance->handle, instance->input.ports.array[idx], data);
-				}
-				for (idx = 0; idx < instance->output.channels.size; idx++) {
-					chn = instance->output.channels.array[idx];
-					data = instance->output.data[idx];
-					if (data == NULL) {
-						data = (LADSPA_Data *)((char *)slave_areas[chn].addr + (slave_areas[chn].first / 8));
-						data += slave_offset;
-					}
-					instance->desc->connect_port(instance->handle, instance->output.ports.array[idx], data);
-				}
-				instance->desc->run(instance->handle, size1);
-			}
-		}
+		snd_pcm_ladspa_process(ladspa, &ladspa->pplugins,
+				       areas, offset,
+				       slave_areas, slave_offset, size1);
 		offset += size1;
 		slave_offset += size1;
 		size -= size1;
@@ -918,10 +1244,7 @@ snd_pcm_ladspa_read_areas(snd_pcm_t *pcm,
 			  snd_pcm_uframes_t *slave_sizep)
 {
 	snd_pcm_ladspa_t *ladspa = pcm->private_data;
-	snd_pcm_ladspa_instance_t *instance;
-	struct list_head *pos, *pos1;
-	LADSPA_Data *data;
-	unsigned int idx, chn, size1, size2;;
+	unsigned int size1, size2;
 
 	if (size > *slave_sizep)
 		size = *slave_sizep;
@@ -935,31 +1258,9 @@ snd_pcm_ladspa_read_areas(snd_pcm_t *pcm,
 		size1 = size;
 		if (size1 > ladspa->allocated)
 			size1 = ladspa->allocated;
-		list_for_each(pos, &ladspa->cplugins) {
-			snd_pcm_ladspa_plugin_t *plugin = list_entry(pos, snd_pcm_ladspa_plugin_t, list);
-			list_for_each(pos1, &plugin->instances) {
-				instance = list_entry(pos1, snd_pcm_ladspa_instance_t, list);
-				for (idx = 0; idx < instance->input.channels.size; idx++) {
-					chn = instance->input.channels.array[idx];
-					data = instance->input.data[idx];
-					if (data == NULL) {
-						data = (LADSPA_Data *)((char *)slave_areas[chn].addr + (slave_areas[chn].first / 8));
-						data += slave_offset;
-					}
-					instance->desc->connect_port(instance->handle, instance->input.ports.array[idx], data);
-				}
-				for (idx = 0; idx < instance->output.channels.size; idx++) {
-					chn = instance->output.channels.array[idx];
-					data = instance->output.data[idx];
-					if (data == NULL) {
-						data = (LADSPA_Data *)((char *)areas[chn].addr + (areas[chn].first / 8));
-						data += offset;
-					}
-					instance->desc->connect_port(instance->handle, instance->output.ports.array[idx], data);
-				}
-				instance->desc->run(instance->handle, size1);
-			}
-		}
+		snd_pcm_ladspa_process(ladspa, &ladspa->cplugins,
+				       slave_areas, slave_offset,
+				       areas, offset, size1);
 		offset += size1;
 		slave_offset += size1;
 		size -= size1;
@@ -1057,6 +1358,10 @@ static void snd_pcm_ladspa_dump(snd_pcm_t *pcm, snd_output_t *out)
 	snd_pcm_ladspa_plugins_dump(&ladspa->pplugins, out);
 	snd_output_printf(out, "  Capture:\n");
 	snd_pcm_ladspa_plugins_dump(&ladspa->cplugins, out);
+#ifdef HAVE_LIBPTHREAD
+	if (ladspa->workers_count > 0)
+		snd_output_printf(out, "  Worker threads: %u\n", ladspa->workers_count);
+#endif
 	if (pcm->setup) {
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
@@ -1672,6 +1977,17 @@ connected to a dummy sample area.
 
 Instances of LADSPA plugins are created dynamically.
 
+Audio ports are connected again only when their buffer moves. Plugins
+without the LADSPA_PROPERTY_INPLACE_BROKEN property process the
+intermediate buffers in place, so the chain doesn't need a separate buffer
+for each stage and channel.
+
+With the threads option, the instances created by the policy duplicate
+(one per channel) are run in parallel by a pool of worker threads. The
+caller's thread takes its share, too, so threads 3 is enough for four
+channels. This pays off only for wide multichannel chains with heavy
+plugins.
+
 \code
 pcm.name {
 	type ladspa             # ALSA<->LADSPA PCM
@@ -1683,6 +1999,7 @@ pcm.name {
 		pcm { }         # Slave PCM definition
 	}
 	[channels INT]		# count input channels (input to LADSPA plugin chain)
+	[threads INT]		# worker threads for duplicated instances, 0-64 (default 0)
 	[path STR]		# Path (directory) with LADSPA plugins
 	plugins |		# Definition for both directions
 	playback_plugins |	# Definition for playback direction
@@ -1740,6 +2057,7 @@ int _snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
 	snd_config_t *slave = NULL, *sconf;
 	const char *path = NULL;
 	long channels = 0;
+	long threads = 0;
 	snd_config_t *plugins = NULL, *pplugins = NULL, *cplugins = NULL;
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
@@ -1768,6 +2086,16 @@ int _snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
 				channels = 0;
 			continue;
 		}
+		if (strcmp(id, "threads") == 0) {
+			err = snd_config_get_integer(n, &threads);
+			if (err < 0)
+				return err;
+			if (threads < 0 || threads > 64) {
+				snd_error(PCM, "threads must be between 0 and 64");
+				return -EINVAL;
+			}
+			continue;
+		}
 		if (strcmp(id, "plugins") == 0) {
 			plugins = n;
 			continue;
@@ -1803,9 +2131,12 @@ int _snd_pcm_ladspa_open(snd_pcm_t **pcmp, const char *name,
 	if (err < 0)
 		return err;
 	err = snd_pcm_ladspa_open(pcmp, name, path, channels, pplugins, cplugins, spcm, 1);
-	if (err < 0)
+	if (err < 0) {
 		snd_pcm_close(spcm);
-	return err;
+		return err;
+	}
+	((snd_pcm_ladspa_t *)(*pcmp)->private_data)->threads = threads;
+	return 0;
 }
 #ifndef DOC_HIDDEN
 SND_DLSYM_BUILD_VERSION(_snd_pcm_ladspa_open, SND_PCM_DLSYM_VERSION);
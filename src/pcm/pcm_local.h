@@ -1187,6 +1187,13 @@ static inline snd_pcm_sframes_t pcm_frame_diff2(snd_pcm_uframes_t ptr1,
 	return r;
 }
 
+/* atomic helpers for the data shared with the plugin threads */
+#define atomic_read(ptr)    __atomic_load_n(ptr, __ATOMIC_SEQ_CST )
+#define atomic_add(ptr, n)  __atomic_add_fetch(ptr, n, __ATOMIC_SEQ_CST)
+#define atomic_dec(ptr)     __atomic_sub_fetch(ptr, 1, __ATOMIC_SEQ_CST)
+#define atomic_load_acquire(ptr)	__atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define atomic_store_release(ptr, val)	__atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+
 #ifdef THREAD_SAFE_API
 /*
  * __snd_pcm_lock() and __snd_pcm_unlock() are used to lock/unlock the plugin
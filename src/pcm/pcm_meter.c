@@ -31,13 +31,12 @@
 #include "pcm_plugin.h"
 #include "bswap.h"
 #include <time.h>
+#include <math.h>
+#include <poll.h>
 #include <pthread.h>
 #include <dlfcn.h>
-
-#ifndef DOC_HIDDEN
-#define atomic_read(ptr)    __atomic_load_n(ptr, __ATOMIC_SEQ_CST )
-#define atomic_add(ptr, n)  __atomic_add_fetch(ptr, n, __ATOMIC_SEQ_CST)
-#define atomic_dec(ptr)     __atomic_sub_fetch(ptr, 1, __ATOMIC_SEQ_CST)
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
 #endif
 
 #ifndef PIC
@@ -54,6 +53,11 @@ struct _snd_pcm_scope {
 	const snd_pcm_scope_ops_t *ops;
 	void *private_data;
 	struct list_head list;
+	/* statistics-only scopes take the committed frames directly and
+	 * don't need the meter copy; the others read meter->buf */
+	void (*feed)(snd_pcm_scope_t *scope,
+		     const snd_pcm_channel_area_t *areas,
+		     snd_pcm_uframes_t offset, snd_pcm_uframes_t frames);
 };
 
 typedef struct _snd_pcm_meter {
@@ -72,30 +76,89 @@ typedef struct _snd_pcm_meter {
 	pthread_mutex_t running_mutex;
 	pthread_cond_t running_cond;
 	struct timespec delay;
+	unsigned int frequency;
+	int wakeup_fd;			/* eventfd kicked from the stream side */
+	snd_pcm_uframes_t wakeup_ptr;	/* position at the last kick */
+	snd_pcm_uframes_t wakeup_frames; /* frames between kicks */
 	void *dl_handle;
 } snd_pcm_meter_t;
 
+/* wake the meter thread once per period (or update interval) of new data */
+static void snd_pcm_meter_wakeup(snd_pcm_t *pcm, snd_pcm_uframes_t ptr)
+{
+	snd_pcm_meter_t *meter = pcm->private_data;
+	snd_pcm_sframes_t frames;
+	uint64_t val = 1;
+
+	if (meter->wakeup_fd < 0)
+		return;
+	frames = ptr - meter->wakeup_ptr;
+	if (frames < 0)
+		frames += pcm->boundary;
+	if ((snd_pcm_uframes_t)frames < meter->wakeup_frames)
+		return;
+	meter->wakeup_ptr = ptr;
+	if (write(meter->wakeup_fd, &val, sizeof(val)) < 0) {
+		/* counter overflow only, the thread is awake anyway */
+	}
+}
+
+/* sleep until the stream side has new data, or the timeout elapses */
+static void snd_pcm_meter_wait(snd_pcm_t *pcm)
+{
+	snd_pcm_meter_t *meter = pcm->private_data;
+	struct pollfd pfd;
+	uint64_t val;
+	int timeout;
+
+	if (meter->wakeup_fd < 0) {
+		nanosleep(&meter->delay, NULL);
+		return;
+	}
+	/* fall back to the buffer time when nothing is committed */
+	timeout = pcm->buffer_size * 1000 / pcm->rate;
+	if (timeout < (int)(1000 / meter->frequency))
+		timeout = 1000 / meter->frequency;
+	pfd.fd = meter->wakeup_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN)) {
+		if (read(meter->wakeup_fd, &val, sizeof(val)) < 0) {
+			/* already consumed */
+		}
+	}
+}
+
 static void snd_pcm_meter_add_frames(snd_pcm_t *pcm,
 				     const snd_pcm_channel_area_t *areas,
 				     snd_pcm_uframes_t ptr,
 				     snd_pcm_uframes_t frames)
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
+	struct list_head *pos;
 	if (frames > pcm->buffer_size)
 		frames = pcm->buffer_size;
 	while (frames > 0) {
 		snd_pcm_uframes_t n = frames;
-		snd_pcm_uframes_t dst_offset = ptr % meter->buf_size;
 		snd_pcm_uframes_t src_offset = ptr % pcm->buffer_size;
-		snd_pcm_uframes_t dst_cont = meter->buf_size - dst_offset;
 		snd_pcm_uframes_t src_cont = pcm->buffer_size - src_offset;
-		if (n > dst_cont)
-			n = dst_cont;
 		if (n > src_cont)
 			n = src_cont;
-		snd_pcm_areas_copy(meter->buf_areas, dst_offset,
-				   areas, src_offset,
-				   pcm->channels, n, pcm->format);
+		if (meter->buf) {
+			snd_pcm_uframes_t dst_offset = ptr % meter->buf_size;
+			snd_pcm_uframes_t dst_cont = meter->buf_size - dst_offset;
+			if (n > dst_cont)
+				n = dst_cont;
+			snd_pcm_areas_copy(meter->buf_areas, dst_offset,
+					   areas, src_offset,
+					   pcm->channels, n, pcm->format);
+		}
+		list_for_each(pos, &meter->scopes) {
+			snd_pcm_scope_t *scope;
+			scope = list_entry(pos, snd_pcm_scope_t, list);
+			if (scope->feed && scope->enabled)
+				scope->feed(scope, areas, src_offset, n);
+		}
 		frames -= n;
 		ptr += n;
 		if (ptr == pcm->boundary)
@@ -109,8 +172,9 @@ static void snd_pcm_meter_update_main(snd_pcm_t *pcm)
 	snd_pcm_sframes_t frames;
 	snd_pcm_uframes_t rptr, old_rptr;
 	const snd_pcm_channel_area_t *areas;
-	int locked;
-	locked = (pthread_mutex_trylock(&meter->update_mutex) >= 0);
+	/* the meter thread is consuming the new frames right now */
+	if (pthread_mutex_trylock(&meter->update_mutex) != 0)
+		return;
 	areas = snd_pcm_mmap_areas(pcm);
 	rptr = *pcm->hw.ptr;
 	old_rptr = meter->rptr;
@@ -123,8 +187,7 @@ static void snd_pcm_meter_update_main(snd_pcm_t *pcm)
 		snd_pcm_meter_add_frames(pcm, areas, old_rptr,
 					 (snd_pcm_uframes_t) frames);
 	}
-	if (locked)
-		pthread_mutex_unlock(&meter->update_mutex);
+	pthread_mutex_unlock(&meter->update_mutex);
 }
 
 static int snd_pcm_meter_update_scope(snd_pcm_t *pcm)
@@ -194,7 +257,9 @@ static void *snd_pcm_meter_thread(void *data)
 	int reset;
 	list_for_each(pos, &meter->scopes) {
 		scope = list_entry(pos, snd_pcm_scope_t, list);
-		snd_pcm_scope_enable(scope);
+		/* fed scopes are enabled before the thread starts */
+		if (!scope->feed)
+			snd_pcm_scope_enable(scope);
 	}
 	while (!meter->closed) {
 		snd_pcm_sframes_t now;
@@ -259,7 +324,7 @@ static void *snd_pcm_meter_thread(void *data)
 			if (scope->enabled)
 				scope->ops->update(scope);
 		}
-		nanosleep(&meter->delay, NULL);
+		snd_pcm_meter_wait(pcm);
 	}
 	list_for_each(pos, &meter->scopes) {
 		scope = list_entry(pos, snd_pcm_scope_t, list);
@@ -358,6 +423,7 @@ static snd_pcm_sframes_t snd_pcm_meter_mmap_commit(snd_pcm_t *pcm,
 	if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
 		snd_pcm_meter_add_frames(pcm, snd_pcm_mmap_areas(pcm), old_rptr, result);
 		meter->rptr = *pcm->appl.ptr;
+		snd_pcm_meter_wakeup(pcm, meter->rptr);
 	}
 	return result;
 }
@@ -368,8 +434,10 @@ static snd_pcm_sframes_t snd_pcm_meter_avail_update(snd_pcm_t *pcm)
 	snd_pcm_sframes_t result = snd_pcm_avail_update(meter->gen.slave);
 	if (result <= 0)
 		return result;
-	if (pcm->stream == SND_PCM_STREAM_CAPTURE)
+	if (pcm->stream == SND_PCM_STREAM_CAPTURE) {
 		snd_pcm_meter_update_main(pcm);
+		snd_pcm_meter_wakeup(pcm, *pcm->hw.ptr);
+	}
 	return result;
 }
 
@@ -444,6 +512,9 @@ static int snd_pcm_meter_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 	unsigned int channel;
 	snd_pcm_t *slave = meter->gen.slave;
 	ssize_t buf_size_bytes;
+	struct list_head *pos;
+	snd_pcm_scope_t *scope;
+	int need_buf = 0;
 	int err;
 	err = snd_pcm_hw_params_slave(pcm, params,
 				      snd_pcm_meter_hw_refine_cchange,
@@ -459,20 +530,47 @@ static int snd_pcm_meter_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 	buf_size_bytes = snd_pcm_frames_to_bytes(slave, meter->buf_size);
 	if (buf_size_bytes < 0)
 		return buf_size_bytes;
+	/* the stream copy is kept only for scopes reading raw samples */
+	list_for_each(pos, &meter->scopes) {
+		scope = list_entry(pos, snd_pcm_scope_t, list);
+		if (!scope->feed)
+			need_buf = 1;
+	}
 	assert(!meter->buf);
-	meter->buf = malloc(buf_size_bytes);
-	if (!meter->buf)
-		return -ENOMEM;
-	meter->buf_areas = malloc(sizeof(*meter->buf_areas) * slave->channels);
-	if (!meter->buf_areas) {
-		free(meter->buf);
-		return -ENOMEM;
+	if (need_buf) {
+		meter->buf = malloc(buf_size_bytes);
+		if (!meter->buf)
+			return -ENOMEM;
+		meter->buf_areas = malloc(sizeof(*meter->buf_areas) * slave->channels);
+		if (!meter->buf_areas) {
+			free(meter->buf);
+			meter->buf = NULL;
+			return -ENOMEM;
+		}
+		for (channel = 0; channel < slave->channels; ++channel) {
+			snd_pcm_channel_area_t *a = &meter->buf_areas[channel];
+			a->addr = meter->buf + buf_size_bytes / slave->channels * channel;
+			a->first = 0;
+			a->step = slave->sample_bits;
+		}
 	}
-	for (channel = 0; channel < slave->channels; ++channel) {
-		snd_pcm_channel_area_t *a = &meter->buf_areas[channel];
-		a->addr = meter->buf + buf_size_bytes / slave->channels * channel;
-		a->first = 0;
-		a->step = slave->sample_bits;
+	/* batch the scope updates per period, but not above the frequency */
+	meter->wakeup_frames = slave->period_size;
+	if (meter->wakeup_frames < slave->rate / meter->frequency)
+		meter->wakeup_frames = slave->rate / meter->frequency;
+	meter->wakeup_ptr = 0;
+#ifdef HAVE_SYS_EVENTFD_H
+	meter->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+	meter->wakeup_fd = -1;
+#endif
+	if (meter->wakeup_fd < 0)
+		snd_debug(PCM, "meter: no eventfd, polling with the update frequency");
+	/* fed scopes run in the stream thread, enable them before it runs */
+	list_for_each(pos, &meter->scopes) {
+		scope = list_entry(pos, snd_pcm_scope_t, list);
+		if (scope->feed)
+			snd_pcm_scope_enable(scope);
 	}
 	meter->closed = 0;
 	err = pthread_create(&meter->thread, NULL, snd_pcm_meter_thread, pcm);
@@ -483,13 +581,22 @@ static int snd_pcm_meter_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t * params)
 static int snd_pcm_meter_hw_free(snd_pcm_t *pcm)
 {
 	snd_pcm_meter_t *meter = pcm->private_data;
+	uint64_t val = 1;
 	int err;
 	meter->closed = 1;
 	pthread_mutex_lock(&meter->running_mutex);
 	pthread_cond_signal(&meter->running_cond);
 	pthread_mutex_unlock(&meter->running_mutex);
+	if (meter->wakeup_fd >= 0 &&
+	    write(meter->wakeup_fd, &val, sizeof(val)) < 0) {
+		/* the thread is awake anyway */
+	}
 	err = pthread_join(meter->thread, 0);
 	assert(err == 0);
+	if (meter->wakeup_fd >= 0) {
+		close(meter->wakeup_fd);
+		meter->wakeup_fd = -1;
+	}
 	free(meter->buf);
 	free(meter->buf_areas);
 	meter->buf = NULL;
@@ -582,6 +689,8 @@ int snd_pcm_meter_open(snd_pcm_t **pcmp, const char *name, unsigned int frequenc
 	meter->gen.close_slave = close_slave;
 	meter->delay.tv_sec = 0;
 	meter->delay.tv_nsec = 1000000000 / frequency;
+	meter->frequency = frequency;
+	meter->wakeup_fd = -1;
 	INIT_LIST_HEAD(&meter->scopes);
 
 	err = snd_pcm_new(&pcm, SND_PCM_TYPE_METER, name, slave->stream, slave->mode);
@@ -735,6 +844,13 @@ pcm.name {
 }
 \endcode
 
+The scopes are updated from a separate thread.  While the stream is not
+running, the thread blocks without any wakeups.  While it runs, the thread
+wakes when a period of new data was committed (or read for capture), and
+at the latest once per buffer time, so it also notices a stream stopped
+by an xrun.  The frequency limits the update rate for short periods.
+Where eventfd is not available, the thread polls with the frequency.
+
 \subsection pcm_plugins_meter_funcref Function reference
 
 <UL>
@@ -1226,6 +1342,362 @@ int16_t *snd_pcm_scope_s16_get_channel_buffer(snd_pcm_scope_t *scope,
 	return s16->buf_areas[channel].addr;
 }
 
+#ifndef DOC_HIDDEN
+#define LEVEL_CHUNK		256	/* frames converted at once */
+#define LEVEL_OVERSAMPLE	4	/* true-peak oversampling factor */
+#define LEVEL_TAPS		12	/* FIR taps per oversampling phase */
+#define LEVEL_HIST		(LEVEL_TAPS - 1)
+#define LEVEL_LANES		8	/* independent accumulators for the vectorizer */
+
+typedef struct {
+	float hist[LEVEL_HIST];		/* last samples for the true-peak FIR */
+	uint32_t peak;
+	float true_peak;
+	double sum;
+	unsigned long clips;
+} snd_pcm_scope_peak_channel_t;
+
+typedef struct _snd_pcm_scope_peak {
+	snd_pcm_t *pcm;
+	unsigned int index;
+	unsigned int channels;
+	snd_pcm_uframes_t frames;	/* frames accumulated since the last publish */
+	snd_pcm_uframes_t interval;	/* frames between publishes */
+	int reset;			/* requested by the meter thread */
+	int32_t clip_max;
+	int32_t clip_min;
+	float taps[LEVEL_OVERSAMPLE][LEVEL_TAPS];
+	int32_t *buf;
+	snd_pcm_channel_area_t *buf_areas;
+	snd_pcm_scope_peak_channel_t *state;
+	snd_pcm_scope_peak_info_t *info[2];	/* published results */
+	unsigned int seq;		/* info[seq & 1] is the current one */
+} snd_pcm_scope_peak_t;
+
+/* 48 taps windowed sinc interpolator split in polyphase form */
+static void level_init_taps(snd_pcm_scope_peak_t *level)
+{
+	const unsigned int n = LEVEL_OVERSAMPLE * LEVEL_TAPS;
+	unsigned int i, p;
+	for (i = 0; i < n; i++) {
+		double t = ((double)i - (n - 1) / 2.0) / LEVEL_OVERSAMPLE;
+		double w = 0.42 - 0.5 * cos(2 * M_PI * i / (n - 1)) +
+			   0.08 * cos(4 * M_PI * i / (n - 1));
+		double s = t == 0 ? 1 : sin(M_PI * t) / (M_PI * t);
+		level->taps[i % LEVEL_OVERSAMPLE][i / LEVEL_OVERSAMPLE] = s * w;
+	}
+	for (p = 0; p < LEVEL_OVERSAMPLE; p++) {
+		float sum = 0;
+		for (i = 0; i < LEVEL_TAPS; i++)
+			sum += level->taps[p][i];
+		for (i = 0; i < LEVEL_TAPS; i++)
+			level->taps[p][i] /= sum;
+	}
+}
+
+/*
+ * The loops below are kept free of cross-iteration dependencies (or
+ * split over LEVEL_LANES accumulators) so the compiler can vectorize them.
+ */
+static void level_channel(snd_pcm_scope_peak_t *level,
+			  snd_pcm_scope_peak_channel_t *st,
+			  const int32_t *restrict in, unsigned int frames)
+{
+	float x[LEVEL_HIST + LEVEL_CHUNK];
+	float y[LEVEL_CHUNK];
+	float sum[LEVEL_LANES] = { 0 };
+	float tp[LEVEL_LANES] = { 0 };
+	const int32_t clip_max = level->clip_max;
+	const int32_t clip_min = level->clip_min;
+	uint32_t peak = st->peak;
+	unsigned long clips = 0;
+	unsigned int i, j, k, p;
+
+	for (i = 0; i < frames; i++) {
+		int32_t v = in[i];
+		uint32_t a = v < 0 ? -(uint32_t)v : (uint32_t)v;
+		peak = a > peak ? a : peak;
+		clips += (v >= clip_max) | (v <= clip_min);
+	}
+	st->peak = peak;
+	st->clips += clips;
+
+	memcpy(x, st->hist, sizeof(st->hist));
+	for (i = 0; i < frames; i++)
+		x[LEVEL_HIST + i] = in[i] * (1.0f / 2147483648.0f);
+	memcpy(st->hist, x + frames, sizeof(st->hist));
+
+	for (i = 0; i + LEVEL_LANES <= frames; i += LEVEL_LANES)
+		for (j = 0; j < LEVEL_LANES; j++)
+			sum[j] += x[LEVEL_HIST + i + j] * x[LEVEL_HIST + i + j];
+	for (j = 0; i < frames; i++, j++)
+		sum[j] += x[LEVEL_HIST + i] * x[LEVEL_HIST + i];
+	for (j = 0; j < LEVEL_LANES; j++)
+		st->sum += sum[j];
+
+	for (p = 0; p < LEVEL_OVERSAMPLE; p++) {
+		for (i = 0; i < frames; i++)
+			y[i] = 0;
+		for (k = 0; k < LEVEL_TAPS; k++) {
+			float t = level->taps[p][k];
+			for (i = 0; i < frames; i++)
+				y[i] += t * x[i + k];
+		}
+		for (i = 0; i + LEVEL_LANES <= frames; i += LEVEL_LANES)
+			for (j = 0; j < LEVEL_LANES; j++) {
+				float a = fabsf(y[i + j]);
+				tp[j] = a > tp[j] ? a : tp[j];
+			}
+		for (j = 0; i < frames; i++, j++) {
+			float a = fabsf(y[i]);
+			tp[j] = a > tp[j] ? a : tp[j];
+		}
+	}
+	for (j = 0; j < LEVEL_LANES; j++)
+		if (tp[j] > st->true_peak)
+			st->true_peak = tp[j];
+}
+
+static void level_process(snd_pcm_scope_peak_t *level,
+			  const snd_pcm_channel_area_t *areas,
+			  snd_pcm_uframes_t offset, snd_pcm_uframes_t frames)
+{
+	unsigned int c;
+	while (frames > 0) {
+		unsigned int n = frames > LEVEL_CHUNK ? LEVEL_CHUNK : frames;
+		snd_pcm_linear_convert(level->buf_areas, 0, areas, offset,
+				       level->channels, n, level->index);
+		for (c = 0; c < level->channels; c++)
+			level_channel(level, &level->state[c],
+				      level->buf + c * LEVEL_CHUNK, n);
+		level->frames += n;
+		offset += n;
+		frames -= n;
+	}
+}
+
+/* fill the spare info slot and flip to it; readers never wait */
+static void level_publish(snd_pcm_scope_peak_t *level)
+{
+	snd_pcm_scope_peak_info_t *info;
+	unsigned int c;
+	info = level->info[(atomic_read(&level->seq) + 1) & 1];
+	/* the previous flip must be visible before the slot is rewritten */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (c = 0; c < level->channels; c++) {
+		snd_pcm_scope_peak_channel_t *st = &level->state[c];
+		float peak = st->peak * (1.0f / 2147483648.0f);
+		info[c].peak = peak;
+		info[c].rms = level->frames ? sqrt(st->sum / level->frames) : 0;
+		info[c].true_peak = st->true_peak > peak ? st->true_peak : peak;
+		info[c].clips = st->clips;
+		st->peak = 0;
+		st->true_peak = 0;
+		st->sum = 0;
+	}
+	level->frames = 0;
+	atomic_add(&level->seq, 1);
+}
+
+static int level_enable(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_peak_t *level = scope->private_data;
+	snd_pcm_meter_t *meter = level->pcm->private_data;
+	snd_pcm_t *spcm = meter->gen.slave;
+	snd_pcm_channel_area_t *a;
+	unsigned int c, width;
+	switch (spcm->format) {
+	case SND_PCM_FORMAT_S8:
+	case SND_PCM_FORMAT_S16_LE:
+	case SND_PCM_FORMAT_S16_BE:
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S24_BE:
+	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_S32_BE:
+	case SND_PCM_FORMAT_U8:
+	case SND_PCM_FORMAT_U16_LE:
+	case SND_PCM_FORMAT_U16_BE:
+	case SND_PCM_FORMAT_U24_LE:
+	case SND_PCM_FORMAT_U24_BE:
+	case SND_PCM_FORMAT_U32_LE:
+	case SND_PCM_FORMAT_U32_BE:
+		break;
+	default:
+		return -EINVAL;
+	}
+	level->index = snd_pcm_linear_convert_index(spcm->format,
+						    SND_PCM_FORMAT_S32);
+	level->channels = spcm->channels;
+	level->interval = meter->wakeup_frames;
+	level->frames = 0;
+	level->reset = 0;
+	width = snd_pcm_format_width(spcm->format);
+	level->clip_max = INT32_MAX & ~(uint32_t)((1ULL << (32 - width)) - 1);
+	level->clip_min = INT32_MIN;
+	level->buf = malloc(LEVEL_CHUNK * 4 * level->channels);
+	level->buf_areas = calloc(level->channels, sizeof(*level->buf_areas));
+	level->state = calloc(level->channels, sizeof(*level->state));
+	level->info[0] = calloc(level->channels * 2, sizeof(*level->info[0]));
+	if (!level->buf || !level->buf_areas || !level->state ||
+	    !level->info[0]) {
+		free(level->buf);
+		free(level->buf_areas);
+		free(level->state);
+		free(level->info[0]);
+		level->buf = NULL;
+		level->buf_areas = NULL;
+		level->state = NULL;
+		level->info[0] = NULL;
+		return -ENOMEM;
+	}
+	level->info[1] = level->info[0] + level->channels;
+	a = level->buf_areas;
+	for (c = 0; c < level->channels; c++, a++) {
+		a->addr = level->buf + c * LEVEL_CHUNK;
+		a->first = 0;
+		a->step = 32;
+	}
+	return 0;
+}
+
+static void level_disable(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_peak_t *level = scope->private_data;
+	free(level->buf);
+	level->buf = NULL;
+	free(level->buf_areas);
+	level->buf_areas = NULL;
+	free(level->state);
+	level->state = NULL;
+	free(level->info[0]);
+	level->info[0] = NULL;
+	level->info[1] = NULL;
+}
+
+static void level_close(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_peak_t *level = scope->private_data;
+	free(level);
+}
+
+static void level_start(snd_pcm_scope_t *scope ATTRIBUTE_UNUSED)
+{
+}
+
+static void level_stop(snd_pcm_scope_t *scope ATTRIBUTE_UNUSED)
+{
+}
+
+static void level_update(snd_pcm_scope_t *scope ATTRIBUTE_UNUSED)
+{
+}
+
+/* called from the stream thread with the committed frames */
+static void level_feed(snd_pcm_scope_t *scope,
+		       const snd_pcm_channel_area_t *areas,
+		       snd_pcm_uframes_t offset, snd_pcm_uframes_t frames)
+{
+	snd_pcm_scope_peak_t *level = scope->private_data;
+	if (atomic_read(&level->reset)) {
+		memset(level->state, 0, level->channels * sizeof(*level->state));
+		level->frames = 0;
+		while (atomic_read(&level->reset))
+			atomic_dec(&level->reset);
+	}
+	level_process(level, areas, offset, frames);
+	if (level->frames >= level->interval)
+		level_publish(level);
+}
+
+static void level_reset(snd_pcm_scope_t *scope)
+{
+	snd_pcm_scope_peak_t *level = scope->private_data;
+	atomic_add(&level->reset, 1);
+}
+
+static const snd_pcm_scope_ops_t level_ops = {
+	.enable = level_enable,
+	.disable = level_disable,
+	.close = level_close,
+	.start = level_start,
+	.stop = level_stop,
+	.update = level_update,
+	.reset = level_reset,
+};
+
+#endif
+
+/**
+ * \brief Add a peak scope to a #SND_PCM_TYPE_METER PCM
+ * \param pcm The pcm handle
+ * \param name Scope name
+ * \param scopep Pointer to newly created and added scope
+ * \return 0 on success otherwise a negative error code
+ *
+ * peak scope computes per channel sample peak, RMS, true-peak (4x
+ * oversampled) and clipped samples count of linear #SND_PCM_TYPE_METER
+ * PCM frames. It is fed with the frames as they are committed (playback)
+ * or captured, so it does not need the meter copy of the stream. Results
+ * are refreshed once per period or update interval and can be read from
+ * any thread with #snd_pcm_scope_peak_get_info.
+ */
+int snd_pcm_scope_peak_open(snd_pcm_t *pcm, const char *name,
+			    snd_pcm_scope_t **scopep)
+{
+	snd_pcm_meter_t *meter;
+	snd_pcm_scope_t *scope;
+	snd_pcm_scope_peak_t *level;
+	assert(pcm->type == SND_PCM_TYPE_METER);
+	meter = pcm->private_data;
+	scope = calloc(1, sizeof(*scope));
+	if (!scope)
+		return -ENOMEM;
+	level = calloc(1, sizeof(*level));
+	if (!level) {
+		free(scope);
+		return -ENOMEM;
+	}
+	if (name)
+		scope->name = strdup(name);
+	level->pcm = pcm;
+	level_init_taps(level);
+	scope->ops = &level_ops;
+	scope->feed = level_feed;
+	scope->private_data = level;
+	list_add_tail(&scope->list, &meter->scopes);
+	*scopep = scope;
+	return 0;
+}
+
+/**
+ * \brief Get the last levels of a channel from a peak scope
+ * \param scope peak scope handle
+ * \param channel Channel
+ * \param info Returned levels
+ * \return 0 on success otherwise a negative error code
+ *
+ * This function does not block and may be called from any thread while
+ * the #SND_PCM_TYPE_METER PCM is set up.
+ */
+int snd_pcm_scope_peak_get_info(snd_pcm_scope_t *scope, unsigned int channel,
+				snd_pcm_scope_peak_info_t *info)
+{
+	snd_pcm_scope_peak_t *level;
+	unsigned int seq;
+	assert(scope->ops == &level_ops);
+	level = scope->private_data;
+	if (!level->info[0])
+		return -EBADFD;
+	if (channel >= level->channels)
+		return -EINVAL;
+	do {
+		seq = atomic_read(&level->seq);
+		*info = level->info[seq & 1][channel];
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (atomic_read(&level->seq) != seq);
+	return 0;
+}
+
 /**
  * \brief allocate an invalid #snd_pcm_scope_t using standard malloc
  * \param ptr returned pointer
@@ -28,11 +28,15 @@
 
 #include "pcm_local.h"
 #include "pcm_generic.h"
+#include "pcm_rate.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
+#ifdef HAVE_LIBPTHREAD
+#include <pthread.h>
+#endif
 
 #ifndef PIC
 /* entry for static linking */
@@ -41,11 +45,64 @@ const char *_snd_module_pcm_multi = "";
 
 #ifndef DOC_HIDDEN
 
+enum {
+	MULTI_OP_NONE,
+	MULTI_OP_MMAP_COMMIT,
+	MULTI_OP_AVAIL_UPDATE,
+	MULTI_OP_HWSYNC,
+	MULTI_OP_QUIT,
+};
+
+/* rate measurement of a slave */
+typedef struct {
+	snd_pcm_uframes_t pos;
+	snd_htimestamp_t tstamp;
+	int valid;
+	double rate;			/* frames per second */
+} snd_pcm_multi_meas_t;
+
+/* drift compensation of a slave running from its own clock */
+typedef struct {
+	snd_pcm_t *pcm;			/* multi PCM */
+	void *obj;			/* converter */
+	snd_pcm_rate_ops_t ops;
+	snd_pcm_rate_info_t info;
+	int initialized;
+	int expand;			/* converter direction */
+	char *buf;			/* client buffer for the slave channels */
+	snd_pcm_channel_area_t *areas;
+	char *pbuf;			/* source scratch for wrap-around */
+	snd_pcm_channel_area_t *pareas;
+	char *sbuf;			/* converted scratch for wrap-around */
+	snd_pcm_channel_area_t *sareas;
+	snd_pcm_uframes_t src_ptr;	/* client position passed to slave */
+	snd_pcm_uframes_t pending;	/* committed but not yet converted */
+	double ratio;			/* slave vs master consumption rate */
+	double err;			/* queued frames mismatch */
+	double acc;			/* fractional frame adjustment */
+	snd_pcm_sframes_t adjusted;	/* frames inserted (or dropped) */
+} snd_pcm_multi_comp_t;
+
 typedef struct {
 	snd_pcm_t *pcm;
 	unsigned int channels_count;
 	int close_slave;
 	snd_pcm_t *linked;
+	/* hw_ptr distance to the master slave */
+	snd_pcm_sframes_t drift, drift_min, drift_max;
+	snd_pcm_uframes_t drift_hw_ptr;	/* last seen slave hw_ptr */
+	long long drift_pos;		/* frames played since prepare or reset */
+	snd_pcm_multi_meas_t meas;
+	snd_pcm_multi_comp_t *comp;
+	/* per-slave job */
+	int op;
+	snd_pcm_uframes_t offset, size;
+	snd_pcm_sframes_t result;
+#ifdef HAVE_LIBPTHREAD
+	struct snd_pcm_multi *multi;
+	pthread_t thread;
+	int thread_running;
+#endif
 } snd_pcm_multi_slave_t;
 
 typedef struct {
@@ -53,22 +110,607 @@ typedef struct {
 	unsigned int slave_channel;
 } snd_pcm_multi_channel_t;
 
-typedef struct {
+typedef struct snd_pcm_multi {
 	snd_pcm_uframes_t appl_ptr, hw_ptr;
 	unsigned int slaves_count;
 	unsigned int master_slave;
 	snd_pcm_multi_slave_t *slaves;
 	unsigned int channels_count;
 	snd_pcm_multi_channel_t *channels;
+	int parallel;
+	int drift_comp;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	unsigned int pending;
+	/* average duration of each operation, serial and parallel (ns) */
+	long long op_time[MULTI_OP_QUIT][2];
+	unsigned int op_calls[MULTI_OP_QUIT];
+#endif
 } snd_pcm_multi_t;
 
+/* every Nth call of an operation probes the other dispatch mode */
+#define MULTI_OP_PROBE		256
+
+/* rate measurement window in nanoseconds */
+#define MULTI_MEAS_WINDOW	500000000LL
+/* the queued frames mismatch is corrected within this many seconds */
+#define MULTI_COMP_ERR_TIME	2
+
 #endif
 
+/*
+ * Drift compensation
+ *
+ * The client writes the channels of a compensated slave into a private
+ * buffer.  The data is passed to the slave period by period through the
+ * rate converter, which inserts or drops a frame now and then to follow
+ * the measured rate of the slave relative to the master slave.  At most
+ * one period stays queued in the private buffer.
+ */
+
+static int snd_pcm_multi_comp_setup(snd_pcm_multi_comp_t *comp, int expand)
+{
+	snd_pcm_t *pcm = comp->pcm;
+	int err;
+
+	comp->info.in.format = pcm->format;
+	comp->info.out.format = pcm->format;
+	comp->info.in.rate = pcm->rate;
+	/* the converter picks the interpolation direction from the rates */
+	comp->info.out.rate = pcm->rate + expand;
+	comp->info.in.buffer_size = pcm->buffer_size;
+	comp->info.out.buffer_size = pcm->buffer_size;
+	comp->info.in.period_size = 0;
+	comp->info.out.period_size = 0;
+	err = comp->ops.init(comp->obj, &comp->info);
+	if (err < 0)
+		return err;
+	if (comp->ops.reset)
+		comp->ops.reset(comp->obj);
+	comp->expand = expand;
+	comp->initialized = 1;
+	return 0;
+}
+
+/* pass size frames from the private buffer as size + adj frames to slave */
+static int snd_pcm_multi_comp_write(snd_pcm_multi_slave_t *slave,
+				    snd_pcm_uframes_t size,
+				    snd_pcm_sframes_t adj)
+{
+	snd_pcm_multi_comp_t *comp = slave->comp;
+	snd_pcm_t *pcm = comp->pcm;
+	unsigned int channels = slave->channels_count;
+	const snd_pcm_channel_area_t *src_areas, *slave_areas;
+	snd_pcm_uframes_t src_offset, slave_offset, slave_frames, cont, xfer;
+	snd_pcm_uframes_t dst_frames = size + adj;
+	snd_pcm_sframes_t result;
+	int expand, err;
+
+	expand = adj > 0 ? 1 : adj < 0 ? 0 : comp->expand;
+	if (!comp->initialized || expand != comp->expand) {
+		err = snd_pcm_multi_comp_setup(comp, expand);
+		if (err < 0)
+			return err;
+	}
+	if (comp->info.in.period_size != size ||
+	    comp->info.out.period_size != dst_frames) {
+		comp->info.in.period_size = size;
+		comp->info.out.period_size = dst_frames;
+		err = comp->ops.adjust_pitch(comp->obj, &comp->info);
+		if (err < 0)
+			return err;
+	}
+
+	src_offset = comp->src_ptr % pcm->buffer_size;
+	cont = pcm->buffer_size - src_offset;
+	if (cont < size) {
+		snd_pcm_areas_copy(comp->pareas, 0, comp->areas, src_offset,
+				   channels, cont, pcm->format);
+		snd_pcm_areas_copy(comp->pareas, cont, comp->areas, 0,
+				   channels, size - cont, pcm->format);
+		src_areas = comp->pareas;
+		src_offset = 0;
+	} else {
+		src_areas = comp->areas;
+	}
+
+	slave_frames = dst_frames;
+	result = snd_pcm_mmap_begin(slave->pcm, &slave_areas, &slave_offset,
+				    &slave_frames);
+	if (result < 0)
+		return result;
+	if (!slave_frames)
+		return -EPIPE;
+	err = 0;
+	if (slave_frames >= dst_frames) {
+		comp->ops.convert(comp->obj, slave_areas, slave_offset,
+				  dst_frames, src_areas, src_offset, size);
+		result = snd_pcm_mmap_commit(slave->pcm, slave_offset,
+					     dst_frames);
+		if (result < 0)
+			err = result;
+		else if ((snd_pcm_uframes_t)result != dst_frames)
+			err = -EIO;
+	} else {
+		comp->ops.convert(comp->obj, comp->sareas, 0, dst_frames,
+				  src_areas, src_offset, size);
+		for (xfer = 0; xfer < dst_frames; xfer += slave_frames) {
+			if (xfer) {
+				slave_frames = dst_frames - xfer;
+				result = snd_pcm_mmap_begin(slave->pcm,
+							    &slave_areas,
+							    &slave_offset,
+							    &slave_frames);
+				if (result < 0) {
+					err = result;
+					break;
+				}
+				if (!slave_frames) {
+					err = -EPIPE;
+					break;
+				}
+			}
+			snd_pcm_areas_copy(slave_areas, slave_offset,
+					   comp->sareas, xfer,
+					   channels, slave_frames,
+					   slave->pcm->format);
+			result = snd_pcm_mmap_commit(slave->pcm, slave_offset,
+						     slave_frames);
+			if (result < 0) {
+				err = result;
+				break;
+			}
+			if ((snd_pcm_uframes_t)result != slave_frames) {
+				err = -EIO;
+				break;
+			}
+		}
+	}
+	/* the period went through the converter, so it is consumed even
+	 * when only a part reached the slave; the converter starts again
+	 * from a clean state then
+	 */
+	if (err < 0 && comp->ops.reset)
+		comp->ops.reset(comp->obj);
+	comp->src_ptr += size;
+	if (comp->src_ptr >= pcm->boundary)
+		comp->src_ptr -= pcm->boundary;
+	comp->pending -= size;
+	comp->adjusted += adj;
+	return err;
+}
+
+static snd_pcm_sframes_t snd_pcm_multi_comp_adjust(snd_pcm_multi_comp_t *comp,
+						   snd_pcm_uframes_t size)
+{
+	snd_pcm_t *pcm = comp->pcm;
+	snd_pcm_sframes_t adj, max_adj;
+
+	/* too coarse steps for tiny periods */
+	if (size < 64)
+		return 0;
+	max_adj = size / 1024 + 1;
+	comp->acc += size * (comp->ratio - 1.0) -
+		comp->err * size / (pcm->rate * MULTI_COMP_ERR_TIME);
+	adj = (snd_pcm_sframes_t)floor(comp->acc + 0.5);
+	if (adj > max_adj)
+		adj = max_adj;
+	else if (adj < -max_adj)
+		adj = -max_adj;
+	comp->acc -= adj;
+	/* don't wind up when the drift exceeds the limit */
+	if (comp->acc > max_adj)
+		comp->acc = max_adj;
+	else if (comp->acc < -max_adj)
+		comp->acc = -max_adj;
+	return adj;
+}
+
+static snd_pcm_sframes_t snd_pcm_multi_comp_commit(snd_pcm_multi_slave_t *slave,
+						   snd_pcm_uframes_t size)
+{
+	snd_pcm_multi_comp_t *comp = slave->comp;
+	snd_pcm_uframes_t period_size = comp->pcm->period_size;
+	int err;
+
+	comp->pending += size;
+	while (comp->pending >= period_size) {
+		err = snd_pcm_multi_comp_write(slave, period_size,
+				snd_pcm_multi_comp_adjust(comp, period_size));
+		if (err < 0)
+			return err;
+	}
+	return size;
+}
+
+/* pass the rest of the private buffer without adjustment */
+static int snd_pcm_multi_comp_flush(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+	int err;
+
+	if (!multi->drift_comp)
+		return 0;
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		if (!slave->comp || !slave->comp->pending)
+			continue;
+		err = snd_pcm_multi_comp_write(slave, slave->comp->pending, 0);
+		if (err < 0)
+			return err;
+	}
+	return 0;
+}
+
+static void snd_pcm_multi_comp_reset(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+
+	if (!multi->drift_comp)
+		return;
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		snd_pcm_multi_comp_t *comp = slave->comp;
+		slave->meas.valid = 0;
+		slave->meas.rate = 0;
+		if (!comp)
+			continue;
+		comp->src_ptr = 0;
+		comp->pending = 0;
+		comp->ratio = 1.0;
+		comp->err = 0;
+		comp->acc = 0;
+		if (comp->initialized && comp->ops.reset)
+			comp->ops.reset(comp->obj);
+	}
+}
+
+static int snd_pcm_multi_meas_update(snd_pcm_multi_slave_t *slave,
+				     snd_pcm_uframes_t *delayp)
+{
+	snd_pcm_multi_meas_t *meas = &slave->meas;
+	snd_pcm_t *spcm = slave->pcm;
+	snd_pcm_uframes_t avail, delay, pos;
+	snd_htimestamp_t tstamp;
+	long long elapsed;
+	double rate;
+	int err;
+
+	err = snd_pcm_htimestamp(spcm, &avail, &tstamp);
+	if (err < 0)
+		return err;
+	delay = avail < spcm->buffer_size ? spcm->buffer_size - avail : 0;
+	*delayp = delay;
+	pos = *spcm->appl.ptr;
+	pos = pos >= delay ? pos - delay : pos + spcm->boundary - delay;
+	if (!meas->valid) {
+		meas->pos = pos;
+		meas->tstamp = tstamp;
+		meas->valid = 1;
+		return 0;
+	}
+	elapsed = (tstamp.tv_sec - meas->tstamp.tv_sec) * 1000000000LL +
+		tstamp.tv_nsec - meas->tstamp.tv_nsec;
+	if (elapsed < MULTI_MEAS_WINDOW)
+		return 0;
+	rate = pcm_frame_diff(pos, meas->pos, spcm->boundary) * 1e9 / elapsed;
+	if (meas->rate > 0)
+		meas->rate += (rate - meas->rate) / 8;
+	else
+		meas->rate = rate;
+	meas->pos = pos;
+	meas->tstamp = tstamp;
+	return 0;
+}
+
+/* update the rate ratio and queue mismatch of the compensated slaves */
+static void snd_pcm_multi_comp_measure(snd_pcm_multi_t *multi)
+{
+	snd_pcm_multi_slave_t *master = &multi->slaves[multi->master_slave];
+	snd_pcm_uframes_t master_delay, delay;
+	unsigned int i;
+
+	if (snd_pcm_state(master->pcm) != SND_PCM_STATE_RUNNING ||
+	    snd_pcm_multi_meas_update(master, &master_delay) < 0)
+		return;
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		snd_pcm_multi_comp_t *comp = slave->comp;
+		if (!comp ||
+		    snd_pcm_state(slave->pcm) != SND_PCM_STATE_RUNNING ||
+		    snd_pcm_multi_meas_update(slave, &delay) < 0)
+			continue;
+		if (master->meas.rate > 0 && slave->meas.rate > 0)
+			comp->ratio = slave->meas.rate / master->meas.rate;
+		/* the slave lags the master by the pending frames */
+		comp->err = (double)delay -
+			((double)master_delay - comp->pending) * comp->ratio;
+	}
+}
+
+static void snd_pcm_multi_comp_free_buffers(snd_pcm_multi_comp_t *comp)
+{
+	if (comp->initialized && comp->ops.free)
+		comp->ops.free(comp->obj);
+	comp->initialized = 0;
+	free(comp->buf);
+	free(comp->pbuf);
+	free(comp->sbuf);
+	free(comp->areas);
+	comp->buf = comp->pbuf = comp->sbuf = NULL;
+	comp->areas = comp->pareas = comp->sareas = NULL;
+}
+
+static int snd_pcm_multi_comp_alloc_buffers(snd_pcm_multi_comp_t *comp,
+					    unsigned int channels)
+{
+	snd_pcm_t *pcm = comp->pcm;
+	unsigned int width = snd_pcm_format_physical_width(pcm->format);
+	snd_pcm_uframes_t scratch = pcm->period_size + pcm->period_size / 1024 + 1;
+	unsigned int c;
+
+	comp->buf = malloc(pcm->buffer_size * channels * width / 8);
+	comp->pbuf = malloc(pcm->period_size * channels * width / 8);
+	comp->sbuf = malloc(scratch * channels * width / 8);
+	comp->areas = calloc(channels * 3, sizeof(*comp->areas));
+	if (!comp->buf || !comp->pbuf || !comp->sbuf || !comp->areas) {
+		snd_pcm_multi_comp_free_buffers(comp);
+		return -ENOMEM;
+	}
+	comp->pareas = comp->areas + channels;
+	comp->sareas = comp->pareas + channels;
+	for (c = 0; c < channels; c++) {
+		comp->areas[c].addr = comp->buf;
+		comp->areas[c].first = c * width;
+		comp->areas[c].step = channels * width;
+		comp->pareas[c].addr = comp->pbuf;
+		comp->pareas[c].first = c * width;
+		comp->pareas[c].step = channels * width;
+		comp->sareas[c].addr = comp->sbuf;
+		comp->sareas[c].first = c * width;
+		comp->sareas[c].step = channels * width;
+	}
+	comp->info.channels = channels;
+	return 0;
+}
+
+static void snd_pcm_multi_comp_free(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_comp_t *comp = multi->slaves[i].comp;
+		if (!comp)
+			continue;
+		snd_pcm_multi_comp_free_buffers(comp);
+		if (comp->ops.close)
+			comp->ops.close(comp->obj);
+		free(comp);
+		multi->slaves[i].comp = NULL;
+	}
+}
+
+static snd_pcm_sframes_t snd_pcm_multi_slave_job(snd_pcm_multi_slave_t *slave)
+{
+	snd_pcm_sframes_t avail;
+
+	switch (slave->op) {
+	case MULTI_OP_MMAP_COMMIT:
+		if (slave->comp)
+			return snd_pcm_multi_comp_commit(slave, slave->size);
+		return snd_pcm_mmap_commit(slave->pcm, slave->offset, slave->size);
+	case MULTI_OP_AVAIL_UPDATE:
+		avail = snd_pcm_avail_update(slave->pcm);
+		if (avail < 0 || !slave->comp)
+			return avail;
+		if (avail < (snd_pcm_sframes_t)slave->comp->pending)
+			return 0;
+		return avail - slave->comp->pending;
+	case MULTI_OP_HWSYNC:
+		return snd_pcm_hwsync(slave->pcm);
+	default:
+		return 0;
+	}
+}
+
+#ifdef HAVE_LIBPTHREAD
+/* worker thread serving one slave in the parallel mode */
+static void *snd_pcm_multi_thread(void *data)
+{
+	snd_pcm_multi_slave_t *slave = data;
+	snd_pcm_multi_t *multi = slave->multi;
+	snd_pcm_sframes_t result;
+
+	pthread_mutex_lock(&multi->mutex);
+	for (;;) {
+		while (slave->op == MULTI_OP_NONE)
+			pthread_cond_wait(&multi->work_cond, &multi->mutex);
+		if (slave->op == MULTI_OP_QUIT)
+			break;
+		pthread_mutex_unlock(&multi->mutex);
+		result = snd_pcm_multi_slave_job(slave);
+		pthread_mutex_lock(&multi->mutex);
+		slave->result = result;
+		slave->op = MULTI_OP_NONE;
+		if (--multi->pending == 0)
+			pthread_cond_signal(&multi->done_cond);
+	}
+	pthread_mutex_unlock(&multi->mutex);
+	return NULL;
+}
+
+static void snd_pcm_multi_stop_threads(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+
+	if (!multi->parallel)
+		return;
+	pthread_mutex_lock(&multi->mutex);
+	for (i = 0; i < multi->slaves_count; ++i)
+		multi->slaves[i].op = MULTI_OP_QUIT;
+	pthread_cond_broadcast(&multi->work_cond);
+	pthread_mutex_unlock(&multi->mutex);
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		if (slave->thread_running) {
+			pthread_join(slave->thread, NULL);
+			slave->thread_running = 0;
+		}
+	}
+	pthread_cond_destroy(&multi->done_cond);
+	pthread_cond_destroy(&multi->work_cond);
+	pthread_mutex_destroy(&multi->mutex);
+	multi->parallel = 0;
+}
+
+/* spawn a worker for each slave except the master, which is always
+ * handled by the caller's thread
+ */
+static int snd_pcm_multi_start_threads(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+	int err;
+
+	pthread_mutex_init(&multi->mutex, NULL);
+	pthread_cond_init(&multi->work_cond, NULL);
+	pthread_cond_init(&multi->done_cond, NULL);
+	multi->parallel = 1;
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		if (i == multi->master_slave)
+			continue;
+		slave->multi = multi;
+		err = pthread_create(&slave->thread, NULL,
+				     snd_pcm_multi_thread, slave);
+		if (err) {
+			snd_error(PCM, "cannot create multi worker thread");
+			snd_pcm_multi_stop_threads(multi);
+			return -err;
+		}
+		slave->thread_running = 1;
+	}
+	return 0;
+}
+#else
+static void snd_pcm_multi_stop_threads(snd_pcm_multi_t *multi ATTRIBUTE_UNUSED)
+{
+}
+#endif
+
+static void snd_pcm_multi_run_serial(snd_pcm_multi_t *multi, int op,
+				     snd_pcm_uframes_t offset,
+				     snd_pcm_uframes_t size)
+{
+	snd_pcm_multi_slave_t *slave;
+	unsigned int i;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		slave = &multi->slaves[i];
+		slave->offset = offset;
+		slave->size = size;
+		slave->op = op;
+		slave->result = snd_pcm_multi_slave_job(slave);
+		slave->op = MULTI_OP_NONE;
+		if (slave->result < 0)
+			break;
+	}
+	for (++i; i < multi->slaves_count; ++i)
+		multi->slaves[i].result = 0;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static long long snd_pcm_multi_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void snd_pcm_multi_run_parallel(snd_pcm_multi_t *multi, int op,
+				       snd_pcm_uframes_t offset,
+				       snd_pcm_uframes_t size)
+{
+	snd_pcm_multi_slave_t *slave;
+	unsigned int i;
+
+	pthread_mutex_lock(&multi->mutex);
+	for (i = 0; i < multi->slaves_count; ++i) {
+		slave = &multi->slaves[i];
+		slave->offset = offset;
+		slave->size = size;
+		slave->result = 0;
+		slave->op = op;
+	}
+	multi->pending = multi->slaves_count - 1;
+	pthread_cond_broadcast(&multi->work_cond);
+	pthread_mutex_unlock(&multi->mutex);
+
+	slave = &multi->slaves[multi->master_slave];
+	slave->result = snd_pcm_multi_slave_job(slave);
+	slave->op = MULTI_OP_NONE;
+
+	pthread_mutex_lock(&multi->mutex);
+	while (multi->pending > 0)
+		pthread_cond_wait(&multi->done_cond, &multi->mutex);
+	pthread_mutex_unlock(&multi->mutex);
+}
+#endif
+
+/* run the given operation on all slaves; the results are stored in
+ * each slave's result field.  in the serial mode, the loop stops at
+ * the first error as the caller bails out anyway.
+ *
+ * in the parallel mode, the hand-off to the worker threads costs more
+ * than cheap slave calls, so both ways are timed for each operation
+ * and the faster one is used; every MULTI_OP_PROBE-th call tries the
+ * other one to follow the changes of the slave costs.
+ */
+static void snd_pcm_multi_run(snd_pcm_multi_t *multi, int op,
+			      snd_pcm_uframes_t offset,
+			      snd_pcm_uframes_t size)
+{
+#ifdef HAVE_LIBPTHREAD
+	if (multi->parallel && multi->slaves_count > 1) {
+		long long *time = multi->op_time[op];
+		long long start, elapsed;
+		int par;
+
+		if (!time[1])
+			par = 1;
+		else if (!time[0])
+			par = 0;
+		else
+			par = time[1] < time[0];
+		if (++multi->op_calls[op] % MULTI_OP_PROBE == 0)
+			par = !par;
+		start = snd_pcm_multi_now();
+		if (par)
+			snd_pcm_multi_run_parallel(multi, op, offset, size);
+		else
+			snd_pcm_multi_run_serial(multi, op, offset, size);
+		elapsed = snd_pcm_multi_now() - start;
+		if (elapsed <= 0)
+			elapsed = 1;
+		if (time[par])
+			time[par] += (elapsed - time[par]) / 8;
+		else
+			time[par] = elapsed;
+		return;
+	}
+#endif
+	snd_pcm_multi_run_serial(multi, op, offset, size);
+}
+
 static int snd_pcm_multi_close(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	int ret = 0;
+	snd_pcm_multi_stop_threads(multi);
+	snd_pcm_multi_comp_free(multi);
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
 		if (slave->close_slave) {
@@ -154,6 +796,19 @@ static int snd_pcm_multi_hw_refine_cprepare(snd_pcm_t *pcm, snd_pcm_hw_params_t
 					 &access_mask);
 	if (err < 0)
 		return err;
+	if (multi->drift_comp) {
+		/* the linear converter works on S16 samples, so wider
+		 * formats would lose their low bits
+		 */
+		snd_pcm_format_mask_t format_mask;
+		snd_pcm_format_mask_none(&format_mask);
+		snd_pcm_format_mask_set(&format_mask, SND_PCM_FORMAT_S16_LE);
+		snd_pcm_format_mask_set(&format_mask, SND_PCM_FORMAT_S16_BE);
+		err = _snd_pcm_hw_param_set_mask(params, SND_PCM_HW_PARAM_FORMAT,
+						 &format_mask);
+		if (err < 0)
+			return err;
+	}
 	err = _snd_pcm_hw_param_set(params, SND_PCM_HW_PARAM_CHANNELS,
 				    multi->channels_count, 0);
 	if (err < 0)
@@ -412,6 +1067,51 @@ static snd_pcm_state_t snd_pcm_multi_state(snd_pcm_t *pcm)
 	return snd_pcm_state(slave);
 }
 
+static void snd_pcm_multi_drift_reset(snd_pcm_multi_t *multi)
+{
+	unsigned int i;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		slave->drift = slave->drift_min = slave->drift_max = 0;
+		slave->drift_hw_ptr = *slave->pcm->hw.ptr;
+		slave->drift_pos = 0;
+	}
+}
+
+/* track the hw_ptr distance of each slave to the master slave;
+ * positive values mean that the slave is ahead of the master.
+ * each hw_ptr wraps at the boundary of its own slave, so the played
+ * frames are accumulated per slave and compared instead
+ */
+static void snd_pcm_multi_drift_update(snd_pcm_t *pcm)
+{
+	snd_pcm_multi_t *multi = pcm->private_data;
+	snd_pcm_multi_slave_t *master = &multi->slaves[multi->master_slave];
+	snd_pcm_sframes_t drift;
+	snd_pcm_uframes_t hw_ptr;
+	unsigned int i;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		hw_ptr = *slave->pcm->hw.ptr;
+		slave->drift_pos += pcm_frame_diff(hw_ptr, slave->drift_hw_ptr,
+						   slave->pcm->boundary);
+		slave->drift_hw_ptr = hw_ptr;
+	}
+	for (i = 0; i < multi->slaves_count; ++i) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[i];
+		if (i == multi->master_slave)
+			continue;
+		drift = slave->drift_pos - master->drift_pos;
+		slave->drift = drift;
+		if (drift < slave->drift_min)
+			slave->drift_min = drift;
+		if (drift > slave->drift_max)
+			slave->drift_max = drift;
+	}
+}
+
 static void snd_pcm_multi_hwptr_update(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
@@ -421,6 +1121,9 @@ static void snd_pcm_multi_hwptr_update(snd_pcm_t *pcm)
 	if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
 		last_avail = 0;
 		for (i = 0; i < multi->slaves_count; ++i) {
+			/* compensated slaves run in their own position domain */
+			if (multi->slaves[i].comp)
+				continue;
 			slave_hw_ptr = *multi->slaves[i].pcm->hw.ptr;
 			avail = __snd_pcm_playback_avail(pcm, multi->hw_ptr, slave_hw_ptr);
 			if (avail > last_avail) {
@@ -440,17 +1143,18 @@ static void snd_pcm_multi_hwptr_update(snd_pcm_t *pcm)
 		}
 	}
 	multi->hw_ptr = hw_ptr;
+	snd_pcm_multi_drift_update(pcm);
 }
 
 static int snd_pcm_multi_hwsync(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
-	int err;
+
+	snd_pcm_multi_run(multi, MULTI_OP_HWSYNC, 0, 0);
 	for (i = 0; i < multi->slaves_count; ++i) {
-		err = snd_pcm_hwsync(multi->slaves[i].pcm);
-		if (err < 0)
-			return err;
+		if (multi->slaves[i].result < 0)
+			return multi->slaves[i].result;
 	}
 	snd_pcm_multi_hwptr_update(pcm);
 	return 0;
@@ -466,6 +1170,8 @@ static int snd_pcm_multi_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
 		err = snd_pcm_delay(multi->slaves[i].pcm, &d);
 		if (err < 0)
 			return err;
+		if (multi->slaves[i].comp)
+			d += multi->slaves[i].comp->pending;
 		if (dr < d)
 			dr = d;
 	}
@@ -478,14 +1184,17 @@ static snd_pcm_sframes_t snd_pcm_multi_avail_update(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	snd_pcm_sframes_t ret = LONG_MAX;
 	unsigned int i;
+
+	snd_pcm_multi_run(multi, MULTI_OP_AVAIL_UPDATE, 0, 0);
 	for (i = 0; i < multi->slaves_count; ++i) {
-		snd_pcm_sframes_t avail;
-		avail = snd_pcm_avail_update(multi->slaves[i].pcm);
+		snd_pcm_sframes_t avail = multi->slaves[i].result;
 		if (avail < 0)
 			return avail;
 		if (ret > avail)
 			ret = avail;
 	}
+	if (multi->drift_comp)
+		snd_pcm_multi_comp_measure(multi);
 	snd_pcm_multi_hwptr_update(pcm);
 	return ret;
 }
@@ -512,6 +1221,8 @@ static int snd_pcm_multi_prepare(snd_pcm_t *pcm)
 			result = err;
 	}
 	multi->hw_ptr = multi->appl_ptr = 0;
+	snd_pcm_multi_drift_reset(multi);
+	snd_pcm_multi_comp_reset(multi);
 	return result;
 }
 
@@ -527,6 +1238,8 @@ static int snd_pcm_multi_reset(snd_pcm_t *pcm)
 			result = err;
 	}
 	multi->hw_ptr = multi->appl_ptr = 0;
+	snd_pcm_multi_drift_reset(multi);
+	snd_pcm_multi_comp_reset(multi);
 	return result;
 }
 
@@ -539,6 +1252,10 @@ static int snd_pcm_multi_start(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	int err = 0;
 	unsigned int i;
+	/* let the compensated slaves start with the same fill level */
+	err = snd_pcm_multi_comp_flush(multi);
+	if (err < 0)
+		return err;
 	if (multi->slaves[0].linked)
 		return snd_pcm_start(multi->slaves[0].linked);
 	for (i = 0; i < multi->slaves_count; ++i) {
@@ -573,6 +1290,9 @@ static int snd_pcm_multi_drain(snd_pcm_t *pcm)
 	snd_pcm_multi_t *multi = pcm->private_data;
 	int err = 0;
 	unsigned int i;
+	err = snd_pcm_multi_comp_flush(multi);
+	if (err < 0)
+		return err;
 	if (multi->slaves[0].linked)
 		return snd_pcm_drain(multi->slaves[0].linked);
 	for (i = 0; i < multi->slaves_count; ++i) {
@@ -622,6 +1342,10 @@ static snd_pcm_sframes_t snd_pcm_multi_rewindable(snd_pcm_t *pcm)
 	unsigned int i;
 	snd_pcm_sframes_t frames = LONG_MAX;
 
+	/* converted data can't be taken back from compensated slaves */
+	if (multi->drift_comp)
+		return 0;
+
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_sframes_t f = snd_pcm_rewindable(multi->slaves[i].pcm);
 		if (f <= 0)
@@ -640,6 +1364,10 @@ static snd_pcm_sframes_t snd_pcm_multi_forwardable(snd_pcm_t *pcm)
 	unsigned int i;
 	snd_pcm_sframes_t frames = LONG_MAX;
 
+	/* converted data can't be taken back from compensated slaves */
+	if (multi->drift_comp)
+		return 0;
+
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_sframes_t f = snd_pcm_forwardable(multi->slaves[i].pcm);
 		if (f <= 0)
@@ -657,6 +1385,8 @@ static snd_pcm_sframes_t snd_pcm_multi_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	snd_pcm_uframes_t pos[multi->slaves_count];
+	if (multi->drift_comp)
+		return 0;
 	memset(pos, 0, sizeof(pos));
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_t *slave_i = multi->slaves[i].pcm;
@@ -688,6 +1418,8 @@ static snd_pcm_sframes_t snd_pcm_multi_forward(snd_pcm_t *pcm, snd_pcm_uframes_t
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int i;
 	snd_pcm_uframes_t pos[multi->slaves_count];
+	if (multi->drift_comp)
+		return 0;
 	memset(pos, 0, sizeof(pos));
 	for (i = 0; i < multi->slaves_count; ++i) {
 		snd_pcm_t *slave_i = multi->slaves[i].pcm;
@@ -783,13 +1515,12 @@ static snd_pcm_sframes_t snd_pcm_multi_mmap_commit(snd_pcm_t *pcm,
 						   snd_pcm_uframes_t size)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
-	snd_pcm_t *slave;
 	unsigned int i;
 	snd_pcm_sframes_t result;
 
+	snd_pcm_multi_run(multi, MULTI_OP_MMAP_COMMIT, offset, size);
 	for (i = 0; i < multi->slaves_count; ++i) {
-		slave = multi->slaves[i].pcm;
-		result = snd_pcm_mmap_commit(slave, offset, size);
+		result = multi->slaves[i].result;
 		if (result < 0)
 			return result;
 		if ((snd_pcm_uframes_t)result != size)
@@ -801,6 +1532,13 @@ static snd_pcm_sframes_t snd_pcm_multi_mmap_commit(snd_pcm_t *pcm,
 
 static int snd_pcm_multi_munmap(snd_pcm_t *pcm)
 {
+	snd_pcm_multi_t *multi = pcm->private_data;
+	unsigned int i;
+
+	for (i = 0; i < multi->slaves_count; ++i) {
+		if (multi->slaves[i].comp)
+			snd_pcm_multi_comp_free_buffers(multi->slaves[i].comp);
+	}
 	free(pcm->mmap_channels);
 	free(pcm->running_areas);
 	pcm->mmap_channels = NULL;
@@ -812,6 +1550,7 @@ static int snd_pcm_multi_mmap(snd_pcm_t *pcm)
 {
 	snd_pcm_multi_t *multi = pcm->private_data;
 	unsigned int c;
+	int err;
 
 	pcm->mmap_channels = calloc(pcm->channels,
 				    sizeof(pcm->mmap_channels[0]));
@@ -822,14 +1561,39 @@ static int snd_pcm_multi_mmap(snd_pcm_t *pcm)
 		return -ENOMEM;
 	}
 
+	for (c = 0; c < multi->slaves_count; c++) {
+		snd_pcm_multi_slave_t *slave = &multi->slaves[c];
+		if (!slave->comp)
+			continue;
+		err = snd_pcm_multi_comp_alloc_buffers(slave->comp,
+						       slave->channels_count);
+		if (err < 0) {
+			snd_pcm_multi_munmap(pcm);
+			return err;
+		}
+	}
+
 	/* Copy the slave mmapped buffer data */
 	for (c = 0; c < pcm->channels; c++) {
 		snd_pcm_multi_channel_t *chan = &multi->channels[c];
+		snd_pcm_multi_comp_t *comp;
 		snd_pcm_t *slave;
 		if (chan->slave_idx < 0) {
 			snd_pcm_multi_munmap(pcm);
 			return -ENXIO;
 		}
+		comp = multi->slaves[chan->slave_idx].comp;
+		if (comp) {
+			/* the client writes to the private buffer */
+			snd_pcm_channel_area_t *area = &comp->areas[chan->slave_channel];
+			pcm->mmap_channels[c].channel = c;
+			pcm->mmap_channels[c].addr = area->addr;
+			pcm->mmap_channels[c].first = area->first;
+			pcm->mmap_channels[c].step = area->step;
+			pcm->mmap_channels[c].type = SND_PCM_AREA_LOCAL;
+			pcm->running_areas[c] = *area;
+			continue;
+		}
 		slave = multi->slaves[chan->slave_idx].pcm;
 		pcm->mmap_channels[c] =
 			slave->mmap_channels[chan->slave_channel];
@@ -996,7 +1760,23 @@ static void snd_pcm_multi_dump(snd_pcm_t *pcm, snd_output_t *out)
 		snd_output_printf(out, "    %d: slave %d, channel %d\n",
 			k, c->slave_idx, c->slave_channel);
 	}
+	snd_output_printf(out, "  Slave processing: %s\n",
+			  multi->parallel ? "parallel" : "serial");
 	if (pcm->setup) {
+		snd_output_printf(out, "  Drift to master slave %u (cur/min/max):\n",
+				  multi->master_slave);
+		for (k = 0; k < multi->slaves_count; ++k) {
+			snd_pcm_multi_slave_t *s = &multi->slaves[k];
+			if (k == multi->master_slave)
+				continue;
+			snd_output_printf(out, "    slave %d: %ld/%ld/%ld frames\n",
+					  k, s->drift, s->drift_min, s->drift_max);
+			if (!s->comp)
+				continue;
+			snd_output_printf(out, "      compensated: ratio %.6f, queue error %.1f, adjusted %ld frames\n",
+					  s->comp->ratio, s->comp->err,
+					  s->comp->adjusted);
+		}
 		snd_output_printf(out, "Its setup is:\n");
 		snd_pcm_dump_setup(pcm, out);
 	}
@@ -1068,6 +1848,9 @@ static const snd_pcm_fast_ops_t snd_pcm_multi_fast_ops = {
  * \param sidxs Array with channels indexes to slaves
  * \param schannels Array with slave channels
  * \param close_slaves When set, the slave PCM handle is closed
+ * \param parallel When set, the slaves are served by worker threads
+ * \param drift_comp When set, the slaves other than the master one are
+ *        resampled to follow the master slave's clock (playback, S16 only)
  * \retval zero on success otherwise a negative error code
  * \warning Using of this function might be dangerous in the sense
  *          of compatibility reasons. The prototype might be freely
@@ -1078,19 +1861,33 @@ int snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 		       snd_pcm_t **slaves_pcm, unsigned int *schannels_count,
 		       unsigned int channels_count,
 		       int *sidxs, unsigned int *schannels,
-		       int close_slaves)
+		       int close_slaves, int parallel, int drift_comp)
 {
 	snd_pcm_t *pcm;
 	snd_pcm_multi_t *multi;
 	unsigned int i;
 	snd_pcm_stream_t stream;
 	int err;
+#ifdef BUILD_PCM_PLUGIN_RATE
+	extern int SND_PCM_RATE_PLUGIN_ENTRY(linear) (unsigned int version, void **objp, snd_pcm_rate_ops_t *ops);
+#endif
 
 	assert(pcmp);
 	assert(slaves_count > 0 && slaves_pcm && schannels_count);
 	assert(channels_count > 0 && sidxs && schannels);
 	assert(master_slave < slaves_count);
 
+	if (drift_comp && slaves_count > 1) {
+#ifndef BUILD_PCM_PLUGIN_RATE
+		snd_error(PCM, "drift compensation requires the rate plugin");
+		return -ENOSYS;
+#endif
+		if (slaves_pcm[0]->stream != SND_PCM_STREAM_PLAYBACK) {
+			snd_error(PCM, "drift compensation is supported only for playback");
+			return -EINVAL;
+		}
+	}
+
 	multi = calloc(1, sizeof(snd_pcm_multi_t));
 	if (!multi) {
 		return -ENOMEM;
@@ -1129,14 +1926,43 @@ int snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 			continue;
 	}
 	multi->channels_count = channels_count;
+#ifdef BUILD_PCM_PLUGIN_RATE
+	if (drift_comp && slaves_count > 1) {
+		multi->drift_comp = 1;
+		for (i = 0; i < slaves_count; ++i) {
+			snd_pcm_multi_comp_t *comp;
+			if (i == master_slave)
+				continue;
+			comp = calloc(1, sizeof(*comp));
+			if (!comp) {
+				err = -ENOMEM;
+				goto _free_comp;
+			}
+			multi->slaves[i].comp = comp;
+			err = SND_PCM_RATE_PLUGIN_ENTRY(linear)(SND_PCM_RATE_PLUGIN_VERSION,
+								&comp->obj, &comp->ops);
+			if (err < 0)
+				goto _free_comp;
+			comp->ratio = 1.0;
+		}
+	}
+#endif
 
 	err = snd_pcm_new(&pcm, SND_PCM_TYPE_MULTI, name, stream,
 			  multi->slaves[0].pcm->mode);
-	if (err < 0) {
-		free(multi->slaves);
-		free(multi->channels);
-		free(multi);
-		return err;
+	if (err < 0)
+		goto _free_comp;
+	if (parallel && slaves_count > 1) {
+#ifdef HAVE_LIBPTHREAD
+		err = snd_pcm_multi_start_threads(multi);
+#else
+		snd_error(PCM, "parallel mode requires thread support");
+		err = -ENOSYS;
+#endif
+		if (err < 0) {
+			snd_pcm_free(pcm);
+			goto _free_comp;
+		}
 	}
 	pcm->mmap_rw = 1;
 	pcm->mmap_shadow = 1; /* has own mmap method */
@@ -1148,8 +1974,19 @@ int snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 	pcm->tstamp_type = multi->slaves[master_slave].pcm->tstamp_type;
 	snd_pcm_set_hw_ptr(pcm, &multi->hw_ptr, -1, 0);
 	snd_pcm_set_appl_ptr(pcm, &multi->appl_ptr, -1, 0);
+	for (i = 0; i < slaves_count; ++i) {
+		if (multi->slaves[i].comp)
+			multi->slaves[i].comp->pcm = pcm;
+	}
 	*pcmp = pcm;
 	return 0;
+
+ _free_comp:
+	snd_pcm_multi_comp_free(multi);
+	free(multi->slaves);
+	free(multi->channels);
+	free(multi);
+	return err;
 }
 
 /*! \page pcm_plugins
@@ -1178,6 +2015,8 @@ pcm.name {
 		}
 	}
 	[master INT]		# Define the master slave
+	[parallel BOOL]		# Serve slaves by worker threads
+	[drift_compensation BOOL] # Follow the master slave's clock
 }
 \endcode
 
@@ -1218,6 +2057,31 @@ pcm.quad2 {
 }
 \endcode
 
+When \c parallel is set, each slave except the master one gets its own
+worker thread, and the commit, avail update and hwsync calls can be
+issued to all slaves at the same time instead of one after another.
+This helps when many slaves with expensive calls are combined and the
+serial calls do not fit into the period time.  The master slave is always
+handled by the calling thread.  Waking the threads costs tens of
+microseconds, more than a cheap slave call, so the duration of both
+ways is measured for each operation and the faster one is used.
+
+The hw_ptr drift of each slave relative to the master slave (current,
+minimum and maximum since the last prepare or reset) is shown in the
+PCM dump.
+
+The slaves are assumed to share one clock.  When they don't, e.g. with
+independent USB devices, set \c drift_compensation to keep the streams
+aligned (playback only).  The rate of each slave relative to the master
+slave is measured from the slave timestamps, and the data for the other
+slaves goes through a linear rate converter which inserts or drops a
+frame per period when needed.  This adds up to one period of latency on
+the compensated slaves, restricts the format to S16 and makes the PCM
+non-rewindable.  The converter interpolates S16 samples, so S24 and S32
+are refused rather than truncated; use a plug PCM on top for other
+formats.  The measured ratio and the number of adjusted
+frames are shown in the PCM dump.
+
 \subsection pcm_plugins_multi_funcref Function reference
 
 <UL>
@@ -1257,6 +2121,7 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 	unsigned int *channels_schannel = NULL;
 	unsigned int slaves_count = 0;
 	long master_slave = 0;
+	int parallel = 0, drift_comp = 0;
 	unsigned int channels_count = 0;
 	snd_config_for_each(i, inext, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
@@ -1288,6 +2153,20 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 			}
 			continue;
 		}
+		if (strcmp(id, "parallel") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return err;
+			parallel = err;
+			continue;
+		}
+		if (strcmp(id, "drift_compensation") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return err;
+			drift_comp = err;
+			continue;
+		}
 		snd_error(PCM, "Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -1435,7 +2314,7 @@ int _snd_pcm_multi_open(snd_pcm_t **pcmp, const char *name,
 				 slaves_pcm, slaves_channels,
 				 channels_count,
 				 channels_sidx, channels_schannel,
-				 1);
+				 1, parallel, drift_comp);
 _free:
 	if (err < 0) {
 		for (idx = 0; idx < slaves_count; ++idx) {
@@ -71,6 +71,15 @@ do { \
 #define Pthread_mutex_unlock(mutex) pthread_mutex_unlock(mutex)
 #endif
 
+/* single producer (client), single consumer (share thread) ring */
+#define SHARE_RING_SIZE		64
+
+typedef struct {
+	snd_pcm_uframes_t frames[SHARE_RING_SIZE];
+	unsigned int head;		/* written by the client */
+	unsigned int tail;		/* written by the consumer */
+} snd_pcm_share_ring_t;
+
 typedef struct {
 	struct list_head clients;
 	struct list_head list;
@@ -96,6 +105,7 @@ typedef struct {
 	char *mutex_holder;
 #endif
 	pthread_cond_t poll_cond;
+	int lockfree;
 } snd_pcm_share_slave_t;
 
 typedef struct {
@@ -109,6 +119,8 @@ typedef struct {
 	snd_pcm_state_t state;
 	snd_pcm_uframes_t hw_ptr;
 	snd_pcm_uframes_t appl_ptr;
+	snd_pcm_uframes_t thread_appl_ptr;	/* appl_ptr as seen by the share thread */
+	snd_pcm_share_ring_t ring;		/* commits not yet seen by the share thread */
 	int ready;
 	int client_socket;
 	int slave_socket;
@@ -118,6 +130,68 @@ typedef struct {
 
 static void _snd_pcm_share_stop(snd_pcm_t *pcm, snd_pcm_state_t state);
 
+/* called from the client only, returns -EAGAIN when the ring is full */
+static int snd_pcm_share_ring_push(snd_pcm_share_ring_t *ring, snd_pcm_uframes_t frames)
+{
+	unsigned int head = ring->head;
+
+	if (head - atomic_load_acquire(&ring->tail) >= SHARE_RING_SIZE)
+		return -EAGAIN;
+	ring->frames[head % SHARE_RING_SIZE] = frames;
+	atomic_store_release(&ring->head, head + 1);
+	return 0;
+}
+
+/* take the mutex before to call this, returns the sum of queued frames */
+static snd_pcm_uframes_t snd_pcm_share_ring_pop(snd_pcm_share_ring_t *ring)
+{
+	unsigned int tail = ring->tail;
+	unsigned int head = atomic_load_acquire(&ring->head);
+	snd_pcm_uframes_t frames = 0;
+
+	for (; tail != head; tail++)
+		frames += ring->frames[tail % SHARE_RING_SIZE];
+	atomic_store_release(&ring->tail, tail);
+	return frames;
+}
+
+/*
+ * In the lockfree mode, the client forwards its appl_ptr without the mutex
+ * and only queues the committed sizes.  The lock functions below must be
+ * used in the client ops changing appl_ptr to keep the thread view in sync.
+ */
+static void snd_pcm_share_lock(snd_pcm_share_t *share)
+{
+	Pthread_mutex_lock(&share->slave->mutex);
+	if (share->slave->lockfree) {
+		snd_pcm_share_ring_pop(&share->ring);
+		share->thread_appl_ptr = share->appl_ptr;
+	}
+}
+
+static void snd_pcm_share_unlock(snd_pcm_share_t *share)
+{
+	Pthread_mutex_unlock(&share->slave->mutex);
+}
+
+/* avail of the client as seen from the share thread */
+static snd_pcm_uframes_t snd_pcm_share_avail(snd_pcm_share_t *share)
+{
+	snd_pcm_t *pcm = share->pcm;
+	snd_pcm_sframes_t avail;
+
+	if (!share->slave->lockfree)
+		return snd_pcm_mmap_avail(pcm);
+	avail = share->hw_ptr - share->thread_appl_ptr;
+	if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
+		avail += pcm->buffer_size;
+	if (avail < 0)
+		avail += pcm->boundary;
+	else if ((snd_pcm_uframes_t) avail >= pcm->boundary)
+		avail -= pcm->boundary;
+	return avail;
+}
+
 static snd_pcm_uframes_t snd_pcm_share_slave_avail(snd_pcm_share_slave_t *slave)
 {
 	snd_pcm_sframes_t avail;
@@ -159,7 +233,7 @@ static snd_pcm_uframes_t _snd_pcm_share_slave_forward(snd_pcm_share_slave_t *sla
 		default:
 			continue;
 		}
-		avail = snd_pcm_mmap_avail(pcm);
+		avail = snd_pcm_share_avail(share);
 		frames = slave_avail - avail;
 		if (frames > max_frames)
 			max_frames = frames;
@@ -217,8 +291,8 @@ static snd_pcm_uframes_t _snd_pcm_share_missing(snd_pcm_t *pcm)
 	default:
 		return INT_MAX;
 	}
-	share->hw_ptr = slave->hw_ptr;
-	avail = snd_pcm_mmap_avail(pcm);
+	atomic_store_release(&share->hw_ptr, slave->hw_ptr);
+	avail = snd_pcm_share_avail(share);
 	if (avail >= pcm->stop_threshold) {
 		_snd_pcm_share_stop(pcm, share->state == SND_PCM_STATE_DRAINING ? SND_PCM_STATE_SETUP : SND_PCM_STATE_XRUN);
 		goto update_poll;
@@ -317,7 +391,7 @@ static snd_pcm_uframes_t _snd_pcm_share_missing(snd_pcm_t *pcm)
 	    !share->drain_silenced) {
 		/* drain silencing */
 		if (avail >= slave->silence_frames) {
-			snd_pcm_uframes_t offset = share->appl_ptr % buffer_size;
+			snd_pcm_uframes_t offset = share->thread_appl_ptr % buffer_size;
 			snd_pcm_uframes_t xfer = 0;
 			snd_pcm_uframes_t size = slave->silence_frames;
 			while (xfer < size) {
@@ -343,12 +417,58 @@ static snd_pcm_uframes_t _snd_pcm_share_missing(snd_pcm_t *pcm)
 	return missing;
 }
 
+/* Warning: take the mutex before to call this */
+/* Apply the commits queued by the clients in the lockfree mode */
+static void _snd_pcm_share_slave_flush(snd_pcm_share_slave_t *slave)
+{
+	snd_pcm_t *spcm = slave->pcm;
+	snd_pcm_sframes_t frames, err;
+	struct list_head *i;
+
+	list_for_each(i, &slave->clients) {
+		snd_pcm_share_t *share = list_entry(i, snd_pcm_share_t, list);
+		snd_pcm_t *pcm = share->pcm;
+		snd_pcm_uframes_t size = snd_pcm_share_ring_pop(&share->ring);
+		if (size == 0)
+			continue;
+		if (pcm->stream == SND_PCM_STREAM_PLAYBACK &&
+		    share->state == SND_PCM_STATE_RUNNING) {
+			frames = *spcm->appl.ptr - share->thread_appl_ptr;
+			if (frames > (snd_pcm_sframes_t)pcm->buffer_size)
+				frames -= pcm->boundary;
+			else if (frames < -(snd_pcm_sframes_t)pcm->buffer_size)
+				frames += pcm->boundary;
+			if (frames > 0) {
+				/* Latecomer PCM */
+				err = snd_pcm_rewind(spcm, frames);
+				if (err < 0)
+					snd_checknum(PCM, "snd_pcm_rewind error");
+			}
+		}
+		share->thread_appl_ptr += size;
+		if (share->thread_appl_ptr >= pcm->boundary)
+			share->thread_appl_ptr -= pcm->boundary;
+	}
+	if (slave->running_count == 0)
+		return;
+	frames = _snd_pcm_share_slave_forward(slave);
+	if (frames > 0) {
+		err = snd_pcm_mmap_commit(spcm, snd_pcm_mmap_offset(spcm), frames);
+		if (err < 0)
+			snd_checknum(PCM, "snd_pcm_mmap_commit error");
+		else if (err != frames)
+			snd_checknum(PCM, "commit returns %ld for size %ld", err, frames);
+	}
+}
+
 static snd_pcm_uframes_t _snd_pcm_share_slave_missing(snd_pcm_share_slave_t *slave)
 {
 	snd_pcm_uframes_t missing = INT_MAX;
 	struct list_head *i;
 	/* snd_pcm_sframes_t avail = */ snd_pcm_avail_update(slave->pcm);
 	slave->hw_ptr = *slave->pcm->hw.ptr;
+	if (slave->lockfree)
+		_snd_pcm_share_slave_flush(slave);
 	list_for_each(i, &slave->clients) {
 		snd_pcm_share_t *share = list_entry(i, snd_pcm_share_t, list);
 		snd_pcm_t *pcm = share->pcm;
@@ -389,6 +509,9 @@ static void *snd_pcm_share_thread(void *data)
 		if (missing < INT_MAX) {
 			snd_pcm_uframes_t hw_ptr;
 			snd_pcm_sframes_t avail_min;
+			/* wake up each period to apply the queued commits */
+			if (slave->lockfree)
+				missing = 1;
 			hw_ptr = slave->hw_ptr + missing;
 			hw_ptr += spcm->period_size - 1;
 			if (hw_ptr >= spcm->boundary)
@@ -702,7 +825,7 @@ static int snd_pcm_share_status(snd_pcm_t *pcm, snd_pcm_status_t *status)
 	snd_pcm_share_slave_t *slave = share->slave;
 	int err = 0;
 	snd_pcm_sframes_t sd = 0, d = 0;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_lock(share);
 	if (pcm->stream == SND_PCM_STREAM_PLAYBACK) {
 		status->avail = snd_pcm_mmap_playback_avail(pcm);
 		if (share->state != SND_PCM_STATE_RUNNING &&
@@ -725,7 +848,7 @@ static int snd_pcm_share_status(snd_pcm_t *pcm, snd_pcm_status_t *status)
 	status->hw_ptr = *pcm->hw.ptr;
 	status->trigger_tstamp = share->trigger_tstamp;
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_unlock(share);
 	return err;
 }
 
@@ -783,6 +906,22 @@ static int snd_pcm_share_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
 	int err;
+	if (slave->lockfree) {
+		switch (atomic_load_acquire(&share->state)) {
+		case SND_PCM_STATE_XRUN:
+			return -EPIPE;
+		case SND_PCM_STATE_RUNNING:
+			break;
+		case SND_PCM_STATE_DRAINING:
+			if (pcm->stream == SND_PCM_STREAM_PLAYBACK)
+				break;
+			/* Fall through */
+		default:
+			return -EBADFD;
+		}
+		*delayp = snd_pcm_mmap_delay(pcm);
+		return 0;
+	}
 	Pthread_mutex_lock(&slave->mutex);
 	err = _snd_pcm_share_delay(pcm, delayp);
 	Pthread_mutex_unlock(&slave->mutex);
@@ -794,16 +933,20 @@ static snd_pcm_sframes_t snd_pcm_share_avail_update(snd_pcm_t *pcm)
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
 	snd_pcm_sframes_t avail;
-	Pthread_mutex_lock(&slave->mutex);
+	/* hw_ptr is updated by the share thread */
+	if (slave->lockfree)
+		goto _avail;
+	snd_pcm_share_lock(share);
 	if (share->state == SND_PCM_STATE_RUNNING) {
 		avail = snd_pcm_avail_update(slave->pcm);
 		if (avail < 0) {
-			Pthread_mutex_unlock(&slave->mutex);
+			snd_pcm_share_unlock(share);
 			return avail;
 		}
 		share->hw_ptr = *slave->pcm->hw.ptr;
 	}
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_unlock(share);
+ _avail:
 	avail = snd_pcm_mmap_avail(pcm);
 	if ((snd_pcm_uframes_t)avail > pcm->buffer_size)
 		return -EPIPE;
@@ -847,6 +990,7 @@ static snd_pcm_sframes_t _snd_pcm_share_mmap_commit(snd_pcm_t *pcm,
 		}
 	}
 	snd_pcm_mmap_appl_forward(pcm, size);
+	share->thread_appl_ptr = share->appl_ptr;
 	if (share->state == SND_PCM_STATE_RUNNING) {
 		frames = _snd_pcm_share_slave_forward(slave);
 		if (frames > 0) {
@@ -873,9 +1017,18 @@ static snd_pcm_sframes_t snd_pcm_share_mmap_commit(snd_pcm_t *pcm,
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
 	snd_pcm_sframes_t ret;
-	Pthread_mutex_lock(&slave->mutex);
+	/* queue the commit for the share thread, fall back to the
+	 * locked path when not running or when the ring is full
+	 */
+	if (slave->lockfree &&
+	    atomic_load_acquire(&share->state) == SND_PCM_STATE_RUNNING &&
+	    snd_pcm_share_ring_push(&share->ring, size) == 0) {
+		snd_pcm_mmap_appl_forward(pcm, size);
+		return size;
+	}
+	snd_pcm_share_lock(share);
 	ret = _snd_pcm_share_mmap_commit(pcm, offset, size);
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_unlock(share);
 	return ret;
 }
 
@@ -884,7 +1037,7 @@ static int snd_pcm_share_prepare(snd_pcm_t *pcm)
 	snd_pcm_share_t *share = pcm->private_data;
 	snd_pcm_share_slave_t *slave = share->slave;
 	int err = 0;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_lock(share);
 	switch (share->state) {
 	case SND_PCM_STATE_OPEN:
 		err = -EBADFD;
@@ -905,10 +1058,10 @@ static int snd_pcm_share_prepare(snd_pcm_t *pcm)
 	}
 	slave->prepared_count++;
 	share->hw_ptr = 0;
-	share->appl_ptr = 0;
+	share->appl_ptr = share->thread_appl_ptr = 0;
 	share->state = SND_PCM_STATE_PREPARED;
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_unlock(share);
 	return err;
 }
 
@@ -918,11 +1071,11 @@ static int snd_pcm_share_reset(snd_pcm_t *pcm)
 	snd_pcm_share_slave_t *slave = share->slave;
 	int err = 0;
 	/* FIXME? */
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_lock(share);
 	snd_pcm_areas_silence(pcm->running_areas, 0, pcm->channels, pcm->buffer_size, pcm->format);
 	share->hw_ptr = *slave->pcm->hw.ptr;
-	share->appl_ptr = share->hw_ptr;
-	Pthread_mutex_unlock(&slave->mutex);
+	share->appl_ptr = share->thread_appl_ptr = share->hw_ptr;
+	snd_pcm_share_unlock(share);
 	return err;
 }
 
@@ -933,7 +1086,7 @@ static int snd_pcm_share_start(snd_pcm_t *pcm)
 	snd_pcm_t *spcm = slave->pcm;
 	int err = 0;
 
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_lock(share);
 	if (share->state != SND_PCM_STATE_PREPARED) {
 		err = -EBADFD;
 		goto _end;
@@ -972,6 +1125,7 @@ static int snd_pcm_share_start(snd_pcm_t *pcm)
 			xfer += frames;
 		}
 		snd_pcm_mmap_appl_forward(pcm, hw_avail);
+		share->thread_appl_ptr = share->appl_ptr;
 		if (slave->running_count == 0) {
 			snd_pcm_sframes_t res;
 			res = snd_pcm_mmap_commit(spcm, snd_pcm_mmap_offset(spcm), hw_avail);
@@ -991,7 +1145,7 @@ static int snd_pcm_share_start(snd_pcm_t *pcm)
 	_snd_pcm_share_update(pcm);
 	gettimestamp(&share->trigger_tstamp, pcm->tstamp_type);
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_unlock(share);
 	return err;
 }
 
@@ -1050,6 +1204,7 @@ static snd_pcm_sframes_t _snd_pcm_share_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t
 		frames = ret;
 	}
 	snd_pcm_mmap_appl_backward(pcm, frames);
+	share->thread_appl_ptr = share->appl_ptr;
 	_snd_pcm_share_update(pcm);
 	return n;
 }
@@ -1068,11 +1223,10 @@ static snd_pcm_sframes_t snd_pcm_share_rewindable(snd_pcm_t *pcm)
 static snd_pcm_sframes_t snd_pcm_share_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
 {
 	snd_pcm_share_t *share = pcm->private_data;
-	snd_pcm_share_slave_t *slave = share->slave;
 	snd_pcm_sframes_t ret;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_lock(share);
 	ret = _snd_pcm_share_rewind(pcm, frames);
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_unlock(share);
 	return ret;
 }
 
@@ -1107,6 +1261,7 @@ static snd_pcm_sframes_t _snd_pcm_share_forward(snd_pcm_t *pcm, snd_pcm_uframes_
 		frames = ret;
 	}
 	snd_pcm_mmap_appl_forward(pcm, frames);
+	share->thread_appl_ptr = share->appl_ptr;
 	_snd_pcm_share_update(pcm);
 	return n;
 }
@@ -1125,11 +1280,10 @@ static snd_pcm_sframes_t snd_pcm_share_forwardable(snd_pcm_t *pcm)
 static snd_pcm_sframes_t snd_pcm_share_forward(snd_pcm_t *pcm, snd_pcm_uframes_t frames)
 {
 	snd_pcm_share_t *share = pcm->private_data;
-	snd_pcm_share_slave_t *slave = share->slave;
 	snd_pcm_sframes_t ret;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_lock(share);
 	ret = _snd_pcm_share_forward(pcm, frames);
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_unlock(share);
 	return ret;
 }
 
@@ -1177,9 +1331,8 @@ static void _snd_pcm_share_stop(snd_pcm_t *pcm, snd_pcm_state_t state)
 static int snd_pcm_share_drain(snd_pcm_t *pcm)
 {
 	snd_pcm_share_t *share = pcm->private_data;
-	snd_pcm_share_slave_t *slave = share->slave;
 	int err = 0;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_lock(share);
 	switch (share->state) {
 	case SND_PCM_STATE_OPEN:
 		err = -EBADFD;
@@ -1201,7 +1354,7 @@ static int snd_pcm_share_drain(snd_pcm_t *pcm)
 		case SND_PCM_STATE_RUNNING:
 			share->state = SND_PCM_STATE_DRAINING;
 			_snd_pcm_share_update(pcm);
-			Pthread_mutex_unlock(&slave->mutex);
+			snd_pcm_share_unlock(share);
 			if (!(pcm->mode & SND_PCM_NONBLOCK))
 				snd_pcm_wait(pcm, SND_PCM_WAIT_DRAIN);
 			return 0;
@@ -1228,16 +1381,15 @@ static int snd_pcm_share_drain(snd_pcm_t *pcm)
 		}
 	}
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_unlock(share);
 	return err;
 }
 
 static int snd_pcm_share_drop(snd_pcm_t *pcm)
 {
 	snd_pcm_share_t *share = pcm->private_data;
-	snd_pcm_share_slave_t *slave = share->slave;
 	int err = 0;
-	Pthread_mutex_lock(&slave->mutex);
+	snd_pcm_share_lock(share);
 	switch (share->state) {
 	case SND_PCM_STATE_OPEN:
 		err = -EBADFD;
@@ -1263,9 +1415,9 @@ static int snd_pcm_share_drop(snd_pcm_t *pcm)
 		break;
 	}
 
-	share->appl_ptr = share->hw_ptr = 0;
+	share->appl_ptr = share->thread_appl_ptr = share->hw_ptr = 0;
  _end:
-	Pthread_mutex_unlock(&slave->mutex);
+	snd_pcm_share_unlock(share);
 	return err;
 }
 
@@ -1380,6 +1532,7 @@ static const snd_pcm_fast_ops_t snd_pcm_share_fast_ops = {
  * \param sbuffer_time Slave buffer time
  * \param channels Count of channels
  * \param channels_map Map of channels
+ * \param lockfree Queue the client commits to the share thread without locking
  * \param stream Direction
  * \param mode PCM mode
  * \retval zero on success otherwise a negative error code
@@ -1392,7 +1545,7 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 		       unsigned int schannels,
 		       int speriod_time, int sbuffer_time,
 		       unsigned int channels, unsigned int *channels_map,
-		       snd_pcm_stream_t stream, int mode)
+		       int lockfree, snd_pcm_stream_t stream, int mode)
 {
 	snd_pcm_t *pcm;
 	snd_pcm_share_t *share;
@@ -1511,6 +1664,7 @@ int snd_pcm_share_open(snd_pcm_t **pcmp, const char *name, const char *sname,
 		slave->rate = srate;
 		slave->period_time = speriod_time;
 		slave->buffer_time = sbuffer_time;
+		slave->lockfree = lockfree;
 		pthread_mutex_init(&slave->mutex, NULL);
 		pthread_cond_init(&slave->poll_cond, NULL);
 		list_add_tail(&slave->list, &snd_pcm_share_slaves);
@@ -1592,9 +1746,18 @@ pcm.name {
 	bindings {
 		N INT		# Slave channel INT for client channel N
 	}
+	[lockfree BOOL]		# Lock-free client commits (default no)
 }
 \endcode
 
+With <code>lockfree</code> set, the mmap_commit, avail_update and delay
+operations of the clients do not take the slave mutex. The committed
+sizes are queued to a per-client ring and the share thread applies them
+to the slave once per slave period. The hardware pointer seen by the
+clients is also updated by the share thread, so it has the slave period
+granularity. The value of the first opened client is used for all
+clients of the same slave.
+
 \subsection pcm_plugins_share_funcref Function reference
 
 <UL>
@@ -1633,6 +1796,7 @@ int _snd_pcm_share_open(snd_pcm_t **pcmp, const char *name,
 	int srate = -1;
 	int speriod_time= -1, sbuffer_time = -1;
 	unsigned int schannel_max = 0;
+	int lockfree = 0;
 
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
@@ -1653,6 +1817,13 @@ int _snd_pcm_share_open(snd_pcm_t **pcmp, const char *name,
 			bindings = n;
 			continue;
 		}
+		if (strcmp(id, "lockfree") == 0) {
+			err = snd_config_get_bool(n);
+			if (err < 0)
+				return err;
+			lockfree = err;
+			continue;
+		}
 		snd_error(PCM, "Unknown field %s", id);
 		return -EINVAL;
 	}
@@ -1732,7 +1903,7 @@ int _snd_pcm_share_open(snd_pcm_t **pcmp, const char *name,
 	err = snd_pcm_share_open(pcmp, name, sname, sformat, srate,
 				 (unsigned int) schannels,
 				 speriod_time, sbuffer_time,
-				 channels, channels_map, stream, mode);
+				 channels, channels_map, lockfree, stream, mode);
 _free:
 	free(channels_map);
 	free((char *)sname);
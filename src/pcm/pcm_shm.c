@@ -54,6 +54,7 @@ const char *_snd_module_pcm_shm = "";
 #ifndef DOC_HIDDEN
 typedef struct {
 	int socket;
+	int memfd;		/* ctrl is mapped from memfd, fast ops use the doorbell */
 	volatile snd_pcm_shm_ctrl_t *ctrl;
 } snd_pcm_shm_t;
 #endif
@@ -110,21 +111,12 @@ static int snd_pcm_shm_new_rbptr(snd_pcm_t *pcm, snd_pcm_shm_t *shm,
 	return 0;
 }
 
-static long snd_pcm_shm_action(snd_pcm_t *pcm)
+static long snd_pcm_shm_action_result(snd_pcm_t *pcm)
 {
 	snd_pcm_shm_t *shm = pcm->private_data;
 	int err, result;
-	char buf[1] = "";
 	volatile snd_pcm_shm_ctrl_t *ctrl = shm->ctrl;
 
-	if (ctrl->hw.changed || ctrl->appl.changed)
-		return -EBADFD;
-	err = write(shm->socket, buf, 1);
-	if (err != 1)
-		return -EBADFD;
-	err = read(shm->socket, buf, 1);
-	if (err != 1)
-		return -EBADFD;
 	if (ctrl->cmd) {
 		snd_error(PCM, "Server has not done the cmd");
 		return -EBADFD;
@@ -145,6 +137,57 @@ static long snd_pcm_shm_action(snd_pcm_t *pcm)
 	return result;
 }
 
+static long snd_pcm_shm_action(snd_pcm_t *pcm)
+{
+	snd_pcm_shm_t *shm = pcm->private_data;
+	int err;
+	char buf[1] = "";
+	volatile snd_pcm_shm_ctrl_t *ctrl = shm->ctrl;
+
+	if (ctrl->hw.changed || ctrl->appl.changed)
+		return -EBADFD;
+	err = write(shm->socket, buf, 1);
+	if (err != 1)
+		return -EBADFD;
+	err = read(shm->socket, buf, 1);
+	if (err != 1)
+		return -EBADFD;
+	return snd_pcm_shm_action_result(pcm);
+}
+
+/*
+ * the commands not touching the setup are passed through the doorbell
+ * with the memfd transport, so they don't need a socket round trip
+ */
+static long snd_pcm_shm_fast_action(snd_pcm_t *pcm)
+{
+#ifdef SND_TRANSPORT_MEMFD
+	snd_pcm_shm_t *shm = pcm->private_data;
+	volatile snd_pcm_shm_ctrl_t *ctrl = shm->ctrl;
+	struct pollfd pfd;
+	uint32_t req, ack;
+
+	if (shm->memfd < 0)
+		return snd_pcm_shm_action(pcm);
+	if (ctrl->hw.changed || ctrl->appl.changed)
+		return -EBADFD;
+	req = ctrl->fast.req + 1;
+	snd_shm_doorbell_ring(&ctrl->fast.req, req);
+	while ((ack = snd_shm_doorbell_get(&ctrl->fast.ack)) != req) {
+		if (snd_shm_doorbell_wait(&ctrl->fast.ack, ack, 1000) != -ETIMEDOUT)
+			continue;
+		/* the server never writes to the socket on its own */
+		pfd.fd = shm->socket;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) != 0)
+			return -EBADFD;
+	}
+	return snd_pcm_shm_action_result(pcm);
+#else
+	return snd_pcm_shm_action(pcm);
+#endif
+}
+
 static long snd_pcm_shm_action_fd(snd_pcm_t *pcm, int *fd)
 {
 	snd_pcm_shm_t *shm = pcm->private_data;
@@ -392,7 +435,7 @@ static int snd_pcm_shm_status(snd_pcm_t *pcm, snd_pcm_status_t * status)
 	int err;
 	ctrl->cmd = SNDRV_PCM_IOCTL_STATUS;
 	// ctrl->u.status = *status;
-	err = snd_pcm_shm_action(pcm);
+	err = snd_pcm_shm_fast_action(pcm);
 	if (err < 0)
 		return err;
 	*status = ctrl->u.status;
@@ -404,7 +447,7 @@ static snd_pcm_state_t snd_pcm_shm_state(snd_pcm_t *pcm)
 	snd_pcm_shm_t *shm = pcm->private_data;
 	volatile snd_pcm_shm_ctrl_t *ctrl = shm->ctrl;
 	ctrl->cmd = SND_PCM_IOCTL_STATE;
-	return snd_pcm_shm_action(pcm);
+	return snd_pcm_shm_fast_action(pcm);
 }
 
 static int snd_pcm_shm_hwsync(snd_pcm_t *pcm)
@@ -412,7 +455,7 @@ static int snd_pcm_shm_hwsync(snd_pcm_t *pcm)
 	snd_pcm_shm_t *shm = pcm->private_data;
 	volatile snd_pcm_shm_ctrl_t *ctrl = shm->ctrl;
 	ctrl->cmd = SND_PCM_IOCTL_HWSYNC;
-	return snd_pcm_shm_action(pcm);
+	return snd_pcm_shm_fast_action(pcm);
 }
 
 static int snd_pcm_shm_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
@@ -421,7 +464,7 @@ static int snd_pcm_shm_delay(snd_pcm_t *pcm, snd_pcm_sframes_t *delayp)
 	volatile snd_pcm_shm_ctrl_t *ctrl = shm->ctrl;
 	int err;
 	ctrl->cmd = SNDRV_PCM_IOCTL_DELAY;
-	err = snd_pcm_shm_action(pcm);
+	err = snd_pcm_shm_fast_action(pcm);
 	if (err < 0)
 		return err;
 	*delayp = ctrl->u.delay.frames;
@@ -434,7 +477,7 @@ static snd_pcm_sframes_t snd_pcm_shm_avail_update(snd_pcm_t *pcm)
 	volatile snd_pcm_shm_ctrl_t *ctrl = shm->ctrl;
 	int err;
 	ctrl->cmd = SND_PCM_IOCTL_AVAIL_UPDATE;
-	err = snd_pcm_shm_action(pcm);
+	err = snd_pcm_shm_fast_action(pcm);
 	return err;
 }
 
@@ -516,7 +559,7 @@ static snd_pcm_sframes_t snd_pcm_shm_rewind(snd_pcm_t *pcm, snd_pcm_uframes_t fr
 	volatile snd_pcm_shm_ctrl_t *ctrl = shm->ctrl;
 	ctrl->cmd = SNDRV_PCM_IOCTL_REWIND;
 	ctrl->u.rewind.frames = frames;
-	return snd_pcm_shm_action(pcm);
+	return snd_pcm_shm_fast_action(pcm);
 }
 
 static snd_pcm_sframes_t snd_pcm_shm_forwardable(snd_pcm_t *pcm ATTRIBUTE_UNUSED)
@@ -530,7 +573,7 @@ static snd_pcm_sframes_t snd_pcm_shm_forward(snd_pcm_t *pcm, snd_pcm_uframes_t f
 	volatile snd_pcm_shm_ctrl_t *ctrl = shm->ctrl;
 	ctrl->cmd = SND_PCM_IOCTL_FORWARD;
 	ctrl->u.forward.frames = frames;
-	return snd_pcm_shm_action(pcm);
+	return snd_pcm_shm_fast_action(pcm);
 }
 
 static int snd_pcm_shm_resume(snd_pcm_t *pcm)
@@ -550,7 +593,7 @@ static snd_pcm_sframes_t snd_pcm_shm_mmap_commit(snd_pcm_t *pcm,
 	ctrl->cmd = SND_PCM_IOCTL_MMAP_COMMIT;
 	ctrl->u.mmap_commit.offset = offset;
 	ctrl->u.mmap_commit.frames = size;
-	return snd_pcm_shm_action(pcm);
+	return snd_pcm_shm_fast_action(pcm);
 }
 
 static int snd_pcm_shm_poll_descriptor(snd_pcm_t *pcm)
@@ -572,7 +615,12 @@ static int snd_pcm_shm_close(snd_pcm_t *pcm)
 	int result;
 	ctrl->cmd = SND_PCM_IOCTL_CLOSE;
 	result = snd_pcm_shm_action(pcm);
-	shmdt((void *)ctrl);
+	if (shm->memfd >= 0) {
+		munmap((void *)ctrl, PCM_SHM_SIZE);
+		close(shm->memfd);
+	} else {
+		shmdt((void *)ctrl);
+	}
 	close(shm->socket);
 	close(pcm->poll_fd);
 	free(shm);
@@ -653,6 +701,81 @@ static int make_local_socket(const char *filename)
 	return sock;
 }
 
+static int snd_pcm_shm_request(int sock, const char *sname, int transport,
+			       snd_pcm_stream_t stream, int mode,
+			       snd_client_open_answer_t *ans)
+{
+	snd_client_open_request_t *req;
+	size_t snamelen = strlen(sname), reqlen;
+	int err;
+
+	reqlen = sizeof(*req) + snamelen;
+	req = alloca(reqlen);
+	memcpy(req->name, sname, snamelen);
+	req->dev_type = SND_DEV_TYPE_PCM;
+	req->transport_type = transport;
+	req->stream = stream;
+	req->mode = mode;
+	req->namelen = snamelen;
+	err = write(sock, req, reqlen);
+	if (err < 0) {
+		snd_errornum(PCM, "write error");
+		return -errno;
+	}
+	if ((size_t) err != reqlen) {
+		snd_error(PCM, "write size error");
+		return -EINVAL;
+	}
+	err = read(sock, ans, sizeof(*ans));
+	if (err < 0) {
+		snd_errornum(PCM, "read error");
+		return -errno;
+	}
+	if (err != sizeof(*ans)) {
+		snd_error(PCM, "read size error");
+		return -EINVAL;
+	}
+	if (ans->result < INT_MIN || ans->result > INT_MAX) {
+		snd_error(PCM, "invalid read");
+		return -EINVAL;
+	}
+	return ans->result;
+}
+
+#ifdef SND_TRANSPORT_MEMFD
+/*
+ * ask for the memfd transport; the control area is passed as a file
+ * descriptor after the answer
+ */
+static int snd_pcm_shm_open_memfd(int sock, const char *sname,
+				  snd_pcm_stream_t stream, int mode,
+				  snd_pcm_shm_ctrl_t **ctrlp, int *memfdp)
+{
+	snd_client_open_answer_t ans;
+	char buf[1];
+	void *ptr;
+	int err, fd;
+
+	err = snd_pcm_shm_request(sock, sname, SND_TRANSPORT_TYPE_MEMFD,
+				  stream, mode, &ans);
+	if (err < 0)
+		return err;
+	err = snd_receive_fd(sock, buf, 1, &fd);
+	if (err != 1 || fd < 0)
+		return -EBADFD;
+	ptr = mmap(NULL, PCM_SHM_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED) {
+		err = -errno;
+		snd_errornum(PCM, "memfd mmap failed");
+		close(fd);
+		return err;
+	}
+	*ctrlp = ptr;
+	*memfdp = fd;
+	return 0;
+}
+#endif
+
 /**
  * \brief Creates a new shared memory PCM
  * \param pcmp Returns created PCM handle
@@ -672,15 +795,13 @@ int snd_pcm_shm_open(snd_pcm_t **pcmp, const char *name,
 {
 	snd_pcm_t *pcm;
 	snd_pcm_shm_t *shm = NULL;
-	snd_client_open_request_t *req;
 	snd_client_open_answer_t ans;
-	size_t snamelen, reqlen;
 	int err;
 	int result;
 	snd_pcm_shm_ctrl_t *ctrl = NULL;
 	int sock = -1;
-	snamelen = strlen(sname);
-	if (snamelen > 255)
+	int memfd = -1;
+	if (strlen(sname) > 255)
 		return -EINVAL;
 
 	result = make_local_socket(sockname);
@@ -690,50 +811,24 @@ int snd_pcm_shm_open(snd_pcm_t **pcmp, const char *name,
 	}
 	sock = result;
 
-	reqlen = sizeof(*req) + snamelen;
-	req = alloca(reqlen);
-	memcpy(req->name, sname, snamelen);
-	req->dev_type = SND_DEV_TYPE_PCM;
-	req->transport_type = SND_TRANSPORT_TYPE_SHM;
-	req->stream = stream;
-	req->mode = mode;
-	req->namelen = snamelen;
-	err = write(sock, req, reqlen);
-	if (err < 0) {
-		snd_errornum(PCM, "write error");
-		result = -errno;
-		goto _err;
-	}
-	if ((size_t) err != reqlen) {
-		snd_error(PCM, "write size error");
-		result = -EINVAL;
+#ifdef SND_TRANSPORT_MEMFD
+	result = snd_pcm_shm_open_memfd(sock, sname, stream, mode, &ctrl, &memfd);
+	/* older servers refuse the memfd transport, fall back to SysV shm */
+	if (result < 0 && result != -EINVAL)
 		goto _err;
-	}
-	err = read(sock, &ans, sizeof(ans));
-	if (err < 0) {
-		snd_errornum(PCM, "read error");
-		result = -errno;
-		goto _err;
-	}
-	if (err != sizeof(ans)) {
-		snd_error(PCM, "read size error");
-		result = -EINVAL;
-		goto _err;
-	}
-	if (ans.result < INT_MIN || ans.result > INT_MAX) {
-		snd_error(PCM, "invalid read");
-		result = -EINVAL;
-		goto _err;
-	}
-	result = ans.result;
-	if (result < 0)
-		goto _err;
-
-	ctrl = shmat(ans.cookie, 0, 0);
+#endif
 	if (!ctrl) {
-		snd_errornum(PCM, "shmat error");
-		result = -errno;
-		goto _err;
+		result = snd_pcm_shm_request(sock, sname, SND_TRANSPORT_TYPE_SHM,
+					     stream, mode, &ans);
+		if (result < 0)
+			goto _err;
+		ctrl = shmat(ans.cookie, 0, 0);
+		if (ctrl == (void *) -1) {
+			snd_errornum(PCM, "shmat error");
+			ctrl = NULL;
+			result = -errno;
+			goto _err;
+		}
 	}
 
 	shm = calloc(1, sizeof(snd_pcm_shm_t));
@@ -743,6 +838,7 @@ int snd_pcm_shm_open(snd_pcm_t **pcmp, const char *name,
 	}
 
 	shm->socket = sock;
+	shm->memfd = memfd;
 	shm->ctrl = ctrl;
 
 	err = snd_pcm_new(&pcm, SND_PCM_TYPE_SHM, name, stream, mode);
@@ -769,8 +865,12 @@ int snd_pcm_shm_open(snd_pcm_t **pcmp, const char *name,
  _err:
 	if (sock >= 0)
 		close(sock);
-	if (ctrl)
+	if (memfd >= 0) {
+		munmap(ctrl, PCM_SHM_SIZE);
+		close(memfd);
+	} else if (ctrl) {
 		shmdt(ctrl);
+	}
 	free(shm);
 	return result;
 }
@@ -783,6 +883,12 @@ This plugin communicates with aserver via shared memory. It is a raw
 communication without any conversions, but it can be expected worse
 performance.
 
+When both sides support it, the shared control area is a memfd passed
+over the socket, and the commands which don't change the setup (state,
+status, delay, hwsync, avail_update, mmap_commit, rewind and forward)
+are signalled through futex words in that area instead of the socket.
+Older servers are served through SysV shared memory.
+
 \code
 pcm.name {
 	type shm                # Shared memory PCM
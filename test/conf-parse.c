@@ -0,0 +1,161 @@
+/*
+ * Configuration parser micro-benchmark
+ *
+ * Usage: conf-parse [-n loops] [-d] [directory]
+ *
+ * Parses every *.conf file below the directory (the shipped src/conf
+ * tree or the installed configuration by default) and reports the
+ * parsing speed.  The -d option dumps the parsed trees to check that
+ * the parser output does not change.
+ */
+
+#include "../include/asoundlib.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <err.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+struct conf_file {
+	char *name;
+	char *data;
+	size_t size;
+};
+
+static struct conf_file *files;
+static unsigned int nfiles;
+
+static void add_file(const char *name)
+{
+	struct conf_file *f;
+	struct stat st;
+	FILE *fp;
+
+	fp = fopen(name, "r");
+	if (!fp)
+		err(1, "%s", name);
+	if (fstat(fileno(fp), &st) < 0)
+		err(1, "%s", name);
+	files = realloc(files, (nfiles + 1) * sizeof(*files));
+	if (!files)
+		err(1, "realloc");
+	f = &files[nfiles++];
+	f->name = strdup(name);
+	f->size = st.st_size;
+	f->data = malloc(f->size + 1);
+	if (!f->name || !f->data)
+		err(1, "malloc");
+	if (fread(f->data, 1, f->size, fp) != f->size)
+		err(1, "%s", name);
+	fclose(fp);
+}
+
+static int filter(const struct dirent *d)
+{
+	return d->d_name[0] != '.';
+}
+
+static void scan_dir(const char *dir)
+{
+	struct dirent **list;
+	char path[4096];
+	struct stat st;
+	int i, n;
+	size_t len;
+
+	n = scandir(dir, &list, filter, alphasort);
+	if (n < 0)
+		err(1, "%s", dir);
+	for (i = 0; i < n; i++) {
+		snprintf(path, sizeof(path), "%s/%s", dir, list[i]->d_name);
+		len = strlen(path);
+		if (stat(path, &st) == 0) {
+			if (S_ISDIR(st.st_mode))
+				scan_dir(path);
+			else if (len > 5 && !strcmp(path + len - 5, ".conf"))
+				add_file(path);
+		}
+		free(list[i]);
+	}
+	free(list);
+}
+
+static int parse(struct conf_file *f, snd_output_t *out)
+{
+	snd_config_t *top;
+	snd_input_t *in;
+	int err;
+
+	err = snd_config_top(&top);
+	if (err < 0)
+		return err;
+	err = snd_input_buffer_open(&in, f->data, f->size);
+	if (err < 0) {
+		snd_config_delete(top);
+		return err;
+	}
+	err = snd_config_load(top, in);
+	snd_input_close(in);
+	if (err >= 0 && out) {
+		snd_output_printf(out, "# %s\n", f->name);
+		snd_config_save(top, out);
+	}
+	snd_config_delete(top);
+	return err;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = snd_config_topdir();
+	snd_output_t *out = NULL;
+	unsigned int loops = 200, i, k;
+	struct timespec start, end;
+	size_t bytes = 0;
+	double sec;
+	int c, err;
+
+	while ((c = getopt(argc, argv, "n:d")) >= 0) {
+		switch (c) {
+		case 'n':
+			loops = atoi(optarg);
+			break;
+		case 'd':
+			if (snd_output_stdio_attach(&out, stdout, 0) < 0)
+				errx(1, "cannot attach the output");
+			loops = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n loops] [-d] [directory]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind < argc)
+		dir = argv[optind];
+	scan_dir(dir);
+	if (nfiles == 0)
+		errx(1, "no configuration files in %s", dir);
+	for (k = 0; k < nfiles; k++)
+		bytes += files[k].size;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < loops; i++) {
+		for (k = 0; k < nfiles; k++) {
+			err = parse(&files[k], out);
+			if (err < 0)
+				errx(1, "%s: %s", files[k].name, snd_strerror(err));
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (out) {
+		snd_output_close(out);
+		return 0;
+	}
+	sec = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%u files, %zu bytes, %u loops: %.1f us per pass, %.1f MB/s\n",
+	       nfiles, bytes, loops, sec * 1e6 / loops,
+	       bytes * (double)loops / sec / 1e6);
+	return 0;
+}
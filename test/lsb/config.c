@@ -184,6 +184,106 @@ static void test_search(void)
 	ALSA_CHECK(snd_config_delete(top));
 }
 
+/* the child with the given id, found by walking the ordered list */
+static snd_config_t *search_linear(snd_config_t *top, const char *key)
+{
+	snd_config_iterator_t i, next;
+	const char *id;
+
+	snd_config_for_each(i, next, top) {
+		snd_config_t *n = snd_config_iterator_entry(i);
+		if (snd_config_get_id(n, &id) >= 0 && !strcmp(id, key))
+			return n;
+	}
+	return NULL;
+}
+
+static int search_matches(snd_config_t *top, unsigned int keys)
+{
+	snd_config_t *c, *l;
+	char key[16];
+	unsigned int k;
+
+	for (k = 0; k < keys; k++) {
+		sprintf(key, "k%u", k);
+		l = search_linear(top, key);
+		c = NULL;
+		if (snd_config_search(top, key, &c) < 0)
+			c = NULL;
+		if (c != l)
+			return 0;
+	}
+	return 1;
+}
+
+/* large compounds are searched through an index, check it against the list */
+static void test_search_index(void)
+{
+	const unsigned int keys = 300;
+	snd_config_t *top, *c, *n, *src;
+	unsigned int seed = 1, k, op;
+	char key[16];
+
+	ALSA_CHECK(snd_config_top(&top));
+	for (op = 0; op < 20000; op++) {
+		seed = seed * 1103515245 + 12345;
+		k = (seed >> 8) % keys;
+		sprintf(key, "k%u", k);
+		c = search_linear(top, key);
+		switch ((seed >> 20) % 6) {
+		case 0:		/* add */
+		case 1:
+			if (c)
+				break;
+			ALSA_CHECK(snd_config_imake_integer(&n, key, k));
+			if ((seed & 1) || snd_config_is_empty(top))
+				ALSA_CHECK(snd_config_add(top, n));
+			else {
+				c = snd_config_iterator_entry(snd_config_iterator_first(top));
+				ALSA_CHECK(snd_config_add_before(c, n));
+			}
+			break;
+		case 2:		/* delete */
+			if (c)
+				ALSA_CHECK(snd_config_delete(c));
+			break;
+		case 3:		/* rename */
+			if (!c)
+				break;
+			sprintf(key, "k%u", (seed >> 4) % keys);
+			n = search_linear(top, key);
+			if (n && n != c)
+				TEST_CHECK(snd_config_set_id(c, key) == -EEXIST);
+			else
+				ALSA_CHECK(snd_config_set_id(c, key));
+			break;
+		case 4:		/* remove and add back */
+			if (!c)
+				break;
+			ALSA_CHECK(snd_config_remove(c));
+			ALSA_CHECK(snd_config_add(top, c));
+			break;
+		case 5:		/* merge */
+			ALSA_CHECK(snd_config_top(&src));
+			for (k = 0; k < 8; k++) {
+				sprintf(key, "k%u", (seed + k * 37) % keys);
+				if (snd_config_search(src, key, NULL) < 0) {
+					ALSA_CHECK(snd_config_imake_integer(&n, key, k));
+					ALSA_CHECK(snd_config_add(src, n));
+				}
+			}
+			ALSA_CHECK(snd_config_merge(top, src, 1));
+			break;
+		}
+		if (op % 100 == 0 && !search_matches(top, keys)) {
+			TEST_CHECK(search_matches(top, keys));
+			break;
+		}
+	}
+	TEST_CHECK(search_matches(top, keys));
+	ALSA_CHECK(snd_config_delete(top));
+}
+
 static void test_searchv(void)
 {
 	const char *text =
@@ -621,6 +721,7 @@ int main(void)
 	test_save();
 	test_update();
 	test_search();
+	test_search_index();
 	test_searchv();
 	test_add();
 	test_delete();
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "test.h"
+
+/*
+ * Concurrent rewinding and forwarding clients.  Each thread plays a frame
+ * counter through its own file plugin (on a null slave) and randomly
+ * rewinds the queued frames, then either forwards over them or writes
+ * them again.  The resulting file must contain the plain counter.
+ */
+
+#define CLIENTS		4
+#define CHANNELS	2
+#define PERIOD_SIZE	256
+#define BUFFER_SIZE	(PERIOD_SIZE * 4)
+#define FRAMES		(48000 * 4)
+
+struct client {
+	pthread_t thread;
+	FILE *out;
+	snd_pcm_t *pcm;
+	unsigned int seed;
+	int failed;
+};
+
+static int open_client(struct client *c)
+{
+	char conf_str[256];
+	snd_config_t *conf;
+	snd_input_t *in;
+	int err;
+
+	c->out = tmpfile();
+	if (!c->out)
+		return -errno;
+	snprintf(conf_str, sizeof(conf_str),
+		 "pcm.rewind { type file file %d format raw slave.pcm { type null } }",
+		 fileno(c->out));
+	err = snd_config_top(&conf);
+	if (err < 0)
+		return err;
+	err = snd_input_buffer_open(&in, conf_str, strlen(conf_str));
+	if (err >= 0) {
+		err = snd_config_load(conf, in);
+		snd_input_close(in);
+	}
+	if (err >= 0)
+		err = snd_pcm_open_lconf(&c->pcm, "rewind", SND_PCM_STREAM_PLAYBACK,
+					 0, conf);
+	snd_config_delete(conf);
+	if (err < 0)
+		return err;
+	return snd_pcm_set_params(c->pcm, SND_PCM_FORMAT_S16,
+				  SND_PCM_ACCESS_RW_INTERLEAVED, CHANNELS,
+				  48000, 0, BUFFER_SIZE * 1000000LL / 48000);
+}
+
+static void fill(short *buf, unsigned long pos, snd_pcm_uframes_t frames)
+{
+	snd_pcm_uframes_t i;
+	int chn;
+
+	for (i = 0; i < frames; i++, pos++)
+		for (chn = 0; chn < CHANNELS; chn++)
+			*buf++ = (short)(pos * CHANNELS + chn);
+}
+
+static void *client_thread(void *data)
+{
+	struct client *c = data;
+	short buf[BUFFER_SIZE * CHANNELS];
+	snd_pcm_sframes_t err, rewindable, rewound, forwarded;
+	snd_pcm_uframes_t size;
+	unsigned long pos = 0;
+
+	while (pos < FRAMES) {
+		size = PERIOD_SIZE / 2 + rand_r(&c->seed) % PERIOD_SIZE;
+		if (size > FRAMES - pos)
+			size = FRAMES - pos;
+		fill(buf, pos, size);
+		err = snd_pcm_writei(c->pcm, buf, size);
+		if (err < 0) {
+			fprintf(stderr, "write failed: %s\n", snd_strerror(err));
+			c->failed = 1;
+			break;
+		}
+		pos += err;
+
+		rewindable = snd_pcm_rewindable(c->pcm);
+		if (rewindable <= 0)
+			continue;
+		size = rand_r(&c->seed) % (rewindable + 1);
+		rewound = snd_pcm_rewind(c->pcm, size);
+		if (rewound < 0 || (snd_pcm_uframes_t)rewound > size) {
+			fprintf(stderr, "rewind of %lu frames returned %ld\n",
+				size, rewound);
+			c->failed = 1;
+			break;
+		}
+		pos -= rewound;
+		if (!rewound || (rand_r(&c->seed) & 1))
+			continue;
+		/* take the rewound frames back, the data must be still there */
+		forwarded = snd_pcm_forward(c->pcm, rewound);
+		if (forwarded != rewound) {
+			fprintf(stderr, "forward of %ld frames returned %ld\n",
+				rewound, forwarded);
+			c->failed = 1;
+			break;
+		}
+		pos += forwarded;
+	}
+	return NULL;
+}
+
+static void check_output(struct client *c)
+{
+	short buf[PERIOD_SIZE * CHANNELS];
+	unsigned long pos = 0;
+	size_t i, n;
+
+	rewind(c->out);
+	while ((n = fread(buf, sizeof(short) * CHANNELS, PERIOD_SIZE, c->out)) > 0) {
+		for (i = 0; i < n * CHANNELS; i++)
+			if (buf[i] != (short)(pos * CHANNELS + i)) {
+				fprintf(stderr, "bad sample at frame %lu\n",
+					pos + i / CHANNELS);
+				any_test_failed = 1;
+				return;
+			}
+		pos += n;
+	}
+	TEST_CHECK(pos == FRAMES);
+}
+
+int main(void)
+{
+	struct client clients[CLIENTS];
+	int i;
+
+	memset(clients, 0, sizeof(clients));
+	for (i = 0; i < CLIENTS; i++) {
+		clients[i].seed = i + 1;
+		if (ALSA_CHECK(open_client(&clients[i])) < 0)
+			return TEST_EXIT_CODE();
+	}
+	for (i = 0; i < CLIENTS; i++)
+		TEST_CHECK(pthread_create(&clients[i].thread, NULL,
+					  client_thread, &clients[i]) == 0);
+	for (i = 0; i < CLIENTS; i++) {
+		struct client *c = &clients[i];
+
+		pthread_join(c->thread, NULL);
+		TEST_CHECK(!c->failed);
+		ALSA_CHECK(snd_pcm_drain(c->pcm));
+		ALSA_CHECK(snd_pcm_close(c->pcm));
+		check_output(c);
+		fclose(c->out);
+	}
+	return TEST_EXIT_CODE();
+}
@@ -0,0 +1,350 @@
+/*
+ * rewind/forward stress test with concurrent clients
+ *
+ * Each thread opens its own handle of the given PCM (dmix by default)
+ * and feeds a sine wave.  After each write, the thread randomly rewinds
+ * a part of the queued data and either forwards over it again or writes
+ * it once more, so the mixed result should stay a clean sine per client.
+ *
+ * At the end, the number of rewound, forwarded and rewritten frames
+ * and errors of each client are shown.  The exit code is non-zero when
+ * the rewind or forward result does not match the expected values.
+ *
+ * With -k, the ipc_key of the dmix definition (and an S16 slave), a single
+ * client checks the mixed result instead: the sum buffer of dmix is read
+ * through the shared memory and the rewound samples must be removed from
+ * it right after the rewind, and the rewritten ones must be there.
+ *
+ * The same rewind and forward pattern is checked without a sound card by
+ * test/lsb/pcm_rewind (make check), through the file plugin.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "../include/asoundlib.h"
+
+#define MAX_THREADS	10
+
+static const char *pcmdev = "dmix";
+static int num_threads = 2;
+static int periodsize = 1024;
+static int bufsize = 1024 * 4;
+static int channels = 2;
+static int rate = 48000;
+static int duration = 10;
+static int quiet = 0;
+static int ipc_key = 0;
+
+struct client {
+	pthread_t thread;
+	int no;
+	snd_pcm_t *pcm;
+	double phase;
+	unsigned long written;
+	unsigned long rewound;
+	unsigned long forwarded;
+	unsigned long errors;
+	unsigned long mismatches;
+};
+
+static struct client clients[MAX_THREADS];
+static volatile int running = 1;
+
+static void generate_sine(struct client *c, short *buf, snd_pcm_uframes_t frames)
+{
+	double step = 2 * M_PI * (220.0 * (c->no + 1)) / rate;
+	snd_pcm_uframes_t i;
+	int chn;
+
+	for (i = 0; i < frames; i++) {
+		short val = sin(c->phase) * 8000;
+		for (chn = 0; chn < channels; chn++)
+			*buf++ = val;
+		c->phase += step;
+		if (c->phase >= 2 * M_PI)
+			c->phase -= 2 * M_PI;
+	}
+}
+
+static int setup_params(snd_pcm_t *pcm)
+{
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_sw_params_t *sw;
+
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_hw_params_any(pcm, hw);
+	snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED);
+	snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16);
+	snd_pcm_hw_params_set_channels(pcm, hw, channels);
+	snd_pcm_hw_params_set_rate(pcm, hw, rate, 0);
+	snd_pcm_hw_params_set_period_size(pcm, hw, periodsize, 0);
+	snd_pcm_hw_params_set_buffer_size(pcm, hw, bufsize);
+	if (snd_pcm_hw_params(pcm, hw) < 0) {
+		fprintf(stderr, "snd_pcm_hw_params error\n");
+		return 1;
+	}
+	snd_pcm_sw_params_alloca(&sw);
+	snd_pcm_sw_params_current(pcm, sw);
+	snd_pcm_sw_params_set_start_threshold(pcm, sw, periodsize);
+	if (snd_pcm_sw_params(pcm, sw) < 0) {
+		fprintf(stderr, "snd_pcm_sw_params error\n");
+		return 1;
+	}
+	return 0;
+}
+
+static void *client_thread(void *data)
+{
+	struct client *c = data;
+	double step = 2 * M_PI * (220.0 * (c->no + 1)) / rate;
+	snd_pcm_sframes_t err, rewindable, rewound, forwarded;
+	snd_pcm_uframes_t size;
+	short *buf;
+
+	buf = malloc(bufsize * channels * sizeof(short));
+	if (!buf)
+		return NULL;
+	while (running) {
+		size = periodsize / 2 + rand() % periodsize;
+		generate_sine(c, buf, size);
+		err = snd_pcm_writei(c->pcm, buf, size);
+		if (err < 0) {
+			c->errors++;
+			if (snd_pcm_recover(c->pcm, err, 1) < 0)
+				break;
+			continue;
+		}
+		c->written += err;
+
+		rewindable = snd_pcm_rewindable(c->pcm);
+		if (rewindable <= 0)
+			continue;
+		size = rand() % (rewindable + 1);
+		rewound = snd_pcm_rewind(c->pcm, size);
+		if (rewound < 0) {
+			c->errors++;
+			continue;
+		}
+		if ((snd_pcm_uframes_t)rewound > size)
+			c->mismatches++;
+		c->rewound += rewound;
+		c->phase -= step * rewound;
+		c->phase = fmod(c->phase, 2 * M_PI);
+		if (c->phase < 0)
+			c->phase += 2 * M_PI;
+
+		if (rand() & 1) {
+			/* take the rewound frames back */
+			forwarded = snd_pcm_forward(c->pcm, rewound);
+			if (forwarded < 0) {
+				c->errors++;
+				continue;
+			}
+			if (forwarded != rewound)
+				c->mismatches++;
+			c->forwarded += forwarded;
+			c->phase = fmod(c->phase + step * forwarded, 2 * M_PI);
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+/* count the samples of the sum buffer in the range [lo, hi] */
+static size_t sum_count(const int *sum, size_t samples, int lo, int hi)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < samples; i++)
+		if (sum[i] >= lo && sum[i] <= hi)
+			count++;
+	return count;
+}
+
+static int check_sum(void)
+{
+	snd_pcm_t *pcm = clients[0].pcm;
+	snd_pcm_sframes_t err, rewound;
+	struct shmid_ds ds;
+	size_t samples, count;
+	short *buf;
+	int *sum;
+	int id, i, chn, frames = periodsize * 3, res = 1;
+
+	id = shmget(ipc_key + 1, 0, 0);
+	if (id < 0 || shmctl(id, IPC_STAT, &ds) < 0) {
+		perror("dmix sum buffer");
+		return 1;
+	}
+	sum = shmat(id, NULL, SHM_RDONLY);
+	if (sum == (void *)-1) {
+		perror("shmat");
+		return 1;
+	}
+	samples = ds.shm_segsz / sizeof(*sum);
+	buf = malloc(frames * channels * sizeof(short));
+	if (!buf)
+		goto _end;
+
+	/* distinct sample values to find them in the sum buffer */
+	for (i = 0; i < frames; i++)
+		for (chn = 0; chn < channels; chn++)
+			buf[i * channels + chn] = 1000 + i;
+	err = snd_pcm_writei(pcm, buf, frames);
+	if (err != frames) {
+		fprintf(stderr, "write error: %s\n", snd_strerror(err));
+		goto _end;
+	}
+	rewound = snd_pcm_rewind(pcm, periodsize);
+	if (rewound <= 0) {
+		fprintf(stderr, "nothing rewound: %s\n", snd_strerror(rewound));
+		goto _end;
+	}
+	/* no further call, the rewound samples must be gone already */
+	count = sum_count(sum, samples, 1000 + frames - rewound, 1000 + frames - 1);
+	if (count) {
+		fprintf(stderr, "%zu rewound samples left in the sum buffer\n", count);
+		goto _end;
+	}
+	for (i = 0; i < rewound; i++)
+		for (chn = 0; chn < channels; chn++)
+			buf[i * channels + chn] = -(1000 + i);
+	err = snd_pcm_writei(pcm, buf, rewound);
+	if (err != rewound) {
+		fprintf(stderr, "rewrite error: %s\n", snd_strerror(err));
+		goto _end;
+	}
+	count = sum_count(sum, samples, -(1000 + rewound - 1), -1000);
+	if (count != (size_t)rewound * channels) {
+		fprintf(stderr, "%zu of %zu rewritten samples in the sum buffer\n",
+			count, (size_t)rewound * channels);
+		goto _end;
+	}
+	if (!quiet)
+		printf("rewound %ld frames, sum buffer ok\n", (long)rewound);
+	res = 0;
+ _end:
+	free(buf);
+	shmdt(sum);
+	return res;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: pcm-rewind [-options]\n");
+	fprintf(stderr, "  -D str  Set device name\n");
+	fprintf(stderr, "  -r val  Set sample rate\n");
+	fprintf(stderr, "  -p val  Set period size (in frame)\n");
+	fprintf(stderr, "  -b val  Set buffer size (in frame)\n");
+	fprintf(stderr, "  -c val  Set number of channels\n");
+	fprintf(stderr, "  -t val  Set number of clients\n");
+	fprintf(stderr, "  -l val  Set test length (in seconds)\n");
+	fprintf(stderr, "  -k val  Check the sum buffer of dmix with this ipc_key\n");
+	fprintf(stderr, "  -q      Quiet mode\n");
+}
+
+static int parse_options(int argc, char **argv)
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "D:r:p:b:c:t:l:k:q")) >= 0) {
+		switch (c) {
+		case 'D':
+			pcmdev = optarg;
+			break;
+		case 'r':
+			rate = atoi(optarg);
+			break;
+		case 'p':
+			periodsize = atoi(optarg);
+			break;
+		case 'b':
+			bufsize = atoi(optarg);
+			break;
+		case 'c':
+			channels = atoi(optarg);
+			break;
+		case 't':
+			num_threads = atoi(optarg);
+			if (num_threads < 1 || num_threads > MAX_THREADS) {
+				fprintf(stderr, "invalid number of clients\n");
+				return 1;
+			}
+			break;
+		case 'l':
+			duration = atoi(optarg);
+			break;
+		case 'k':
+			ipc_key = atoi(optarg);
+			num_threads = 1;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i, err, res = 0;
+
+	if (parse_options(argc, argv))
+		return 1;
+
+	for (i = 0; i < num_threads; i++) {
+		clients[i].no = i;
+		err = snd_pcm_open(&clients[i].pcm, pcmdev,
+				   SND_PCM_STREAM_PLAYBACK, 0);
+		if (err < 0) {
+			fprintf(stderr, "cannot open pcm %s: %s\n", pcmdev,
+				snd_strerror(err));
+			return 1;
+		}
+		if (setup_params(clients[i].pcm))
+			return 1;
+	}
+
+	if (ipc_key) {
+		res = check_sum();
+		snd_pcm_close(clients[0].pcm);
+		return res;
+	}
+
+	for (i = 0; i < num_threads; i++) {
+		if (pthread_create(&clients[i].thread, NULL, client_thread,
+				   &clients[i])) {
+			fprintf(stderr, "pthread_create error\n");
+			return 1;
+		}
+	}
+
+	sleep(duration);
+	running = 0;
+
+	for (i = 0; i < num_threads; i++) {
+		struct client *c = &clients[i];
+
+		pthread_join(c->thread, NULL);
+		snd_pcm_drain(c->pcm);
+		snd_pcm_close(c->pcm);
+		if (!quiet)
+			printf("client %d: written %lu, rewound %lu, forwarded %lu, "
+			       "errors %lu, mismatches %lu\n",
+			       i, c->written, c->rewound, c->forwarded,
+			       c->errors, c->mismatches);
+		if (c->mismatches)
+			res = 1;
+	}
+	return res;
+}